@@ -0,0 +1,103 @@
+#!/bin/sh
+# Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+# 
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+# 
+# 1. Redistributions of source code must retain the above copyright notice, this
+# list of conditions and the following disclaimer.
+# 
+# 2. Redistributions in binary form must reproduce the above copyright notice,
+# this list of conditions and the following disclaimer in the documentation and/or
+# other materials provided with the distribution.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+# ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# amalgamate.sh - generate the single-header build of the library
+#
+# usage: amalgamation/amalgamate.sh output.h   (from the top of the tree)
+#
+# The declarations of isotp_config.h, can/can.h and isotp.h come first,
+# then the implementation, isotp_private.h, can/can.c and isotp*.c, which
+# is only compiled where ISOTP_IMPLEMENTATION is defined.  Includes of the
+# library's own headers are dropped, and the macros each source defines
+# for itself are undefined after it, so that they cannot clash with the
+# next.
+
+set -e
+
+if [ $# -ne 1 ]; then
+    echo "usage: $0 output.h" >&2
+    exit 1
+fi
+
+OUT=$1
+HEADERS="isotp_config.h can/can.h isotp.h"
+SOURCES="can/can.c $(ls isotp*.c)"
+REV=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+# a file without its license comment, #pragma once or local includes
+strip() {
+    awk '
+        NR == 1 && /^\/\*\*$/ { in_license = 1; next }
+        in_license { if ($0 ~ /^ ?\*\/$/) in_license = 0; next }
+        /^#pragma once/ { next }
+        /^#include [<"](isotp_config|isotp|isotp_private|can\/can)\.h[>"]/ { next }
+        { print }
+    ' "$1"
+}
+
+# the names of the macros a file defines
+defines() {
+    sed -n 's/^#define \([A-Za-z_][A-Za-z0-9_]*\).*/\1/p' "$@" | sort -u
+}
+
+HEADER_DEFINES=$(defines $HEADERS isotp_private.h)
+
+{
+    sed -n '1,/^ \?\*\/$/p' isotp.h
+    cat <<HEAD
+
+/**
+ * Single-header build of the ISOTP library, generated by
+ * amalgamation/amalgamate.sh from revision $REV; do not edit.
+ *
+ * Include it wherever the API is used, and define ISOTP_IMPLEMENTATION
+ * before including it in exactly one source file.  Settings from
+ * isotp_config.h must be the same for every include.
+ */
+
+#ifndef ISOTP_SINGLE_H_
+#define ISOTP_SINGLE_H_
+HEAD
+    for f in $HEADERS; do
+        printf '\n// %s\n' "$f"
+        strip "$f"
+    done
+    printf '\n#endif  // ISOTP_SINGLE_H_\n'
+
+    printf '\n#if defined(ISOTP_IMPLEMENTATION) && '
+    printf '!defined(ISOTP_IMPLEMENTATION_INCLUDED)\n'
+    printf '#define ISOTP_IMPLEMENTATION_INCLUDED\n'
+    printf '\n// isotp_private.h\n'
+    strip isotp_private.h
+    for f in $SOURCES; do
+        printf '\n// %s\n' "$f"
+        strip "$f"
+        for m in $(defines "$f"); do
+            if ! echo "$HEADER_DEFINES" | grep -qx "$m"; then
+                printf '#undef %s\n' "$m"
+            fi
+        done
+    done
+    printf '\n#endif  // ISOTP_IMPLEMENTATION\n'
+} > "$OUT"
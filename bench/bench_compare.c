@@ -0,0 +1,141 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * bench_compare - flag performance regressions between benchmark runs
+ *
+ * usage: bench_compare [-t threshold_percent] [-a alpha] baseline current
+ *
+ * Compares the metrics of two results files written by a benchmark's -J
+ * option (see bench/bench_results.h), usually the baseline and the
+ * current revision.  A metric has regressed when its mean got worse by
+ * more than the threshold (5% by default) and Welch's t-test gives a
+ * p-value under alpha (0.05 by default).  Every metric is printed with
+ * its change; the exit status is 1 when any regressed.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench/bench_results.h"
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-t threshold_percent] [-a alpha] baseline current\n",
+            prog);
+}
+
+int main(int argc, char** argv) {
+    double threshold = 0.05;
+    double alpha = 0.05;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "t:a:")) != -1) {
+        char* end = NULL;
+        switch (opt) {
+        case 't':
+            threshold = strtod(optarg, &end) / 100.0;
+            if ((end == optarg) || (*end != '\0') || (threshold < 0.0)) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'a':
+            alpha = strtod(optarg, &end);
+            if ((end == optarg) || (*end != '\0') ||
+                (alpha <= 0.0) || (alpha >= 1.0)) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != (argc - 2)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    bench_report_t baseline;
+    bench_report_t current;
+    int rc = bench_report_load(&baseline, argv[optind]);
+    if (rc < 0) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[optind], strerror(-rc));
+        return EXIT_FAILURE;
+    }
+    rc = bench_report_load(&current, argv[optind + 1]);
+    if (rc < 0) {
+        fprintf(stderr, "%s: %s: %s\n",
+                argv[0], argv[optind + 1], strerror(-rc));
+        bench_report_free(&baseline);
+        return EXIT_FAILURE;
+    }
+
+    printf("%s: %s -> %s\n",
+           current.bench, baseline.revision, current.revision);
+    printf("%-36s %-6s %12s %12s %8s %8s\n",
+           "metric", "unit", "baseline", "current", "change", "p");
+
+    int regressions = 0;
+    for (int i=0; i < baseline.count; i++) {
+        const bench_metric_t* base = &(baseline.metrics[i]);
+        const bench_metric_t* now = bench_report_find(&current, base->name);
+        if (now == NULL) {
+            printf("%-36s %-6s %12.3f %12s\n",
+                   base->name, base->unit, bench_metric_mean(base),
+                   "missing");
+            continue;
+        }
+
+        double change = 0.0;
+        double p = 1.0;
+        bench_verdict_t verdict = bench_compare(base, now, threshold, alpha,
+                                                &change, &p);
+        const char* label = "";
+        if (verdict == BENCH_REGRESSED) {
+            label = "REGRESSED";
+            regressions++;
+        } else if (verdict == BENCH_IMPROVED) {
+            label = "improved";
+        }
+        printf("%-36s %-6s %12.3f %12.3f %+7.1f%% %8.4f %s\n",
+               base->name, base->unit, bench_metric_mean(base),
+               bench_metric_mean(now), 100.0 * change, p, label);
+    }
+    if (regressions > 0) {
+        printf("%d of %d metrics regressed\n", regressions, baseline.count);
+    }
+
+    bench_report_free(&baseline);
+    bench_report_free(&current);
+
+    return (regressions > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,222 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench/bench_hist.h"
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+// values below 2 * SUB_BUCKETS are exact; above, each power of two is
+// split into SUB_BUCKETS
+#define SUB_BUCKET_BITS (7)
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define EXACT (2 * SUB_BUCKETS)
+#define BUCKETS (EXACT + ((64 - (SUB_BUCKET_BITS + 1)) * SUB_BUCKETS))
+
+// reporting steps in each half of the remaining distance to 100%
+#define TICKS_PER_HALF_DISTANCE (5)
+
+struct bench_hist_s {
+    uint64_t count[BUCKETS];
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+    double sum_sq;
+};
+
+static int bucket_of(const uint64_t value) {
+    if (value < EXACT) {
+        return (int)value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - SUB_BUCKET_BITS;
+    return EXACT + ((msb - (SUB_BUCKET_BITS + 1)) * SUB_BUCKETS) +
+           (int)((value >> shift) - SUB_BUCKETS);
+}
+
+// the highest value counted in a bucket
+static uint64_t highest_of(const int bucket) {
+    if (bucket < EXACT) {
+        return (uint64_t)bucket;
+    }
+    int shift = ((bucket - EXACT) / SUB_BUCKETS) + 1;
+    uint64_t lowest = (uint64_t)(SUB_BUCKETS + ((bucket - EXACT) % SUB_BUCKETS))
+                      << shift;
+    return lowest + ((1ULL << shift) - 1);
+}
+
+int bench_hist_init(bench_hist_t* hist) {
+    if (hist == NULL) {
+        return -EINVAL;
+    }
+
+    bench_hist_t h = calloc(1, sizeof(*h));
+    if (h == NULL) {
+        return -ENOMEM;
+    }
+    *hist = h;
+    return EOK;
+}
+
+void bench_hist_free(bench_hist_t hist) {
+    free(hist);
+}
+
+void bench_hist_reset(bench_hist_t hist) {
+    memset(hist, 0, sizeof(*hist));
+}
+
+void bench_hist_record(bench_hist_t hist, const uint64_t value) {
+    hist->count[bucket_of(value)]++;
+    if ((hist->total == 0) || (value < hist->min)) {
+        hist->min = value;
+    }
+    if (value > hist->max) {
+        hist->max = value;
+    }
+    hist->total++;
+    hist->sum += (double)value;
+    hist->sum_sq += (double)value * (double)value;
+}
+
+void bench_hist_record_corrected(bench_hist_t hist,
+                                 const uint64_t value,
+                                 const uint64_t expected_interval) {
+    bench_hist_record(hist, value);
+    if ((expected_interval == 0) || (value <= expected_interval)) {
+        return;
+    }
+    for (uint64_t missing = value - expected_interval;
+         missing >= expected_interval;
+         missing -= expected_interval) {
+        bench_hist_record(hist, missing);
+    }
+}
+
+uint64_t bench_hist_count(const bench_hist_t hist) {
+    return hist->total;
+}
+
+uint64_t bench_hist_min(const bench_hist_t hist) {
+    return hist->min;
+}
+
+uint64_t bench_hist_max(const bench_hist_t hist) {
+    return hist->max;
+}
+
+double bench_hist_mean(const bench_hist_t hist) {
+    return (hist->total > 0) ? (hist->sum / hist->total) : 0.0;
+}
+
+// the value at a percentile, and how many values are at or below it
+static uint64_t value_at(const bench_hist_t hist,
+                         const double percentile,
+                         uint64_t* cumulative) {
+    *cumulative = 0;
+    if (hist->total == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)((percentile / 100.0) * hist->total);
+    if ((double)target < ((percentile / 100.0) * hist->total)) {
+        target++;
+    }
+    if (target == 0) {
+        target = 1;
+    } else if (target > hist->total) {
+        target = hist->total;
+    }
+
+    for (int i=0; i < BUCKETS; i++) {
+        *cumulative += hist->count[i];
+        if (*cumulative >= target) {
+            uint64_t value = highest_of(i);
+            return (value < hist->max) ? value : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+uint64_t bench_hist_percentile(const bench_hist_t hist,
+                               const double percentile) {
+    uint64_t cumulative = 0;
+    return value_at(hist, percentile, &cumulative);
+}
+
+void bench_hist_print(const bench_hist_t hist,
+                      FILE* out,
+                      const double unit_ratio) {
+    fprintf(out, "%12s %14s %10s %14s\n\n",
+            "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+
+    double percentile = 0.0;
+    while (hist->total > 0) {
+        uint64_t cumulative = 0;
+        uint64_t value = value_at(hist, percentile, &cumulative);
+        if (cumulative >= hist->total) {
+            fprintf(out, "%12.3f %2.12f %10llu\n",
+                    value / unit_ratio,
+                    1.0,
+                    (unsigned long long)cumulative);
+            break;
+        }
+        fprintf(out, "%12.3f %2.12f %10llu %14.2f\n",
+                value / unit_ratio,
+                percentile / 100.0,
+                (unsigned long long)cumulative,
+                1.0 / (1.0 - (percentile / 100.0)));
+
+        // halve the step each time the remaining distance halves
+        double remaining = 100.0 - percentile;
+        double halves = 2.0;
+        while (((remaining * halves) <= 100.0) && (halves < 1e18)) {
+            halves *= 2.0;
+        }
+        percentile += 100.0 / (TICKS_PER_HALF_DISTANCE * halves);
+    }
+
+    double mean = bench_hist_mean(hist);
+    double variance = 0.0;
+    if (hist->total > 0) {
+        variance = (hist->sum_sq / hist->total) - (mean * mean);
+    }
+    double stddev = (variance > 0.0) ? sqrt(variance) : 0.0;
+    fprintf(out, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n",
+            mean / unit_ratio, stddev / unit_ratio);
+    fprintf(out, "#[Max     = %12.3f, Total count    = %12llu]\n",
+            hist->max / unit_ratio, (unsigned long long)hist->total);
+    fprintf(out, "#[Buckets = %12d, SubBuckets     = %12d]\n",
+            BUCKETS / SUB_BUCKETS, SUB_BUCKETS);
+}
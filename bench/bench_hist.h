@@ -0,0 +1,151 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Latency histograms for the benchmarks
+ *
+ * A log-linear histogram in the style of HdrHistogram: values below 256
+ * are counted exactly, and larger values in 128 buckets per power of two,
+ * so every value is kept to within 1% over the whole range of uint64_t.
+ * Percentiles report the highest value equivalent to the one recorded.
+ *
+ * When requests are sent at a fixed rate and a slow response holds up
+ * the next requests, the latencies those requests would have seen are
+ * missing from the measurements ("coordinated omission").
+ * bench_hist_record_corrected() fills them in, as HdrHistogram's
+ * recordValueWithExpectedInterval() does.
+ */
+
+typedef struct bench_hist_s* bench_hist_t;
+
+/**
+ * @brief allocate an empty histogram
+ *
+ * @param hist - histogram
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int bench_hist_init(bench_hist_t* hist);
+
+/**
+ * @brief release a histogram
+ *
+ * @param hist - histogram, may be NULL
+ */
+void bench_hist_free(bench_hist_t hist);
+
+/**
+ * @brief forget every value recorded
+ *
+ * @param hist - histogram
+ */
+void bench_hist_reset(bench_hist_t hist);
+
+/**
+ * @brief record a value
+ *
+ * @param hist - histogram
+ * @param value - value
+ */
+void bench_hist_record(bench_hist_t hist, const uint64_t value);
+
+/**
+ * @brief record a value, correcting for coordinated omission
+ *
+ * Besides the value, records value - interval, value - 2 * interval, ...
+ * down to the interval: the latencies of the requests that were due while
+ * this one was outstanding.
+ *
+ * @param hist - histogram
+ * @param value - value
+ * @param expected_interval - interval between requests; 0 records the
+ *                            value alone
+ */
+void bench_hist_record_corrected(bench_hist_t hist,
+                                 const uint64_t value,
+                                 const uint64_t expected_interval);
+
+/**
+ * @brief the number of values recorded
+ */
+uint64_t bench_hist_count(const bench_hist_t hist);
+
+/**
+ * @brief the smallest value recorded, or 0
+ */
+uint64_t bench_hist_min(const bench_hist_t hist);
+
+/**
+ * @brief the largest value recorded, or 0
+ */
+uint64_t bench_hist_max(const bench_hist_t hist);
+
+/**
+ * @brief the mean of the values recorded, or 0
+ */
+double bench_hist_mean(const bench_hist_t hist);
+
+/**
+ * @brief the value at a percentile
+ *
+ * @param hist - histogram
+ * @param percentile - 0.0 to 100.0
+ *
+ * @returns
+ * the highest value equivalent to the value below which percentile% of
+ * the values recorded fall, or 0 when the histogram is empty
+ */
+uint64_t bench_hist_percentile(const bench_hist_t hist,
+                               const double percentile);
+
+/**
+ * @brief print the percentile distribution
+ *
+ * Prints in the format of HdrHistogram's outputPercentileDistribution(),
+ * which its plotting tools read.
+ *
+ * @param hist - histogram
+ * @param out - stream
+ * @param unit_ratio - values are divided by this when printed (e.g. 1000.0
+ *                     for nanoseconds printed as microseconds)
+ */
+void bench_hist_print(const bench_hist_t hist,
+                      FILE* out,
+                      const double unit_ratio);
+
+#ifdef __cplusplus
+}
+#endif
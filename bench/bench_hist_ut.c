@@ -0,0 +1,144 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "bench/bench_hist.h"
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+static void hist_exact_and_relative(void** state) {
+    (void)state;
+    bench_hist_t hist = NULL;
+    assert_true(bench_hist_init(NULL) == -EINVAL);
+    assert_true(bench_hist_init(&hist) == EOK);
+
+    assert_true(bench_hist_percentile(hist, 50.0) == 0);
+    assert_true(bench_hist_count(hist) == 0);
+
+    // small values are exact
+    for (uint64_t v=1; v <= 100; v++) {
+        bench_hist_record(hist, v);
+    }
+    assert_true(bench_hist_count(hist) == 100);
+    assert_true(bench_hist_min(hist) == 1);
+    assert_true(bench_hist_max(hist) == 100);
+    assert_true(bench_hist_percentile(hist, 0.0) == 1);
+    assert_true(bench_hist_percentile(hist, 50.0) == 50);
+    assert_true(bench_hist_percentile(hist, 99.0) == 99);
+    assert_true(bench_hist_percentile(hist, 100.0) == 100);
+    assert_true(bench_hist_mean(hist) == 50.5);
+
+    // larger values to within 1%, never below the value recorded
+    const uint64_t values[] = {
+        256, 257, 1000, 123456, 10000000, 987654321ULL, 1ULL << 40,
+        UINT64_MAX
+    };
+    for (size_t i=0; i < (sizeof(values) / sizeof(values[0])); i++) {
+        bench_hist_reset(hist);
+        bench_hist_record(hist, values[i]);
+        bench_hist_record(hist, 0);
+        uint64_t p = bench_hist_percentile(hist, 100.0);
+        assert_true(p == values[i]);
+        bench_hist_record(hist, values[i]);
+        p = bench_hist_percentile(hist, 50.0);
+        assert_true(p >= values[i]);
+        assert_true((p - values[i]) <= (values[i] / 100));
+    }
+
+    bench_hist_free(hist);
+}
+
+static void hist_coordinated_omission(void** state) {
+    (void)state;
+    bench_hist_t raw = NULL;
+    bench_hist_t corrected = NULL;
+    assert_true(bench_hist_init(&raw) == EOK);
+    assert_true(bench_hist_init(&corrected) == EOK);
+
+    // 1 request every 10, and one stall of 100: 9 requests were held up
+    for (int i=0; i < 90; i++) {
+        bench_hist_record(raw, 1);
+        bench_hist_record_corrected(corrected, 1, 10);
+    }
+    bench_hist_record(raw, 100);
+    bench_hist_record_corrected(corrected, 100, 10);
+
+    assert_true(bench_hist_count(raw) == 91);
+    assert_true(bench_hist_percentile(raw, 95.0) == 1);
+    assert_true(bench_hist_count(corrected) == 100);
+    assert_true(bench_hist_percentile(corrected, 90.0) == 1);
+    assert_true(bench_hist_percentile(corrected, 95.0) == 50);
+    assert_true(bench_hist_percentile(corrected, 100.0) == 100);
+
+    bench_hist_free(raw);
+    bench_hist_free(corrected);
+}
+
+static void hist_print(void** state) {
+    (void)state;
+    bench_hist_t hist = NULL;
+    assert_true(bench_hist_init(&hist) == EOK);
+    for (uint64_t v=1000; v <= 100000; v += 1000) {
+        bench_hist_record(hist, v);
+    }
+
+    char* text = NULL;
+    size_t text_sz = 0;
+    FILE* out = open_memstream(&text, &text_sz);
+    assert_true(out != NULL);
+    bench_hist_print(hist, out, 1000.0);
+    fclose(out);
+
+    // the first and last percentiles, then the summary
+    assert_true(strstr(text, "       1.003 0.000000000000          1") != NULL);
+    assert_true(strstr(text, "     100.000 1.000000000000        100\n") !=
+                NULL);
+    assert_true(strstr(text, "#[Max     =      100.000, Total count    = "
+                             "         100]") != NULL);
+    free(text);
+
+    bench_hist_free(hist);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(hist_exact_and_relative),
+        cmocka_unit_test(hist_coordinated_omission),
+        cmocka_unit_test(hist_print),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
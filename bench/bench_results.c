@@ -0,0 +1,579 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench/bench_results.h"
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+#define INITIAL_METRICS (16)
+#define MAX_DEPTH (32)
+// continued fraction of the incomplete beta function
+#define BETACF_ITERATIONS (200)
+#define BETACF_EPSILON (1e-12)
+#define BETACF_TINY (1e-300)
+
+int bench_report_init(bench_report_t* report,
+                      const char* bench,
+                      const char* revision) {
+    if ((report == NULL) || (bench == NULL)) {
+        return -EINVAL;
+    }
+
+    memset(report, 0, sizeof(*report));
+    snprintf(report->bench, sizeof(report->bench), "%s", bench);
+    snprintf(report->revision, sizeof(report->revision), "%s",
+             (revision != NULL) ? revision : "");
+    return EOK;
+}
+
+void bench_report_free(bench_report_t* report) {
+    if (report == NULL) {
+        return;
+    }
+    for (int i=0; i < report->count; i++) {
+        free(report->metrics[i].samples);
+    }
+    free(report->metrics);
+    report->metrics = NULL;
+    report->count = 0;
+    report->capacity = 0;
+}
+
+const bench_metric_t* bench_report_find(const bench_report_t* report,
+                                        const char* name) {
+    if ((report == NULL) || (name == NULL)) {
+        return NULL;
+    }
+    for (int i=0; i < report->count; i++) {
+        if (strcmp(report->metrics[i].name, name) == 0) {
+            return &(report->metrics[i]);
+        }
+    }
+    return NULL;
+}
+
+static bench_metric_t* add_metric(bench_report_t* report,
+                                  const char* name) {
+    if (report->count == report->capacity) {
+        int capacity = (report->capacity > 0) ? (2 * report->capacity)
+                                              : INITIAL_METRICS;
+        bench_metric_t* m = realloc(report->metrics, capacity * sizeof(*m));
+        if (m == NULL) {
+            return NULL;
+        }
+        report->metrics = m;
+        report->capacity = capacity;
+    }
+
+    bench_metric_t* m = &(report->metrics[report->count++]);
+    memset(m, 0, sizeof(*m));
+    snprintf(m->name, sizeof(m->name), "%s", name);
+    m->lower_is_better = true;
+    return m;
+}
+
+static int add_sample(bench_metric_t* m, const double value) {
+    double* samples = realloc(m->samples, (m->count + 1) * sizeof(*samples));
+    if (samples == NULL) {
+        return -ENOMEM;
+    }
+    m->samples = samples;
+    m->samples[m->count++] = value;
+    return EOK;
+}
+
+int bench_report_add(bench_report_t* report,
+                     const char* name,
+                     const char* unit,
+                     const bool lower_is_better,
+                     const double value) {
+    if ((report == NULL) || (name == NULL) || (unit == NULL) ||
+        !isfinite(value)) {
+        return -EINVAL;
+    }
+
+    bench_metric_t* m = (bench_metric_t*)bench_report_find(report, name);
+    if (m == NULL) {
+        m = add_metric(report, name);
+        if (m == NULL) {
+            return -ENOMEM;
+        }
+        snprintf(m->unit, sizeof(m->unit), "%s", unit);
+        m->lower_is_better = lower_is_better;
+    }
+    return add_sample(m, value);
+}
+
+static void write_string(FILE* out, const char* s) {
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+        if ((*s == '"') || (*s == '\\')) {
+            fprintf(out, "\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(out, "\\u%04x", (unsigned char)*s);
+        } else {
+            fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
+
+int bench_report_save(const bench_report_t* report, const char* path) {
+    if ((report == NULL) || (path == NULL)) {
+        return -EINVAL;
+    }
+
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        return -errno;
+    }
+
+    fprintf(out, "{\n  \"bench\": ");
+    write_string(out, report->bench);
+    fprintf(out, ",\n  \"revision\": ");
+    write_string(out, report->revision);
+    fprintf(out, ",\n  \"metrics\": [");
+    for (int i=0; i < report->count; i++) {
+        const bench_metric_t* m = &(report->metrics[i]);
+        fprintf(out, "%s\n    {\n      \"name\": ", (i > 0) ? "," : "");
+        write_string(out, m->name);
+        fprintf(out, ",\n      \"unit\": ");
+        write_string(out, m->unit);
+        fprintf(out, ",\n      \"better\": \"%s\",\n      \"samples\": [",
+                m->lower_is_better ? "lower" : "higher");
+        for (int j=0; j < m->count; j++) {
+            fprintf(out, "%s%.10g", (j > 0) ? ", " : " ", m->samples[j]);
+        }
+        fprintf(out, " ]\n    }");
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (fclose(out) != 0) {
+        return -errno;
+    }
+    return EOK;
+}
+
+// a JSON reader for the documents bench_report_save() writes
+struct parser_s {
+    const char* p;
+    int depth;
+};
+
+static void skip_ws(struct parser_s* ps) {
+    while ((*ps->p == ' ') || (*ps->p == '\t') ||
+           (*ps->p == '\n') || (*ps->p == '\r')) {
+        ps->p++;
+    }
+}
+
+static bool accept(struct parser_s* ps, const char c) {
+    skip_ws(ps);
+    if (*ps->p != c) {
+        return false;
+    }
+    ps->p++;
+    return true;
+}
+
+static int parse_string(struct parser_s* ps, char* out, const size_t out_sz) {
+    if (!accept(ps, '"')) {
+        return -EBADMSG;
+    }
+
+    size_t len = 0;
+    while (*ps->p != '"') {
+        char c = *ps->p++;
+        if (c == '\0') {
+            return -EBADMSG;
+        } else if (c == '\\') {
+            c = *ps->p++;
+            switch (c) {
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u':
+                // only ASCII is expected; anything else becomes '?'
+                for (int i=0; i < 4; i++) {
+                    if (*ps->p++ == '\0') {
+                        return -EBADMSG;
+                    }
+                }
+                c = '?';
+                break;
+            case '"':
+            case '\\':
+            case '/':
+                break;
+            default:
+                return -EBADMSG;
+                break;
+            }
+        }
+        if ((out != NULL) && (len < (out_sz - 1))) {
+            out[len++] = c;
+        }
+    }
+    ps->p++;
+
+    if (out != NULL) {
+        out[len] = '\0';
+    }
+    return EOK;
+}
+
+static int parse_number(struct parser_s* ps, double* value) {
+    skip_ws(ps);
+    char* end = NULL;
+    *value = strtod(ps->p, &end);
+    if (end == ps->p) {
+        return -EBADMSG;
+    }
+    ps->p = end;
+    return EOK;
+}
+
+static int skip_value(struct parser_s* ps);
+
+// the members of an object; each is handed to member_f, or skipped
+typedef int (*member_f)(struct parser_s* ps, const char* key, void* ctx);
+
+static int parse_object(struct parser_s* ps, member_f member, void* ctx) {
+    if (!accept(ps, '{')) {
+        return -EBADMSG;
+    }
+    if (++(ps->depth) > MAX_DEPTH) {
+        return -EBADMSG;
+    }
+    if (accept(ps, '}')) {
+        ps->depth--;
+        return EOK;
+    }
+
+    do {
+        char key[BENCH_NAME_LEN];
+        int rc = parse_string(ps, key, sizeof(key));
+        if ((rc == EOK) && !accept(ps, ':')) {
+            rc = -EBADMSG;
+        }
+        if (rc == EOK) {
+            rc = (member != NULL) ? (*member)(ps, key, ctx) : skip_value(ps);
+        }
+        if (rc < 0) {
+            return rc;
+        }
+    } while (accept(ps, ','));
+
+    ps->depth--;
+    return accept(ps, '}') ? EOK : -EBADMSG;
+}
+
+// the elements of an array; each is handed to element_f, or skipped
+typedef int (*element_f)(struct parser_s* ps, void* ctx);
+
+static int parse_array(struct parser_s* ps, element_f element, void* ctx) {
+    if (!accept(ps, '[')) {
+        return -EBADMSG;
+    }
+    if (++(ps->depth) > MAX_DEPTH) {
+        return -EBADMSG;
+    }
+    if (accept(ps, ']')) {
+        ps->depth--;
+        return EOK;
+    }
+
+    do {
+        int rc = (element != NULL) ? (*element)(ps, ctx) : skip_value(ps);
+        if (rc < 0) {
+            return rc;
+        }
+    } while (accept(ps, ','));
+
+    ps->depth--;
+    return accept(ps, ']') ? EOK : -EBADMSG;
+}
+
+static int skip_value(struct parser_s* ps) {
+    skip_ws(ps);
+    double number = 0.0;
+    const char* words[] = { "true", "false", "null" };
+
+    switch (*ps->p) {
+    case '{':
+        return parse_object(ps, NULL, NULL);
+        break;
+    case '[':
+        return parse_array(ps, NULL, NULL);
+        break;
+    case '"':
+        return parse_string(ps, NULL, 0);
+        break;
+    default:
+        for (size_t i=0; i < (sizeof(words) / sizeof(words[0])); i++) {
+            if (strncmp(ps->p, words[i], strlen(words[i])) == 0) {
+                ps->p += strlen(words[i]);
+                return EOK;
+            }
+        }
+        return parse_number(ps, &number);
+        break;
+    }
+}
+
+static int sample_element(struct parser_s* ps, void* ctx) {
+    double value = 0.0;
+    int rc = parse_number(ps, &value);
+    if (rc < 0) {
+        return rc;
+    }
+    return add_sample((bench_metric_t*)ctx, value);
+}
+
+static int metric_member(struct parser_s* ps, const char* key, void* ctx) {
+    bench_metric_t* m = (bench_metric_t*)ctx;
+    if (strcmp(key, "name") == 0) {
+        return parse_string(ps, m->name, sizeof(m->name));
+    } else if (strcmp(key, "unit") == 0) {
+        return parse_string(ps, m->unit, sizeof(m->unit));
+    } else if (strcmp(key, "better") == 0) {
+        char better[BENCH_NAME_LEN];
+        int rc = parse_string(ps, better, sizeof(better));
+        m->lower_is_better = (strcmp(better, "higher") != 0);
+        return rc;
+    } else if (strcmp(key, "samples") == 0) {
+        return parse_array(ps, sample_element, m);
+    }
+    return skip_value(ps);
+}
+
+static int metric_element(struct parser_s* ps, void* ctx) {
+    bench_report_t* report = (bench_report_t*)ctx;
+    bench_metric_t* m = add_metric(report, "");
+    if (m == NULL) {
+        return -ENOMEM;
+    }
+    int rc = parse_object(ps, metric_member, m);
+    if ((rc == EOK) && (m->name[0] == '\0')) {
+        rc = -EBADMSG;
+    }
+    return rc;
+}
+
+static int report_member(struct parser_s* ps, const char* key, void* ctx) {
+    bench_report_t* report = (bench_report_t*)ctx;
+    if (strcmp(key, "bench") == 0) {
+        return parse_string(ps, report->bench, sizeof(report->bench));
+    } else if (strcmp(key, "revision") == 0) {
+        return parse_string(ps, report->revision, sizeof(report->revision));
+    } else if (strcmp(key, "metrics") == 0) {
+        return parse_array(ps, metric_element, report);
+    }
+    return skip_value(ps);
+}
+
+int bench_report_load(bench_report_t* report, const char* path) {
+    if ((report == NULL) || (path == NULL)) {
+        return -EINVAL;
+    }
+    memset(report, 0, sizeof(*report));
+
+    FILE* in = fopen(path, "r");
+    if (in == NULL) {
+        return -errno;
+    }
+    char* text = NULL;
+    long len = -1;
+    int rc = EOK;
+    if ((fseek(in, 0, SEEK_END) != 0) || ((len = ftell(in)) < 0) ||
+        (fseek(in, 0, SEEK_SET) != 0)) {
+        rc = -errno;
+    } else if ((text = malloc(len + 1)) == NULL) {
+        rc = -ENOMEM;
+    } else if (fread(text, 1, len, in) != (size_t)len) {
+        rc = -EIO;
+    }
+    fclose(in);
+
+    if (rc == EOK) {
+        text[len] = '\0';
+        struct parser_s ps = { .p = text, .depth = 0 };
+        rc = parse_object(&ps, report_member, report);
+        skip_ws(&ps);
+        if ((rc == EOK) && (*ps.p != '\0')) {
+            rc = -EBADMSG;
+        }
+    }
+    free(text);
+
+    if (rc < 0) {
+        bench_report_free(report);
+    }
+    return rc;
+}
+
+double bench_metric_mean(const bench_metric_t* metric) {
+    if ((metric == NULL) || (metric->count == 0)) {
+        return 0.0;
+    }
+    double sum = 0.0;
+    for (int i=0; i < metric->count; i++) {
+        sum += metric->samples[i];
+    }
+    return sum / metric->count;
+}
+
+static double variance(const bench_metric_t* m, const double mean) {
+    double sum = 0.0;
+    for (int i=0; i < m->count; i++) {
+        sum += (m->samples[i] - mean) * (m->samples[i] - mean);
+    }
+    return sum / (m->count - 1);
+}
+
+// the continued fraction of the regularized incomplete beta function
+static double betacf(const double a, const double b, const double x) {
+    double qab = a + b;
+    double qap = a + 1.0;
+    double qam = a - 1.0;
+    double c = 1.0;
+    double d = 1.0 - ((qab * x) / qap);
+    if (fabs(d) < BETACF_TINY) {
+        d = BETACF_TINY;
+    }
+    d = 1.0 / d;
+    double h = d;
+
+    for (int m=1; m <= BETACF_ITERATIONS; m++) {
+        int m2 = 2 * m;
+        double aa = (m * (b - m) * x) / ((qam + m2) * (a + m2));
+        d = 1.0 + (aa * d);
+        if (fabs(d) < BETACF_TINY) {
+            d = BETACF_TINY;
+        }
+        c = 1.0 + (aa / c);
+        if (fabs(c) < BETACF_TINY) {
+            c = BETACF_TINY;
+        }
+        d = 1.0 / d;
+        h *= d * c;
+
+        aa = -((a + m) * (qab + m) * x) / ((a + m2) * (qap + m2));
+        d = 1.0 + (aa * d);
+        if (fabs(d) < BETACF_TINY) {
+            d = BETACF_TINY;
+        }
+        c = 1.0 + (aa / c);
+        if (fabs(c) < BETACF_TINY) {
+            c = BETACF_TINY;
+        }
+        d = 1.0 / d;
+        double del = d * c;
+        h *= del;
+        if (fabs(del - 1.0) < BETACF_EPSILON) {
+            break;
+        }
+    }
+    return h;
+}
+
+// the regularized incomplete beta function I_x(a, b)
+static double incbeta(const double a, const double b, const double x) {
+    if (x <= 0.0) {
+        return 0.0;
+    } else if (x >= 1.0) {
+        return 1.0;
+    }
+
+    double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) +
+                       (a * log(x)) + (b * log(1.0 - x)));
+    if (x < ((a + 1.0) / (a + b + 2.0))) {
+        return (front * betacf(a, b, x)) / a;
+    }
+    return 1.0 - ((front * betacf(b, a, 1.0 - x)) / b);
+}
+
+double bench_welch_p(const bench_metric_t* a, const bench_metric_t* b) {
+    double mean_a = bench_metric_mean(a);
+    double mean_b = bench_metric_mean(b);
+    if ((a->count < 2) || (b->count < 2)) {
+        return (mean_a != mean_b) ? 0.0 : 1.0;
+    }
+
+    double se_a = variance(a, mean_a) / a->count;
+    double se_b = variance(b, mean_b) / b->count;
+    double se = se_a + se_b;
+    if (se <= 0.0) {
+        return (mean_a != mean_b) ? 0.0 : 1.0;
+    }
+
+    double t = (mean_a - mean_b) / sqrt(se);
+    double df = (se * se) /
+                (((se_a * se_a) / (a->count - 1)) +
+                 ((se_b * se_b) / (b->count - 1)));
+    return incbeta(df / 2.0, 0.5, df / (df + (t * t)));
+}
+
+bench_verdict_t bench_compare(const bench_metric_t* baseline,
+                              const bench_metric_t* current,
+                              const double threshold,
+                              const double alpha,
+                              double* change,
+                              double* p_value) {
+    double base = bench_metric_mean(baseline);
+    double now = bench_metric_mean(current);
+    double c = 0.0;
+    if (base != 0.0) {
+        c = (now - base) / fabs(base);
+    } else if (now != 0.0) {
+        c = (now > 0.0) ? 1.0 : -1.0;
+    }
+    double p = bench_welch_p(baseline, current);
+
+    if (change != NULL) {
+        *change = c;
+    }
+    if (p_value != NULL) {
+        *p_value = p;
+    }
+
+    if ((p > alpha) || (fabs(c) <= threshold)) {
+        return BENCH_UNCHANGED;
+    }
+    bool worse = baseline->lower_is_better ? (c > 0.0) : (c < 0.0);
+    return worse ? BENCH_REGRESSED : BENCH_IMPROVED;
+}
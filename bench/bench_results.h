@@ -0,0 +1,203 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Benchmark results, and comparing them
+ *
+ * Each benchmark run writes a JSON document naming the benchmark and the
+ * git revision measured, with its metrics:
+ *
+ *     {
+ *       "bench": "sf_bench",
+ *       "revision": "0ef38ae",
+ *       "metrics": [
+ *         {
+ *           "name": "loop.p99_usec",
+ *           "unit": "usec",
+ *           "better": "lower",
+ *           "samples": [ 1.063, 1.047, 1.071 ]
+ *         }
+ *       ]
+ *     }
+ *
+ * A metric has a sample from each repetition of the measurement, so two
+ * runs are compared with Welch's t-test: a metric has regressed when its
+ * mean got worse by more than a threshold, and the t-test says the
+ * difference is unlikely to be noise.
+ */
+
+#define BENCH_NAME_LEN (64)
+
+typedef struct bench_metric_s {
+    char name[BENCH_NAME_LEN];
+    char unit[BENCH_NAME_LEN];
+    bool lower_is_better;
+    double* samples;
+    int count;
+} bench_metric_t;
+
+typedef struct bench_report_s {
+    char bench[BENCH_NAME_LEN];
+    char revision[BENCH_NAME_LEN];
+    bench_metric_t* metrics;
+    int count;
+    int capacity;
+} bench_report_t;
+
+typedef enum {
+    BENCH_UNCHANGED,
+    BENCH_IMPROVED,
+    BENCH_REGRESSED,
+} bench_verdict_t;
+
+/**
+ * @brief start an empty report
+ *
+ * @param report - report
+ * @param bench - name of the benchmark
+ * @param revision - git revision measured, may be NULL
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int bench_report_init(bench_report_t* report,
+                      const char* bench,
+                      const char* revision);
+
+/**
+ * @brief release the metrics of a report
+ *
+ * @param report - report
+ */
+void bench_report_free(bench_report_t* report);
+
+/**
+ * @brief add a sample of a metric, adding the metric the first time
+ *
+ * @param report - report
+ * @param name - name of the metric, unique in the report
+ * @param unit - unit of the metric
+ * @param lower_is_better - whether a smaller value is an improvement
+ * @param value - sample
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int bench_report_add(bench_report_t* report,
+                     const char* name,
+                     const char* unit,
+                     const bool lower_is_better,
+                     const double value);
+
+/**
+ * @brief find a metric by name
+ *
+ * @returns
+ * the metric, or NULL
+ */
+const bench_metric_t* bench_report_find(const bench_report_t* report,
+                                        const char* name);
+
+/**
+ * @brief write a report as JSON
+ *
+ * @param report - report
+ * @param path - file to (over)write
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int bench_report_save(const bench_report_t* report, const char* path);
+
+/**
+ * @brief read a report written by bench_report_save()
+ *
+ * Reads any JSON document of that shape; unknown members are ignored.
+ *
+ * @param report - report, initialized here
+ * @param path - file
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code; -EBADMSG for a malformed document
+ */
+int bench_report_load(bench_report_t* report, const char* path);
+
+/**
+ * @brief the mean of a metric's samples
+ */
+double bench_metric_mean(const bench_metric_t* metric);
+
+/**
+ * @brief Welch's t-test of the difference between two metrics' means
+ *
+ * @param a - metric
+ * @param b - metric
+ *
+ * @returns
+ * the two-sided p-value: the probability of a difference at least this
+ * large between samples of equal means.  Without the samples to estimate
+ * a variance (one sample each, or no spread), 0.0 if the means differ
+ * and 1.0 otherwise
+ */
+double bench_welch_p(const bench_metric_t* a, const bench_metric_t* b);
+
+/**
+ * @brief compare a metric against its baseline
+ *
+ * @param baseline - metric in the baseline
+ * @param current - same metric now
+ * @param threshold - smallest relative change of the mean that counts,
+ *                    e.g. 0.05 for 5%
+ * @param alpha - largest p-value that counts as significant, e.g. 0.05
+ * @param change - set to the relative change of the mean, may be NULL
+ * @param p_value - set to the p-value, may be NULL
+ *
+ * @returns
+ * the verdict
+ */
+bench_verdict_t bench_compare(const bench_metric_t* baseline,
+                              const bench_metric_t* current,
+                              const double threshold,
+                              const double alpha,
+                              double* change,
+                              double* p_value);
+
+#ifdef __cplusplus
+}
+#endif
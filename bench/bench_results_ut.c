@@ -0,0 +1,205 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "bench/bench_results.h"
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+static void temp_path(char* path, const size_t path_sz) {
+    snprintf(path, path_sz, "/tmp/bench_results_ut.%d.json", (int)getpid());
+}
+
+static void write_file(const char* path, const char* text) {
+    FILE* f = fopen(path, "w");
+    assert_true(f != NULL);
+    fputs(text, f);
+    fclose(f);
+}
+
+static bench_metric_t metric_of(double* samples, const int count,
+                                const bool lower_is_better) {
+    bench_metric_t m;
+    memset(&m, 0, sizeof(m));
+    m.samples = samples;
+    m.count = count;
+    m.lower_is_better = lower_is_better;
+    return m;
+}
+
+static void results_save_load(void** state) {
+    (void)state;
+    char path[64];
+    temp_path(path, sizeof(path));
+
+    bench_report_t report;
+    assert_true(bench_report_init(NULL, "x", NULL) == -EINVAL);
+    assert_true(bench_report_init(&report, "sf_bench", "abc1234") == EOK);
+    assert_true(bench_report_add(&report, "loop.p99_usec", "usec", true,
+                                 1.5) == EOK);
+    assert_true(bench_report_add(&report, "loop.p99_usec", "usec", true,
+                                 1.25) == EOK);
+    assert_true(bench_report_add(&report, "loop.\"rate\"", "1/s", false,
+                                 10000.0) == EOK);
+    assert_true(bench_report_add(&report, "bad", "x", true, NAN) == -EINVAL);
+    assert_true(bench_report_save(&report, path) == EOK);
+    bench_report_free(&report);
+
+    assert_true(bench_report_load(&report, path) == EOK);
+    assert_true(strcmp(report.bench, "sf_bench") == 0);
+    assert_true(strcmp(report.revision, "abc1234") == 0);
+    assert_true(report.count == 2);
+    const bench_metric_t* m = bench_report_find(&report, "loop.p99_usec");
+    assert_true(m != NULL);
+    assert_true(strcmp(m->unit, "usec") == 0);
+    assert_true(m->lower_is_better);
+    assert_true(m->count == 2);
+    assert_true(m->samples[0] == 1.5);
+    assert_true(m->samples[1] == 1.25);
+    m = bench_report_find(&report, "loop.\"rate\"");
+    assert_true(m != NULL);
+    assert_true(!m->lower_is_better);
+    assert_true(bench_report_find(&report, "missing") == NULL);
+    bench_report_free(&report);
+
+    // other members, in any order, are ignored
+    write_file(path,
+               "{ \"host\": { \"cpus\": [1, 2] }, \"metrics\": [ "
+               "{ \"samples\": [ 3, 4e0 ], \"name\": \"a\", \"ok\": true, "
+               "\"better\": \"higher\" } ], \"bench\": \"b\", "
+               "\"note\": null }");
+    assert_true(bench_report_load(&report, path) == EOK);
+    assert_true(strcmp(report.bench, "b") == 0);
+    assert_true(report.count == 1);
+    assert_true(report.metrics[0].count == 2);
+    assert_true(report.metrics[0].samples[1] == 4.0);
+    bench_report_free(&report);
+
+    unlink(path);
+}
+
+static void results_load_errors(void** state) {
+    (void)state;
+    char path[64];
+    temp_path(path, sizeof(path));
+    bench_report_t report;
+
+    assert_true(bench_report_load(&report, "/nonexistent/x.json") == -ENOENT);
+    const char* bad[] = {
+        "",
+        "{",
+        "{ \"metrics\": [ { \"samples\": [ 1, ] } ] }",
+        "{ \"metrics\": [ { \"unit\": \"usec\" } ] }",
+        "{ \"bench\": \"a\" } trailing",
+        "[ 1, 2 ]",
+    };
+    for (size_t i=0; i < (sizeof(bad) / sizeof(bad[0])); i++) {
+        write_file(path, bad[i]);
+        assert_true(bench_report_load(&report, path) == -EBADMSG);
+        assert_true(report.metrics == NULL);
+    }
+    unlink(path);
+}
+
+static void results_welch(void** state) {
+    (void)state;
+    double a[] = { 1, 2, 3, 4, 5 };
+    double b[] = { 2, 3, 4, 5, 6 };
+    double c[] = { 101, 102, 103, 104, 105 };
+    double one[] = { 1 };
+    bench_metric_t ma = metric_of(a, 5, true);
+    bench_metric_t mb = metric_of(b, 5, true);
+    bench_metric_t mc = metric_of(c, 5, true);
+    bench_metric_t m1 = metric_of(one, 1, true);
+
+    // t = 1 with 8 degrees of freedom
+    assert_true(fabs(bench_welch_p(&ma, &mb) - 0.3466) < 0.0005);
+    assert_true(bench_welch_p(&ma, &ma) == 1.0);
+    assert_true(bench_welch_p(&ma, &mc) < 0.000001);
+    assert_true(bench_metric_mean(&mc) == 103.0);
+
+    // no variance to go by
+    assert_true(bench_welch_p(&m1, &m1) == 1.0);
+    assert_true(bench_welch_p(&m1, &ma) == 0.0);
+}
+
+static void results_compare(void** state) {
+    (void)state;
+    double base[] = { 100, 101, 99, 100, 100 };
+    double slower[] = { 110, 111, 109, 110, 110 };
+    double noisy[] = { 60, 160, 90, 150, 110 };
+    double close[] = { 102, 103, 101, 102, 102 };
+    bench_metric_t mbase = metric_of(base, 5, true);
+    bench_metric_t mslower = metric_of(slower, 5, true);
+    bench_metric_t mnoisy = metric_of(noisy, 5, true);
+    bench_metric_t mclose = metric_of(close, 5, true);
+
+    double change = 0.0;
+    double p = 1.0;
+    assert_true(bench_compare(&mbase, &mslower, 0.05, 0.05, &change, &p) ==
+                BENCH_REGRESSED);
+    assert_true(fabs(change - 0.10) < 1e-9);
+    assert_true(p < 0.05);
+    assert_true(bench_compare(&mslower, &mbase, 0.05, 0.05, NULL, NULL) ==
+                BENCH_IMPROVED);
+
+    // significant but under the threshold, or over it but not significant
+    assert_true(bench_compare(&mbase, &mclose, 0.05, 0.05, NULL, &p) ==
+                BENCH_UNCHANGED);
+    assert_true(p < 0.05);
+    assert_true(bench_compare(&mbase, &mnoisy, 0.05, 0.05, &change, &p) ==
+                BENCH_UNCHANGED);
+    assert_true(change > 0.05);
+
+    // higher is better
+    mbase.lower_is_better = false;
+    assert_true(bench_compare(&mbase, &mslower, 0.05, 0.05, NULL, NULL) ==
+                BENCH_IMPROVED);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(results_save_load),
+        cmocka_unit_test(results_load_errors),
+        cmocka_unit_test(results_welch),
+        cmocka_unit_test(results_compare),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,424 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * isotp_ctx_bench - the memory cost of polling many waiting sessions
+ *
+ * usage: isotp_ctx_bench [-n sessions[,sessions]...] [-p polls]
+ *                        [-R repetitions] [-J results.json] [-g revision]
+ *                        [-S] [-c]
+ *
+ * A gateway polls every session on every tick, and most sessions are
+ * waiting for a frame most of the time, so most polls find nothing and
+ * cost little more than bringing the context into the cache.  For each
+ * number of sessions, this creates that many contexts receiving with
+ * isotp_recv_start() from a transport that never has a frame, and times
+ * about -p polls (10 million by default) in sweeps over all of them.  The
+ * sessions are swept in a random order, as when they are looked up by CAN
+ * ID, or in the order they were created with -S.
+ *
+ * One row is printed per run (CSV with -c): the heap taken by each
+ * context, as glibc accounts it, the time per poll and, where the kernel
+ * allows perf events, the last level cache misses and L1 data cache read
+ * misses per poll.
+ *
+ * Each number of sessions is run -R times.  With -J, the rows are written
+ * to a results file for the revision given with -g, for bench_compare.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif  // defined(__GLIBC__)
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif  // defined(__linux__)
+
+#include <isotp.h>
+#include "bench/bench_results.h"
+
+#define MAX_RUNS (16)
+#define NSEC_PER_SEC (1000000000)
+#define NSEC_PER_USEC (1000)
+#define TICK_USEC (1000)
+
+enum counter_e {
+    LLC_MISSES,
+    L1D_READ_MISSES,
+    NUM_COUNTERS
+};
+
+struct result_s {
+    int sessions;
+    int sweeps;
+    double heap_per_ctx;
+    double ns_per_poll;
+    double misses_per_poll[NUM_COUNTERS];  // < 0 when not counted
+};
+
+static int rx_f(void* rxfn_ctx,
+                uint8_t* rx_buf_p,
+                const int rx_buf_sz,
+                const uint64_t timeout_usec) {
+    (void)rxfn_ctx;
+    (void)rx_buf_p;
+    (void)rx_buf_sz;
+    (void)timeout_usec;
+    return 0;
+}
+
+static int tx_f(void* txfn_ctx,
+                const uint8_t* tx_buf_p,
+                const int tx_len,
+                const uint64_t timeout_usec) {
+    (void)txfn_ctx;
+    (void)tx_buf_p;
+    (void)timeout_usec;
+    return tx_len;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * NSEC_PER_SEC) + (uint64_t)ts.tv_nsec;
+}
+
+static size_t heap_in_use(void) {
+#if defined(__GLIBC__)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif  // defined(__GLIBC__)
+}
+
+// open a counter of this thread's user space, -1 if there is none
+static int counter_open(const enum counter_e counter) {
+#if defined(__linux__)
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    if (counter == LLC_MISSES) {
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    } else {
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D |
+                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    (void)counter;
+    return -1;
+#endif  // defined(__linux__)
+}
+
+static void counter_start(const int fd) {
+#if defined(__linux__)
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    (void)fd;
+#endif  // defined(__linux__)
+}
+
+// the count since counter_start(), -1 if there is none
+static double counter_stop(const int fd) {
+    uint64_t count = 0;
+#if defined(__linux__)
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) == (ssize_t)sizeof(count)) {
+            return (double)count;
+        }
+    }
+#else
+    (void)fd;
+    (void)count;
+#endif  // defined(__linux__)
+    return -1.0;
+}
+
+static uint64_t xorshift(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static int run(const int sessions,
+               const long polls,
+               const bool shuffle,
+               struct result_s* res) {
+    memset(res, 0, sizeof(*res));
+    res->sessions = sessions;
+    res->sweeps = (int)((polls + sessions - 1) / sessions);
+
+    isotp_ctx_t* ctx = calloc(sessions, sizeof(*ctx));
+    isotp_ctx_t* order = calloc(sessions, sizeof(*order));
+    if ((ctx == NULL) || (order == NULL)) {
+        free(ctx);
+        free(order);
+        return -ENOMEM;
+    }
+
+    static uint8_t recv_buf[4095];
+    int rc = 0;
+    int created = 0;
+    size_t heap_before = heap_in_use();
+    for (; (rc == 0) && (created < sessions); created++) {
+        rc = isotp_ctx_init(&(ctx[created]),
+                            CAN_FORMAT,
+                            ISOTP_NORMAL_ADDRESSING_MODE,
+                            0,
+                            NULL,
+                            rx_f,
+                            tx_f);
+        if (rc == 0) {
+            rc = isotp_recv_start(ctx[created], recv_buf, sizeof(recv_buf),
+                                  0, 0, 0);
+        } else {
+            created--;
+        }
+    }
+    res->heap_per_ctx = (double)(heap_in_use() - heap_before) / sessions;
+
+    // sweep pointers in sequence, contexts at random
+    memcpy(order, ctx, sessions * sizeof(*order));
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    for (int i=sessions - 1; shuffle && (i > 0); i--) {
+        int j = (int)(xorshift(&seed) % (uint64_t)(i + 1));
+        isotp_ctx_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    int fd[NUM_COUNTERS];
+    for (int c=0; c < NUM_COUNTERS; c++) {
+        fd[c] = counter_open((enum counter_e)c);
+    }
+
+    // a sweep to arm the timers and warm up, then the measured ones
+    uint64_t now_us = TICK_USEC;
+    uint64_t start_ns = 0;
+    for (int sweep=0; (rc == 0) && (sweep <= res->sweeps); sweep++) {
+        if (sweep == 1) {
+            for (int c=0; c < NUM_COUNTERS; c++) {
+                counter_start(fd[c]);
+            }
+            start_ns = now_ns();
+        }
+        for (int i=0; i < sessions; i++) {
+            int poll_rc = isotp_poll(order[i], now_us);
+            if (poll_rc != -EINPROGRESS) {
+                rc = (poll_rc < 0) ? poll_rc : -EPROTO;
+                break;
+            }
+        }
+        now_us += TICK_USEC;
+    }
+    double measured = (double)res->sweeps * sessions;
+    res->ns_per_poll = (double)(now_ns() - start_ns) / measured;
+    for (int c=0; c < NUM_COUNTERS; c++) {
+        double count = counter_stop(fd[c]);
+        res->misses_per_poll[c] = (count < 0.0) ? -1.0 : (count / measured);
+        if (fd[c] >= 0) {
+            close(fd[c]);
+        }
+    }
+
+    for (int i=0; i < created; i++) {
+        isotp_ctx_free(ctx[i]);
+    }
+    free(ctx);
+    free(order);
+    return rc;
+}
+
+static void print_misses(const double misses, const bool csv) {
+    if (misses < 0.0) {
+        printf(csv ? "," : " %12s", "-");
+    } else {
+        printf(csv ? ",%.3f" : " %12.3f", misses);
+    }
+}
+
+static void print_result(const struct result_s* r, const bool csv) {
+    static bool header = false;
+    if (!header) {
+        header = true;
+        printf(csv ? "sessions,sweeps,heap_per_ctx,ns_per_poll,"
+                     "llc_misses_per_poll,l1d_misses_per_poll\n"
+                   : "sessions   sweeps  heap_B/ctx  ns/poll "
+                     " llc_miss/poll  l1d_miss/poll\n");
+    }
+    printf(csv ? "%d,%d,%.1f,%.2f" : "%8d %8d %11.1f %8.2f",
+           r->sessions, r->sweeps, r->heap_per_ctx, r->ns_per_poll);
+    print_misses(r->misses_per_poll[LLC_MISSES], csv);
+    print_misses(r->misses_per_poll[L1D_READ_MISSES], csv);
+    printf("\n");
+}
+
+static int add_metrics(bench_report_t* report, const struct result_s* r) {
+    const struct {
+        const char* name;
+        const char* unit;
+        double value;
+    } m[] = {
+        { "heap_per_ctx", "bytes", r->heap_per_ctx },
+        { "ns_per_poll", "nsec", r->ns_per_poll },
+        { "llc_misses_per_poll", "count", r->misses_per_poll[LLC_MISSES] },
+        { "l1d_misses_per_poll", "count",
+          r->misses_per_poll[L1D_READ_MISSES] },
+    };
+
+    char name[BENCH_NAME_LEN];
+    int rc = 0;
+    for (size_t i=0; (rc == 0) && (i < (sizeof(m) / sizeof(m[0]))); i++) {
+        if (m[i].value < 0.0) {
+            continue;  // not counted here
+        }
+        snprintf(name, sizeof(name), "n%d.%s", r->sessions, m[i].name);
+        rc = bench_report_add(report, name, m[i].unit, true, m[i].value);
+    }
+    return rc;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-n sessions[,sessions]...] [-p polls] "
+            "[-R repetitions] [-J results.json] [-g revision] [-S] [-c]\n",
+            prog);
+}
+
+static bool parse_int(const char* s, const long min, const long max,
+                      long* value) {
+    char* end = NULL;
+    errno = 0;
+    *value = strtol(s, &end, 0);
+    return (errno == 0) && (end != s) && (*end == '\0') &&
+           (*value >= min) && (*value <= max);
+}
+
+int main(int argc, char** argv) {
+    int sessions[MAX_RUNS] = { 1000, 10000, 100000, 1000000 };
+    int runs = 4;
+    long polls = 10000000;
+    long repetitions = 1;
+    const char* results_path = NULL;
+    const char* revision = NULL;
+    bool shuffle = true;
+    bool csv = false;
+
+    int opt = 0;
+    long v = 0;
+    while ((opt = getopt(argc, argv, "n:p:R:J:g:Sc")) != -1) {
+        bool ok = true;
+        switch (opt) {
+        case 'n':
+            runs = 0;
+            for (char* tok = strtok(optarg, ",");
+                 ok && (tok != NULL);
+                 tok = strtok(NULL, ",")) {
+                ok = (runs < MAX_RUNS) && parse_int(tok, 1, 10000000, &v);
+                sessions[runs++] = (int)v;
+            }
+            ok = ok && (runs > 0);
+            break;
+        case 'p':
+            ok = parse_int(optarg, 1, 1000000000, &polls);
+            break;
+        case 'R':
+            ok = parse_int(optarg, 1, 1000, &repetitions);
+            break;
+        case 'J':
+            results_path = optarg;
+            break;
+        case 'g':
+            revision = optarg;
+            break;
+        case 'S':
+            shuffle = false;
+            break;
+        case 'c':
+            csv = true;
+            break;
+        default:
+            ok = false;
+            break;
+        }
+        if (!ok) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    bench_report_t report;
+    int rc = bench_report_init(&report, "ctx_bench", revision);
+    for (int i=0; (rc == 0) && (i < runs); i++) {
+        for (long r=0; (rc == 0) && (r < repetitions); r++) {
+            struct result_s res;
+            rc = run(sessions[i], polls, shuffle, &res);
+            if (rc < 0) {
+                fprintf(stderr, "%s: %d sessions: %s\n",
+                        argv[0], sessions[i], strerror(-rc));
+                break;
+            }
+            print_result(&res, csv);
+            fflush(stdout);
+            rc = add_metrics(&report, &res);
+        }
+    }
+
+    if ((rc == 0) && (results_path != NULL)) {
+        rc = bench_report_save(&report, results_path);
+        if (rc < 0) {
+            fprintf(stderr, "%s: %s: %s\n",
+                    argv[0], results_path, strerror(-rc));
+        }
+    }
+    bench_report_free(&report);
+
+    return (rc < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,572 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * isotp_scale_bench - many concurrent ISOTP sessions in one process
+ *
+ * usage: isotp_scale_bench [-n sessions[,sessions]...] [-u sessions_per_bus]
+ *                          [-q request_len] [-r response_len] [-k requests]
+ *                          [-s stmin_usec] [-b blocksize] [-t tick_usec]
+ *                          [-T timeout_ms] [-R repetitions]
+ *                          [-J results.json] [-g revision] [-C] [-c]
+ *
+ * For each number of sessions, a gateway-like loop runs that many
+ * non-blocking tester contexts against as many simulated ECUs
+ * (sim/isotp_sim.h), spread over simulated CAN FD buses (500k/2M, or
+ * classic CAN at 500k with -C).  Every session sends its requests one at
+ * a time, each waiting for its response; all sessions start together.
+ * Every tick of virtual time the loop polls all sessions that are still
+ * running, then advances the buses.
+ *
+ * One row is printed per number of sessions (CSV with -c):
+ * - the frames carried and the virtual time taken;
+ * - the aggregate message and payload rates, in virtual time;
+ * - failed requests (timeouts, mostly);
+ * - percentiles of the request to response latency, in virtual time, to
+ *   the resolution of a tick;
+ * - the heap taken by each tester context, as glibc accounts it;
+ * - the CPU time per frame of the whole process (contexts and
+ *   simulation), and of the polling loop alone.
+ *
+ * The CPU figures scale with the simulation's costs as well as the
+ * library's; the polling figure is the one to watch for cliffs.
+ *
+ * Each number of sessions is run -R times, a row each.  With -J, the
+ * rows are written to a results file for the revision given with -g, for
+ * bench_compare to check against a baseline.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif  // defined(__GLIBC__)
+
+#include <isotp.h>
+#include "bench/bench_results.h"
+#include "sim/isotp_sim.h"
+
+#define MAX_RUNS (16)
+#define NSEC_PER_USEC (1000)
+#define NSEC_PER_SEC (1000000000)
+#define USEC_PER_SEC (1000000)
+#define USEC_PER_MSEC (1000)
+#define BASE_CAN_ID (0x10000000)
+// give up on a run after an hour of virtual time
+#define MAX_VIRTUAL_USEC (3600ULL * USEC_PER_SEC)
+
+struct bench_opts_s {
+    int sessions_per_bus;
+    int request_len;
+    int response_len;
+    int requests;
+    uint32_t stmin_usec;
+    uint8_t blocksize;
+    uint64_t tick_usec;
+    uint64_t timeout_usec;
+    bool classic;
+    bool csv;
+};
+
+enum session_state_e {
+    SENDING,
+    RECEIVING,
+    DONE,
+};
+
+struct session_s {
+    isotp_ctx_t ctx;
+    isotp_sim_t sim;
+    enum session_state_e state;
+    int requests_left;
+    uint64_t start_us;
+};
+
+struct result_s {
+    int sessions;
+    int buses;
+    uint64_t frames;
+    uint64_t dropped;
+    uint64_t elapsed_us;
+    uint64_t messages;
+    uint64_t bytes;
+    uint64_t failed;
+    uint64_t latency_us[4];   // p50, p90, p99, max
+    size_t ctx_bytes;
+    uint64_t cpu_ns;
+    uint64_t poll_ns;
+};
+
+static uint8_t request[4095];
+static uint8_t response[4095];
+
+static int respond_f(void* respond_ctx,
+                     const uint8_t* request_p,
+                     const int request_len,
+                     uint8_t* response_p,
+                     const int response_sz,
+                     uint64_t* delay_usec) {
+    (void)request_p;
+    (void)request_len;
+    (void)delay_usec;
+    int len = *(const int*)respond_ctx;
+    if (len > response_sz) {
+        return -ENOBUFS;
+    }
+    memset(response_p, 0x5A, len);
+    return len;
+}
+
+static uint64_t cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ((uint64_t)ts.tv_sec * NSEC_PER_SEC) + (uint64_t)ts.tv_nsec;
+}
+
+static size_t heap_in_use(void) {
+#if defined(__GLIBC__)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif  // defined(__GLIBC__)
+}
+
+static int compare_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static int session_start(struct session_s* s,
+                         const struct bench_opts_s* opts,
+                         const uint64_t now_us) {
+    s->state = SENDING;
+    s->start_us = now_us;
+    return isotp_send_start(s->ctx,
+                            request,
+                            opts->request_len,
+                            opts->timeout_usec);
+}
+
+// the outcome of a poll of a session; returns true when it is done
+static bool session_step(struct session_s* s,
+                         const int rc,
+                         const struct bench_opts_s* opts,
+                         const uint64_t now_us,
+                         struct result_s* res,
+                         uint64_t* latency_us) {
+    if ((s->state == SENDING) && (rc >= 0)) {
+        s->state = RECEIVING;
+        if (isotp_recv_start(s->ctx,
+                             response,
+                             sizeof(response),
+                             0,
+                             0,
+                             opts->timeout_usec) == 0) {
+            return false;
+        }
+        res->failed++;
+    } else if (rc < 0) {
+        res->failed++;
+    } else {
+        latency_us[res->messages++] = now_us - s->start_us;
+        res->bytes += opts->request_len + rc;
+    }
+
+    while (--(s->requests_left) > 0) {
+        if (session_start(s, opts, now_us) == 0) {
+            return false;
+        }
+        res->failed++;
+    }
+    s->state = DONE;
+    return true;
+}
+
+static int run(const int sessions,
+               const struct bench_opts_s* opts,
+               struct result_s* res) {
+    memset(res, 0, sizeof(*res));
+    res->sessions = sessions;
+    res->buses = (sessions + opts->sessions_per_bus - 1) /
+                 opts->sessions_per_bus;
+
+    isotp_sim_opts_t sim_opts = {
+        .can_format = opts->classic ? CAN_FORMAT : CANFD_FORMAT,
+        .nominal_bps = 500000,
+        .data_bps = opts->classic ? 0 : 2000000,
+        .seed = 1,
+    };
+    isotp_sim_t* sims = calloc(res->buses, sizeof(*sims));
+    struct session_s* s = calloc(sessions, sizeof(*s));
+    struct session_s** active = calloc(sessions, sizeof(*active));
+    uint64_t* latency_us = calloc((size_t)sessions * opts->requests,
+                                  sizeof(*latency_us));
+    if ((sims == NULL) || (s == NULL) || (active == NULL) ||
+        (latency_us == NULL)) {
+        free(sims);
+        free(s);
+        free(active);
+        free(latency_us);
+        return -ENOMEM;
+    }
+
+    int rc = 0;
+    for (int i=0; (rc == 0) && (i < res->buses); i++) {
+        rc = isotp_sim_init(&(sims[i]), &sim_opts);
+    }
+
+    // every session has a pair of 29 bit CAN IDs on its bus
+    for (int i=0; (rc == 0) && (i < sessions); i++) {
+        isotp_sim_t sim = sims[i / opts->sessions_per_bus];
+        uint32_t id = BASE_CAN_ID + (2 * (i % opts->sessions_per_bus));
+        isotp_sim_ecu_t ecu = {
+            .rx_id = id,
+            .tx_id = id + 1,
+            .extended_id = true,
+            .addressing_mode = ISOTP_NORMAL_ADDRESSING_MODE,
+            .blocksize = opts->blocksize,
+            .stmin_usec = opts->stmin_usec,
+            .respond_f = respond_f,
+            .respond_ctx = (void*)&(opts->response_len),
+        };
+        isotp_sim_node_t node = NULL;
+        s[i].sim = sim;
+        rc = isotp_sim_ecu_add(sim, &ecu);
+        if (rc == 0) {
+            rc = isotp_sim_tester_add(sim, id, id + 1, true, false, &node);
+        }
+        if (rc == 0) {
+            size_t before = heap_in_use();
+            rc = isotp_ctx_init(&(s[i].ctx),
+                                sim_opts.can_format,
+                                ISOTP_NORMAL_ADDRESSING_MODE,
+                                0,
+                                node,
+                                isotp_sim_rx_f,
+                                isotp_sim_tx_f);
+            res->ctx_bytes += heap_in_use() - before;
+        }
+    }
+    res->ctx_bytes /= (sessions > 0) ? sessions : 1;
+
+    int active_count = 0;
+    for (int i=0; (rc == 0) && (i < sessions); i++) {
+        s[i].requests_left = opts->requests;
+        if (session_start(&(s[i]), opts, 0) == 0) {
+            active[active_count++] = &(s[i]);
+        } else {
+            res->failed++;
+            s[i].state = DONE;
+        }
+    }
+
+    uint64_t now_us = 0;
+    uint64_t cpu_start = cpu_ns();
+    while ((rc == 0) && (active_count > 0)) {
+        uint64_t poll_start = cpu_ns();
+        for (int i=0; i < active_count; ) {
+            struct session_s* a = active[i];
+            int poll_rc = isotp_poll(a->ctx, now_us);
+            if ((poll_rc != -EINPROGRESS) &&
+                session_step(a, poll_rc, opts, now_us, res, latency_us)) {
+                active[i] = active[--active_count];
+            } else {
+                i++;
+            }
+        }
+        res->poll_ns += cpu_ns() - poll_start;
+
+        for (int i=0; (rc == 0) && (i < res->buses); i++) {
+            rc = isotp_sim_run_for(sims[i], opts->tick_usec);
+        }
+        now_us += opts->tick_usec;
+        if (now_us > MAX_VIRTUAL_USEC) {
+            rc = -ETIMEDOUT;
+        }
+    }
+    res->cpu_ns = cpu_ns() - cpu_start;
+    res->elapsed_us = now_us;
+
+    for (int i=0; i < res->buses; i++) {
+        isotp_sim_stats_t stats;
+        if (sims[i] == NULL) {
+            continue;
+        }
+        isotp_sim_stats(sims[i], &stats);
+        res->frames += stats.frames;
+        res->dropped += stats.dropped;
+    }
+
+    if (res->messages > 0) {
+        qsort(latency_us, res->messages, sizeof(*latency_us), compare_u64);
+        res->latency_us[0] = latency_us[(res->messages * 50) / 100];
+        res->latency_us[1] = latency_us[(res->messages * 90) / 100];
+        res->latency_us[2] = latency_us[(res->messages * 99) / 100];
+        res->latency_us[3] = latency_us[res->messages - 1];
+    }
+
+    for (int i=0; i < sessions; i++) {
+        isotp_ctx_free(s[i].ctx);
+    }
+    for (int i=0; i < res->buses; i++) {
+        isotp_sim_free(sims[i]);
+    }
+    free(sims);
+    free(s);
+    free(active);
+    free(latency_us);
+
+    return rc;
+}
+
+static void print_result(const struct result_s* r, const bool csv) {
+    double secs = (double)r->elapsed_us / USEC_PER_SEC;
+    double frames = (r->frames > 0) ? (double)r->frames : 1.0;
+    if (csv) {
+        printf("%d,%d,%llu,%.3f,%.1f,%.1f,%llu,%.3f,%.3f,%.3f,%.3f,%zu,"
+               "%.1f,%.1f\n",
+               r->sessions,
+               r->buses,
+               (unsigned long long)r->frames,
+               secs,
+               r->messages / secs,
+               r->bytes / secs,
+               (unsigned long long)r->failed,
+               (double)r->latency_us[0] / USEC_PER_MSEC,
+               (double)r->latency_us[1] / USEC_PER_MSEC,
+               (double)r->latency_us[2] / USEC_PER_MSEC,
+               (double)r->latency_us[3] / USEC_PER_MSEC,
+               r->ctx_bytes,
+               r->cpu_ns / frames,
+               r->poll_ns / frames);
+        return;
+    }
+    printf("%8d %5d %9llu %8.3f %9.1f %9.1f %7llu %8.1f %8.1f %8.1f %8.1f "
+           "%6zu %9.1f %9.1f\n",
+           r->sessions,
+           r->buses,
+           (unsigned long long)r->frames,
+           secs,
+           r->messages / secs,
+           (r->bytes / secs) / 1024,
+           (unsigned long long)r->failed,
+           (double)r->latency_us[0] / USEC_PER_MSEC,
+           (double)r->latency_us[1] / USEC_PER_MSEC,
+           (double)r->latency_us[2] / USEC_PER_MSEC,
+           (double)r->latency_us[3] / USEC_PER_MSEC,
+           r->ctx_bytes,
+           r->cpu_ns / frames,
+           r->poll_ns / frames);
+}
+
+static int add_metrics(bench_report_t* report, const struct result_s* r) {
+    const struct {
+        const char* name;
+        const char* unit;
+        bool lower_is_better;
+        double value;
+    } m[] = {
+        { "msg_per_sec", "1/s", false,
+          r->messages / ((double)r->elapsed_us / USEC_PER_SEC) },
+        { "failed", "count", true, (double)r->failed },
+        { "latency_p50_ms", "msec", true,
+          (double)r->latency_us[0] / USEC_PER_MSEC },
+        { "latency_p99_ms", "msec", true,
+          (double)r->latency_us[2] / USEC_PER_MSEC },
+        { "ctx_bytes", "bytes", true, (double)r->ctx_bytes },
+        { "cpu_ns_per_frame", "nsec", true,
+          (double)r->cpu_ns / ((r->frames > 0) ? r->frames : 1) },
+        { "poll_ns_per_frame", "nsec", true,
+          (double)r->poll_ns / ((r->frames > 0) ? r->frames : 1) },
+    };
+
+    char name[BENCH_NAME_LEN];
+    int rc = 0;
+    for (size_t i=0; (rc == 0) && (i < (sizeof(m) / sizeof(m[0]))); i++) {
+        snprintf(name, sizeof(name), "n%d.%s", r->sessions, m[i].name);
+        rc = bench_report_add(report, name, m[i].unit, m[i].lower_is_better,
+                              m[i].value);
+    }
+    return rc;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-n sessions[,sessions]...] [-u sessions_per_bus] "
+            "[-q request_len] [-r response_len] [-k requests] "
+            "[-s stmin_usec] [-b blocksize] [-t tick_usec] [-T timeout_ms] "
+            "[-R repetitions] [-J results.json] [-g revision] [-C] [-c]\n",
+            prog);
+}
+
+static bool parse_int(const char* s, const long min, const long max,
+                      long* value) {
+    char* end = NULL;
+    errno = 0;
+    *value = strtol(s, &end, 0);
+    return (errno == 0) && (end != s) && (*end == '\0') &&
+           (*value >= min) && (*value <= max);
+}
+
+int main(int argc, char** argv) {
+    struct bench_opts_s opts = {
+        .sessions_per_bus = 64,
+        .request_len = 256,
+        .response_len = 256,
+        .requests = 2,
+        .tick_usec = 1000,
+        .timeout_usec = USEC_PER_SEC,
+    };
+    int sessions[MAX_RUNS] = { 10, 100, 1000, 10000 };
+    int runs = 4;
+    long repetitions = 1;
+    const char* results_path = NULL;
+    const char* revision = NULL;
+
+    int opt = 0;
+    long v = 0;
+    while ((opt = getopt(argc, argv, "n:u:q:r:k:s:b:t:T:R:J:g:Cc")) != -1) {
+        bool ok = true;
+        switch (opt) {
+        case 'n':
+            runs = 0;
+            for (char* tok = strtok(optarg, ",");
+                 ok && (tok != NULL);
+                 tok = strtok(NULL, ",")) {
+                ok = (runs < MAX_RUNS) && parse_int(tok, 1, 1000000, &v);
+                sessions[runs++] = (int)v;
+            }
+            ok = ok && (runs > 0);
+            break;
+        case 'u':
+            ok = parse_int(optarg, 1, 1000000, &v);
+            opts.sessions_per_bus = (int)v;
+            break;
+        case 'q':
+            ok = parse_int(optarg, 1, sizeof(request), &v);
+            opts.request_len = (int)v;
+            break;
+        case 'r':
+            ok = parse_int(optarg, 1, sizeof(response), &v);
+            opts.response_len = (int)v;
+            break;
+        case 'k':
+            ok = parse_int(optarg, 1, 1000000, &v);
+            opts.requests = (int)v;
+            break;
+        case 's':
+            ok = parse_int(optarg, 0, 127000, &v);
+            opts.stmin_usec = (uint32_t)v;
+            break;
+        case 'b':
+            ok = parse_int(optarg, 0, 255, &v);
+            opts.blocksize = (uint8_t)v;
+            break;
+        case 't':
+            ok = parse_int(optarg, 1, USEC_PER_SEC, &v);
+            opts.tick_usec = (uint64_t)v;
+            break;
+        case 'T':
+            ok = parse_int(optarg, 1, 3600000, &v);
+            opts.timeout_usec = (uint64_t)v * USEC_PER_MSEC;
+            break;
+        case 'R':
+            ok = parse_int(optarg, 1, 1000, &repetitions);
+            break;
+        case 'J':
+            results_path = optarg;
+            break;
+        case 'g':
+            revision = optarg;
+            break;
+        case 'C':
+            opts.classic = true;
+            break;
+        case 'c':
+            opts.csv = true;
+            break;
+        default:
+            ok = false;
+            break;
+        }
+        if (!ok) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    memset(request, 0x22, sizeof(request));
+
+    if (opts.csv) {
+        printf("sessions,buses,frames,virtual_sec,msg_per_sec,bytes_per_sec,"
+               "failed,latency_p50_ms,latency_p90_ms,latency_p99_ms,"
+               "latency_max_ms,ctx_bytes,cpu_ns_per_frame,"
+               "poll_ns_per_frame\n");
+    } else {
+        printf("%8s %5s %9s %8s %9s %9s %7s %8s %8s %8s %8s %6s %9s %9s\n",
+               "sessions", "buses", "frames", "virt_s", "msg/s", "KiB/s",
+               "failed", "p50_ms", "p90_ms", "p99_ms", "max_ms", "ctx_B",
+               "cpu_ns/f", "poll_ns/f");
+    }
+
+    bench_report_t report;
+    int rc = bench_report_init(&report, "scale_bench", revision);
+    for (int i=0; (rc == 0) && (i < runs); i++) {
+        for (long r=0; (rc == 0) && (r < repetitions); r++) {
+            struct result_s res;
+            rc = run(sessions[i], &opts, &res);
+            if (rc < 0) {
+                fprintf(stderr, "%s: %d sessions: %s\n",
+                        argv[0], sessions[i], strerror(-rc));
+                break;
+            }
+            print_result(&res, opts.csv);
+            fflush(stdout);
+            rc = add_metrics(&report, &res);
+        }
+    }
+
+    if ((rc == 0) && (results_path != NULL)) {
+        rc = bench_report_save(&report, results_path);
+        if (rc < 0) {
+            fprintf(stderr, "%s: %s: %s\n",
+                    argv[0], results_path, strerror(-rc));
+        }
+    }
+    bench_report_free(&report);
+
+    return (rc < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
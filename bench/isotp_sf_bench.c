@@ -0,0 +1,623 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * isotp_sf_bench - tail latency of SF request/response round trips
+ *
+ * usage: isotp_sf_bench [-x loop|sim|ifname] [-n count] [-w warmup]
+ *                       [-r per_sec] [-q request_len] [-p response_len]
+ *                       [-j jitter_usec] [-R repetitions]
+ *                       [-J results.json] [-g revision] [-F] [-H]
+ *
+ * A tester context sends an SF request with isotp_send(), a responder
+ * context receives it with isotp_recv() and answers with another SF,
+ * which the tester receives: the whole blocking API, both ways.  The
+ * frames go through the chosen transport:
+ * - loop: in-process mailboxes, so only the library is measured;
+ * - sim: the bus simulator (sim/isotp_sim.h), timed in virtual time,
+ *   with -j microseconds of receive jitter;
+ * - an interface name, e.g. vcan0: two raw SocketCAN sockets (Linux).
+ *
+ * Requests are started at a fixed rate (-r, 10000/s by default; 0 sends
+ * them back to back), waiting for each by spinning on the clock.  The
+ * latencies are kept in histograms, as measured and corrected for
+ * coordinated omission (see bench/bench_hist.h); -H prints the corrected
+ * distribution in full.
+ *
+ * With -J, the percentiles and mean of each of the -R repetitions (and
+ * the rate achieved, without -r) are written to a results file for the
+ * revision given with -g, for bench_compare to check against a baseline.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__linux__)
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif  // defined(__linux__)
+
+#include <isotp.h>
+#include "bench/bench_hist.h"
+#include "bench/bench_results.h"
+#include "sim/isotp_sim.h"
+
+#define NSEC_PER_USEC (1000ULL)
+#define NSEC_PER_SEC (1000000000ULL)
+#define USEC_PER_MSEC (1000)
+#define MAX_FRAME_LEN (64)
+#define REQUEST_ID (0x7E0)
+#define RESPONSE_ID (0x7E8)
+#define TIMEOUT_USEC (1000 * USEC_PER_MSEC)
+
+// a frame in flight between the in-process contexts
+struct mailbox_s {
+    uint8_t frame[MAX_FRAME_LEN];
+    int len;
+    bool full;
+};
+
+// one side of the transport
+struct endpoint_s {
+    struct mailbox_s* in;     // loop
+    struct mailbox_s* out;
+    int fd;                   // SocketCAN
+    uint32_t tx_id;
+    bool fd_frames;
+};
+
+struct transport_s {
+    const char* name;
+    can_format_t can_format;
+    void* tester_ctx;
+    void* responder_ctx;
+    isotp_rx_f rx_f;
+    isotp_tx_f tx_f;
+    isotp_sim_t sim;              // sim only
+    struct mailbox_s mailboxes[2];
+    struct endpoint_s endpoints[2];
+};
+
+static int loop_rx_f(void* rxfn_ctx,
+                     uint8_t* rx_buf_p,
+                     const int rx_buf_sz,
+                     const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct endpoint_s* ep = (struct endpoint_s*)rxfn_ctx;
+    if (!ep->in->full) {
+        // nothing else runs, so nothing else will arrive
+        return -ETIMEDOUT;
+    }
+    if (ep->in->len > rx_buf_sz) {
+        return -ENOBUFS;
+    }
+    memcpy(rx_buf_p, ep->in->frame, ep->in->len);
+    ep->in->full = false;
+    return ep->in->len;
+}
+
+static int loop_tx_f(void* txfn_ctx,
+                     const uint8_t* tx_buf_p,
+                     const int tx_len,
+                     const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct endpoint_s* ep = (struct endpoint_s*)txfn_ctx;
+    if (ep->out->full) {
+        return -ENOBUFS;
+    }
+    memcpy(ep->out->frame, tx_buf_p, tx_len);
+    ep->out->len = tx_len;
+    ep->out->full = true;
+    return tx_len;
+}
+
+#if defined(__linux__)
+static int socketcan_rx_f(void* rxfn_ctx,
+                          uint8_t* rx_buf_p,
+                          const int rx_buf_sz,
+                          const uint64_t timeout_usec) {
+    struct endpoint_s* ep = (struct endpoint_s*)rxfn_ctx;
+    struct pollfd pfd = { .fd = ep->fd, .events = POLLIN };
+    int rc = poll(&pfd, 1, (int)(timeout_usec / USEC_PER_MSEC));
+    if (rc < 0) {
+        return -errno;
+    } else if (rc == 0) {
+        return -ETIMEDOUT;
+    }
+
+    struct canfd_frame frame;
+    ssize_t len = read(ep->fd, &frame, sizeof(frame));
+    if (len < 0) {
+        return -errno;
+    } else if ((len != CAN_MTU) && (len != CANFD_MTU)) {
+        return -EIO;
+    }
+    if (frame.len > rx_buf_sz) {
+        return -ENOBUFS;
+    }
+    memcpy(rx_buf_p, frame.data, frame.len);
+    return frame.len;
+}
+
+static int socketcan_tx_f(void* txfn_ctx,
+                          const uint8_t* tx_buf_p,
+                          const int tx_len,
+                          const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct endpoint_s* ep = (struct endpoint_s*)txfn_ctx;
+    struct canfd_frame frame = {0};
+    frame.can_id = ep->tx_id;
+    frame.len = (uint8_t)tx_len;
+    memcpy(frame.data, tx_buf_p, tx_len);
+    if (ep->fd_frames) {
+        frame.flags = CANFD_BRS;
+    }
+
+    size_t mtu = ep->fd_frames ? CANFD_MTU : CAN_MTU;
+    ssize_t len = write(ep->fd, &frame, mtu);
+    if (len < 0) {
+        return (errno == ENOBUFS) ? -ENOBUFS : -errno;
+    }
+    return tx_len;
+}
+
+static int socketcan_open(struct endpoint_s* ep,
+                          const char* ifname,
+                          const uint32_t tx_id,
+                          const uint32_t rx_id,
+                          const bool fd_frames) {
+    ep->fd = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (ep->fd < 0) {
+        return -errno;
+    }
+    ep->tx_id = tx_id;
+    ep->fd_frames = fd_frames;
+
+    struct can_filter filter = { .can_id = rx_id, .can_mask = CAN_SFF_MASK };
+    int on = 1;
+    struct sockaddr_can addr = {0};
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = (int)if_nametoindex(ifname);
+    if ((addr.can_ifindex == 0) ||
+        (setsockopt(ep->fd, SOL_CAN_RAW, CAN_RAW_FILTER,
+                    &filter, sizeof(filter)) < 0) ||
+        (fd_frames && (setsockopt(ep->fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES,
+                                  &on, sizeof(on)) < 0)) ||
+        (bind(ep->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)) {
+        int rc = (addr.can_ifindex == 0) ? -ENODEV : -errno;
+        close(ep->fd);
+        ep->fd = -1;
+        return rc;
+    }
+    return 0;
+}
+#endif  // defined(__linux__)
+
+static uint64_t now_ns(const struct transport_s* t) {
+    if (t->sim != NULL) {
+        return isotp_sim_now_us(t->sim) * NSEC_PER_USEC;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * NSEC_PER_SEC) + (uint64_t)ts.tv_nsec;
+}
+
+static void wait_until(const struct transport_s* t, const uint64_t at_ns) {
+    uint64_t now = now_ns(t);
+    if (now >= at_ns) {
+        return;
+    }
+    if (t->sim != NULL) {
+        (void)isotp_sim_run_for(t->sim, (at_ns - now) / NSEC_PER_USEC);
+        return;
+    }
+    // spin, as sleeping would wake up too late at high rates
+    while (now_ns(t) < at_ns) {
+    }
+}
+
+static int transport_open(struct transport_s* t,
+                          const char* name,
+                          const bool fd_frames,
+                          const uint64_t jitter_usec) {
+    memset(t, 0, sizeof(*t));
+    t->name = name;
+    t->can_format = fd_frames ? CANFD_FORMAT : CAN_FORMAT;
+    t->endpoints[0].fd = -1;
+    t->endpoints[1].fd = -1;
+
+    if (strcmp(name, "loop") == 0) {
+        t->endpoints[0].in = &(t->mailboxes[0]);
+        t->endpoints[0].out = &(t->mailboxes[1]);
+        t->endpoints[1].in = &(t->mailboxes[1]);
+        t->endpoints[1].out = &(t->mailboxes[0]);
+        t->tester_ctx = &(t->endpoints[0]);
+        t->responder_ctx = &(t->endpoints[1]);
+        t->rx_f = loop_rx_f;
+        t->tx_f = loop_tx_f;
+        return 0;
+    }
+
+    if (strcmp(name, "sim") == 0) {
+        isotp_sim_opts_t opts = {
+            .can_format = t->can_format,
+            .nominal_bps = 500000,
+            .data_bps = fd_frames ? 2000000 : 0,
+            .rx_jitter_usec = jitter_usec,
+            .seed = 1,
+        };
+        isotp_sim_node_t tester = NULL;
+        isotp_sim_node_t responder = NULL;
+        int rc = isotp_sim_init(&(t->sim), &opts);
+        if (rc == 0) {
+            rc = isotp_sim_tester_add(t->sim, REQUEST_ID, RESPONSE_ID,
+                                      false, true, &tester);
+        }
+        if (rc == 0) {
+            rc = isotp_sim_tester_add(t->sim, RESPONSE_ID, REQUEST_ID,
+                                      false, true, &responder);
+        }
+        if (rc < 0) {
+            isotp_sim_free(t->sim);
+            t->sim = NULL;
+            return rc;
+        }
+        t->tester_ctx = tester;
+        t->responder_ctx = responder;
+        t->rx_f = isotp_sim_rx_f;
+        t->tx_f = isotp_sim_tx_f;
+        return 0;
+    }
+
+#if defined(__linux__)
+    int rc = socketcan_open(&(t->endpoints[0]), name,
+                            REQUEST_ID, RESPONSE_ID, fd_frames);
+    if (rc == 0) {
+        rc = socketcan_open(&(t->endpoints[1]), name,
+                            RESPONSE_ID, REQUEST_ID, fd_frames);
+        if (rc < 0) {
+            close(t->endpoints[0].fd);
+        }
+    }
+    t->tester_ctx = &(t->endpoints[0]);
+    t->responder_ctx = &(t->endpoints[1]);
+    t->rx_f = socketcan_rx_f;
+    t->tx_f = socketcan_tx_f;
+    return rc;
+#else
+    return -ENOTSUP;
+#endif  // defined(__linux__)
+}
+
+static void transport_close(struct transport_s* t) {
+    isotp_sim_free(t->sim);
+#if defined(__linux__)
+    for (int i=0; i < 2; i++) {
+        if (t->endpoints[i].fd >= 0) {
+            close(t->endpoints[i].fd);
+        }
+    }
+#endif  // defined(__linux__)
+}
+
+struct bench_s {
+    isotp_ctx_t tester;
+    isotp_ctx_t responder;
+    uint8_t request[MAX_FRAME_LEN];
+    int request_len;
+    uint8_t response[MAX_FRAME_LEN];
+    int response_len;
+    uint8_t buf[MAX_FRAME_LEN];
+};
+
+static int round_trip(struct bench_s* b) {
+    int rc = isotp_send(b->tester, b->request, b->request_len, TIMEOUT_USEC);
+    if (rc >= 0) {
+        rc = isotp_recv(b->responder, b->buf, sizeof(b->buf), 0, 0,
+                        TIMEOUT_USEC);
+    }
+    if (rc >= 0) {
+        rc = isotp_send(b->responder, b->response, b->response_len,
+                        TIMEOUT_USEC);
+    }
+    if (rc >= 0) {
+        rc = isotp_recv(b->tester, b->buf, sizeof(b->buf), 0, 0,
+                        TIMEOUT_USEC);
+    }
+    return (rc < 0) ? rc : 0;
+}
+
+static void print_row(const char* label, const bench_hist_t hist) {
+    const double p[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+    printf("%-12s %9.3f", label,
+           (double)bench_hist_min(hist) / NSEC_PER_USEC);
+    for (size_t i=0; i < (sizeof(p) / sizeof(p[0])); i++) {
+        printf(" %9.3f",
+               (double)bench_hist_percentile(hist, p[i]) / NSEC_PER_USEC);
+    }
+    printf(" %9.3f %9.3f\n",
+           (double)bench_hist_max(hist) / NSEC_PER_USEC,
+           bench_hist_mean(hist) / NSEC_PER_USEC);
+}
+
+// the percentiles of a repetition, as metrics
+static int add_metrics(bench_report_t* report,
+                       const char* prefix,
+                       const bench_hist_t hist) {
+    const struct {
+        const char* name;
+        double percentile;
+    } p[] = {
+        { "p50_usec", 50.0 },
+        { "p90_usec", 90.0 },
+        { "p99_usec", 99.0 },
+        { "p99.9_usec", 99.9 },
+    };
+    char name[BENCH_NAME_LEN];
+    int rc = 0;
+    for (size_t i=0; (rc == 0) && (i < (sizeof(p) / sizeof(p[0]))); i++) {
+        snprintf(name, sizeof(name), "%s.%s", prefix, p[i].name);
+        rc = bench_report_add(report, name, "usec", true,
+                              (double)bench_hist_percentile(hist,
+                                                            p[i].percentile) /
+                              NSEC_PER_USEC);
+    }
+    if (rc == 0) {
+        snprintf(name, sizeof(name), "%s.mean_usec", prefix);
+        rc = bench_report_add(report, name, "usec", true,
+                              bench_hist_mean(hist) / NSEC_PER_USEC);
+    }
+    return rc;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-x loop|sim|ifname] [-n count] [-w warmup] "
+            "[-r per_sec] [-q request_len] [-p response_len] "
+            "[-j jitter_usec] [-R repetitions] [-J results.json] "
+            "[-g revision] [-F] [-H]\n",
+            prog);
+}
+
+static bool parse_long(const char* s, const long min, const long max,
+                       long* value) {
+    char* end = NULL;
+    errno = 0;
+    *value = strtol(s, &end, 0);
+    return (errno == 0) && (end != s) && (*end == '\0') &&
+           (*value >= min) && (*value <= max);
+}
+
+int main(int argc, char** argv) {
+    const char* transport_name = "loop";
+    const char* results_path = NULL;
+    const char* revision = NULL;
+    long count = 100000;
+    long warmup = 1000;
+    long rate = 10000;
+    long request_len = 2;
+    long response_len = 2;
+    long jitter_usec = 0;
+    long repetitions = 1;
+    bool fd_frames = false;
+    bool full = false;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "x:n:w:r:q:p:j:R:J:g:FH")) != -1) {
+        bool ok = true;
+        switch (opt) {
+        case 'x':
+            transport_name = optarg;
+            break;
+        case 'n':
+            ok = parse_long(optarg, 1, 100000000, &count);
+            break;
+        case 'w':
+            ok = parse_long(optarg, 0, 100000000, &warmup);
+            break;
+        case 'r':
+            ok = parse_long(optarg, 0, 10000000, &rate);
+            break;
+        case 'q':
+            ok = parse_long(optarg, 1, MAX_FRAME_LEN, &request_len);
+            break;
+        case 'p':
+            ok = parse_long(optarg, 1, MAX_FRAME_LEN, &response_len);
+            break;
+        case 'j':
+            ok = parse_long(optarg, 0, 1000000, &jitter_usec);
+            break;
+        case 'R':
+            ok = parse_long(optarg, 1, 1000, &repetitions);
+            break;
+        case 'J':
+            results_path = optarg;
+            break;
+        case 'g':
+            revision = optarg;
+            break;
+        case 'F':
+            fd_frames = true;
+            break;
+        case 'H':
+            full = true;
+            break;
+        default:
+            ok = false;
+            break;
+        }
+        if (!ok) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct transport_s t;
+    int rc = transport_open(&t, transport_name, fd_frames,
+                            (uint64_t)jitter_usec);
+    if (rc < 0) {
+        fprintf(stderr, "%s: %s: %s\n",
+                argv[0], transport_name, strerror(-rc));
+        return EXIT_FAILURE;
+    }
+
+    static struct bench_s b;
+    b.request_len = (int)request_len;
+    b.response_len = (int)response_len;
+    memset(b.request, 0x22, sizeof(b.request));
+    memset(b.response, 0x62, sizeof(b.response));
+
+    // over all repetitions, and over the current one
+    bench_hist_t measured = NULL;
+    bench_hist_t corrected = NULL;
+    bench_hist_t rep_measured = NULL;
+    bench_hist_t rep_corrected = NULL;
+    bench_report_t report;
+    char prefix[BENCH_NAME_LEN / 2];
+    snprintf(prefix, sizeof(prefix), "%.16s.%s",
+             transport_name, fd_frames ? "canfd" : "can");
+    rc = bench_report_init(&report, "sf_bench", revision);
+    if (rc == 0) {
+        rc = isotp_ctx_init(&(b.tester), t.can_format,
+                            ISOTP_NORMAL_ADDRESSING_MODE, 0,
+                            t.tester_ctx, t.rx_f, t.tx_f);
+    }
+    if (rc == 0) {
+        rc = isotp_ctx_init(&(b.responder), t.can_format,
+                            ISOTP_NORMAL_ADDRESSING_MODE, 0,
+                            t.responder_ctx, t.rx_f, t.tx_f);
+    }
+    if (rc == 0) {
+        rc = bench_hist_init(&measured);
+    }
+    if (rc == 0) {
+        rc = bench_hist_init(&corrected);
+    }
+    if (rc == 0) {
+        rc = bench_hist_init(&rep_measured);
+    }
+    if (rc == 0) {
+        rc = bench_hist_init(&rep_corrected);
+    }
+
+    uint64_t interval_ns = (rate > 0) ? (NSEC_PER_SEC / rate) : 0;
+    uint64_t elapsed_ns = 0;
+    for (long r=0; (rc == 0) && (r < repetitions); r++) {
+        bench_hist_reset(rep_measured);
+        bench_hist_reset(rep_corrected);
+
+        uint64_t start_ns = now_ns(&t);
+        for (long i=0; (rc == 0) && (i < (warmup + count)); i++) {
+            if (interval_ns > 0) {
+                wait_until(&t, start_ns + (i * interval_ns));
+            }
+            uint64_t sent_ns = now_ns(&t);
+            rc = round_trip(&b);
+            uint64_t latency_ns = now_ns(&t) - sent_ns;
+            if ((rc == 0) && (i >= warmup)) {
+                bench_hist_record(measured, latency_ns);
+                bench_hist_record_corrected(corrected, latency_ns,
+                                            interval_ns);
+                bench_hist_record(rep_measured, latency_ns);
+                bench_hist_record_corrected(rep_corrected, latency_ns,
+                                            interval_ns);
+            }
+        }
+        uint64_t rep_ns = now_ns(&t) - start_ns;
+        elapsed_ns += rep_ns;
+
+        char name[BENCH_NAME_LEN];
+        snprintf(name, sizeof(name), "%s.measured", prefix);
+        if (rc == 0) {
+            rc = add_metrics(&report, name, rep_measured);
+        }
+        snprintf(name, sizeof(name), "%s.corrected", prefix);
+        if (rc == 0) {
+            rc = add_metrics(&report, name, rep_corrected);
+        }
+        snprintf(name, sizeof(name), "%s.round_trips_per_sec", prefix);
+        if ((rc == 0) && (rate == 0) && (rep_ns > 0)) {
+            rc = bench_report_add(&report, name, "1/s", false,
+                                  (warmup + count) /
+                                  ((double)rep_ns / NSEC_PER_SEC));
+        }
+    }
+
+    if (rc < 0) {
+        fprintf(stderr, "%s: round trip: %s\n", argv[0], strerror(-rc));
+    } else {
+        printf("%s, %s, %ld x %ld round trips of %ld/%ld bytes, ",
+               transport_name, fd_frames ? "CAN FD" : "CAN",
+               repetitions, count, request_len, response_len);
+        if (rate > 0) {
+            printf("%ld/s requested, ", rate);
+        }
+        printf("%.0f/s achieved%s\n",
+               (repetitions * (warmup + count)) /
+               ((double)elapsed_ns / NSEC_PER_SEC),
+               (t.sim != NULL) ? " (virtual time)" : "");
+        printf("%-12s %9s %9s %9s %9s %9s %9s %9s %9s\n",
+               "usec", "min", "p50", "p90", "p99", "p99.9", "p99.99",
+               "max", "mean");
+        print_row("measured", measured);
+        print_row("corrected", corrected);
+        if (full) {
+            printf("\n");
+            bench_hist_print(corrected, stdout, (double)NSEC_PER_USEC);
+        }
+    }
+
+    if ((rc == 0) && (results_path != NULL)) {
+        rc = bench_report_save(&report, results_path);
+        if (rc < 0) {
+            fprintf(stderr, "%s: %s: %s\n",
+                    argv[0], results_path, strerror(-rc));
+        }
+    }
+
+    bench_report_free(&report);
+    bench_hist_free(measured);
+    bench_hist_free(corrected);
+    bench_hist_free(rep_measured);
+    bench_hist_free(rep_corrected);
+    isotp_ctx_free(b.tester);
+    isotp_ctx_free(b.responder);
+    transport_close(&t);
+
+    return (rc < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -29,7 +29,6 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
-#include <sys/param.h>
 
 #include "can/can.h"
 
@@ -246,3 +245,95 @@ int can_datalen_to_dlc(const int datalen, const can_format_t format) {
         break;
     }
 }
+
+// frame fields (in bits) that are covered by dynamic bit stuffing, less data;
+// classic: SOF, ID, RTR (SRR, IDE, ext ID, RTR), IDE/r1, r0, DLC, CRC
+#define CAN_STUFFED_BITS_STD (34)
+#define CAN_STUFFED_BITS_EXT (54)
+// CRC delimiter, ACK slot, ACK delimiter, EOF, interframe space
+#define CAN_TRAILER_BITS (13)
+// CAN-FD arbitration phase: SOF, ID, RRS (SRR, IDE, ext ID, RRS), IDE/FDF,
+// FDF/res, res/BRS
+#define CANFD_ARB_BITS_STD (17)
+#define CANFD_ARB_BITS_EXT (36)
+// CAN-FD data phase control fields: ESI and DLC
+#define CANFD_CTRL_BITS (5)
+// stuff count: 3-bit gray code plus parity
+#define CANFD_STUFF_COUNT_BITS (4)
+#define CANFD_CRC17_BITS (17)
+#define CANFD_CRC21_BITS (21)
+#define CANFD_CRC17_MAX_DATALEN (16)
+// CRC delimiter (sampled at the data bit rate)
+#define CANFD_CRC_DELIM_BITS (1)
+// ACK slot, ACK delimiter, EOF, interframe space
+#define CANFD_TRAILER_BITS (12)
+
+#define NSEC_PER_SEC (1000000000LL)
+
+// worst case: one stuff bit after the first five bits, then every four
+static inline int worst_case_stuff_bits(const int bits) {
+    return (bits - 1) / 4;
+}
+
+int64_t can_frame_time_ns(const int datalen,
+                          const can_format_t format,
+                          const bool extended_id,
+                          const uint32_t nominal_bps,
+                          const uint32_t data_bps) {
+    if (nominal_bps == 0) {
+        return -EINVAL;
+    }
+
+    // time the frame as it is padded on the wire
+    int dlc = can_datalen_to_dlc(datalen, format);
+    if (dlc < 0) {
+        return dlc;
+    }
+    int len = can_dlc_to_datalen(dlc, format);
+    if (len < 0) {
+        return len;
+    }
+
+    int64_t nominal_bits = 0;
+    int64_t data_bits = 0;
+
+    switch (format) {
+    case CAN_FORMAT: {
+        int stuffed = (extended_id ? CAN_STUFFED_BITS_EXT
+                                   : CAN_STUFFED_BITS_STD) + (8 * len);
+        nominal_bits = stuffed + worst_case_stuff_bits(stuffed) +
+                       CAN_TRAILER_BITS;
+        break;
+    }
+
+    case CANFD_FORMAT: {
+        int arb = extended_id ? CANFD_ARB_BITS_EXT : CANFD_ARB_BITS_STD;
+        int ctrl = CANFD_CTRL_BITS + (8 * len);
+        int crc = (len <= CANFD_CRC17_MAX_DATALEN) ? CANFD_CRC17_BITS
+                                                   : CANFD_CRC21_BITS;
+        // one fixed stuff bit ahead of the stuff count and then after
+        // every fourth bit of the stuff count and CRC
+        int fixed = (CANFD_STUFF_COUNT_BITS + crc + 3) / 4;
+
+        nominal_bits = arb + worst_case_stuff_bits(arb) + CANFD_TRAILER_BITS;
+        data_bits = ctrl + worst_case_stuff_bits(ctrl) +
+                    CANFD_STUFF_COUNT_BITS + crc + fixed +
+                    CANFD_CRC_DELIM_BITS;
+        break;
+    }
+
+    case NULL_CAN_FORMAT:
+    case LAST_CAN_FORMAT:
+    default:
+        return -EINVAL;
+        break;
+    }
+
+    // without bit rate switching the whole frame runs at the nominal rate
+    if (data_bps == 0) {
+        return ((nominal_bits + data_bits) * NSEC_PER_SEC) / nominal_bps;
+    }
+
+    return ((nominal_bits * NSEC_PER_SEC) / nominal_bps) +
+           ((data_bits * NSEC_PER_SEC) / data_bps);
+}
@@ -25,8 +25,13 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * @brief define possible CAN frame formats
  */
@@ -135,3 +140,34 @@ int can_dlc_to_datalen(const int dlc, const can_format_t format);
  *             the value of the DLC (>=0) for the data length is returned
  */
 int can_datalen_to_dlc(const int datalen, const can_format_t format);
+
+/**
+ * @brief worst-case on-wire time of a CAN frame
+ *
+ * The data length is rounded up to the next valid DLC (as the frame
+ * would be padded), and the worst-case number of stuff bits is assumed.
+ * Interframe space is included so back to back frames can be summed.
+ * For CAN-FD with bit rate switching, the bits between the BRS bit and
+ * the CRC delimiter are timed at the data bit rate; everything else is
+ * timed at the nominal (arbitration) bit rate.
+ *
+ * @ref ISO-11898-1, section 10.4 (frame formats) and 10.5 (bit stuffing)
+ * @param datalen - length of the CAN frame data, in bytes
+ * @param format - CAN frame format
+ * @param extended_id - true for a 29-bit identifier, false for 11-bit
+ * @param nominal_bps - nominal (arbitration phase) bit rate, in bit/s
+ * @param data_bps - data phase bit rate, in bit/s (CAN-FD only);
+ *                   0 when bit rate switching is not used
+ * @returns
+ * -EINVAL   - invalid data length, CAN frame format or bit rate
+ * otherwise - frame time in nanoseconds (>0)
+ */
+int64_t can_frame_time_ns(const int datalen,
+                          const can_format_t format,
+                          const bool extended_id,
+                          const uint32_t nominal_bps,
+                          const uint32_t data_bps);
+
+#ifdef __cplusplus
+}
+#endif
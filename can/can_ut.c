@@ -295,6 +295,54 @@ static void pad_can_frame_len_canfd_format_test(void** state) {
     }
 }
 
+static void can_frame_time_can_format_test(void** state) {
+    // at 1Mbit/s, one bit is 1000ns
+    // worst-case 8 byte frames: 135 bits (11-bit ID), 160 bits (29-bit ID)
+    assert_true(can_frame_time_ns(8, CAN_FORMAT, false, 1000000, 0) ==
+                135000);
+    assert_true(can_frame_time_ns(8, CAN_FORMAT, true, 1000000, 0) ==
+                160000);
+    // empty frame: 47 bits + 8 stuff bits
+    assert_true(can_frame_time_ns(0, CAN_FORMAT, false, 1000000, 0) ==
+                55000);
+    // a data rate has no effect on classic frames
+    assert_true(can_frame_time_ns(8, CAN_FORMAT, false, 500000, 2000000) ==
+                270000);
+
+    assert_true(can_frame_time_ns(9, CAN_FORMAT, false, 500000, 0) ==
+                -EINVAL);
+    assert_true(can_frame_time_ns(-1, CAN_FORMAT, false, 500000, 0) ==
+                -EINVAL);
+    assert_true(can_frame_time_ns(8, CAN_FORMAT, false, 0, 0) == -EINVAL);
+    assert_true(can_frame_time_ns(8, NULL_CAN_FORMAT, false, 500000, 0) ==
+                -EINVAL);
+}
+
+static void can_frame_time_canfd_format_test(void** state) {
+    // without bit rate switching: 33 arbitration/trailer bits
+    // plus 114 data phase bits for 8 bytes (CRC-17)
+    assert_true(can_frame_time_ns(8, CANFD_FORMAT, false, 1000000, 0) ==
+                147000);
+    // 64 bytes: 33 + 679 bits (CRC-21)
+    assert_true(can_frame_time_ns(64, CANFD_FORMAT, false, 1000000, 0) ==
+                712000);
+
+    // frames are timed at their padded length
+    assert_true(can_frame_time_ns(9, CANFD_FORMAT, false, 1000000, 0) ==
+                can_frame_time_ns(12, CANFD_FORMAT, false, 1000000, 0));
+
+    // with bit rate switching the data phase runs at the data rate
+    assert_true(can_frame_time_ns(64, CANFD_FORMAT, false, 500000, 2000000) ==
+                (33 * 2000) + (679 * 500));
+    assert_true(can_frame_time_ns(64, CANFD_FORMAT, true, 500000, 2000000) >
+                can_frame_time_ns(64, CANFD_FORMAT, false, 500000, 2000000));
+    assert_true(can_frame_time_ns(64, CANFD_FORMAT, false, 500000, 2000000) <
+                can_frame_time_ns(64, CANFD_FORMAT, false, 500000, 0));
+
+    assert_true(can_frame_time_ns(65, CANFD_FORMAT, false, 500000, 0) ==
+                -EINVAL);
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(can_max_datalen_test),
@@ -312,6 +360,8 @@ int main(void) {
         cmocka_unit_test(pad_can_frame_len_invalid_format_test),
         cmocka_unit_test(pad_can_frame_len_can_format_test),
         cmocka_unit_test(pad_can_frame_len_canfd_format_test),
+        cmocka_unit_test(can_frame_time_can_format_test),
+        cmocka_unit_test(can_frame_time_canfd_format_test),
     };
  
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -31,36 +31,66 @@
 #include <isotp.h>
 #include <isotp_private.h>
 
-int isotp_ctx_init(isotp_ctx_t* ctx,
-                   const can_format_t can_format,
-                   const isotp_addressing_mode_t isotp_addressing_mode,
-                   const uint8_t max_fc_wait_frames,
-                   void* can_ctx,
-                   isotp_rx_f can_rx_f,
-                   isotp_tx_f can_tx_f) {
-    if ((ctx == NULL) ||
-        (can_rx_f == NULL) ||
-        (can_tx_f == NULL)) {
-        return -EINVAL;
+// a context, padded to whole cache lines so the first one holds the
+// fields polling reads (see struct isotp_ctx_s)
+struct ctx_slot_s {
+    struct isotp_ctx_s ctx;
+} __attribute__((aligned(CACHE_LINE_SZ)));
+
+#ifdef ISOTP_STATIC_CONTEXTS
+// contexts come from here rather than the heap, see isotp_config.h
+static struct ctx_slot_s ctx_pool[ISOTP_STATIC_CONTEXTS];
+static bool ctx_pool_used[ISOTP_STATIC_CONTEXTS];
+#endif  // ISOTP_STATIC_CONTEXTS
+
+static isotp_ctx_t ctx_alloc(void) {
+#ifdef ISOTP_STATIC_CONTEXTS
+    for (int i=0; i < ISOTP_STATIC_CONTEXTS; i++) {
+        if (!ctx_pool_used[i]) {
+            ctx_pool_used[i] = true;
+            memset(&(ctx_pool[i]), 0, sizeof(ctx_pool[i]));
+            return &(ctx_pool[i].ctx);
+        }
     }
+    return NULL;
+#else
+    struct ctx_slot_s* slot = aligned_alloc(CACHE_LINE_SZ, sizeof(*slot));
+    if (slot == NULL) {
+        return NULL;
+    }
+    memset(slot, 0, sizeof(*slot));
+    return &(slot->ctx);
+#endif  // ISOTP_STATIC_CONTEXTS
+}
 
-    *ctx = calloc(1, sizeof(**ctx));
-    if (*ctx == NULL) {
-        return -ENOMEM;
+static void ctx_release(isotp_ctx_t ctx) {
+#ifdef ISOTP_STATIC_CONTEXTS
+    struct ctx_slot_s* slot = (struct ctx_slot_s*)ctx;
+    if ((slot >= ctx_pool) && (slot < &(ctx_pool[ISOTP_STATIC_CONTEXTS]))) {
+        ctx_pool_used[slot - ctx_pool] = false;
     }
+#else
+    free(ctx);
+#endif  // ISOTP_STATIC_CONTEXTS
+}
 
+int ctx_setup(isotp_ctx_t ctx,
+              const can_format_t can_format,
+              const isotp_addressing_mode_t isotp_addressing_mode,
+              const uint8_t max_fc_wait_frames,
+              void* can_ctx,
+              isotp_rx_f can_rx_f,
+              isotp_tx_f can_tx_f) {
     switch (can_format) {
         case CAN_FORMAT:
         case CANFD_FORMAT:
-            (*ctx)->can_format = can_format;
-            (*ctx)->can_max_datalen = can_max_datalen(can_format);
+            ctx->can_format = can_format;
+            ctx->can_max_datalen = can_max_datalen(can_format);
             break;
 
         case NULL_CAN_FORMAT:
         case LAST_CAN_FORMAT:
         default:
-            free(*ctx);
-            *ctx = NULL;
             return -EFAULT;
             break;
     }
@@ -68,35 +98,66 @@ int isotp_ctx_init(isotp_ctx_t* ctx,
     switch (isotp_addressing_mode) {
         case ISOTP_NORMAL_ADDRESSING_MODE:
         case ISOTP_NORMAL_FIXED_ADDRESSING_MODE:
-            (*ctx)->addressing_mode = isotp_addressing_mode;
-            (*ctx)->address_extension_len = 0;
+            ctx->addressing_mode = isotp_addressing_mode;
+            ctx->address_extension_len = 0;
             break;
 
         case ISOTP_EXTENDED_ADDRESSING_MODE:
         case ISOTP_MIXED_ADDRESSING_MODE:
-            (*ctx)->addressing_mode = isotp_addressing_mode;
-            (*ctx)->address_extension_len = 1;
+            ctx->addressing_mode = isotp_addressing_mode;
+            ctx->address_extension_len = 1;
             break;
 
         case NULL_ISOTP_ADDRESSING_MODE:
         case LAST_ISOTP_ADDRESSING_MODE:
         default:
-            free(*ctx);
-            *ctx = NULL;
             return -EFAULT;
             break;
     }
 
-    (*ctx)->fc_wait_max = max_fc_wait_frames;
+    ctx->fc_wait_max = max_fc_wait_frames;
 
-    (*ctx)->can_ctx = can_ctx;
-    (*ctx)->can_rx_f = can_rx_f;
-    (*ctx)->can_tx_f = can_tx_f;
+    ctx->can_ctx = can_ctx;
+    ctx->can_rx_f = can_rx_f;
+    ctx->can_tx_f = can_tx_f;
 
     // finally, reset everything and set to the IDLE state
-    int rc = isotp_ctx_reset(*ctx);
+    return isotp_ctx_reset(ctx);
+}
+
+int isotp_ctx_init(isotp_ctx_t* ctx,
+                   const can_format_t can_format,
+                   const isotp_addressing_mode_t isotp_addressing_mode,
+                   const uint8_t max_fc_wait_frames,
+                   void* can_ctx,
+                   isotp_rx_f can_rx_f,
+                   isotp_tx_f can_tx_f) {
+    if ((ctx == NULL) ||
+        (can_tx_f == NULL)) {
+        return -EINVAL;
+    }
+
+    // a build may fix the format and mode, see isotp_config.h
+    if (!can_format_supported(can_format) ||
+        !addressing_mode_supported(isotp_addressing_mode)) {
+        *ctx = NULL;
+        return -EFAULT;
+    }
+
+    *ctx = ctx_alloc();
+    if (*ctx == NULL) {
+        return -ENOMEM;
+    }
+
+    int rc = ctx_setup(*ctx,
+                       can_format,
+                       isotp_addressing_mode,
+                       max_fc_wait_frames,
+                       can_ctx,
+                       can_rx_f,
+                       can_tx_f);
     if (rc < 0) {
-        free(*ctx);
+        ctx_release(*ctx);
         *ctx = NULL;
     }
     return rc;
@@ -113,10 +174,22 @@ int isotp_ctx_reset(isotp_ctx_t ctx) {
     ctx->fs_stmin = 0;
     ctx->timestamp_us = 0;
     ctx->fc_wait_count = 0;
+    ctx->nb_state = ISOTP_NB_IDLE;
+    ctx->rx_iov = NULL;
+    ctx->rx_iovcnt = 0;
+    rx_pool_drop(ctx);
+    ctx->rx_buf_pool = NULL;
 
     return EOK;
 }
 
+void isotp_ctx_free(isotp_ctx_t ctx) {
+    if (ctx != NULL) {
+        rx_pool_drop(ctx);
+    }
+    ctx_release(ctx);
+}
+
 int get_isotp_address_extension(const isotp_ctx_t ctx) {
     if (ctx == NULL) {
         return -EINVAL;
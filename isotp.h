@@ -25,7 +25,14 @@
 
 #pragma once
 
+#include <stddef.h>
+
 #include <can/can.h>
+#include <isotp_config.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /**
  * @ref ISO-15765-2:2016
@@ -124,6 +131,9 @@ typedef int (*isotp_tx_f)(void* txfn_ctx,
  * @param can_ctx - opaque context passed to transmit/receive CAN frame function
  *                  (user provided, unrelated to the ctx parameter above)
  * @param can_rx_f - function invoked to receive a CAN frame
+ *                   may be NULL if frames are only delivered with
+ *                   isotp_rx_frame(); isotp_send() and isotp_recv()
+ *                   then return -ENOTSUP for transfers needing to receive
  * @param can_tx_f - function invoked to transmit a CAN frame
  * @returns
  * on success, 0.  The context is valid and allocated
@@ -141,6 +151,7 @@ int isotp_ctx_init(isotp_ctx_t* ctx,
  * @brief reset an ISOTP context
  *
  * An ISOTP context should be reset after a transmit or receive is completed.
+ * A message buffer from a pool that was not taken is given back.
  *
  * @param ctx - pointer to an isotp_ctx_t
  * @returns
@@ -149,11 +160,23 @@ int isotp_ctx_init(isotp_ctx_t* ctx,
  */
 int isotp_ctx_reset(isotp_ctx_t ctx);
 
+/**
+ * @brief free an ISOTP context
+ *
+ * Releases a context allocated by isotp_ctx_init().  The context must not
+ * be used after this call.
+ *
+ * @param ctx - ISOTP context, may be NULL
+ */
+void isotp_ctx_free(isotp_ctx_t ctx);
+
 /**
  * @brief transmit data via ISOTP
  *
  * The caller invokes this function to initiate an ISOTP transmit.
  * The call is blocking until the data is transmitted, or an error occurs.
+ * A CF that can_tx_f has no room for (it returns -EAGAIN or -ENOBUFS) is
+ * retried until the timeout.
  *
  * @param ctx - ISOTP context
  * @param send_buf_p - pointer to the data to transmit
@@ -194,6 +217,276 @@ int isotp_recv(isotp_ctx_t ctx,
                const int stmin_usec,
                const uint64_t timeout);
 
+/**
+ * @brief what a receiver has observed, handed to its flow control policy
+ *
+ * Gaps are measured between consecutive CFs of the block that just ended,
+ * as seen by the receiver (i.e. including its own processing delays).
+ * Jitter is the mean difference between consecutive gaps.
+ */
+struct isotp_fc_stats_s {
+    int total_datalen;          // FF_DL of the message being received
+    int remaining_datalen;      // payload bytes still to be received
+    int block_cfs;              // CFs in the last block, 0 before the first FC
+    uint64_t block_gap_avg_us;  // mean gap between CFs of the last block
+    uint64_t block_gap_max_us;  // largest gap between CFs of the last block
+    uint64_t block_jitter_us;   // mean gap-to-gap variation of the last block
+    uint8_t blocksize;          // BS sent in the previous FC
+    int stmin_usec;             // STmin sent in the previous FC
+};
+typedef struct isotp_fc_stats_s isotp_fc_stats_t;
+
+/**
+ * @brief type definition of a receiver flow control policy
+ *
+ * Invoked before every FC.CTS a receiver sends (after the FF and after
+ * each block) to choose the BS and STmin for the next block.
+ *
+ * @param policy_ctx - opaque context given to isotp_set_fc_policy()
+ * @param stats - observations so far
+ * @param blocksize - in: BS of the previous FC (or the isotp_recv() value)
+ *                    out: BS to send
+ * @param stmin_usec - in: STmin of the previous FC (or the isotp_recv() value)
+ *                     out: STmin to send
+ *
+ * @returns
+ *     0 - send the updated values
+ *     <0 - keep the previous values
+ */
+typedef int (*isotp_fc_policy_f)(void* policy_ctx,
+                                 const isotp_fc_stats_t* stats,
+                                 uint8_t* blocksize,
+                                 int* stmin_usec);
+
+/**
+ * @brief set the flow control policy used when receiving
+ *
+ * @param ctx - ISOTP context
+ * @param policy - policy function, or NULL to always send the BS and STmin
+ *                 passed to isotp_recv()/isotp_recv_start()
+ * @param policy_ctx - opaque context passed to the policy
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_set_fc_policy(isotp_ctx_t ctx,
+                        isotp_fc_policy_f policy,
+                        void* policy_ctx);
+
+/**
+ * @brief state of the built-in adaptive flow control policy
+ *
+ * Starts from min_blocksize/max_stmin_usec.  After every block with little
+ * jitter the BS is doubled and STmin halved; when the jitter exceeds
+ * jitter_limit_us, or load_pct exceeds load_limit_pct, BS is halved and
+ * STmin doubled, within the configured limits.
+ *
+ * load_pct is not measured by the library; the application may update it
+ * at any time (e.g. from its CPU or buffer usage), 0 disables it.
+ */
+struct isotp_fc_adaptive_s {
+    uint8_t min_blocksize;
+    uint8_t max_blocksize;
+    int min_stmin_usec;
+    int max_stmin_usec;
+    uint64_t jitter_limit_us;
+    int load_limit_pct;
+    volatile int load_pct;
+};
+typedef struct isotp_fc_adaptive_s isotp_fc_adaptive_t;
+
+/**
+ * @brief initialize the built-in adaptive flow control policy
+ *
+ * @param a - policy state to initialize
+ * @param min_blocksize - smallest BS to send, must be >0
+ * @param max_blocksize - largest BS to send, >= min_blocksize
+ * @param min_stmin_usec - shortest STmin to send
+ * @param max_stmin_usec - longest STmin to send, >= min_stmin_usec
+ * @param jitter_limit_us - jitter above which the policy backs off
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_fc_adaptive_init(isotp_fc_adaptive_t* a,
+                           const uint8_t min_blocksize,
+                           const uint8_t max_blocksize,
+                           const int min_stmin_usec,
+                           const int max_stmin_usec,
+                           const uint64_t jitter_limit_us);
+
+/**
+ * @brief the built-in adaptive flow control policy
+ *
+ * Pass to isotp_set_fc_policy() with an isotp_fc_adaptive_t as policy_ctx.
+ */
+int isotp_fc_policy_adaptive(void* policy_ctx,
+                             const isotp_fc_stats_t* stats,
+                             uint8_t* blocksize,
+                             int* stmin_usec);
+
+/**
+ * @brief how a sender treats the BS/STmin advertised by one peer
+ *
+ * Some ECUs advertise a conservative STmin but handle much faster traffic,
+ * others advertise values they can't keep up with.  A profile is applied
+ * to every FC.CTS received while sending to the peer: an override replaces
+ * the advertised value, otherwise STmin is scaled and then clamped and BS
+ * is clamped.  A BS of 0 ("no limit") counts as larger than any maximum.
+ * Fields set to -1 are not applied.
+ */
+struct isotp_peer_profile_s {
+    uint32_t can_id;          // CAN ID the peer is sent to
+    int stmin_override_usec;  // STmin to use regardless of the FC
+    int stmin_scale_pct;      // percentage of the advertised STmin
+    int stmin_min_usec;
+    int stmin_max_usec;
+    int bs_override;          // BS to use regardless of the FC
+    int bs_min;
+    int bs_max;
+};
+typedef struct isotp_peer_profile_s isotp_peer_profile_t;
+
+/**
+ * @brief a set of peer profiles, looked up by CAN ID
+ */
+struct isotp_profile_table_s {
+    isotp_peer_profile_t* profiles;  // sorted by can_id
+    int count;
+    int capacity;
+};
+typedef struct isotp_profile_table_s isotp_profile_table_t;
+
+/**
+ * @brief initialize a peer profile that leaves the FC values untouched
+ *
+ * @param profile - profile to initialize
+ * @param can_id - CAN ID the peer is sent to
+ */
+void isotp_peer_profile_init(isotp_peer_profile_t* profile,
+                             const uint32_t can_id);
+
+/**
+ * @brief apply a peer profile to the BS/STmin from a received FC.CTS
+ *
+ * @param profile - peer profile
+ * @param blocksize - in: advertised BS, out: BS to use
+ * @param stmin_usec - in: advertised STmin, out: STmin to use
+ */
+void isotp_peer_profile_apply(const isotp_peer_profile_t* profile,
+                              uint8_t* blocksize,
+                              int* stmin_usec);
+
+/**
+ * @brief set the profile applied to FCs received while sending
+ *
+ * The profile is copied into the context.
+ *
+ * @param ctx - ISOTP context
+ * @param profile - peer profile, or NULL to use the FC values as received
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_ctx_set_peer_profile(isotp_ctx_t ctx,
+                               const isotp_peer_profile_t* profile);
+
+/**
+ * @brief add a profile to a table, replacing any with the same CAN ID
+ *
+ * @param table - profile table, zero-initialized before first use
+ * @param profile - profile to add (copied)
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_profile_table_add(isotp_profile_table_t* table,
+                            const isotp_peer_profile_t* profile);
+
+/**
+ * @brief find the profile for a CAN ID
+ *
+ * @param table - profile table
+ * @param can_id - CAN ID the peer is sent to
+ *
+ * @returns
+ * the profile, or NULL if the table has none for can_id
+ */
+const isotp_peer_profile_t* isotp_profile_table_find(const isotp_profile_table_t* table,
+                                                     const uint32_t can_id);
+
+/**
+ * @brief load peer profiles from a text file into a table
+ *
+ * One peer per line: the CAN ID followed by key=value settings, where the
+ * keys are stmin, stmin_scale, stmin_min, stmin_max, bs, bs_min and bs_max
+ * (STmin values in microseconds, stmin_scale in percent, stmin and bs
+ * being overrides).  '#' starts a comment.  For example:
+ *
+ *     # fast ECU that advertises 10ms
+ *     0x7E0 stmin=0 bs=0
+ *     # drops frames at its advertised STmin
+ *     0x18DA10F1 stmin_scale=200 stmin_min=1000 bs_max=8
+ *
+ * @param table - profile table, zero-initialized before first use
+ * @param path - file to load
+ *
+ * @returns
+ * on success, number of profiles loaded
+ * otherwise (<0) - error code; -EBADMSG for a malformed line, in which case
+ * profiles from the lines before it have been added
+ */
+int isotp_profile_table_load(isotp_profile_table_t* table, const char* path);
+
+/**
+ * @brief release the memory held by a profile table
+ *
+ * @param table - profile table, left empty and reusable
+ */
+void isotp_profile_table_free(isotp_profile_table_t* table);
+
+/**
+ * @brief a segment of caller-owned memory to receive into
+ *
+ * @see isotp_recv_iov(), isotp_recv_start_iov()
+ */
+struct isotp_iovec_s {
+    uint8_t* base;  // start of the segment
+    int len;        // length of the segment, in bytes
+};
+typedef struct isotp_iovec_s isotp_iovec_t;
+
+/**
+ * @brief receive data via ISOTP directly into a list of segments
+ *
+ * Same as isotp_recv(), except that the payload is written straight into
+ * the caller's segments, in order, splitting CFs across segment boundaries
+ * as needed.  This avoids assembling the message in a flat buffer and then
+ * copying it out again.
+ *
+ * @param ctx - ISOTP context
+ * @param iov - list of segments; must remain valid until the call returns
+ * @param iovcnt - number of segments
+ * @param blocksize - number of blocks to receive at a time, between flow control
+ *                    0 means to send all blocks at once
+ * @param stmin_usec - gap between blocks, in microseconds
+ * @param timeout - timeout during receiving, in microseconds
+ *
+ * @returns
+ * on success (>=0) - number of bytes received
+ * otherwise (<0) - error code
+ */
+int isotp_recv_iov(isotp_ctx_t ctx,
+                   const isotp_iovec_t* iov,
+                   const int iovcnt,
+                   const uint8_t blocksize,
+                   const int stmin_usec,
+                   const uint64_t timeout);
+
 /**
  * @brief return the current ISOTP address extension
  *
@@ -218,3 +511,1224 @@ int get_isotp_address_extension(const isotp_ctx_t ctx);
  * otherwise (<0) - error code
  */
 int set_isotp_address_extension(isotp_ctx_t ctx, const uint8_t ae);
+
+/**
+ * Normal Fixed Addressing CAN IDs
+ * ref ISO-15765-2:2016 section 10.3.3, tables 29 and 30
+ *
+ * 29 bit CAN ID, priority (bits 28-26), R and DP (bits 25-24, both 0),
+ * PF (bits 23-16, 218 physical / 219 functional), TA (bits 15-8) and
+ * SA (bits 7-0); i.e. 0x18DATTSS and 0x18DBTTSS with the default priority.
+ */
+#define ISOTP_FIXED_DEFAULT_PRIORITY (6)
+#define ISOTP_FIXED_PF_PHYSICAL      (0xDA)
+#define ISOTP_FIXED_PF_FUNCTIONAL    (0xDB)
+
+enum isotp_ta_type_e {
+    NULL_ISOTP_TA_TYPE,
+    ISOTP_PHYSICAL_TA_TYPE,    // one to one
+    ISOTP_FUNCTIONAL_TA_TYPE,  // one to many
+    LAST_ISOTP_TA_TYPE
+};
+typedef enum isotp_ta_type_e isotp_ta_type_t;
+
+/**
+ * @brief build a normal fixed addressing CAN ID
+ *
+ * @param ta_type - physical or functional target address
+ * @param ta - target address
+ * @param sa - source address
+ * @param priority - message priority, 0-7
+ * @param can_id - updated with the 29 bit CAN ID
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_fixed_id_build(const isotp_ta_type_t ta_type,
+                         const uint8_t ta,
+                         const uint8_t sa,
+                         const uint8_t priority,
+                         uint32_t* can_id);
+
+/**
+ * @brief split a normal fixed addressing CAN ID into its addresses
+ *
+ * Any priority is accepted.
+ *
+ * @param can_id - 29 bit CAN ID
+ * @param ta_type - updated with physical or functional target address
+ * @param ta - updated with the target address
+ * @param sa - updated with the source address
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code; -ENOMSG if can_id isn't a normal fixed
+ * addressing ID
+ */
+int isotp_fixed_id_parse(const uint32_t can_id,
+                         isotp_ta_type_t* ta_type,
+                         uint8_t* ta,
+                         uint8_t* sa);
+
+/**
+ * @brief set the addresses of a normal fixed addressing context
+ *
+ * @param ctx - ISOTP context, initialized with ISOTP_NORMAL_FIXED_ADDRESSING_MODE
+ * @param ta_type - physical or functional target address
+ * @param ta - address of the peer
+ * @param sa - own address
+ * @param priority - priority of the frames sent, 0-7
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_ctx_set_fixed_address(isotp_ctx_t ctx,
+                                const isotp_ta_type_t ta_type,
+                                const uint8_t ta,
+                                const uint8_t sa,
+                                const uint8_t priority);
+
+/**
+ * @brief return the CAN ID a normal fixed addressing context sends with
+ *
+ * @param ctx - ISOTP context, with its addresses set
+ * @param can_id - updated with the 29 bit CAN ID
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_ctx_fixed_tx_id(const isotp_ctx_t ctx, uint32_t* can_id);
+
+/**
+ * @brief return the CAN ID a normal fixed addressing context receives with
+ *
+ * That is the physical ID from the peer back to us, with TA and SA swapped.
+ * A functional request has no single peer; responses to it are each
+ * received with their own physical ID.
+ *
+ * @param ctx - ISOTP context, with physical addresses set
+ * @param can_id - updated with the 29 bit CAN ID
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code; -EOPNOTSUPP for a functional context
+ */
+int isotp_ctx_fixed_rx_id(const isotp_ctx_t ctx, uint32_t* can_id);
+
+/**
+ * @brief SA/TA dispatch table for normal fixed addressing
+ *
+ * Maps the (TA, SA) pair of a received fixed addressing CAN ID straight to
+ * the ISOTP context handling it, so a gateway can serve every address on
+ * the bus with two array lookups per frame.  Rows of the table are only
+ * allocated for target addresses that are in use.
+ */
+typedef struct isotp_fixed_router_s* isotp_fixed_router_t;
+
+/**
+ * @brief allocate an empty dispatch table
+ *
+ * @param router - updated with the allocated table
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_fixed_router_init(isotp_fixed_router_t* router);
+
+/**
+ * @brief free a dispatch table (but not the contexts in it)
+ *
+ * @param router - dispatch table
+ */
+void isotp_fixed_router_free(isotp_fixed_router_t router);
+
+/**
+ * @brief route frames received with the given addresses to a context
+ *
+ * @param router - dispatch table
+ * @param ta_type - physical or functional target address
+ * @param ta - target address of the received frames
+ * @param sa - source address of the received frames
+ * @param ctx - context to route to, or NULL to remove the route
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_fixed_router_set(isotp_fixed_router_t router,
+                           const isotp_ta_type_t ta_type,
+                           const uint8_t ta,
+                           const uint8_t sa,
+                           isotp_ctx_t ctx);
+
+/**
+ * @brief find the context for a received CAN ID
+ *
+ * @param router - dispatch table
+ * @param can_id - 29 bit CAN ID of the received frame
+ *
+ * @returns
+ * the context, or NULL if can_id isn't a fixed addressing ID or has no route
+ */
+isotp_ctx_t isotp_fixed_router_lookup(const isotp_fixed_router_t router,
+                                      const uint32_t can_id);
+
+/**
+ * Non-blocking transfers
+ *
+ * isotp_send() and isotp_recv() block the caller for the whole transfer.
+ * The functions below run the same transfers as a state machine instead:
+ * a transfer is started with isotp_send_start() or isotp_recv_start(), and
+ * then advanced by calling isotp_poll() until it no longer returns
+ * -EINPROGRESS.  isotp_poll() never sleeps; it receives any frames the
+ * transport has pending (can_rx_f is invoked with a timeout of zero, and
+ * should return 0 or -EAGAIN if nothing has been received), transmits the
+ * CFs whose STmin has elapsed, and checks the N_Bs/N_Cr timeouts.
+ *
+ * Only one transfer, in either direction, can be active on a context.
+ */
+
+/**
+ * @brief start a non-blocking ISOTP transmit
+ *
+ * The data is not copied; send_buf_p must remain valid until the transfer
+ * completes.  A CF that can_tx_f has no room for (it returns -EAGAIN or
+ * -ENOBUFS) is retried on the next isotp_poll().
+ *
+ * @param ctx - ISOTP context
+ * @param send_buf_p - pointer to the data to transmit
+ * @param send_buf_len - length of the data to transmit
+ * @param timeout - timeout waiting for an FC (N_Bs), in usec
+ *                  0 means to wait forever
+ *
+ * @returns
+ * on success, 0.  The transfer is in progress
+ * otherwise (<0) - error code
+ *     -EBUSY = a transfer is already in progress on this context
+ */
+int isotp_send_start(isotp_ctx_t ctx,
+                     const uint8_t* send_buf_p,
+                     const int send_buf_len,
+                     const uint64_t timeout);
+
+/**
+ * @brief start a non-blocking ISOTP receive
+ *
+ * @param ctx - ISOTP context
+ * @param recv_buf_p - pointer to the buffer where to write the received data
+ *                     must remain valid until the transfer completes
+ * @param recv_buf_sz - size of the receive buffer
+ * @param blocksize - number of CFs to receive between flow control frames
+ *                    0 means to send all blocks at once
+ * @param stmin_usec - gap between CFs requested from the sender, in microseconds
+ * @param timeout - timeout waiting for each frame (N_Cr), in usec
+ *                  0 means to wait forever
+ *
+ * @returns
+ * on success, 0.  The transfer is in progress
+ * otherwise (<0) - error code
+ *     -EBUSY = a transfer is already in progress on this context
+ */
+int isotp_recv_start(isotp_ctx_t ctx,
+                     uint8_t* recv_buf_p,
+                     const int recv_buf_sz,
+                     const uint8_t blocksize,
+                     const int stmin_usec,
+                     const uint64_t timeout);
+
+/**
+ * @brief start a non-blocking ISOTP receive into a list of segments
+ *
+ * @see isotp_recv_iov(), isotp_recv_start()
+ *
+ * The segment list, and the segments, must remain valid until the transfer
+ * completes.
+ */
+int isotp_recv_start_iov(isotp_ctx_t ctx,
+                         const isotp_iovec_t* iov,
+                         const int iovcnt,
+                         const uint8_t blocksize,
+                         const int stmin_usec,
+                         const uint64_t timeout);
+
+/**
+ * @brief deliver a received CAN frame to a non-blocking transfer
+ *
+ * An alternative to having isotp_poll() call can_rx_f: the frame is parsed
+ * where the caller holds it (e.g. a slot in a driver's receive ring) rather
+ * than being copied into the context first, so the payload is copied only
+ * once, straight into the receive buffer.  The frame is not referenced
+ * after the call returns.  Any CFs that become due are sent, as with
+ * isotp_poll().
+ *
+ * Frames that are not expected in the current state are ignored.
+ *
+ * @param ctx - ISOTP context
+ * @param frame_p - pointer to the CAN frame data
+ * @param frame_len - length of the CAN frame data
+ * @param now_us - current time, in microseconds, from a monotonic clock
+ *
+ * @returns
+ *     same as isotp_poll()
+ */
+int isotp_rx_frame(isotp_ctx_t ctx,
+                   const uint8_t* frame_p,
+                   const int frame_len,
+                   const uint64_t now_us);
+
+/**
+ * @brief advance a non-blocking transfer
+ *
+ * @param ctx - ISOTP context
+ * @param now_us - current time, in microseconds, from a monotonic clock
+ *
+ * @returns
+ *     -EINPROGRESS - the transfer is still running; poll again later
+ *     >=0 - the transfer completed; number of bytes sent or received
+ *     -ENOTCONN - no transfer has been started on this context
+ *     <0 - the transfer failed; error code.  The context is idle again
+ */
+int isotp_poll(isotp_ctx_t ctx, const uint64_t now_us);
+
+/**
+ * @brief check whether a non-blocking receive has started on a message
+ *
+ * Lets a caller time the wait for the first frame (e.g. UDS P2) separately
+ * from the N_Cr passed to isotp_recv_start().
+ *
+ * @param ctx - ISOTP context
+ *
+ * @returns
+ *     1 - an FF has been received; the CFs are still to come
+ *     0 - no frame of the message has been received yet
+ *     -EINVAL - ctx is NULL
+ */
+int isotp_recv_started(const isotp_ctx_t ctx);
+
+/**
+ * Functional requests
+ *
+ * A functionally addressed request (e.g. to 0x7DF, or 0x18DB33F1) is a
+ * single SF that any number of ECUs respond to, each on its own physical
+ * CAN ID, and each possibly with a multi-frame response needing its own
+ * FCs.  The functions below send the request once and reassemble all the
+ * responses concurrently, returning them together.
+ *
+ * Telling the responders apart needs the CAN ID of every frame, so these
+ * use their own transport functions, which carry the CAN ID.
+ */
+
+/**
+ * @brief receive a CAN frame, along with its CAN ID
+ *
+ * As isotp_rx_f; should return 0 or -EAGAIN if no frame arrived within
+ * the timeout.
+ */
+typedef int (*isotp_id_rx_f)(void* rxfn_ctx,
+                             uint32_t* can_id,
+                             uint8_t* rx_buf_p,
+                             const int rx_buf_sz,
+                             const uint64_t timeout_usec);
+
+/**
+ * @brief transmit a CAN frame with the given CAN ID
+ *
+ * As isotp_tx_f.
+ */
+typedef int (*isotp_id_tx_f)(void* txfn_ctx,
+                             const uint32_t can_id,
+                             const uint8_t* tx_buf_p,
+                             const int tx_len,
+                             const uint64_t timeout_usec);
+
+/**
+ * @brief map the CAN ID of a response to the CAN ID its FCs are sent to
+ *
+ * @param map_ctx - opaque context given to isotp_functional_set_fc_id()
+ * @param resp_id - CAN ID of a received frame
+ * @param fc_id - updated with the CAN ID to send FCs to
+ *
+ * @returns
+ *     0 - resp_id is a response
+ *     <0 - resp_id is not a response; its frames are ignored
+ */
+typedef int (*isotp_fc_id_f)(void* map_ctx,
+                             const uint32_t resp_id,
+                             uint32_t* fc_id);
+
+/**
+ * @brief default response to FC CAN ID mapping
+ *
+ * 11 bit OBD/UDS responses 0x7E8-0x7EF are answered on 0x7E0-0x7E7, and
+ * normal fixed addressing physical responses with SA and TA swapped.
+ * Anything else is not a response.
+ */
+int isotp_functional_fc_id(void* map_ctx,
+                           const uint32_t resp_id,
+                           uint32_t* fc_id);
+
+typedef struct isotp_functional_s* isotp_functional_t;
+
+/**
+ * @brief one response to a functional request
+ */
+struct isotp_response_s {
+    uint32_t can_id;  // CAN ID the response was received on
+    int rc;           // length of the response, or (<0) why it failed
+    uint8_t* data;    // response, valid until the next request
+};
+typedef struct isotp_response_s isotp_response_t;
+
+/**
+ * @brief allocate a functional requester
+ *
+ * @param f - updated with pointer to the allocated requester
+ * @param can_format - format of the CAN frames
+ * @param isotp_addressing_mode - ISOTP addressing mode
+ * @param max_responses - most responses collected per request
+ * @param max_response_len - largest response, in bytes
+ * @param can_ctx - opaque context passed to can_rx_f/can_tx_f
+ * @param can_rx_f - function invoked to receive a CAN frame and its ID
+ * @param can_tx_f - function invoked to transmit a CAN frame to an ID
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_functional_init(isotp_functional_t* f,
+                          const can_format_t can_format,
+                          const isotp_addressing_mode_t isotp_addressing_mode,
+                          const int max_responses,
+                          const int max_response_len,
+                          void* can_ctx,
+                          isotp_id_rx_f can_rx_f,
+                          isotp_id_tx_f can_tx_f);
+
+/**
+ * @brief free a functional requester, and the responses it holds
+ *
+ * @param f - functional requester
+ */
+void isotp_functional_free(isotp_functional_t f);
+
+/**
+ * @brief set how response CAN IDs are recognized and answered
+ *
+ * @param f - functional requester
+ * @param fc_id_f - mapping function, NULL for isotp_functional_fc_id()
+ * @param map_ctx - opaque context passed to the mapping function
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_functional_set_fc_id(isotp_functional_t f,
+                               isotp_fc_id_f fc_id_f,
+                               void* map_ctx);
+
+/**
+ * @brief set the flow control used for multi-frame responses
+ *
+ * Defaults to a BS of 0, an STmin of 0 and a 1 second N_Cr timeout.
+ *
+ * @param f - functional requester
+ * @param blocksize - BS sent in FCs
+ * @param stmin_usec - STmin sent in FCs
+ * @param timeout - N_Cr timeout, in microseconds; with 0, a stalled
+ *                  response is still given up on after the default
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_functional_set_fc(isotp_functional_t f,
+                            const uint8_t blocksize,
+                            const int stmin_usec,
+                            const uint64_t timeout);
+
+/**
+ * @brief send a functional request and collect the responses
+ *
+ * Responses starting within window_us of the request are collected; a
+ * multi-frame response started within the window is allowed to finish,
+ * subject to the N_Cr timeout.  An ECU sending several responses (e.g. a
+ * "response pending" first) is reported once per response.
+ *
+ * @param f - functional requester
+ * @param request_id - functional CAN ID to send the request to
+ * @param req_p - request; must fit into a single SF
+ * @param req_len - length of the request
+ * @param window_us - how long to wait for responses, in microseconds
+ * @param responses - array of max_responses entries, updated with the
+ *                    responses in order of completion
+ *
+ * @returns
+ * on success (>=0), the number of responses; at most max_responses,
+ * further responders are ignored
+ * otherwise (<0) - error code
+ */
+int isotp_functional_request(isotp_functional_t f,
+                             const uint32_t request_id,
+                             const uint8_t* req_p,
+                             const int req_len,
+                             const uint64_t window_us,
+                             isotp_response_t* responses);
+
+/**
+ * Bus-load aware transmit scheduling
+ *
+ * When several non-blocking transfers share one CAN channel, a scheduler
+ * can sit between them and the channel.  Each sending CAN ID gets a port
+ * with its own queue; a context transmits into its port by being created
+ * with the port as can_ctx and isotp_sched_tx_f() as can_tx_f (frames for
+ * the context are then delivered with isotp_rx_frame()).
+ *
+ * isotp_sched_poll() passes the queued frames to the channel, keeping the
+ * bus time used, at the worst-case on-wire time of each frame, within a
+ * ceiling percentage of wall time.  Among the ports with frames queued,
+ * the lowest CAN ID is sent first, as it would win arbitration, as long as
+ * no port falls more than about a millisecond of bus time behind its
+ * weighted fair share.
+ *
+ * FCs are queued apart from the other frames, and are sent ahead of them,
+ * lowest CAN ID first, whatever the load, so a peer sending to us is never
+ * kept waiting for an FC behind our own CFs.  A full queue pushes back on
+ * the CFs of the transfer using the port, which are retried.  CFs held
+ * back by the load ceiling are still released at least STmin apart, when
+ * the port knows its sender (see isotp_sched_port_set_sender()).
+ */
+typedef struct isotp_sched_s* isotp_sched_t;
+typedef struct isotp_sched_port_s* isotp_sched_port_t;
+
+/**
+ * @brief allocate a transmit scheduler for a CAN channel
+ *
+ * @param sched - updated with the allocated scheduler
+ * @param can_format - format of the CAN frames
+ * @param nominal_bps - nominal (arbitration) bit rate, in bit/s
+ * @param data_bps - CAN-FD data phase bit rate, in bit/s;
+ *                   0 if bit rate switching is not used
+ * @param load_pct - bus load ceiling, as a percentage (1-100)
+ * @param chan_ctx - opaque context passed to chan_tx_f
+ * @param chan_tx_f - function invoked to transmit a CAN frame on the
+ *                    channel; should return -EAGAIN if the channel is full
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_sched_init(isotp_sched_t* sched,
+                     const can_format_t can_format,
+                     const uint32_t nominal_bps,
+                     const uint32_t data_bps,
+                     const int load_pct,
+                     void* chan_ctx,
+                     isotp_id_tx_f chan_tx_f);
+
+/**
+ * @brief free a transmit scheduler, its ports and any frames still queued
+ *
+ * @param sched - scheduler
+ */
+void isotp_sched_free(isotp_sched_t sched);
+
+/**
+ * @brief add a port, transmitting on one CAN ID
+ *
+ * @param sched - scheduler
+ * @param can_id - CAN ID the port's frames are transmitted with
+ * @param extended_id - true if can_id is a 29 bit ID
+ * @param weight - share of the bus relative to the other ports (>0)
+ * @param queue_depth - frames queued before isotp_sched_tx_f() fails
+ * @param port - updated with the port; valid until the scheduler is free'd
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_sched_port_add(isotp_sched_t sched,
+                         const uint32_t can_id,
+                         const bool extended_id,
+                         const int weight,
+                         const int queue_depth,
+                         isotp_sched_port_t* port);
+
+/**
+ * @brief set the ISOTP addressing mode of the contexts using a port
+ *
+ * Needed to find the PCI, and so recognize FCs, in frames with an address
+ * extension.  Defaults to normal addressing.
+ *
+ * @param port - port
+ * @param isotp_addressing_mode - ISOTP addressing mode
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_sched_port_set_addressing(isotp_sched_port_t port,
+                                    const isotp_addressing_mode_t
+                                        isotp_addressing_mode);
+
+/**
+ * @brief set the context transmitting through a port
+ *
+ * The port then releases CFs no closer together than the STmin of the
+ * last FC the context received, even if they were queued while the load
+ * ceiling held them back.  Without a sender, queued CFs are released as
+ * the ceiling allows.
+ *
+ * @param port - port
+ * @param ctx - context using the port, or NULL; it must outlive the port
+ *              or be unset before it is free'd
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_sched_port_set_sender(isotp_sched_port_t port,
+                                const isotp_ctx_t ctx);
+
+/**
+ * @brief queue a CAN frame on a port; an isotp_tx_f
+ *
+ * @param txfn_ctx - the port
+ *
+ * @returns
+ *     -ENOBUFS - the port's queue (or FC queue, for an FC) is full
+ *     <0 - another error occurred
+ *     >=0 - number of bytes queued
+ */
+int isotp_sched_tx_f(void* txfn_ctx,
+                     const uint8_t* tx_buf_p,
+                     const int tx_len,
+                     const uint64_t timeout_usec);
+
+/**
+ * @brief count bus time used by a frame not sent through the scheduler
+ *
+ * Frames sent by other nodes (e.g. FCs from the peers) load the bus as
+ * well; charging them keeps the ceiling a ceiling on the total bus load.
+ *
+ * @param sched - scheduler
+ * @param datalen - length of the frame's data
+ * @param extended_id - true if the frame has a 29 bit ID
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_sched_charge(isotp_sched_t sched,
+                       const int datalen,
+                       const bool extended_id);
+
+/**
+ * @brief transmit the queued frames the bus load ceiling allows
+ *
+ * @param sched - scheduler
+ * @param now_us - current time, in microseconds (monotonic)
+ *
+ * @returns
+ * on success (>=0), the number of frames still queued
+ * otherwise (<0) - error code from the channel; the frame it failed
+ * to transmit has been dropped
+ */
+int isotp_sched_poll(isotp_sched_t sched, const uint64_t now_us);
+
+/**
+ * @brief return the frames transmitted and the bus time used so far
+ *
+ * @param sched - scheduler
+ * @param frames - updated with the number of frames transmitted
+ * @param busy_ns - updated with the bus time used (including charged
+ *                  frames), in nanoseconds
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_sched_stats(const isotp_sched_t sched,
+                      uint64_t* frames,
+                      uint64_t* busy_ns);
+
+/**
+ * Passive decoding
+ *
+ * A decoder reassembles ISOTP messages from frames captured off a bus (or
+ * read back from a log) without ever transmitting.  Frames are
+ * demultiplexed by CAN ID, so both directions of every conversation are
+ * decoded at once; each message is handed to a callback, with its timing,
+ * when its last frame is seen.  Frames that don't parse as ISOTP are
+ * ignored.
+ */
+typedef struct isotp_decoder_s* isotp_decoder_t;
+
+/**
+ * @brief one passively decoded ISOTP message
+ */
+struct isotp_message_s {
+    uint32_t can_id;            // CAN ID the message was sent with
+    bool extended_id;           // can_id is a 29 bit ID
+    uint8_t address_extension;  // extended or mixed addressing only
+    uint64_t start_us;          // timestamp of the SF/FF
+    uint64_t end_us;            // timestamp of the last frame
+    int frames;                 // number of frames, SF/FF and CFs
+    int len;                    // length of the message, or (<0) why it
+                                // was not reassembled:
+                                //   -ECONNABORTED - a new SF/FF interrupted it
+                                //   -EOVERFLOW/-ENOBUFS - too large
+                                //   -EBADMSG - a malformed SF/FF, e.g.
+                                //              shorter than its SF_DL
+                                //   -ENODATA - still incomplete when flushed
+                                //   other - a CF was out of sequence, etc.
+    const uint8_t* data;        // payload; only valid during the callback
+};
+typedef struct isotp_message_s isotp_message_t;
+
+/**
+ * @brief receive a decoded message
+ *
+ * @param cb_ctx - opaque context given to isotp_decoder_init()
+ * @param msg - the message
+ */
+typedef void (*isotp_message_f)(void* cb_ctx, const isotp_message_t* msg);
+
+/**
+ * @brief allocate a passive decoder
+ *
+ * @param decoder - updated with the allocated decoder
+ * @param isotp_addressing_mode - ISOTP addressing mode of the traffic
+ * @param max_message_len - largest message reassembled, in bytes
+ * @param message_f - function invoked with each message
+ * @param cb_ctx - opaque context passed to message_f
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_decoder_init(isotp_decoder_t* decoder,
+                       const isotp_addressing_mode_t isotp_addressing_mode,
+                       const int max_message_len,
+                       isotp_message_f message_f,
+                       void* cb_ctx);
+
+/**
+ * @brief free a passive decoder; messages still in progress are dropped
+ *
+ * @param decoder - decoder
+ */
+void isotp_decoder_free(isotp_decoder_t decoder);
+
+/**
+ * @brief feed a captured CAN frame to a decoder
+ *
+ * message_f is invoked from within this call for any message the frame
+ * completes (or aborts).
+ *
+ * @param decoder - decoder
+ * @param ts_us - timestamp of the frame, in microseconds
+ * @param can_id - CAN ID of the frame
+ * @param extended_id - true if can_id is a 29 bit ID
+ * @param can_format - format of the frame
+ * @param frame_p - pointer to the CAN frame data
+ * @param frame_len - length of the CAN frame data
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_decoder_frame(isotp_decoder_t decoder,
+                        const uint64_t ts_us,
+                        const uint32_t can_id,
+                        const bool extended_id,
+                        const can_format_t can_format,
+                        const uint8_t* frame_p,
+                        const int frame_len);
+
+/**
+ * @brief continue a decoder with the state of one that decoded what follows
+ *
+ * A long log can be split into parts, each decoded by its own decoder
+ * (e.g. on its own thread).  Messages that span the boundary between two
+ * parts are stitched back together by joining the decoders in log order:
+ * the CFs the next decoder saw on each stream before any SF/FF are run
+ * through the message in progress here, and the messages next has in
+ * progress at its end are moved here, with their FF_DL, SN and payload so
+ * far.  Completed (or aborted) messages are reported with decoder's
+ * message_f.  Both decoders must have the same addressing mode and
+ * maximum message length.
+ *
+ * @param decoder - decoder of the part before
+ * @param next - decoder of the part after; it has nothing left in
+ *               progress after the join, and may be free'd
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_decoder_join(isotp_decoder_t decoder, isotp_decoder_t next);
+
+/**
+ * @brief report the messages still in progress, with -ENODATA
+ *
+ * Used at the end of a log, where the last frames of some messages may
+ * be missing.
+ *
+ * @param decoder - decoder
+ *
+ * @returns
+ * on success (>=0), the number of messages reported
+ * otherwise (<0) - error code
+ */
+int isotp_decoder_flush(isotp_decoder_t decoder);
+
+/**
+ * Passive bus monitor
+ *
+ * A monitor keeps statistics on the ISOTP traffic of each CAN ID from
+ * captured frames, and never transmits.  Messages are reassembled with a
+ * passive decoder; FCs are parsed to learn the BS and STmin each sender
+ * was given, which the gaps between its CFs are measured against.
+ *
+ * The CAN ID FCs are sent with is paired with the CAN ID whose FF (or
+ * block of CFs) they answer, the first time an FC follows one while no
+ * other unpaired sender is waiting for an FC; pairs can also be given with
+ * isotp_monitor_pair().  FCs are counted with the CAN ID they steer, or
+ * with their own until it is known.
+ */
+typedef struct isotp_monitor_s* isotp_monitor_t;
+
+/**
+ * @brief statistics of the messages sent with one CAN ID
+ *
+ * Counts are totals since the monitor was created; rates are over the
+ * interval since the previous report.
+ */
+struct isotp_monitor_stats_s {
+    uint32_t can_id;
+    bool extended_id;
+    bool paired;
+    uint32_t fc_can_id;          // CAN ID of the FCs, when paired
+
+    uint64_t frames;             // SFs, FFs and CFs; FCs when unpaired
+    uint64_t messages;           // messages reassembled
+    uint64_t bytes;              // payload of the messages reassembled
+    uint64_t failed;             // messages not reassembled
+    uint64_t sn_errors;          // CFs out of sequence
+
+    uint64_t fc_cts;             // FCs received, by flow status
+    uint64_t fc_wait;
+    uint64_t fc_overflow;
+    int blocksize;               // BS of the last FC.CTS, or -1
+    int stmin_usec;              // STmin of the last FC.CTS, or -1
+
+    uint64_t cf_gaps;            // gaps measured between consecutive CFs
+    uint64_t cf_gap_min_usec;
+    uint64_t cf_gap_max_usec;
+    uint64_t cf_gap_avg_usec;
+    uint64_t stmin_violations;   // gaps shorter than the STmin in force
+
+    uint64_t transfer_bytes_per_sec;  // of multi-frame messages, from the
+                                      // FF to the last CF
+
+    uint64_t interval_usec;
+    uint64_t messages_per_sec;
+    uint64_t bytes_per_sec;
+};
+typedef struct isotp_monitor_stats_s isotp_monitor_stats_t;
+
+/**
+ * @brief receive the statistics of one CAN ID
+ *
+ * @param cb_ctx - opaque context given to isotp_monitor_report()
+ * @param stats - statistics; only valid during the callback
+ */
+typedef void (*isotp_monitor_report_f)(void* cb_ctx,
+                                       const isotp_monitor_stats_t* stats);
+
+/**
+ * @brief allocate a passive monitor
+ *
+ * @param monitor - updated with the allocated monitor
+ * @param isotp_addressing_mode - ISOTP addressing mode of the traffic
+ * @param max_message_len - largest message reassembled, in bytes
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_monitor_init(isotp_monitor_t* monitor,
+                       const isotp_addressing_mode_t isotp_addressing_mode,
+                       const int max_message_len);
+
+/**
+ * @brief free a passive monitor
+ *
+ * @param monitor - monitor, may be NULL
+ */
+void isotp_monitor_free(isotp_monitor_t monitor);
+
+/**
+ * @brief declare that the FCs sent with fc_can_id steer the sender of
+ *        can_id
+ *
+ * @param monitor - monitor
+ * @param can_id - CAN ID of the SFs, FFs and CFs
+ * @param fc_can_id - CAN ID of the FCs answering them
+ * @param extended_id - true if the IDs are 29 bit IDs
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_monitor_pair(isotp_monitor_t monitor,
+                       const uint32_t can_id,
+                       const uint32_t fc_can_id,
+                       const bool extended_id);
+
+/**
+ * @brief feed a captured CAN frame to a monitor
+ *
+ * @param monitor - monitor
+ * @param ts_us - timestamp of the frame, in microseconds
+ * @param can_id - CAN ID of the frame
+ * @param extended_id - true if can_id is a 29 bit ID
+ * @param can_format - format of the frame
+ * @param frame_p - pointer to the CAN frame data
+ * @param frame_len - length of the CAN frame data
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_monitor_frame(isotp_monitor_t monitor,
+                        const uint64_t ts_us,
+                        const uint32_t can_id,
+                        const bool extended_id,
+                        const can_format_t can_format,
+                        const uint8_t* frame_p,
+                        const int frame_len);
+
+/**
+ * @brief report the statistics of every CAN ID seen, and start a new
+ *        interval for the rates
+ *
+ * @param monitor - monitor
+ * @param now_us - end of the interval, on the clock of the frames
+ * @param report_f - function invoked with the statistics of each CAN ID,
+ *                   in no particular order
+ * @param cb_ctx - opaque context passed to report_f
+ *
+ * @returns
+ * on success (>=0), the number of CAN IDs reported
+ * otherwise (<0) - error code
+ */
+int isotp_monitor_report(isotp_monitor_t monitor,
+                         const uint64_t now_us,
+                         isotp_monitor_report_f report_f,
+                         void* cb_ctx);
+
+/**
+ * Session pools
+ *
+ * A gateway opens a session as each tester connects and drops it when the
+ * tester goes quiet.  A session pool allocates a fixed number of contexts up
+ * front, all with the same CAN format, addressing mode and FC.WAIT limit,
+ * and hands them out and takes them back in constant time, so setting up a
+ * session costs no allocation and memory stays bounded however many testers
+ * connect at once.
+ *
+ * A context given back to the pool is reset to the state isotp_ctx_init()
+ * leaves a context in; its callbacks, flow control policy, peer profile,
+ * fixed address and address extension are all cleared.  A session not
+ * marked active with isotp_pool_touch() within the idle timeout is evicted
+ * by isotp_pool_evict(), or by isotp_pool_acquire() when no context is
+ * free.  The evict callback is invoked first, so the application can drop
+ * its references to the context.
+ *
+ * Contexts from a pool must not be free'd with isotp_ctx_free().
+ */
+typedef struct isotp_pool_s* isotp_pool_t;
+
+struct isotp_pool_stats_s {
+    int capacity;         // contexts allocated by isotp_pool_init()
+    int in_use;           // contexts handed out
+    uint64_t acquired;    // isotp_pool_acquire() successes
+    uint64_t released;    // contexts given back, evictions included
+    uint64_t evicted;     // idle sessions evicted
+    uint64_t exhausted;   // isotp_pool_acquire() failures, all in use
+};
+typedef struct isotp_pool_stats_s isotp_pool_stats_t;
+
+/**
+ * @brief learn that an idle session is about to be evicted
+ *
+ * @param cb_ctx - opaque context given to isotp_pool_init()
+ * @param ctx - the session's context; reset and reused after the callback
+ */
+typedef void (*isotp_pool_evict_f)(void* cb_ctx, isotp_ctx_t ctx);
+
+/**
+ * @brief allocate a session pool and all of its contexts
+ *
+ * @param pool - updated with the allocated pool
+ * @param can_format - format of the CAN frames
+ * @param isotp_addressing_mode - ISOTP addressing mode of the sessions
+ * @param max_fc_wait_frames - maximum number of FC.WAIT frames allowed
+ * @param capacity - number of contexts (>0)
+ * @param idle_timeout_us - time without activity after which a session is
+ *                          evicted, in microseconds; 0 never evicts
+ * @param evict_f - function invoked for each session evicted, may be NULL
+ * @param cb_ctx - opaque context passed to evict_f
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_pool_init(isotp_pool_t* pool,
+                    const can_format_t can_format,
+                    const isotp_addressing_mode_t isotp_addressing_mode,
+                    const uint8_t max_fc_wait_frames,
+                    const int capacity,
+                    const uint64_t idle_timeout_us,
+                    isotp_pool_evict_f evict_f,
+                    void* cb_ctx);
+
+/**
+ * @brief free a session pool and all of its contexts, even those in use
+ *
+ * @param pool - pool, may be NULL
+ */
+void isotp_pool_free(isotp_pool_t pool);
+
+/**
+ * @brief take a context from the pool for a new session
+ *
+ * If no context is free, the session idle the longest is evicted, if it
+ * has been idle for the idle timeout.
+ *
+ * @param pool - pool
+ * @param can_ctx - opaque context passed to can_rx_f and can_tx_f
+ * @param can_rx_f - function invoked to receive a CAN frame, may be NULL
+ * @param can_tx_f - function invoked to transmit a CAN frame
+ * @param now_us - current time, in microseconds (monotonic); the session
+ *                 is active from then
+ * @param ctx - updated with the context
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ *     -ENOBUFS = every context is in use by a session that isn't idle
+ */
+int isotp_pool_acquire(isotp_pool_t pool,
+                       void* can_ctx,
+                       isotp_rx_f can_rx_f,
+                       isotp_tx_f can_tx_f,
+                       const uint64_t now_us,
+                       isotp_ctx_t* ctx);
+
+/**
+ * @brief give a context back to the pool, resetting it
+ *
+ * @param pool - pool
+ * @param ctx - context from isotp_pool_acquire(); not to be used after
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ *     -EINVAL = ctx is not in use from this pool
+ */
+int isotp_pool_release(isotp_pool_t pool, isotp_ctx_t ctx);
+
+/**
+ * @brief mark a session active, restarting its idle timeout
+ *
+ * @param pool - pool
+ * @param ctx - context from isotp_pool_acquire()
+ * @param now_us - current time, in microseconds (monotonic)
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_pool_touch(isotp_pool_t pool,
+                     isotp_ctx_t ctx,
+                     const uint64_t now_us);
+
+/**
+ * @brief evict the sessions idle for the idle timeout
+ *
+ * Takes time in the number of sessions evicted only.
+ *
+ * @param pool - pool
+ * @param now_us - current time, in microseconds (monotonic)
+ *
+ * @returns
+ * on success (>=0), the number of sessions evicted
+ * otherwise (<0) - error code
+ */
+int isotp_pool_evict(isotp_pool_t pool, const uint64_t now_us);
+
+/**
+ * @brief return the usage of a session pool
+ *
+ * @param pool - pool
+ * @param stats - updated with the usage
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_pool_stats(const isotp_pool_t pool, isotp_pool_stats_t* stats);
+
+/**
+ * Receive buffer pools
+ *
+ * A receiver otherwise needs a buffer for the largest message it may be
+ * sent before the FF says how large the message is, for every session.
+ * A buffer pool hands out buffers on demand instead: a non-blocking
+ * receive started with isotp_recv_start_pooled() takes one sized to FF_DL
+ * when the FF arrives (to the frame, for an SF), and on completion its
+ * ownership passes to the application with isotp_recv_take(), which gives
+ * it back with isotp_buf_pool_put() when done with it.
+ *
+ * Buffers are kept in size classes, four per doubling of the size from 64
+ * bytes, so a buffer is at most a quarter larger than asked for.  A buffer
+ * given back stays on its class's free list for the next message of about
+ * the same size; cached buffers are only free'd when the pool would
+ * otherwise exceed its byte budget.  A pool is not thread safe.
+ */
+typedef struct isotp_buf_pool_s* isotp_buf_pool_t;
+
+struct isotp_buf_pool_stats_s {
+    size_t bytes_allocated;   // held by the pool, in use or cached
+    size_t bytes_in_use;      // of the buffers handed out, by size class
+    size_t bytes_requested;   // of the buffers handed out, as asked for
+    int buffers_in_use;
+    uint64_t acquired;        // isotp_buf_pool_get() successes
+    uint64_t allocated;       // of those, the ones needing a new buffer
+    uint64_t exhausted;       // isotp_buf_pool_get() failures, over budget
+};
+typedef struct isotp_buf_pool_stats_s isotp_buf_pool_stats_t;
+
+/**
+ * @brief allocate a receive buffer pool
+ *
+ * @param pool - updated with the allocated pool
+ * @param max_message_len - largest buffer handed out, in bytes
+ *                          (1 to MAX_TX_DATALEN)
+ * @param max_bytes - most memory held in buffers, by size class;
+ *                    0 for no limit
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_buf_pool_init(isotp_buf_pool_t* pool,
+                        const int max_message_len,
+                        const size_t max_bytes);
+
+/**
+ * @brief free a receive buffer pool and the buffers it caches
+ *
+ * Every buffer handed out must have been given back first.
+ *
+ * @param pool - pool, may be NULL
+ */
+void isotp_buf_pool_free(isotp_buf_pool_t pool);
+
+/**
+ * @brief take a buffer from the pool
+ *
+ * @param pool - pool
+ * @param len - bytes needed (1 to max_message_len)
+ * @param buf - updated with a buffer of at least len bytes
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ *     -EMSGSIZE = len is larger than max_message_len
+ *     -ENOBUFS = the buffer would take the pool over max_bytes
+ */
+int isotp_buf_pool_get(isotp_buf_pool_t pool,
+                       const int len,
+                       uint8_t** buf);
+
+/**
+ * @brief give a buffer back to the pool
+ *
+ * @param pool - pool
+ * @param buf - buffer from isotp_buf_pool_get() or isotp_recv_take();
+ *              not to be used after
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ *     -EINVAL = buf is not in use from this pool
+ */
+int isotp_buf_pool_put(isotp_buf_pool_t pool, uint8_t* buf);
+
+/**
+ * @brief return the usage of a receive buffer pool
+ *
+ * @param pool - pool
+ * @param stats - updated with the usage
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_buf_pool_stats(const isotp_buf_pool_t pool,
+                         isotp_buf_pool_stats_t* stats);
+
+/**
+ * @brief start receiving a message into a buffer from a pool
+ *
+ * Same as isotp_recv_start(), except that the buffer is taken from pool
+ * when the first frame of the message arrives.  An FF larger than the
+ * pool's max_message_len, or arriving when the pool is over budget, is
+ * answered with an FC.OVFLW.  The buffer is given back if the transfer
+ * fails, and is otherwise held by the context until isotp_recv_take().
+ *
+ * @param ctx - ISOTP context
+ * @param pool - buffer pool
+ * @param blocksize - BS sent in FC frames
+ * @param stmin_usec - STmin sent in FC frames, in microseconds
+ * @param timeout - N_Cr timeout, in usec; 0 for none
+ *
+ * @returns
+ * on success, 0.  The transfer is in progress; isotp_poll() returns the
+ * length of the message, or
+ *     -EMSGSIZE = the FF_DL is larger than the pool's max_message_len
+ *     -ENOBUFS = the pool had no buffer within its budget
+ * otherwise (<0) - error code
+ *     -EBUSY = a transfer is already in progress on this context
+ */
+int isotp_recv_start_pooled(isotp_ctx_t ctx,
+                            isotp_buf_pool_t pool,
+                            const uint8_t blocksize,
+                            const int stmin_usec,
+                            const uint64_t timeout);
+
+/**
+ * @brief take ownership of the buffer of a message received from a pool
+ *
+ * @param ctx - ISOTP context
+ * @param buf - updated with the buffer holding the message; give it back
+ *              with isotp_buf_pool_put()
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ *     -EBUSY = the transfer is still in progress
+ *     -ENOMSG = the context holds no received message
+ */
+int isotp_recv_take(isotp_ctx_t ctx, uint8_t** buf);
+
+#ifdef __cplusplus
+}
+#endif
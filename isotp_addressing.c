@@ -67,3 +67,145 @@ int address_extension_len(const isotp_addressing_mode_t addr_mode) {
         return -EFAULT;
     }
 }
+
+// @ref ISO-15765-2:2016, section 10.3.3, tables 29 and 30
+#define FIXED_PRIORITY_SHIFT (26)
+#define FIXED_PRIORITY_MAX   (7)
+#define FIXED_PF_SHIFT       (16)
+#define FIXED_TA_SHIFT       (8)
+#define FIXED_ID_MASK        (0x1FFFFFFFU)
+#define FIXED_R_DP_MASK      (0x03000000U)
+
+int isotp_fixed_id_build(const isotp_ta_type_t ta_type,
+                         const uint8_t ta,
+                         const uint8_t sa,
+                         const uint8_t priority,
+                         uint32_t* can_id) {
+    if (can_id == NULL) {
+        return -EINVAL;
+    }
+
+    if (priority > FIXED_PRIORITY_MAX) {
+        return -ERANGE;
+    }
+
+    uint32_t pf = 0;
+    switch (ta_type) {
+    case ISOTP_PHYSICAL_TA_TYPE:
+        pf = ISOTP_FIXED_PF_PHYSICAL;
+        break;
+
+    case ISOTP_FUNCTIONAL_TA_TYPE:
+        pf = ISOTP_FIXED_PF_FUNCTIONAL;
+        break;
+
+    case NULL_ISOTP_TA_TYPE:
+    case LAST_ISOTP_TA_TYPE:
+    default:
+        return -EFAULT;
+    }
+
+    *can_id = ((uint32_t)priority << FIXED_PRIORITY_SHIFT) |
+              (pf << FIXED_PF_SHIFT) |
+              ((uint32_t)ta << FIXED_TA_SHIFT) |
+              sa;
+
+    return EOK;
+}
+
+int isotp_fixed_id_parse(const uint32_t can_id,
+                         isotp_ta_type_t* ta_type,
+                         uint8_t* ta,
+                         uint8_t* sa) {
+    if ((ta_type == NULL) || (ta == NULL) || (sa == NULL)) {
+        return -EINVAL;
+    }
+
+    if (((can_id & ~FIXED_ID_MASK) != 0) ||
+        ((can_id & FIXED_R_DP_MASK) != 0)) {
+        return -ENOMSG;
+    }
+
+    switch ((can_id >> FIXED_PF_SHIFT) & 0xff) {
+    case ISOTP_FIXED_PF_PHYSICAL:
+        *ta_type = ISOTP_PHYSICAL_TA_TYPE;
+        break;
+
+    case ISOTP_FIXED_PF_FUNCTIONAL:
+        *ta_type = ISOTP_FUNCTIONAL_TA_TYPE;
+        break;
+
+    default:
+        return -ENOMSG;
+    }
+
+    *ta = (uint8_t)(can_id >> FIXED_TA_SHIFT);
+    *sa = (uint8_t)can_id;
+
+    return EOK;
+}
+
+int isotp_ctx_set_fixed_address(isotp_ctx_t ctx,
+                                const isotp_ta_type_t ta_type,
+                                const uint8_t ta,
+                                const uint8_t sa,
+                                const uint8_t priority) {
+    if (ctx == NULL) {
+        return -EINVAL;
+    }
+
+    if (ctx_addressing_mode(ctx) != ISOTP_NORMAL_FIXED_ADDRESSING_MODE) {
+        return -EFAULT;
+    }
+
+    // validates ta_type and priority
+    uint32_t can_id = 0;
+    int rc = isotp_fixed_id_build(ta_type, ta, sa, priority, &can_id);
+    if (rc < 0) {
+        return rc;
+    }
+
+    ctx->fixed_ta_type = ta_type;
+    ctx->fixed_ta = ta;
+    ctx->fixed_sa = sa;
+    ctx->fixed_priority = priority;
+    ctx->has_fixed_address = true;
+
+    return EOK;
+}
+
+int isotp_ctx_fixed_tx_id(const isotp_ctx_t ctx, uint32_t* can_id) {
+    if ((ctx == NULL) || (can_id == NULL)) {
+        return -EINVAL;
+    }
+
+    if (!ctx->has_fixed_address) {
+        return -EDESTADDRREQ;
+    }
+
+    return isotp_fixed_id_build(ctx->fixed_ta_type,
+                                ctx->fixed_ta,
+                                ctx->fixed_sa,
+                                ctx->fixed_priority,
+                                can_id);
+}
+
+int isotp_ctx_fixed_rx_id(const isotp_ctx_t ctx, uint32_t* can_id) {
+    if ((ctx == NULL) || (can_id == NULL)) {
+        return -EINVAL;
+    }
+
+    if (!ctx->has_fixed_address) {
+        return -EDESTADDRREQ;
+    }
+
+    if (ctx->fixed_ta_type != ISOTP_PHYSICAL_TA_TYPE) {
+        return -EOPNOTSUPP;
+    }
+
+    return isotp_fixed_id_build(ISOTP_PHYSICAL_TA_TYPE,
+                                ctx->fixed_sa,
+                                ctx->fixed_ta,
+                                ctx->fixed_priority,
+                                can_id);
+}
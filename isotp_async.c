@@ -0,0 +1,641 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <can/can.h>
+#include <isotp.h>
+#include <isotp_private.h>
+
+/**
+ * @brief return the largest payload that fits into an SF
+ *
+ * CAN frames use the SF_DL nibble, CAN-FD frames use the escape sequence.
+ * @ref ISO-15765-2:2016, section 9.6.2.1, table 10
+ */
+static int max_sf_payload(const isotp_ctx_t ctx) {
+    if (ctx_can_max_datalen(ctx) <= 8) {
+        return 7 - ctx_ae_len(ctx);
+    } else {
+        return ctx_can_max_datalen(ctx) - (2 + ctx_ae_len(ctx));
+    }
+}
+
+static bool nb_active(const isotp_ctx_t ctx) {
+    return ((ctx->nb_state != ISOTP_NB_IDLE) &&
+            (ctx->nb_state != ISOTP_NB_DONE));
+}
+
+static bool nb_waiting_for_frame(const isotp_ctx_t ctx) {
+    return ((ctx->nb_state == ISOTP_NB_TX_WAIT_FC) ||
+            (ctx->nb_state == ISOTP_NB_RX_WAIT) ||
+            (ctx->nb_state == ISOTP_NB_RX_CF));
+}
+
+static int nb_finish(isotp_ctx_t ctx, const int rc) {
+    if (rc < 0) {
+        rx_pool_drop(ctx);
+    }
+    ctx->nb_state = ISOTP_NB_DONE;
+    ctx->nb_result = rc;
+    ctx->total_datalen = 0;
+    ctx->remaining_datalen = 0;
+    ctx->rx_iov = NULL;
+    return rc;
+}
+
+static void nb_restart_timer(isotp_ctx_t ctx, const uint64_t now_us) {
+    ctx->nb_deadline_us = now_us + ctx->nb_timeout_us;
+    ctx->nb_timer_armed = true;
+}
+
+static int nb_transmit(isotp_ctx_t ctx) {
+    return (*(ctx->can_tx_f))(ctx->can_ctx,
+                              ctx->can_frame,
+                              ctx->can_frame_len,
+                              ctx->nb_timeout_us);
+}
+
+static int nb_send_fc(isotp_ctx_t ctx, const isotp_fc_flowstatus_t fs) {
+    int rc = prepare_fc(ctx, fs, ctx->nb_blocksize, ctx->nb_stmin_usec);
+    if (rc < 0) {
+        return rc;
+    }
+
+    return nb_transmit(ctx);
+}
+
+int isotp_send_start(isotp_ctx_t ctx,
+                     const uint8_t* send_buf_p,
+                     const int send_buf_len,
+                     const uint64_t timeout) {
+    if ((ctx == NULL) ||
+        (send_buf_p == NULL)) {
+        return -EINVAL;
+    }
+
+    if ((send_buf_len < 0) || (send_buf_len > MAX_TX_DATALEN)) {
+        return -ERANGE;
+    }
+
+    if (nb_active(ctx)) {
+        return -EBUSY;
+    }
+
+    ctx->nb_send_buf_p = send_buf_p;
+    ctx->nb_recv_buf_p = NULL;
+    ctx->nb_buf_len = send_buf_len;
+    ctx->nb_timeout_us = timeout;
+    ctx->nb_timer_armed = false;
+    ctx->fc_wait_count = 0;
+
+    int rc = 0;
+    if (send_buf_len <= max_sf_payload(ctx)) {
+        rc = prepare_sf(ctx, send_buf_p, send_buf_len);
+    } else {
+        rc = prepare_ff(ctx, send_buf_p, send_buf_len);
+    }
+    if (rc < 0) {
+        ctx->nb_state = ISOTP_NB_IDLE;
+        return rc;
+    }
+
+    rc = nb_transmit(ctx);
+    if (rc < 0) {
+        ctx->nb_state = ISOTP_NB_IDLE;
+        return rc;
+    }
+
+    if (ctx->remaining_datalen > 0) {
+        ctx->nb_state = ISOTP_NB_TX_WAIT_FC;
+    } else {
+        (void)nb_finish(ctx, send_buf_len);
+    }
+
+    return EOK;
+}
+
+int isotp_recv_start(isotp_ctx_t ctx,
+                     uint8_t* recv_buf_p,
+                     const int recv_buf_sz,
+                     const uint8_t blocksize,
+                     const int stmin_usec,
+                     const uint64_t timeout) {
+    if ((ctx == NULL) || (recv_buf_p == NULL)) {
+        return -EINVAL;
+    }
+
+    if ((recv_buf_sz < 0) || (recv_buf_sz > MAX_TX_DATALEN)) {
+        return -ERANGE;
+    }
+
+    if (nb_active(ctx)) {
+        return -EBUSY;
+    }
+
+    rx_pool_drop(ctx);
+    ctx->rx_buf_pool = NULL;
+    ctx->rx_iov = NULL;
+    ctx->nb_send_buf_p = NULL;
+    ctx->nb_recv_buf_p = recv_buf_p;
+    ctx->nb_buf_len = recv_buf_sz;
+    ctx->nb_blocksize = blocksize;
+    ctx->nb_stmin_usec = stmin_usec;
+    ctx->nb_timeout_us = timeout;
+    ctx->nb_timer_armed = false;
+    ctx->total_datalen = 0;
+    ctx->remaining_datalen = 0;
+    ctx->nb_state = ISOTP_NB_RX_WAIT;
+
+    return EOK;
+}
+
+int isotp_recv_start_iov(isotp_ctx_t ctx,
+                         const isotp_iovec_t* iov,
+                         const int iovcnt,
+                         const uint8_t blocksize,
+                         const int stmin_usec,
+                         const uint64_t timeout) {
+    if (ctx == NULL) {
+        return -EINVAL;
+    }
+
+    int total = iov_total_len(iov, iovcnt);
+    if (total < 0) {
+        return total;
+    }
+
+    // the first segment stands in as the flat buffer, see isotp_recv_iov()
+    int rc = isotp_recv_start(ctx,
+                              iov[0].base,
+                              total,
+                              blocksize,
+                              stmin_usec,
+                              timeout);
+    if (rc < 0) {
+        return rc;
+    }
+
+    ctx->rx_iov = iov;
+    ctx->rx_iovcnt = iovcnt;
+    ctx->rx_iov_idx = 0;
+    ctx->rx_iov_off = 0;
+
+    return EOK;
+}
+
+int isotp_recv_start_pooled(isotp_ctx_t ctx,
+                            isotp_buf_pool_t pool,
+                            const uint8_t blocksize,
+                            const int stmin_usec,
+                            const uint64_t timeout) {
+    if ((ctx == NULL) || (pool == NULL)) {
+        return -EINVAL;
+    }
+
+    if (nb_active(ctx)) {
+        return -EBUSY;
+    }
+
+    rx_pool_drop(ctx);
+    ctx->rx_buf_pool = pool;
+    ctx->rx_iov = NULL;
+    ctx->nb_send_buf_p = NULL;
+    ctx->nb_recv_buf_p = NULL;
+    ctx->nb_buf_len = 0;
+    ctx->nb_blocksize = blocksize;
+    ctx->nb_stmin_usec = stmin_usec;
+    ctx->nb_timeout_us = timeout;
+    ctx->nb_timer_armed = false;
+    ctx->total_datalen = 0;
+    ctx->remaining_datalen = 0;
+    ctx->nb_state = ISOTP_NB_RX_WAIT;
+
+    return EOK;
+}
+
+int isotp_recv_take(isotp_ctx_t ctx, uint8_t** buf) {
+    if ((ctx == NULL) || (buf == NULL)) {
+        return -EINVAL;
+    }
+
+    if (nb_active(ctx)) {
+        return -EBUSY;
+    }
+
+    if (ctx->rx_pool_buf == NULL) {
+        return -ENOMSG;
+    }
+
+    *buf = ctx->rx_pool_buf;
+    ctx->rx_pool_buf = NULL;
+    ctx->nb_recv_buf_p = NULL;
+    return EOK;
+}
+
+/**
+ * @brief take a pooled buffer for the message a first frame starts
+ *
+ * Sized to the FF_DL of an FF, or the SF_DL of an SF.  Nothing to do
+ * unless the receive was started with isotp_recv_start_pooled().
+ */
+static int nb_pool_buf(isotp_ctx_t ctx,
+                       const uint8_t* frame_p,
+                       const int frame_len) {
+    if (ctx->rx_buf_pool == NULL) {
+        return EOK;
+    }
+
+    // a new message replaces the one in progress
+    rx_pool_drop(ctx);
+
+    int len = 0;
+    if ((frame_p[ctx_ae_len(ctx)] & PCI_MASK) == FF_PCI) {
+        len = ff_datalen(ctx, frame_p, frame_len);
+    } else {
+        len = sf_datalen(ctx, frame_p, frame_len);
+    }
+    if (len < 0) {
+        return len;
+    }
+
+    int rc = isotp_buf_pool_get(ctx->rx_buf_pool, len, &(ctx->rx_pool_buf));
+    if (rc < 0) {
+        return rc;
+    }
+    ctx->nb_recv_buf_p = ctx->rx_pool_buf;
+    ctx->nb_buf_len = len;
+    return EOK;
+}
+
+static int nb_handle_fc(isotp_ctx_t ctx,
+                        const uint8_t* frame_p,
+                        const int frame_len,
+                        const uint64_t now_us) {
+    isotp_fc_flowstatus_t fs = ISOTP_FC_FLOWSTATUS_NULL;
+    uint8_t bs = 0;
+    int stmin_usec = 0;
+
+    int rc = parse_fc_frame(ctx, frame_p, frame_len, &fs, &bs, &stmin_usec);
+    if ((rc == -ENOMSG) || (rc == -EMSGSIZE)) {
+        // not an FC; ignore it
+        // @ref ISO-15765-2:2016, section 9.8.3
+        return EOK;
+    } else if (rc < 0) {
+        return nb_finish(ctx, rc);
+    }
+
+    switch (fs) {
+        case ISOTP_FC_FLOWSTATUS_CTS:
+            if (ctx->has_peer_profile) {
+                isotp_peer_profile_apply(&(ctx->peer_profile),
+                                         &bs,
+                                         &stmin_usec);
+            }
+            ctx->fs_blocksize = bs;
+            ctx->fs_stmin = stmin_usec;
+            ctx->nb_bs_remaining = bs;
+            ctx->nb_next_cf_us = now_us;
+            ctx->nb_state = ISOTP_NB_TX_CF;
+            break;
+
+        case ISOTP_FC_FLOWSTATUS_WAIT:
+            // @ref ISO-15765-2:2016, section 9.7
+            if (ctx->fc_wait_max > 0) {
+                ctx->fc_wait_count++;
+                if (ctx->fc_wait_count > ctx->fc_wait_max) {
+                    return nb_finish(ctx, -ECONNABORTED);
+                }
+            }
+            nb_restart_timer(ctx, now_us);
+            break;
+
+        case ISOTP_FC_FLOWSTATUS_OVFLW:
+            return nb_finish(ctx, -ECONNABORTED);
+            break;
+
+        case ISOTP_FC_FLOWSTATUS_NULL:
+        case ISOTP_FC_FLOWSTATUS_LAST:
+        default:
+            return nb_finish(ctx, -EBADMSG);
+            break;
+    }
+
+    return EOK;
+}
+
+static int nb_handle_first_frame(isotp_ctx_t ctx,
+                                 const uint8_t* frame_p,
+                                 const int frame_len,
+                                 const uint64_t now_us) {
+    int rc = 0;
+
+    switch ((frame_p[ctx_ae_len(ctx)]) & PCI_MASK) {
+        case SF_PCI:
+            rc = nb_pool_buf(ctx, frame_p, frame_len);
+            if (rc == -EBADMSG) {
+                // malformed SF; ignore it
+                return EOK;
+            } else if (rc < 0) {
+                return nb_finish(ctx, rc);
+            }
+
+            rc = parse_sf_frame(ctx,
+                                frame_p,
+                                frame_len,
+                                ctx->nb_recv_buf_p,
+                                ctx->nb_buf_len);
+            if (rc == -ENOBUFS) {
+                return nb_finish(ctx, rc);
+            } else if (rc < 0) {
+                // malformed SF; ignore it
+                rx_pool_drop(ctx);
+                return EOK;
+            }
+            return nb_finish(ctx, rc);
+            break;
+
+        case FF_PCI:
+            rc = nb_pool_buf(ctx, frame_p, frame_len);
+            if (rc == -EBADMSG) {
+                return EOK;
+            } else if (rc < 0) {
+                // no buffer for it; tell the sender we can't take it
+                (void)nb_send_fc(ctx, ISOTP_FC_FLOWSTATUS_OVFLW);
+                return nb_finish(ctx, rc);
+            }
+
+            rc = parse_ff_frame(ctx,
+                                frame_p,
+                                frame_len,
+                                ctx->nb_recv_buf_p,
+                                ctx->nb_buf_len);
+            if (rc == -EOVERFLOW) {
+                // tell the sender we can't take it
+                (void)nb_send_fc(ctx, ISOTP_FC_FLOWSTATUS_OVFLW);
+                return nb_finish(ctx, rc);
+            } else if (rc < 0) {
+                rx_pool_drop(ctx);
+                return EOK;
+            }
+
+            // new message; nothing observed for the policy yet
+            ctx->fc_block_cfs = 0;
+            fc_policy_next_block(ctx,
+                                 &(ctx->nb_blocksize),
+                                 &(ctx->nb_stmin_usec),
+                                 now_us);
+            rc = nb_send_fc(ctx, ISOTP_FC_FLOWSTATUS_CTS);
+            if (rc < 0) {
+                return nb_finish(ctx, rc);
+            }
+
+            ctx->nb_bs_remaining = ctx->nb_blocksize;
+            ctx->nb_state = ISOTP_NB_RX_CF;
+            nb_restart_timer(ctx, now_us);
+            break;
+
+        case CF_PCI:
+        case FC_PCI:
+        default:
+            // not the start of a message; ignore it
+            break;
+    }
+
+    return EOK;
+}
+
+static int nb_handle_cf(isotp_ctx_t ctx,
+                        const uint8_t* frame_p,
+                        const int frame_len,
+                        const uint64_t now_us) {
+    uint8_t pci = frame_p[ctx_ae_len(ctx)] & PCI_MASK;
+
+    if ((pci == SF_PCI) || (pci == FF_PCI)) {
+        // a new message replaces the one in progress
+        // @ref ISO-15765-2:2016, section 9.8.3, table 23
+        ctx->nb_state = ISOTP_NB_RX_WAIT;
+        return nb_handle_first_frame(ctx, frame_p, frame_len, now_us);
+    } else if (pci != CF_PCI) {
+        return EOK;
+    }
+
+    int rc = parse_cf_frame(ctx,
+                            frame_p,
+                            frame_len,
+                            ctx->nb_recv_buf_p,
+                            ctx->nb_buf_len);
+    if (rc < 0) {
+        return nb_finish(ctx, rc);
+    }
+
+    if (ctx->remaining_datalen == 0) {
+        return nb_finish(ctx, ctx->total_datalen);
+    }
+
+    nb_restart_timer(ctx, now_us);
+    fc_policy_cf_received(ctx, now_us);
+
+    if (ctx->nb_blocksize > 0) {
+        ctx->nb_bs_remaining--;
+        if (ctx->nb_bs_remaining == 0) {
+            fc_policy_next_block(ctx,
+                                 &(ctx->nb_blocksize),
+                                 &(ctx->nb_stmin_usec),
+                                 now_us);
+            rc = nb_send_fc(ctx, ISOTP_FC_FLOWSTATUS_CTS);
+            if (rc < 0) {
+                return nb_finish(ctx, rc);
+            }
+            ctx->nb_bs_remaining = ctx->nb_blocksize;
+        }
+    }
+
+    return EOK;
+}
+
+static int nb_handle_frame(isotp_ctx_t ctx,
+                           const uint8_t* frame_p,
+                           const int frame_len,
+                           const uint64_t now_us) {
+    if ((frame_len <= ctx_ae_len(ctx)) ||
+        (frame_len > (int)sizeof(ctx->can_frame))) {
+        // too short to hold a PCI, or not a CAN frame
+        return EOK;
+    }
+
+    switch (ctx->nb_state) {
+        case ISOTP_NB_TX_WAIT_FC:
+            return nb_handle_fc(ctx, frame_p, frame_len, now_us);
+            break;
+
+        case ISOTP_NB_RX_WAIT:
+            return nb_handle_first_frame(ctx, frame_p, frame_len, now_us);
+            break;
+
+        case ISOTP_NB_RX_CF:
+            return nb_handle_cf(ctx, frame_p, frame_len, now_us);
+            break;
+
+        default:
+            // nothing is expected; drop the frame
+            return EOK;
+            break;
+    }
+}
+
+static int nb_send_cfs(isotp_ctx_t ctx, const uint64_t now_us) {
+    while ((ctx->nb_state == ISOTP_NB_TX_CF) &&
+           (now_us >= ctx->nb_next_cf_us)) {
+        int remaining_datalen = ctx->remaining_datalen;
+        int sequence_num = ctx->sequence_num;
+
+        int rc = prepare_cf(ctx, ctx->nb_send_buf_p, ctx->nb_buf_len);
+        if (rc < 0) {
+            return nb_finish(ctx, rc);
+        }
+
+        rc = nb_transmit(ctx);
+        if (tx_backpressure(rc)) {
+            // the transport is full; take the CF back and retry it on
+            // the next poll
+            ctx->remaining_datalen = remaining_datalen;
+            ctx->sequence_num = sequence_num;
+            return EOK;
+        } else if (rc < 0) {
+            return nb_finish(ctx, rc);
+        }
+
+        ctx->nb_next_cf_us = now_us + ctx->fs_stmin;
+
+        if (ctx->remaining_datalen == 0) {
+            return nb_finish(ctx, ctx->nb_buf_len);
+        }
+
+        // @ref ISO-15765-2:2016, section 9.6.5.3, table 19
+        if (ctx->fs_blocksize > 0) {
+            ctx->nb_bs_remaining--;
+            if (ctx->nb_bs_remaining == 0) {
+                ctx->fc_wait_count = 0;
+                ctx->nb_state = ISOTP_NB_TX_WAIT_FC;
+                nb_restart_timer(ctx, now_us);
+            }
+        }
+    }
+
+    return EOK;
+}
+
+/**
+ * @brief send due CFs, check timeouts and report a finished transfer
+ */
+static int nb_step(isotp_ctx_t ctx, const uint64_t now_us) {
+    (void)nb_send_cfs(ctx, now_us);
+
+    if (nb_waiting_for_frame(ctx) &&
+        (ctx->nb_timeout_us > 0) &&
+        (now_us >= ctx->nb_deadline_us)) {
+        (void)nb_finish(ctx, -ETIMEDOUT);
+    }
+
+    if (ctx->nb_state == ISOTP_NB_DONE) {
+        ctx->nb_state = ISOTP_NB_IDLE;
+        return ctx->nb_result;
+    }
+
+    return -EINPROGRESS;
+}
+
+int isotp_poll(isotp_ctx_t ctx, const uint64_t now_us) {
+    if (ctx == NULL) {
+        return -EINVAL;
+    }
+
+    if (ctx->nb_state == ISOTP_NB_IDLE) {
+        return -ENOTCONN;
+    }
+
+    if (!ctx->nb_timer_armed) {
+        nb_restart_timer(ctx, now_us);
+    }
+
+    // receive everything the transport has pending, unless the frames
+    // are delivered with isotp_rx_frame() instead
+    while ((ctx->can_rx_f != NULL) && nb_waiting_for_frame(ctx)) {
+        int rc = (*(ctx->can_rx_f))(ctx->can_ctx,
+                                    ctx->can_frame,
+                                    sizeof(ctx->can_frame),
+                                    0);
+        if ((rc == 0) ||
+            (rc == -EAGAIN) ||
+            (rc == -ETIMEDOUT) ||
+            (rc == -ETIME)) {
+            break;
+        } else if (rc < 0) {
+            (void)nb_finish(ctx, rc);
+            break;
+        }
+
+        ctx->can_frame_len = (uint8_t)MIN(rc, (int)sizeof(ctx->can_frame));
+        (void)nb_handle_frame(ctx, ctx->can_frame, ctx->can_frame_len, now_us);
+    }
+
+    return nb_step(ctx, now_us);
+}
+
+int isotp_recv_started(const isotp_ctx_t ctx) {
+    if (ctx == NULL) {
+        return -EINVAL;
+    }
+
+    return (ctx->nb_state == ISOTP_NB_RX_CF) ? 1 : 0;
+}
+
+int isotp_rx_frame(isotp_ctx_t ctx,
+                   const uint8_t* frame_p,
+                   const int frame_len,
+                   const uint64_t now_us) {
+    if ((ctx == NULL) || (frame_p == NULL)) {
+        return -EINVAL;
+    }
+
+    if (ctx->nb_state == ISOTP_NB_IDLE) {
+        return -ENOTCONN;
+    }
+
+    if (!ctx->nb_timer_armed) {
+        nb_restart_timer(ctx, now_us);
+    }
+
+    // the frame is parsed where it is; only the payload is copied out
+    if (nb_waiting_for_frame(ctx)) {
+        (void)nb_handle_frame(ctx, frame_p, frame_len, now_us);
+    }
+
+    return nb_step(ctx, now_us);
+}
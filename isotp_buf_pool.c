@@ -0,0 +1,247 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <isotp.h>
+#include <isotp_private.h>
+
+// the smallest size class; every SF fits
+#define BUF_MIN_CLASS_SZ (64)
+#define BUF_MIN_CLASS_SHIFT (6)
+
+// size classes per doubling of the size; a power of two
+#define BUF_CLASS_STEPS (4)
+#define BUF_CLASS_STEP_SHIFT (2)
+
+/**
+ * @brief the header in front of each buffer
+ *
+ * Lets a buffer be given back with nothing but its data pointer.
+ */
+struct buf_hdr_s {
+    struct isotp_buf_pool_s* pool;
+    struct buf_hdr_s* next;   // on its class's free list
+    int class_idx;
+    int len;                  // asked for, while in use
+    bool in_use;
+};
+
+struct buf_class_s {
+    int size;
+    struct buf_hdr_s* free_list;
+};
+
+struct isotp_buf_pool_s {
+    int max_message_len;
+    size_t max_bytes;
+    struct buf_class_s* classes;
+    int num_classes;
+    isotp_buf_pool_stats_t stats;
+};
+
+/**
+ * @brief the size class of a length
+ *
+ * Class 0 holds up to BUF_MIN_CLASS_SZ bytes; above that, each doubling of
+ * the size is split in BUF_CLASS_STEPS classes (80, 96, 112, 128, 160...).
+ */
+static int class_of(const int len) {
+    if (len <= BUF_MIN_CLASS_SZ) {
+        return 0;
+    }
+
+    unsigned int v = (unsigned int)(len - 1);
+    int msb = (int)(sizeof(v) * 8) - 1 - __builtin_clz(v);
+    int step = (int)(v >> (msb - BUF_CLASS_STEP_SHIFT)) & (BUF_CLASS_STEPS - 1);
+    return ((msb - BUF_MIN_CLASS_SHIFT) * BUF_CLASS_STEPS) + step + 1;
+}
+
+static int class_size(const int class_idx) {
+    if (class_idx == 0) {
+        return BUF_MIN_CLASS_SZ;
+    }
+
+    int steps = class_idx - 1;
+    int shift = (steps / BUF_CLASS_STEPS) +
+                (BUF_MIN_CLASS_SHIFT - BUF_CLASS_STEP_SHIFT);
+    int64_t size = (int64_t)(BUF_CLASS_STEPS + (steps % BUF_CLASS_STEPS) + 1)
+                   << shift;
+    return (size > INT32_MAX) ? INT32_MAX : (int)size;
+}
+
+static struct buf_hdr_s* hdr_of(uint8_t* buf) {
+    return ((struct buf_hdr_s*)buf) - 1;
+}
+
+// free cached buffers, largest first, until need more bytes fit the budget
+static void pool_trim(struct isotp_buf_pool_s* pool, const size_t need) {
+    for (int c=pool->num_classes - 1; c >= 0; c--) {
+        struct buf_class_s* cls = &(pool->classes[c]);
+        while ((cls->free_list != NULL) &&
+               ((pool->stats.bytes_allocated + need) > pool->max_bytes)) {
+            struct buf_hdr_s* hdr = cls->free_list;
+            cls->free_list = hdr->next;
+            pool->stats.bytes_allocated -= (size_t)cls->size;
+            free(hdr);
+        }
+    }
+}
+
+int isotp_buf_pool_init(isotp_buf_pool_t* pool,
+                        const int max_message_len,
+                        const size_t max_bytes) {
+    if ((pool == NULL) ||
+        (max_message_len <= 0) ||
+        (max_message_len > MAX_TX_DATALEN)) {
+        return -EINVAL;
+    }
+
+    struct isotp_buf_pool_s* p = calloc(1, sizeof(*p));
+    if (p == NULL) {
+        return -ENOMEM;
+    }
+    p->num_classes = class_of(max_message_len) + 1;
+    p->classes = calloc(p->num_classes, sizeof(*(p->classes)));
+    if (p->classes == NULL) {
+        free(p);
+        return -ENOMEM;
+    }
+    for (int c=0; c < p->num_classes; c++) {
+        p->classes[c].size = class_size(c);
+    }
+    p->max_message_len = max_message_len;
+    p->max_bytes = max_bytes;
+
+    *pool = p;
+    return EOK;
+}
+
+void isotp_buf_pool_free(isotp_buf_pool_t pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    for (int c=0; c < pool->num_classes; c++) {
+        struct buf_hdr_s* hdr = pool->classes[c].free_list;
+        while (hdr != NULL) {
+            struct buf_hdr_s* next = hdr->next;
+            free(hdr);
+            hdr = next;
+        }
+    }
+    free(pool->classes);
+    free(pool);
+}
+
+int isotp_buf_pool_get(isotp_buf_pool_t pool,
+                       const int len,
+                       uint8_t** buf) {
+    if ((pool == NULL) || (len <= 0) || (buf == NULL)) {
+        return -EINVAL;
+    }
+
+    if (len > pool->max_message_len) {
+        return -EMSGSIZE;
+    }
+
+    int c = class_of(len);
+    struct buf_class_s* cls = &(pool->classes[c]);
+    struct buf_hdr_s* hdr = cls->free_list;
+    if (hdr != NULL) {
+        cls->free_list = hdr->next;
+    } else {
+        if (pool->max_bytes > 0) {
+            pool_trim(pool, (size_t)cls->size);
+            if ((pool->stats.bytes_allocated + (size_t)cls->size) >
+                pool->max_bytes) {
+                pool->stats.exhausted++;
+                return -ENOBUFS;
+            }
+        }
+        hdr = malloc(sizeof(*hdr) + (size_t)cls->size);
+        if (hdr == NULL) {
+            return -ENOMEM;
+        }
+        hdr->pool = pool;
+        hdr->class_idx = c;
+        pool->stats.bytes_allocated += (size_t)cls->size;
+        pool->stats.allocated++;
+    }
+    hdr->next = NULL;
+    hdr->len = len;
+    hdr->in_use = true;
+
+    pool->stats.bytes_in_use += (size_t)cls->size;
+    pool->stats.bytes_requested += (size_t)len;
+    pool->stats.buffers_in_use++;
+    pool->stats.acquired++;
+
+    *buf = (uint8_t*)(hdr + 1);
+    return EOK;
+}
+
+int isotp_buf_pool_put(isotp_buf_pool_t pool, uint8_t* buf) {
+    if ((pool == NULL) || (buf == NULL)) {
+        return -EINVAL;
+    }
+
+    struct buf_hdr_s* hdr = hdr_of(buf);
+    if ((hdr->pool != pool) || !hdr->in_use) {
+        return -EINVAL;
+    }
+
+    struct buf_class_s* cls = &(pool->classes[hdr->class_idx]);
+    hdr->in_use = false;
+    hdr->next = cls->free_list;
+    cls->free_list = hdr;
+
+    pool->stats.bytes_in_use -= (size_t)cls->size;
+    pool->stats.bytes_requested -= (size_t)hdr->len;
+    pool->stats.buffers_in_use--;
+    return EOK;
+}
+
+int isotp_buf_pool_stats(const isotp_buf_pool_t pool,
+                         isotp_buf_pool_stats_t* stats) {
+    if ((pool == NULL) || (stats == NULL)) {
+        return -EINVAL;
+    }
+
+    *stats = pool->stats;
+    return EOK;
+}
+
+void rx_pool_drop(isotp_ctx_t ctx) {
+    if (ctx->rx_pool_buf != NULL) {
+        (void)isotp_buf_pool_put(ctx->rx_buf_pool, ctx->rx_pool_buf);
+        ctx->rx_pool_buf = NULL;
+        ctx->nb_recv_buf_p = NULL;
+    }
+}
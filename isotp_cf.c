@@ -40,7 +40,24 @@
 int parse_cf(isotp_ctx_t ctx,
              uint8_t* recv_buf_p,
              const int recv_buf_sz) {
+    if (ctx == NULL) {
+        return -EINVAL;
+    }
+
+    return parse_cf_frame(ctx,
+                          ctx->can_frame,
+                          ctx->can_frame_len,
+                          recv_buf_p,
+                          recv_buf_sz);
+}
+
+int parse_cf_frame(isotp_ctx_t ctx,
+                   const uint8_t* frame_p,
+                   const int frame_len,
+                   uint8_t* recv_buf_p,
+                   const int recv_buf_sz) {
     if ((ctx == NULL) ||
+        (frame_p == NULL) ||
         (recv_buf_p == NULL)) {
         return -EINVAL;
     }
@@ -54,18 +71,23 @@ int parse_cf(isotp_ctx_t ctx,
         return -ENOBUFS;
     }
 
-    int ae_l = address_extension_len(ctx->addressing_mode);
+    int ae_l = address_extension_len(ctx_addressing_mode(ctx));
     if (ae_l < 0) {
         return ae_l;
     }
 
+    // too short to hold the PCI
+    if (frame_len < (ae_l + 1)) {
+        return -EBADMSG;
+    }
+
     // check for the CF PCI
-    if ((ctx->can_frame[ae_l] & PCI_MASK) != CF_PCI) {
+    if ((frame_p[ae_l] & PCI_MASK) != CF_PCI) {
         return -EBADMSG;
     }
 
     // validate the sequence number; it should be the next one
-    int sn = ctx->can_frame[ae_l] & 0x0fU;
+    int sn = frame_p[ae_l] & 0x0fU;
     if (sn != ctx->sequence_num) {
         // we're out of sequence; abort the transmission
 
@@ -84,16 +106,19 @@ int parse_cf(isotp_ctx_t ctx,
 
     // capture the address extension
     if (ae_l > 0) {
-        ctx->address_extension = ctx->can_frame[0];
+        ctx->address_extension = frame_p[0];
     }
 
     // copy the incoming data into the receive buffer
-    uint8_t* sp = &(ctx->can_frame[ae_l + 1]);  // starting after the PCI
-    uint8_t* dp = &(recv_buf_p[ctx->total_datalen - ctx->remaining_datalen]);
-    int copy_len = MIN(ctx->can_frame_len - (ae_l + 1),
+    const uint8_t* sp = &(frame_p[ae_l + 1]);  // starting after the PCI
+    int copy_len = MIN(frame_len - (ae_l + 1),
                        ctx->remaining_datalen);
     assert(copy_len >= 0);
-    memcpy(dp, sp, copy_len);
+    rx_copy(ctx,
+            recv_buf_p,
+            ctx->total_datalen - ctx->remaining_datalen,
+            sp,
+            copy_len);
 
     ctx->remaining_datalen -= copy_len;
     assert((ctx->remaining_datalen >= 0) &&
@@ -118,7 +143,7 @@ int prepare_cf(isotp_ctx_t ctx,
         return -EMSGSIZE;
     }
 
-    int ae_l = address_extension_len(ctx->addressing_mode);
+    int ae_l = address_extension_len(ctx_addressing_mode(ctx));
     if (ae_l < 0) {
         return ae_l;
     }
@@ -152,14 +177,14 @@ int prepare_cf(isotp_ctx_t ctx,
     assert((ctx->sequence_num >= 0) && (ctx->sequence_num <= 0x0000000f));
 
     // copy the data
-    int copy_len = MIN(can_max_datalen(ctx->can_format) - ctx->can_frame_len,
-                       ctx->remaining_datalen);
+    int max_len = can_max_datalen(ctx_can_format(ctx));
+    int copy_len = MIN(max_len - ctx->can_frame_len, ctx->remaining_datalen);
     memcpy(dp, sp, copy_len);
     ctx->can_frame_len += copy_len;
 
     int pad_rc = pad_can_frame_len(ctx->can_frame,
                                    ctx->can_frame_len,
-                                   ctx->can_format);
+                                   ctx_can_format(ctx));
     if (pad_rc < 0) {
         return pad_rc;
     }
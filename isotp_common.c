@@ -25,6 +25,38 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <isotp.h>
 #include <isotp_private.h>
+
+#define USEC_PER_SEC  (1000000)
+#define NSEC_PER_USEC (1000)
+
+uint64_t get_time(void) {
+    struct timespec ts = {0};
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * USEC_PER_SEC) +
+           ((uint64_t)ts.tv_nsec / NSEC_PER_USEC);
+}
+
+int iov_total_len(const isotp_iovec_t* iov, const int iovcnt) {
+    if ((iov == NULL) || (iovcnt <= 0)) {
+        return -EINVAL;
+    }
+
+    int64_t total = 0;
+    for (int i=0; i < iovcnt; i++) {
+        if ((iov[i].base == NULL) || (iov[i].len < 0)) {
+            return -EINVAL;
+        }
+
+        total += iov[i].len;
+        if (total > MAX_TX_DATALEN) {
+            return -ERANGE;
+        }
+    }
+
+    return (int)total;
+}
@@ -0,0 +1,65 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/**
+ * Compile-time configuration.
+ *
+ * Each setting may be defined on the compiler's command line, or before
+ * including isotp.h (or the single-header build, see amalgamation/).  The
+ * defaults build the general library.
+ *
+ * ISOTP_FIXED_CAN_FORMAT - CAN_FORMAT or CANFD_FORMAT.  When defined,
+ * isotp_ctx_init() accepts that format only, and the per-frame code uses
+ * the constant instead of the context's format, so that the frame length
+ * and DLC calculations fold at compile time.
+ *
+ * ISOTP_FIXED_ADDRESSING_MODE - one of the isotp_addressing_mode_t modes,
+ * likewise.  It fixes the address extension length, the offset of the PCI
+ * in every frame.
+ *
+ * ISOTP_MAX_TX_DATALEN - the longest message that may be sent or received.
+ * Longer buffers, and FFs announcing longer messages, are rejected.
+ *
+ * ISOTP_NO_FF_ESCAPE - leave out the FF_DL escape sequence, which only
+ * messages over 4095 bytes use; ISOTP_MAX_TX_DATALEN must be 4095 or less.
+ * Incoming FFs with the escape are answered with FC.OVFLW.
+ *
+ * ISOTP_STATIC_CONTEXTS - the number of contexts.  When defined,
+ * isotp_ctx_init() takes contexts from a static array of that many
+ * instead of the heap, failing with -ENOMEM when all are in use, and
+ * isotp_ctx_free() gives them back.  The array is not locked, so create
+ * and free contexts from one thread.  The rest of the core (frames, the
+ * blocking and non-blocking transfers) never allocates; the decoder,
+ * monitor, scheduler, router, functional and profile modules still do.
+ *
+ * With ISOTP_FIXED_CAN_FORMAT set to CAN_FORMAT, a context holds one
+ * 8 byte frame instead of 64.
+ */
+
+#ifndef ISOTP_MAX_TX_DATALEN
+#define ISOTP_MAX_TX_DATALEN (INT32_MAX - 1)  // @ref ISO-15765-2:2016, 9.1
+#endif  // ISOTP_MAX_TX_DATALEN
@@ -0,0 +1,329 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <span>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <isotp.h>
+
+/**
+ * C++20 coroutine front-end for ISOTP
+ *
+ * Header-only layer over the non-blocking transfers (isotp_send_start(),
+ * isotp_recv_start() and isotp_poll()).  Each session wraps one ISOTP
+ * context; a coroutine awaits a transfer on it and is resumed by the loop
+ * the session belongs to when the transfer completes.
+ *
+ *     isotp::loop l;
+ *     isotp::session s(l, isotp::context(CAN_FORMAT, ...));
+ *
+ *     isotp::task tester(isotp::session& s) {
+ *         int rc = co_await s.send(request);
+ *         rc = co_await s.recv(response);
+ *     }
+ *
+ *     tester(s);
+ *     l.run();
+ *
+ * A loop is not thread-safe; run one loop per thread.  Results use the same
+ * convention as the C API: >=0 is a byte count, <0 is a negated errno.
+ */
+
+namespace isotp {
+
+/**
+ * @brief owner of an isotp_ctx_t
+ *
+ * The context is allocated by isotp_ctx_init() and released with
+ * isotp_ctx_free() when the owner goes out of scope.
+ */
+class context {
+ public:
+    context(const can_format_t can_format,
+            const isotp_addressing_mode_t addressing_mode,
+            const uint8_t max_fc_wait_frames,
+            void* can_ctx,
+            isotp_rx_f can_rx_f,
+            isotp_tx_f can_tx_f) {
+        int rc = isotp_ctx_init(&ctx_,
+                                can_format,
+                                addressing_mode,
+                                max_fc_wait_frames,
+                                can_ctx,
+                                can_rx_f,
+                                can_tx_f);
+        if (rc < 0) {
+            throw std::system_error(-rc, std::generic_category(),
+                                    "isotp_ctx_init");
+        }
+    }
+
+    ~context() {
+        isotp_ctx_free(ctx_);
+    }
+
+    context(const context&) = delete;
+    context& operator=(const context&) = delete;
+
+    context(context&& other) noexcept
+        : ctx_(std::exchange(other.ctx_, nullptr)) {}
+
+    context& operator=(context&& other) noexcept {
+        if (this != &other) {
+            isotp_ctx_free(ctx_);
+            ctx_ = std::exchange(other.ctx_, nullptr);
+        }
+        return *this;
+    }
+
+    isotp_ctx_t get() const noexcept {
+        return ctx_;
+    }
+
+ private:
+    isotp_ctx_t ctx_ = nullptr;
+};
+
+/**
+ * @brief fire-and-forget coroutine
+ *
+ * Starts running immediately and frees itself when it returns.
+ */
+struct task {
+    struct promise_type {
+        task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+class session;
+
+/**
+ * @brief drives the transfers of all the sessions created on it
+ */
+class loop {
+ public:
+    loop() = default;
+    loop(const loop&) = delete;
+    loop& operator=(const loop&) = delete;
+
+    /**
+     * @brief poll every transfer in progress once, resuming the completed ones
+     *
+     * @returns number of transfers that completed
+     */
+    std::size_t poll_once();
+
+    /**
+     * @brief poll until no transfer is in progress
+     *
+     * @param idle - how long to sleep when a pass completed nothing;
+     *               zero yields the thread instead
+     */
+    void run(const std::chrono::microseconds idle = std::chrono::microseconds{0}) {
+        while (!active_.empty()) {
+            if (poll_once() == 0) {
+                if (idle.count() > 0) {
+                    std::this_thread::sleep_for(idle);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    /**
+     * @returns number of transfers in progress
+     */
+    std::size_t pending() const noexcept {
+        return active_.size();
+    }
+
+    static uint64_t now_us() noexcept {
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+ private:
+    friend class session;
+
+    void activate(session* s) {
+        active_.push_back(s);
+    }
+
+    void deactivate(session* s) noexcept {
+        for (std::size_t i = 0; i < active_.size(); i++) {
+            if (active_[i] == s) {
+                active_[i] = active_.back();
+                active_.pop_back();
+                return;
+            }
+        }
+    }
+
+    std::vector<session*> active_;
+};
+
+/**
+ * @brief an ISOTP context whose transfers can be awaited
+ *
+ * Destroying a session abandons its transfer: the coroutine awaiting it is
+ * resumed, from the destructor, with -ECANCELED, and any transfer it goes
+ * on to await on the session fails the same way without suspending.
+ */
+class session {
+ public:
+    session(loop& l, context&& ctx) : loop_(l), ctx_(std::move(ctx)) {}
+
+    ~session() {
+        loop_.deactivate(this);
+        closed_ = true;
+        if (waiter_) {
+            result_ = -ECANCELED;
+            std::exchange(waiter_, nullptr).resume();
+        }
+    }
+
+    session(const session&) = delete;
+    session& operator=(const session&) = delete;
+
+    /**
+     * @brief awaitable for a single transfer
+     *
+     * The transfer is started when the awaitable is created, by send() or
+     * recv(), not when it is awaited; an awaitable that is never awaited
+     * leaves its transfer started but never polled.  If starting fails,
+     * co_await does not suspend and returns the error.
+     */
+    class [[nodiscard]] transfer {
+     public:
+        transfer(session& s, const int start_rc) : s_(s), start_rc_(start_rc) {}
+
+        bool await_ready() const noexcept {
+            return (start_rc_ < 0);
+        }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            s_.waiter_ = h;
+            s_.loop_.activate(&s_);
+        }
+
+        int await_resume() const noexcept {
+            return (start_rc_ < 0) ? start_rc_ : s_.result_;
+        }
+
+     private:
+        session& s_;
+        int start_rc_;
+    };
+
+    /**
+     * @brief transmit a message, see isotp_send_start()
+     *
+     * The first frame is sent before this returns.
+     */
+    [[nodiscard]] transfer send(std::span<const uint8_t> data,
+                                const std::chrono::microseconds timeout = std::chrono::seconds{1}) {
+        if (closed_) {
+            return transfer(*this, -ECANCELED);
+        }
+        return transfer(*this, isotp_send_start(ctx_.get(),
+                                                data.data(),
+                                                static_cast<int>(data.size()),
+                                                static_cast<uint64_t>(timeout.count())));
+    }
+
+    /**
+     * @brief receive a message, see isotp_recv_start()
+     */
+    [[nodiscard]] transfer recv(std::span<uint8_t> buf,
+                                const uint8_t blocksize = 0,
+                                const std::chrono::microseconds stmin = std::chrono::microseconds{0},
+                                const std::chrono::microseconds timeout = std::chrono::seconds{1}) {
+        if (closed_) {
+            return transfer(*this, -ECANCELED);
+        }
+        return transfer(*this, isotp_recv_start(ctx_.get(),
+                                                buf.data(),
+                                                static_cast<int>(buf.size()),
+                                                blocksize,
+                                                static_cast<int>(stmin.count()),
+                                                static_cast<uint64_t>(timeout.count())));
+    }
+
+    isotp_ctx_t get() const noexcept {
+        return ctx_.get();
+    }
+
+ private:
+    friend class loop;
+
+    loop& loop_;
+    context ctx_;
+    std::coroutine_handle<> waiter_;
+    int result_ = 0;
+    bool closed_ = false;
+};
+
+inline std::size_t loop::poll_once() {
+    const uint64_t now = now_us();
+    std::size_t completed = 0;
+
+    for (std::size_t i = 0; i < active_.size();) {
+        session* s = active_[i];
+        int rc = isotp_poll(s->ctx_.get(), now);
+        if (rc == -EINPROGRESS) {
+            i++;
+            continue;
+        }
+
+        active_[i] = active_.back();
+        active_.pop_back();
+        completed++;
+
+        // resuming may start another transfer, which appends to active_
+        s->result_ = rc;
+        std::exchange(s->waiter_, nullptr).resume();
+    }
+
+    return completed;
+}
+
+}  // namespace isotp
@@ -0,0 +1,490 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <can/can.h>
+#include <isotp.h>
+#include <isotp_private.h>
+
+#define DECODER_INITIAL_STREAMS (64)
+
+// a stream is keyed by its CAN ID, with 29 bit IDs kept apart from 11 bit
+#define STREAM_KEY_EXT (0x80000000U)
+
+// a CF can carry as little as 6 bytes (with an address extension)
+#define MIN_CF_PAYLOAD (6)
+
+#define MAX_FRAME_LEN (64)
+
+/**
+ * @brief a CF seen before any SF/FF on its stream
+ *
+ * It may continue a message started before the part of the log the
+ * decoder was given; kept for isotp_decoder_join().
+ */
+struct orphan_s {
+    uint64_t ts_us;
+    can_format_t can_format;
+    int len;
+    uint8_t data[MAX_FRAME_LEN];
+};
+
+/**
+ * @brief reassembly state of the frames sent with one CAN ID
+ *
+ * The context is only used to parse frames; it never transmits.  It holds
+ * the FF_DL and the expected SN of the message in progress.
+ */
+struct stream_s {
+    uint32_t key;
+    bool used;
+    isotp_ctx_t ctx;
+    uint8_t* buf;
+    bool started;      // an SF/FF has been seen
+    bool in_progress;
+    isotp_message_t msg;
+
+    struct orphan_s* orphans;
+    int orphan_count;
+};
+
+struct isotp_decoder_s {
+    isotp_addressing_mode_t addressing_mode;
+    int max_message_len;
+    int max_orphans;  // most CFs a message can have
+    isotp_message_f message_f;
+    void* cb_ctx;
+
+    struct stream_s* streams;  // open addressing hash table
+    int capacity;              // power of two
+    int count;
+};
+
+static int decoder_tx_f(void* txfn_ctx,
+                        const uint8_t* tx_buf_p,
+                        const int tx_len,
+                        const uint64_t timeout_usec) {
+    (void)txfn_ctx;
+    (void)tx_buf_p;
+    (void)tx_len;
+    (void)timeout_usec;
+    return -EPERM;
+}
+
+static inline uint32_t stream_key(const uint32_t can_id,
+                                  const bool extended_id) {
+    return extended_id ? (can_id | STREAM_KEY_EXT) : can_id;
+}
+
+static inline uint32_t stream_hash(const uint32_t key) {
+    // Fibonacci hashing; CAN IDs in use tend to be clustered
+    return key * 2654435761U;
+}
+
+static struct stream_s* stream_slot(struct stream_s* streams,
+                                    const int capacity,
+                                    const uint32_t key) {
+    uint32_t mask = (uint32_t)capacity - 1;
+    uint32_t i = stream_hash(key) & mask;
+    while (streams[i].used && (streams[i].key != key)) {
+        i = (i + 1) & mask;
+    }
+    return &(streams[i]);
+}
+
+static int grow_streams(struct isotp_decoder_s* d) {
+    int capacity = d->capacity * 2;
+    struct stream_s* streams = calloc(capacity, sizeof(*streams));
+    if (streams == NULL) {
+        return -ENOMEM;
+    }
+
+    for (int i=0; i < d->capacity; i++) {
+        if (d->streams[i].used) {
+            *stream_slot(streams, capacity, d->streams[i].key) =
+                d->streams[i];
+        }
+    }
+
+    free(d->streams);
+    d->streams = streams;
+    d->capacity = capacity;
+
+    return EOK;
+}
+
+static struct stream_s* find_stream(struct isotp_decoder_s* d,
+                                    const uint32_t can_id,
+                                    const bool extended_id) {
+    uint32_t key = stream_key(can_id, extended_id);
+    struct stream_s* s = stream_slot(d->streams, d->capacity, key);
+    if (s->used) {
+        return s;
+    }
+
+    // keep the table at most half full
+    if ((2 * (d->count + 1)) > d->capacity) {
+        if (grow_streams(d) < 0) {
+            return NULL;
+        }
+        s = stream_slot(d->streams, d->capacity, key);
+    }
+
+    int rc = isotp_ctx_init(&(s->ctx),
+                            DEFAULT_CAN_FORMAT,
+                            d->addressing_mode,
+                            0,
+                            NULL,
+                            NULL,
+                            decoder_tx_f);
+    if (rc < 0) {
+        return NULL;
+    }
+
+    s->buf = malloc(d->max_message_len);
+    if (s->buf == NULL) {
+        isotp_ctx_free(s->ctx);
+        s->ctx = NULL;
+        return NULL;
+    }
+
+    s->used = true;
+    s->key = key;
+    s->msg.can_id = can_id;
+    s->msg.extended_id = extended_id;
+    d->count++;
+
+    return s;
+}
+
+int isotp_decoder_init(isotp_decoder_t* decoder,
+                       const isotp_addressing_mode_t isotp_addressing_mode,
+                       const int max_message_len,
+                       isotp_message_f message_f,
+                       void* cb_ctx) {
+    if ((decoder == NULL) || (message_f == NULL)) {
+        return -EINVAL;
+    }
+
+    if ((max_message_len <= 0) || (max_message_len > MAX_TX_DATALEN)) {
+        return -ERANGE;
+    }
+
+    if ((address_extension_len(isotp_addressing_mode) < 0) ||
+        !addressing_mode_supported(isotp_addressing_mode)) {
+        return -EFAULT;
+    }
+
+    *decoder = calloc(1, sizeof(**decoder));
+    if (*decoder == NULL) {
+        return -ENOMEM;
+    }
+
+    struct isotp_decoder_s* d = *decoder;
+    d->streams = calloc(DECODER_INITIAL_STREAMS, sizeof(*(d->streams)));
+    if (d->streams == NULL) {
+        free(d);
+        *decoder = NULL;
+        return -ENOMEM;
+    }
+
+    d->capacity = DECODER_INITIAL_STREAMS;
+    d->addressing_mode = isotp_addressing_mode;
+    d->max_message_len = max_message_len;
+    d->max_orphans = (max_message_len / MIN_CF_PAYLOAD) + 1;
+    d->message_f = message_f;
+    d->cb_ctx = cb_ctx;
+
+    return EOK;
+}
+
+void isotp_decoder_free(isotp_decoder_t decoder) {
+    if (decoder == NULL) {
+        return;
+    }
+
+    for (int i=0; i < decoder->capacity; i++) {
+        if (decoder->streams[i].used) {
+            isotp_ctx_free(decoder->streams[i].ctx);
+            free(decoder->streams[i].buf);
+            free(decoder->streams[i].orphans);
+        }
+    }
+    free(decoder->streams);
+    free(decoder);
+}
+
+// report the stream's message, complete (len >= 0) or not (len < 0)
+static void emit(struct isotp_decoder_s* d,
+                 struct stream_s* s,
+                 const int len) {
+    s->in_progress = false;
+    s->msg.len = len;
+    s->msg.data = (len >= 0) ? s->buf : NULL;
+    s->msg.address_extension = s->ctx->address_extension;
+    (*(d->message_f))(d->cb_ctx, &(s->msg));
+}
+
+static void start_message(struct stream_s* s, const uint64_t ts_us) {
+    s->msg.start_us = ts_us;
+    s->msg.end_us = ts_us;
+    s->msg.frames = 1;
+}
+
+static int keep_orphan(struct isotp_decoder_s* d,
+                       struct stream_s* s,
+                       const uint64_t ts_us,
+                       const can_format_t can_format,
+                       const uint8_t* frame_p,
+                       const int frame_len) {
+    if (s->orphan_count == d->max_orphans) {
+        // more than any message could continue with; drop it
+        return EOK;
+    }
+
+    if (s->orphans == NULL) {
+        s->orphans = malloc(d->max_orphans * sizeof(*(s->orphans)));
+        if (s->orphans == NULL) {
+            return -ENOMEM;
+        }
+    }
+
+    struct orphan_s* o = &(s->orphans[s->orphan_count++]);
+    o->ts_us = ts_us;
+    o->can_format = can_format;
+    o->len = frame_len;
+    memcpy(o->data, frame_p, frame_len);
+
+    return EOK;
+}
+
+static int stream_frame(struct isotp_decoder_s* d,
+                        struct stream_s* s,
+                        const uint64_t ts_us,
+                        const can_format_t can_format,
+                        const uint8_t* frame_p,
+                        const int frame_len) {
+    int ae_l = s->ctx->address_extension_len;
+    if (frame_len <= ae_l) {
+        // too short to hold a PCI; not ISOTP
+        return EOK;
+    }
+
+    // parse each frame with the format it was sent in
+    s->ctx->can_format = can_format;
+    s->ctx->can_max_datalen = can_max_datalen(can_format);
+
+    int rc = 0;
+    switch (frame_p[ae_l] & PCI_MASK) {
+        case SF_PCI:
+            s->started = true;
+            if (s->in_progress) {
+                emit(d, s, -ECONNABORTED);
+            }
+            start_message(s, ts_us);
+            rc = parse_sf_frame(s->ctx,
+                                frame_p,
+                                frame_len,
+                                s->buf,
+                                d->max_message_len);
+            if ((rc >= 0) || (rc == -ENOBUFS) || (rc == -EBADMSG)) {
+                // -EBADMSG: shorter than its PCI/SF_DL, report it malformed
+                emit(d, s, rc);
+            }
+            break;
+
+        case FF_PCI:
+            s->started = true;
+            if (s->in_progress) {
+                emit(d, s, -ECONNABORTED);
+            }
+            start_message(s, ts_us);
+            rc = parse_ff_frame(s->ctx,
+                                frame_p,
+                                frame_len,
+                                s->buf,
+                                d->max_message_len);
+            if (rc >= 0) {
+                s->in_progress = true;
+            } else if ((rc == -EOVERFLOW) || (rc == -EBADMSG)) {
+                emit(d, s, rc);
+            }
+            break;
+
+        case CF_PCI:
+            // a CF without an FF (e.g. at the start of a log) is ignored,
+            // unless a join may find the rest of its message
+            if (!s->in_progress) {
+                if (!s->started) {
+                    return keep_orphan(d,
+                                       s,
+                                       ts_us,
+                                       can_format,
+                                       frame_p,
+                                       frame_len);
+                }
+                break;
+            }
+            s->msg.end_us = ts_us;
+            s->msg.frames++;
+            rc = parse_cf_frame(s->ctx,
+                                frame_p,
+                                frame_len,
+                                s->buf,
+                                d->max_message_len);
+            if (rc < 0) {
+                emit(d, s, rc);
+            } else if (s->ctx->remaining_datalen == 0) {
+                emit(d, s, s->ctx->total_datalen);
+            }
+            break;
+
+        case FC_PCI:
+        default:
+            // FCs steer the sender on the other CAN ID; they carry no data
+            break;
+    }
+
+    return EOK;
+}
+
+int isotp_decoder_frame(isotp_decoder_t decoder,
+                        const uint64_t ts_us,
+                        const uint32_t can_id,
+                        const bool extended_id,
+                        const can_format_t can_format,
+                        const uint8_t* frame_p,
+                        const int frame_len) {
+    if ((decoder == NULL) || (frame_p == NULL)) {
+        return -EINVAL;
+    }
+
+    int max_len = can_max_datalen(can_format);
+    if (max_len < 0) {
+        return max_len;
+    }
+    if (!can_format_supported(can_format)) {
+        return -ENOTSUP;
+    }
+    if ((frame_len < 0) || (frame_len > max_len)) {
+        return -EMSGSIZE;
+    }
+
+    struct stream_s* s = find_stream(decoder, can_id, extended_id);
+    if (s == NULL) {
+        return -ENOMEM;
+    }
+
+    return stream_frame(decoder, s, ts_us, can_format, frame_p, frame_len);
+}
+
+int isotp_decoder_join(isotp_decoder_t decoder, isotp_decoder_t next) {
+    if ((decoder == NULL) || (next == NULL) || (decoder == next)) {
+        return -EINVAL;
+    }
+
+    if ((decoder->addressing_mode != next->addressing_mode) ||
+        (decoder->max_message_len != next->max_message_len)) {
+        return -EINVAL;
+    }
+
+    for (int i=0; i < next->capacity; i++) {
+        struct stream_s* ns = &(next->streams[i]);
+        if (!ns->used) {
+            continue;
+        }
+
+        struct stream_s* s = find_stream(decoder,
+                                         ns->msg.can_id,
+                                         ns->msg.extended_id);
+        if (s == NULL) {
+            return -ENOMEM;
+        }
+
+        // the CFs next saw first continue what is in progress here (or,
+        // if nothing on this stream has started yet, stay orphans)
+        for (int j=0; j < ns->orphan_count; j++) {
+            struct orphan_s* o = &(ns->orphans[j]);
+            int rc = stream_frame(decoder,
+                                  s,
+                                  o->ts_us,
+                                  o->can_format,
+                                  o->data,
+                                  o->len);
+            if (rc < 0) {
+                return rc;
+            }
+        }
+        ns->orphan_count = 0;
+
+        if (!ns->started) {
+            continue;
+        }
+
+        // next started a message, which cut short anything still here
+        if (s->in_progress) {
+            emit(decoder, s, -ECONNABORTED);
+        }
+        s->started = true;
+
+        // carry on with the message next has in progress, by taking over
+        // its parsing state (FF_DL, SN) and partial payload
+        if (ns->in_progress) {
+            isotp_ctx_t ctx = s->ctx;
+            uint8_t* buf = s->buf;
+            s->ctx = ns->ctx;
+            s->buf = ns->buf;
+            s->msg = ns->msg;
+            s->in_progress = true;
+            ns->ctx = ctx;
+            ns->buf = buf;
+            ns->in_progress = false;
+        }
+    }
+
+    return EOK;
+}
+
+int isotp_decoder_flush(isotp_decoder_t decoder) {
+    if (decoder == NULL) {
+        return -EINVAL;
+    }
+
+    int flushed = 0;
+    for (int i=0; i < decoder->capacity; i++) {
+        struct stream_s* s = &(decoder->streams[i]);
+        if (s->used && s->in_progress) {
+            emit(decoder, s, -ENODATA);
+            flushed++;
+        }
+    }
+
+    return flushed;
+}
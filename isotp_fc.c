@@ -54,31 +54,50 @@ int parse_fc(isotp_ctx_t ctx,
              isotp_fc_flowstatus_t* flowstatus,
              uint8_t* blocksize,
              int* stmin_usec) {
+    if (ctx == NULL) {
+        return -EINVAL;
+    }
+
+    return parse_fc_frame(ctx,
+                          ctx->can_frame,
+                          ctx->can_frame_len,
+                          flowstatus,
+                          blocksize,
+                          stmin_usec);
+}
+
+int parse_fc_frame(isotp_ctx_t ctx,
+                   const uint8_t* frame_p,
+                   const int frame_len,
+                   isotp_fc_flowstatus_t* flowstatus,
+                   uint8_t* blocksize,
+                   int* stmin_usec) {
     if ((ctx == NULL) ||
+        (frame_p == NULL) ||
         (flowstatus == NULL) ||
         (blocksize == NULL) ||
         (stmin_usec == NULL)) {
         return -EINVAL;
     }
 
-    int ae_l = address_extension_len(ctx->addressing_mode);
+    int ae_l = address_extension_len(ctx_addressing_mode(ctx));
     if (ae_l < 0) {
         return ae_l;
     }
 
-    if (ctx->can_frame_len < (3 + ae_l)) {
+    if (frame_len < (3 + ae_l)) {
         // CAN frame is shorter than
         return -EMSGSIZE;
     }
 
     // check the PCI
-    if ((ctx->can_frame[ae_l] & PCI_MASK) != FC_PCI) {
+    if ((frame_p[ae_l] & PCI_MASK) != FC_PCI) {
         // not an FC
         return -ENOMSG;
     }
 
     // get the FS
-    switch (ctx->can_frame[ae_l] & FC_FS_MASK) {
+    switch (frame_p[ae_l] & FC_FS_MASK) {
     case 0x00:
         *flowstatus = ISOTP_FC_FLOWSTATUS_CTS;
         break;
@@ -98,11 +117,11 @@ int parse_fc(isotp_ctx_t ctx,
     }
 
     // get the BS
-    *blocksize = ctx->can_frame[ae_l + 1];
+    *blocksize = frame_p[ae_l + 1];
 
     // get the STmin code and convert to usec
     // @ref ISO-15765-2:2016, section 9.6.5.5
-    *stmin_usec = fc_stmin_parameter_to_usec(ctx->can_frame[ae_l + 2]);
+    *stmin_usec = fc_stmin_parameter_to_usec(frame_p[ae_l + 2]);
 
     return EOK;
 }
@@ -115,7 +134,7 @@ int prepare_fc(isotp_ctx_t ctx,
         return -EINVAL;
     }
 
-    int ae_l = address_extension_len(ctx->addressing_mode);
+    int ae_l = address_extension_len(ctx_addressing_mode(ctx));
     if (ae_l < 0) {
         return ae_l;
     }
@@ -171,7 +190,7 @@ int prepare_fc(isotp_ctx_t ctx,
 
     int pad_rc = pad_can_frame_len(ctx->can_frame,
                                    ctx->can_frame_len,
-                                   ctx->can_format);
+                                   ctx_can_format(ctx));
     if (pad_rc < 0) {
         return pad_rc;
     } else {
@@ -199,7 +218,7 @@ uint8_t fc_stmin_usec_to_parameter(const int stmin_usec) {
 
     // make sure the parameter isn't a reserved value
     // 0x80-0xf0, 0xfa-0xff reserved
-    assert(((stmin_param >= 0x00) && (stmin_param <= MAX_STMIN)) ||
+    assert((stmin_param <= MAX_STMIN) ||
            ((stmin_param >= 0xf1) && (stmin_param <= 0xf9)));
 
     return stmin_param;
@@ -0,0 +1,179 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <isotp.h>
+#include <isotp_private.h>
+
+// smallest non-zero STmin that can be encoded
+// @ref ISO-15765-2:2016, section 9.6.5.4, table 20
+#define MIN_NONZERO_STMIN_USEC (100)
+
+int isotp_set_fc_policy(isotp_ctx_t ctx,
+                        isotp_fc_policy_f policy,
+                        void* policy_ctx) {
+    if (ctx == NULL) {
+        return -EINVAL;
+    }
+
+    ctx->fc_policy = policy;
+    ctx->fc_policy_ctx = policy_ctx;
+
+    return EOK;
+}
+
+void fc_policy_cf_received(isotp_ctx_t ctx, const uint64_t now_us) {
+    if (ctx->fc_block_cfs > 0) {
+        uint64_t gap = (now_us > ctx->fc_last_cf_us) ?
+                       (now_us - ctx->fc_last_cf_us) : 0;
+
+        if (ctx->fc_block_cfs > 1) {
+            ctx->fc_jitter_sum_us += (gap > ctx->fc_last_gap_us) ?
+                                     (gap - ctx->fc_last_gap_us) :
+                                     (ctx->fc_last_gap_us - gap);
+        }
+
+        ctx->fc_gap_sum_us += gap;
+        ctx->fc_gap_max_us = MAX(ctx->fc_gap_max_us, gap);
+        ctx->fc_last_gap_us = gap;
+    }
+
+    ctx->fc_last_cf_us = now_us;
+    ctx->fc_block_cfs++;
+}
+
+void fc_policy_next_block(isotp_ctx_t ctx,
+                          uint8_t* blocksize,
+                          int* stmin_usec,
+                          const uint64_t now_us) {
+    (void)now_us;
+
+    if (ctx->fc_policy != NULL) {
+        isotp_fc_stats_t stats = {0};
+        stats.total_datalen = ctx->total_datalen;
+        stats.remaining_datalen = ctx->remaining_datalen;
+        stats.block_cfs = ctx->fc_block_cfs;
+        if (ctx->fc_block_cfs > 1) {
+            stats.block_gap_avg_us = ctx->fc_gap_sum_us /
+                                     (uint64_t)(ctx->fc_block_cfs - 1);
+            stats.block_gap_max_us = ctx->fc_gap_max_us;
+        }
+        if (ctx->fc_block_cfs > 2) {
+            stats.block_jitter_us = ctx->fc_jitter_sum_us /
+                                    (uint64_t)(ctx->fc_block_cfs - 2);
+        }
+        stats.blocksize = *blocksize;
+        stats.stmin_usec = *stmin_usec;
+
+        uint8_t bs = *blocksize;
+        int stmin = *stmin_usec;
+        if ((*(ctx->fc_policy))(ctx->fc_policy_ctx, &stats, &bs, &stmin) >= 0) {
+            *blocksize = bs;
+            *stmin_usec = stmin;
+        }
+    }
+
+    ctx->fc_block_cfs = 0;
+    ctx->fc_last_cf_us = 0;
+    ctx->fc_last_gap_us = 0;
+    ctx->fc_gap_sum_us = 0;
+    ctx->fc_gap_max_us = 0;
+    ctx->fc_jitter_sum_us = 0;
+}
+
+int isotp_fc_adaptive_init(isotp_fc_adaptive_t* a,
+                           const uint8_t min_blocksize,
+                           const uint8_t max_blocksize,
+                           const int min_stmin_usec,
+                           const int max_stmin_usec,
+                           const uint64_t jitter_limit_us) {
+    if (a == NULL) {
+        return -EINVAL;
+    }
+
+    if ((min_blocksize == 0) ||
+        (max_blocksize < min_blocksize) ||
+        (min_stmin_usec < 0) ||
+        (max_stmin_usec < min_stmin_usec)) {
+        return -ERANGE;
+    }
+
+    a->min_blocksize = min_blocksize;
+    a->max_blocksize = max_blocksize;
+    a->min_stmin_usec = min_stmin_usec;
+    a->max_stmin_usec = max_stmin_usec;
+    a->jitter_limit_us = jitter_limit_us;
+    a->load_limit_pct = 0;
+    a->load_pct = 0;
+
+    return EOK;
+}
+
+int isotp_fc_policy_adaptive(void* policy_ctx,
+                             const isotp_fc_stats_t* stats,
+                             uint8_t* blocksize,
+                             int* stmin_usec) {
+    isotp_fc_adaptive_t* a = (isotp_fc_adaptive_t*)policy_ctx;
+    if ((a == NULL) ||
+        (stats == NULL) ||
+        (blocksize == NULL) ||
+        (stmin_usec == NULL)) {
+        return -EINVAL;
+    }
+
+    int bs = *blocksize;
+    int stmin = *stmin_usec;
+
+    bool overloaded = ((a->load_limit_pct > 0) &&
+                       (a->load_pct > a->load_limit_pct));
+
+    if (stats->block_cfs == 0) {
+        // nothing observed yet; start conservatively
+        bs = a->min_blocksize;
+        stmin = a->max_stmin_usec;
+    } else if (overloaded || (stats->block_jitter_us > a->jitter_limit_us)) {
+        // back off quickly
+        bs /= 2;
+        stmin = MAX(stmin * 2, MIN_NONZERO_STMIN_USEC);
+    } else {
+        // the last block went through cleanly; ask for more
+        bs *= 2;
+        stmin /= 2;
+        if (stmin < MIN_NONZERO_STMIN_USEC) {
+            stmin = 0;
+        }
+    }
+
+    bs = MIN(MAX(bs, (int)a->min_blocksize), (int)a->max_blocksize);
+    stmin = MIN(MAX(stmin, a->min_stmin_usec), a->max_stmin_usec);
+
+    *blocksize = (uint8_t)bs;
+    *stmin_usec = stmin;
+
+    return EOK;
+}
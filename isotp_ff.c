@@ -46,15 +46,15 @@ static int FF_DLmin(const isotp_ctx_t ctx) {
         return -EINVAL;
     }
 
-    switch (ctx->can_format) {
+    switch (ctx_can_format(ctx)) {
     case CAN_FORMAT:
-        return (can_max_datalen(ctx->can_format) -
-                ctx->address_extension_len);
+        return (can_max_datalen(ctx_can_format(ctx)) -
+                ctx_ae_len(ctx));
         break;
 
     case CANFD_FORMAT:
-        return (can_max_datalen(ctx->can_format) -
-                (ctx->address_extension_len + 1));
+        return (can_max_datalen(ctx_can_format(ctx)) -
+                (ctx_ae_len(ctx) + 1));
         break;
 
     default:
@@ -65,7 +65,23 @@ static int FF_DLmin(const isotp_ctx_t ctx) {
 int parse_ff(isotp_ctx_t ctx,
              uint8_t* recv_buf_p,
              const int recv_buf_sz) {
-    if ((ctx == NULL) || (recv_buf_p == NULL)) {
+    if (ctx == NULL) {
+        return -EINVAL;
+    }
+
+    return parse_ff_frame(ctx,
+                          ctx->can_frame,
+                          ctx->can_frame_len,
+                          recv_buf_p,
+                          recv_buf_sz);
+}
+
+int parse_ff_frame(isotp_ctx_t ctx,
+                   const uint8_t* frame_p,
+                   const int frame_len,
+                   uint8_t* recv_buf_p,
+                   const int recv_buf_sz) {
+    if ((ctx == NULL) || (frame_p == NULL) || (recv_buf_p == NULL)) {
         return -EINVAL;
     }
 
@@ -73,12 +89,19 @@ int parse_ff(isotp_ctx_t ctx,
         return -ERANGE;
     }
 
-    uint8_t* sp = ctx->can_frame;
+    // the frame must hold the PCI and FF_DL
+    // @ref ISO-15765-2:2016, section 9.6.3.2
+    if (frame_len < (ctx_ae_len(ctx) + 2)) {
+        return -EBADMSG;
+    }
+
+    const uint8_t* sp = frame_p;
+    int len = frame_len;
 
-    if (ctx->address_extension_len > 0) {
+    if (ctx_ae_len(ctx) > 0) {
         ctx->address_extension = *sp;
         sp++;
-        (ctx->can_frame_len)--;
+        len--;
     }
 
     // make sure this is an FF_PCI
@@ -90,26 +113,34 @@ int parse_ff(isotp_ctx_t ctx,
     int ff_dl = 0;
     ff_dl = (int)(*sp & 0x0fU) << 8;
     sp++;
-    (ctx->can_frame_len)--;
+    len--;
     ff_dl += (int)(*sp);
     sp++;
-    (ctx->can_frame_len)--;
+    len--;
 
     if (ff_dl == 0) {
+#ifdef ISOTP_NO_FF_ESCAPE
+        // FF_DL >= 4096, more than this build receives
+        return -EOVERFLOW;
+#else
         // FF has the escape == this is an FF with DL >= 4096
         // extract the next four bytes to get the FF_DL
+        if (len < 4) {
+            return -EBADMSG;
+        }
         ff_dl = (int)(*sp) << 24;
         sp++;
-        (ctx->can_frame_len)--;
+        len--;
         ff_dl += (int)(*sp) << 16;
         sp++;
-        (ctx->can_frame_len)--;
+        len--;
         ff_dl += (int)(*sp) << 8;
         sp++;
-        (ctx->can_frame_len)--;
+        len--;
         ff_dl += (int)(*sp);
         sp++;
-        (ctx->can_frame_len)--;
+        len--;
+#endif  // ISOTP_NO_FF_ESCAPE
     }
 
     // check the incoming FF_DL
@@ -132,8 +163,8 @@ int parse_ff(isotp_ctx_t ctx,
     }
 
     // copy the data into the receive buffer
-    int copy_len = MIN(ctx->can_frame_len, ff_dl);
-    memcpy(recv_buf_p, sp, copy_len);
+    int copy_len = MIN(MAX(len, 0), ff_dl);
+    rx_copy(ctx, recv_buf_p, 0, sp, copy_len);
 
     ctx->total_datalen = ff_dl;
     ctx->remaining_datalen = ff_dl - copy_len;
@@ -142,6 +173,48 @@ int parse_ff(isotp_ctx_t ctx,
     return copy_len;
 }
 
+int ff_datalen(const isotp_ctx_t ctx,
+               const uint8_t* frame_p,
+               const int frame_len) {
+    if ((ctx == NULL) || (frame_p == NULL)) {
+        return -EINVAL;
+    }
+
+    int ae_len = ctx_ae_len(ctx);
+    if (frame_len < (ae_len + 2)) {
+        return -EBADMSG;
+    }
+
+    const uint8_t* sp = &(frame_p[ae_len]);
+    if ((sp[0] & PCI_MASK) != FF_PCI) {
+        return -EBADMSG;
+    }
+
+    int ff_dl = ((int)(sp[0] & 0x0fU) << 8) + (int)(sp[1]);
+    if (ff_dl > 0) {
+        return ff_dl;
+    }
+
+#ifdef ISOTP_NO_FF_ESCAPE
+    return -EOVERFLOW;
+#else
+    // the escape; the FF_DL is in the next four bytes
+    if (frame_len < (ae_len + 6)) {
+        return -EBADMSG;
+    }
+    uint32_t esc_dl = ((uint32_t)(sp[2]) << 24) |
+                      ((uint32_t)(sp[3]) << 16) |
+                      ((uint32_t)(sp[4]) << 8) |
+                      (uint32_t)(sp[5]);
+    if (esc_dl == 0) {
+        return -EBADMSG;
+    } else if (esc_dl > (uint32_t)MAX_TX_DATALEN) {
+        return -EOVERFLOW;
+    }
+    return (int)esc_dl;
+#endif  // ISOTP_NO_FF_ESCAPE
+}
+
 static int prepare_ff_no_esc(isotp_ctx_t ctx,
                              const uint8_t* send_buf_p,
                              const int send_buf_len) {
@@ -151,7 +224,7 @@ static int prepare_ff_no_esc(isotp_ctx_t ctx,
     uint8_t* dp = ctx->can_frame;
 
     // add the address extension, if any
-    if (ctx->address_extension_len > 0) {
+    if (ctx_ae_len(ctx) > 0) {
         (*dp) = ctx->address_extension;
         dp++;
         (ctx->can_frame_len)++;
@@ -166,7 +239,7 @@ static int prepare_ff_no_esc(isotp_ctx_t ctx,
     (ctx->can_frame_len)++;
 
     // start copying the data
-    int copy_len = can_max_datalen(ctx->can_format) - ctx->can_frame_len;
+    int copy_len = can_max_datalen(ctx_can_format(ctx)) - ctx->can_frame_len;
 
     ctx->total_datalen = send_buf_len;
     memcpy(dp, send_buf_p, copy_len);
@@ -178,6 +251,7 @@ static int prepare_ff_no_esc(isotp_ctx_t ctx,
     return copy_len;
 }
 
+#ifndef ISOTP_NO_FF_ESCAPE
 static int prepare_ff_with_esc(isotp_ctx_t ctx,
                                const uint8_t* send_buf_p,
                                const int send_buf_len) {
@@ -187,7 +261,7 @@ static int prepare_ff_with_esc(isotp_ctx_t ctx,
     uint8_t* dp = ctx->can_frame;
 
     // add the address extension, if any
-    if (ctx->address_extension_len > 0) {
+    if (ctx_ae_len(ctx) > 0) {
         (*dp) = ctx->address_extension;
         dp++;
         (ctx->can_frame_len)++;
@@ -216,7 +290,7 @@ static int prepare_ff_with_esc(isotp_ctx_t ctx,
     (ctx->can_frame_len)++;
 
     // start copying the data
-    int copy_len = can_max_datalen(ctx->can_format) - ctx->can_frame_len;
+    int copy_len = can_max_datalen(ctx_can_format(ctx)) - ctx->can_frame_len;
 
     ctx->total_datalen = send_buf_len;
     memcpy(dp, send_buf_p, copy_len);
@@ -227,6 +301,7 @@ static int prepare_ff_with_esc(isotp_ctx_t ctx,
 
     return copy_len;
 }
+#endif  // ISOTP_NO_FF_ESCAPE
 
 int prepare_ff(isotp_ctx_t ctx,
                const uint8_t* send_buf_p,
@@ -244,8 +319,10 @@ int prepare_ff(isotp_ctx_t ctx,
 
     if ((send_buf_len >= ff_dlmin) && (send_buf_len <= 4095)) {
         return prepare_ff_no_esc(ctx, send_buf_p, send_buf_len);
+#ifndef ISOTP_NO_FF_ESCAPE
     } else if ((send_buf_len >= 4096) && (send_buf_len <= MAX_TX_DATALEN)) {
         return prepare_ff_with_esc(ctx, send_buf_p, send_buf_len);
+#endif  // ISOTP_NO_FF_ESCAPE
     } else {
         return -ERANGE;
     }
@@ -0,0 +1,417 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <isotp.h>
+#include <isotp_private.h>
+
+#define DEFAULT_N_CR_USEC (1000000)  // @ref ISO-15765-2:2016, table 16
+
+// 11 bit OBD/UDS physical response IDs
+#define OBD_RESP_ID_FIRST (0x7E8)
+#define OBD_RESP_ID_LAST  (0x7EF)
+#define OBD_RESP_TO_REQ   (8)
+
+/**
+ * @brief reassembly of one response
+ *
+ * Each slot has its own non-blocking ISOTP context, whose FCs are sent
+ * to the slot's fc_id.
+ */
+struct responder_s {
+    struct isotp_functional_s* f;
+    isotp_ctx_t ctx;
+    uint32_t resp_id;
+    uint32_t fc_id;
+    uint8_t* buf;
+    uint64_t last_us;  // last frame received
+    bool in_use;
+    bool done;
+};
+
+struct isotp_functional_s {
+    isotp_ctx_t req_ctx;   // prepares the request SF
+    struct responder_s* responders;
+    int max_responses;
+    int max_response_len;
+    uint8_t* bufs;
+
+    isotp_fc_id_f fc_id_f;
+    void* map_ctx;
+    uint8_t blocksize;
+    int stmin_usec;
+    uint64_t timeout_us;
+
+    void* can_ctx;
+    isotp_id_rx_f can_rx_f;
+    isotp_id_tx_f can_tx_f;
+};
+
+int isotp_functional_fc_id(void* map_ctx,
+                           const uint32_t resp_id,
+                           uint32_t* fc_id) {
+    (void)map_ctx;
+
+    if (fc_id == NULL) {
+        return -EINVAL;
+    }
+
+    if ((resp_id >= OBD_RESP_ID_FIRST) && (resp_id <= OBD_RESP_ID_LAST)) {
+        *fc_id = resp_id - OBD_RESP_TO_REQ;
+        return EOK;
+    }
+
+    isotp_ta_type_t ta_type = NULL_ISOTP_TA_TYPE;
+    uint8_t ta = 0;
+    uint8_t sa = 0;
+    int rc = isotp_fixed_id_parse(resp_id, &ta_type, &ta, &sa);
+    if ((rc < 0) || (ta_type != ISOTP_PHYSICAL_TA_TYPE)) {
+        return -ENOMSG;
+    }
+
+    // keep the responder's priority
+    *fc_id = (resp_id & 0xFFFF0000U) | ((uint32_t)sa << 8) | ta;
+
+    return EOK;
+}
+
+// sends the FCs of one responder to its FC ID
+static int responder_tx_f(void* txfn_ctx,
+                          const uint8_t* tx_buf_p,
+                          const int tx_len,
+                          const uint64_t timeout_usec) {
+    struct responder_s* r = (struct responder_s*)txfn_ctx;
+    return (*(r->f->can_tx_f))(r->f->can_ctx,
+                               r->fc_id,
+                               tx_buf_p,
+                               tx_len,
+                               timeout_usec);
+}
+
+// the request is only ever prepared, never sent, by the request context
+static int request_tx_f(void* txfn_ctx,
+                        const uint8_t* tx_buf_p,
+                        const int tx_len,
+                        const uint64_t timeout_usec) {
+    (void)txfn_ctx;
+    (void)tx_buf_p;
+    (void)timeout_usec;
+    return tx_len;
+}
+
+int isotp_functional_init(isotp_functional_t* f,
+                          const can_format_t can_format,
+                          const isotp_addressing_mode_t isotp_addressing_mode,
+                          const int max_responses,
+                          const int max_response_len,
+                          void* can_ctx,
+                          isotp_id_rx_f can_rx_f,
+                          isotp_id_tx_f can_tx_f) {
+    if ((f == NULL) || (can_rx_f == NULL) || (can_tx_f == NULL)) {
+        return -EINVAL;
+    }
+
+    if ((max_responses <= 0) ||
+        (max_response_len <= 0) ||
+        (max_response_len > MAX_TX_DATALEN) ||
+        ((size_t)max_responses > (SIZE_MAX / (size_t)max_response_len))) {
+        return -ERANGE;
+    }
+
+    struct isotp_functional_s* nf = calloc(1, sizeof(*nf));
+    if (nf == NULL) {
+        return -ENOMEM;
+    }
+
+    nf->max_responses = max_responses;
+    nf->max_response_len = max_response_len;
+    nf->fc_id_f = isotp_functional_fc_id;
+    nf->timeout_us = DEFAULT_N_CR_USEC;
+    nf->can_ctx = can_ctx;
+    nf->can_rx_f = can_rx_f;
+    nf->can_tx_f = can_tx_f;
+
+    int rc = isotp_ctx_init(&(nf->req_ctx),
+                            can_format,
+                            isotp_addressing_mode,
+                            0,
+                            NULL,
+                            NULL,
+                            request_tx_f);
+    if (rc < 0) {
+        free(nf);
+        return rc;
+    }
+
+    nf->responders = calloc(max_responses, sizeof(*(nf->responders)));
+    nf->bufs = malloc((size_t)max_responses * (size_t)max_response_len);
+    if ((nf->responders == NULL) || (nf->bufs == NULL)) {
+        isotp_functional_free(nf);
+        return -ENOMEM;
+    }
+
+    for (int i=0; i < max_responses; i++) {
+        struct responder_s* r = &(nf->responders[i]);
+        r->f = nf;
+        r->buf = &(nf->bufs[(size_t)i * (size_t)max_response_len]);
+        rc = isotp_ctx_init(&(r->ctx),
+                            can_format,
+                            isotp_addressing_mode,
+                            0,
+                            r,
+                            NULL,
+                            responder_tx_f);
+        if (rc < 0) {
+            isotp_functional_free(nf);
+            return rc;
+        }
+    }
+
+    *f = nf;
+
+    return EOK;
+}
+
+void isotp_functional_free(isotp_functional_t f) {
+    if (f == NULL) {
+        return;
+    }
+
+    if (f->responders != NULL) {
+        for (int i=0; i < f->max_responses; i++) {
+            isotp_ctx_free(f->responders[i].ctx);
+        }
+    }
+    isotp_ctx_free(f->req_ctx);
+    free(f->responders);
+    free(f->bufs);
+    free(f);
+}
+
+int isotp_functional_set_fc_id(isotp_functional_t f,
+                               isotp_fc_id_f fc_id_f,
+                               void* map_ctx) {
+    if (f == NULL) {
+        return -EINVAL;
+    }
+
+    f->fc_id_f = (fc_id_f != NULL) ? fc_id_f : isotp_functional_fc_id;
+    f->map_ctx = map_ctx;
+
+    return EOK;
+}
+
+int isotp_functional_set_fc(isotp_functional_t f,
+                            const uint8_t blocksize,
+                            const int stmin_usec,
+                            const uint64_t timeout) {
+    if (f == NULL) {
+        return -EINVAL;
+    }
+
+    if (stmin_usec < 0) {
+        return -ERANGE;
+    }
+
+    f->blocksize = blocksize;
+    f->stmin_usec = stmin_usec;
+    f->timeout_us = timeout;
+
+    return EOK;
+}
+
+/**
+ * @brief find the reassembly a frame belongs to
+ *
+ * Frames continuing a response go to its slot; an SF or FF with no
+ * response in progress for its CAN ID takes a free slot.
+ */
+static struct responder_s* find_responder(isotp_functional_t f,
+                                          const uint32_t can_id,
+                                          const uint8_t* frame_p,
+                                          const int frame_len) {
+    struct responder_s* free_r = NULL;
+    for (int i=0; i < f->max_responses; i++) {
+        struct responder_s* r = &(f->responders[i]);
+        if (!r->in_use) {
+            if (free_r == NULL) {
+                free_r = r;
+            }
+        } else if (!r->done && (r->resp_id == can_id)) {
+            return r;
+        }
+    }
+
+    int ae_len = f->req_ctx->address_extension_len;
+    if ((free_r == NULL) || (frame_len <= ae_len)) {
+        return NULL;
+    }
+
+    uint8_t pci = frame_p[ae_len] & PCI_MASK;
+    if ((pci != SF_PCI) && (pci != FF_PCI)) {
+        return NULL;
+    }
+
+    uint32_t fc_id = 0;
+    if ((*(f->fc_id_f))(f->map_ctx, can_id, &fc_id) < 0) {
+        return NULL;
+    }
+
+    (void)isotp_ctx_reset(free_r->ctx);
+    free_r->ctx->address_extension = f->req_ctx->address_extension;
+    if (isotp_recv_start(free_r->ctx,
+                         free_r->buf,
+                         f->max_response_len,
+                         f->blocksize,
+                         f->stmin_usec,
+                         f->timeout_us) < 0) {
+        return NULL;
+    }
+
+    free_r->resp_id = can_id;
+    free_r->fc_id = fc_id;
+    free_r->in_use = true;
+    free_r->done = false;
+
+    return free_r;
+}
+
+static void responder_done(struct responder_s* r,
+                           const int rc,
+                           isotp_response_t* responses,
+                           int* count) {
+    r->done = true;
+    responses[*count].can_id = r->resp_id;
+    responses[*count].rc = rc;
+    responses[*count].data = (rc >= 0) ? r->buf : NULL;
+    (*count)++;
+}
+
+int isotp_functional_request(isotp_functional_t f,
+                             const uint32_t request_id,
+                             const uint8_t* req_p,
+                             const int req_len,
+                             const uint64_t window_us,
+                             isotp_response_t* responses) {
+    if ((f == NULL) || (req_p == NULL) || (responses == NULL)) {
+        return -EINVAL;
+    }
+
+    // functional addressing only allows SFs
+    // @ref ISO-15765-2:2016, section 9.6.1
+    int rc = prepare_sf(f->req_ctx, req_p, req_len);
+    if (rc < 0) {
+        return rc;
+    }
+
+    for (int i=0; i < f->max_responses; i++) {
+        f->responders[i].in_use = false;
+        f->responders[i].done = false;
+    }
+
+    rc = (*(f->can_tx_f))(f->can_ctx,
+                          request_id,
+                          f->req_ctx->can_frame,
+                          f->req_ctx->can_frame_len,
+                          f->timeout_us);
+    if (rc < 0) {
+        return rc;
+    }
+
+    int count = 0;
+    uint8_t frame[sizeof(f->req_ctx->can_frame)];
+    uint64_t now = get_time();
+    const uint64_t window_end = now + window_us;
+
+    // a response without an N_Cr timeout still can't hold the request
+    // open forever
+    const uint64_t n_cr_us = (f->timeout_us > 0) ? f->timeout_us :
+                                                   DEFAULT_N_CR_USEC;
+
+    while (true) {
+        // wait for the window to end, or the first reassembly to time out
+        uint64_t wait_until = (now < window_end) ? window_end : UINT64_MAX;
+        bool in_progress = false;
+        for (int i=0; i < f->max_responses; i++) {
+            struct responder_s* r = &(f->responders[i]);
+            if (r->in_use && !r->done) {
+                in_progress = true;
+                if (r->ctx->nb_timeout_us > 0) {
+                    wait_until = MIN(wait_until, r->ctx->nb_deadline_us);
+                } else {
+                    wait_until = MIN(wait_until, r->last_us + n_cr_us);
+                }
+            }
+        }
+        if ((now >= window_end) && !in_progress) {
+            break;
+        }
+
+        uint32_t can_id = 0;
+        rc = (*(f->can_rx_f))(f->can_ctx,
+                              &can_id,
+                              frame,
+                              sizeof(frame),
+                              (wait_until > now) ? (wait_until - now) : 0);
+        now = get_time();
+
+        if (rc > 0) {
+            struct responder_s* r = find_responder(f, can_id, frame, rc);
+            if (r != NULL) {
+                r->last_us = now;
+                int xrc = isotp_rx_frame(r->ctx, frame, rc, now);
+                if (xrc != -EINPROGRESS) {
+                    responder_done(r, xrc, responses, &count);
+                }
+            }
+        } else if ((rc < 0) &&
+                   (rc != -EAGAIN) &&
+                   (rc != -ETIMEDOUT) &&
+                   (rc != -ETIME)) {
+            return rc;
+        }
+
+        // expire reassemblies that stalled
+        for (int i=0; i < f->max_responses; i++) {
+            struct responder_s* r = &(f->responders[i]);
+            if (r->in_use && !r->done) {
+                int xrc = isotp_poll(r->ctx, now);
+                if ((xrc == -EINPROGRESS) &&
+                    (r->ctx->nb_timeout_us == 0) &&
+                    (now >= (r->last_us + n_cr_us))) {
+                    xrc = -ETIMEDOUT;
+                }
+                if (xrc != -EINPROGRESS) {
+                    responder_done(r, xrc, responses, &count);
+                }
+            }
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,518 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <can/can.h>
+#include <isotp.h>
+#include <isotp_private.h>
+
+#define MONITOR_INITIAL_ENTRIES (64)
+
+// an entry is keyed by its CAN ID, with 29 bit IDs kept apart from 11 bit
+#define ENTRY_KEY_EXT (0x80000000U)
+
+#define USEC_PER_SEC (1000000)
+
+// how long a sender is owed an FC
+// @ref ISO-15765-2:2016, table 16
+#define MONITOR_N_BS_USEC (1000000)
+
+/**
+ * @brief what is known of the frames sent with one CAN ID
+ *
+ * The peer is the other CAN ID of a pair: the one whose FCs steer this
+ * one's CFs, and whose CFs this one's FCs steer.
+ */
+struct entry_s {
+    uint32_t key;
+    bool used;
+    bool has_peer;
+    uint32_t peer_key;
+    isotp_monitor_stats_t stats;
+
+    bool awaiting_fc;     // sent an FF or a full block, and is owed an FC
+    uint64_t awaiting_since_us;
+    uint64_t last_cf_us;  // 0 when the next CF starts a block
+    int block_cfs;        // CFs since the last FC
+    uint64_t cf_gap_sum_usec;
+    uint64_t transfer_usec;
+    uint64_t transfer_bytes;
+    uint64_t interval_messages;
+    uint64_t interval_bytes;
+};
+
+struct isotp_monitor_s {
+    isotp_ctx_t ctx;          // only parses FCs
+    isotp_decoder_t decoder;
+    int ae_l;
+
+    struct entry_s* entries;  // open addressing hash table
+    int capacity;             // power of two
+    int count;
+
+    uint8_t frame_pci;        // PCI of the frame being decoded
+    bool started;             // a frame has been seen
+    uint64_t interval_start_us;
+};
+
+static int monitor_tx_f(void* txfn_ctx,
+                        const uint8_t* tx_buf_p,
+                        const int tx_len,
+                        const uint64_t timeout_usec) {
+    (void)txfn_ctx;
+    (void)tx_buf_p;
+    (void)tx_len;
+    (void)timeout_usec;
+    return -EPERM;
+}
+
+static inline uint32_t entry_key(const uint32_t can_id,
+                                 const bool extended_id) {
+    return extended_id ? (can_id | ENTRY_KEY_EXT) : can_id;
+}
+
+static inline uint32_t entry_hash(const uint32_t key) {
+    // Fibonacci hashing; CAN IDs in use tend to be clustered
+    return key * 2654435761U;
+}
+
+static struct entry_s* entry_slot(struct entry_s* entries,
+                                  const int capacity,
+                                  const uint32_t key) {
+    uint32_t mask = (uint32_t)capacity - 1;
+    uint32_t i = entry_hash(key) & mask;
+    while (entries[i].used && (entries[i].key != key)) {
+        i = (i + 1) & mask;
+    }
+    return &(entries[i]);
+}
+
+static int grow_entries(struct isotp_monitor_s* m) {
+    int capacity = m->capacity * 2;
+    struct entry_s* entries = calloc(capacity, sizeof(*entries));
+    if (entries == NULL) {
+        return -ENOMEM;
+    }
+
+    for (int i=0; i < m->capacity; i++) {
+        if (m->entries[i].used) {
+            *entry_slot(entries, capacity, m->entries[i].key) =
+                m->entries[i];
+        }
+    }
+
+    free(m->entries);
+    m->entries = entries;
+    m->capacity = capacity;
+
+    return EOK;
+}
+
+// NULL if the CAN ID has not been seen
+static struct entry_s* lookup_entry(struct isotp_monitor_s* m,
+                                    const uint32_t key) {
+    struct entry_s* e = entry_slot(m->entries, m->capacity, key);
+    return e->used ? e : NULL;
+}
+
+// adding an entry may move the others
+static struct entry_s* find_entry(struct isotp_monitor_s* m,
+                                  const uint32_t can_id,
+                                  const bool extended_id) {
+    uint32_t key = entry_key(can_id, extended_id);
+    struct entry_s* e = entry_slot(m->entries, m->capacity, key);
+    if (e->used) {
+        return e;
+    }
+
+    // keep the table at most half full
+    if ((2 * (m->count + 1)) > m->capacity) {
+        if (grow_entries(m) < 0) {
+            return NULL;
+        }
+        e = entry_slot(m->entries, m->capacity, key);
+    }
+
+    e->used = true;
+    e->key = key;
+    e->stats.can_id = can_id;
+    e->stats.extended_id = extended_id;
+    e->stats.blocksize = -1;
+    e->stats.stmin_usec = -1;
+    m->count++;
+
+    return e;
+}
+
+static void pair_entries(struct entry_s* e, struct entry_s* peer) {
+    e->has_peer = true;
+    e->peer_key = peer->key;
+    e->stats.paired = true;
+    e->stats.fc_can_id = peer->stats.can_id;
+    peer->has_peer = true;
+    peer->peer_key = e->key;
+    peer->stats.paired = true;
+    peer->stats.fc_can_id = e->stats.can_id;
+}
+
+static void message_f(void* cb_ctx, const isotp_message_t* msg) {
+    struct isotp_monitor_s* m = (struct isotp_monitor_s*)cb_ctx;
+    struct entry_s* e = lookup_entry(m, entry_key(msg->can_id,
+                                                  msg->extended_id));
+    if (e == NULL) {
+        return;
+    }
+
+    if (msg->len < 0) {
+        e->stats.failed++;
+        // parse_cf_frame() aborts a message on a CF out of sequence; an
+        // SF/FF aborting one is not a sequence error
+        if ((m->frame_pci == CF_PCI) && (msg->len == -ECONNABORTED)) {
+            e->stats.sn_errors++;
+        }
+        return;
+    }
+
+    e->stats.messages++;
+    e->stats.bytes += msg->len;
+    e->interval_messages++;
+    e->interval_bytes += msg->len;
+    if (msg->frames > 1) {
+        e->transfer_usec += msg->end_us - msg->start_us;
+        e->transfer_bytes += msg->len;
+    }
+}
+
+int isotp_monitor_init(isotp_monitor_t* monitor,
+                       const isotp_addressing_mode_t isotp_addressing_mode,
+                       const int max_message_len) {
+    if (monitor == NULL) {
+        return -EINVAL;
+    }
+
+    int ae_l = address_extension_len(isotp_addressing_mode);
+    if (ae_l < 0) {
+        return -EFAULT;
+    }
+
+    struct isotp_monitor_s* m = calloc(1, sizeof(*m));
+    if (m == NULL) {
+        return -ENOMEM;
+    }
+
+    m->ae_l = ae_l;
+    m->capacity = MONITOR_INITIAL_ENTRIES;
+    m->entries = calloc(m->capacity, sizeof(*(m->entries)));
+    int rc = (m->entries == NULL) ? -ENOMEM : EOK;
+    if (rc == EOK) {
+        rc = isotp_decoder_init(&(m->decoder),
+                                isotp_addressing_mode,
+                                max_message_len,
+                                message_f,
+                                m);
+    }
+    if (rc == EOK) {
+        rc = isotp_ctx_init(&(m->ctx),
+                            DEFAULT_CAN_FORMAT,
+                            isotp_addressing_mode,
+                            0,
+                            NULL,
+                            NULL,
+                            monitor_tx_f);
+    }
+    if (rc < 0) {
+        isotp_decoder_free(m->decoder);
+        free(m->entries);
+        free(m);
+        return rc;
+    }
+
+    *monitor = m;
+    return EOK;
+}
+
+void isotp_monitor_free(isotp_monitor_t monitor) {
+    if (monitor == NULL) {
+        return;
+    }
+
+    isotp_ctx_free(monitor->ctx);
+    isotp_decoder_free(monitor->decoder);
+    free(monitor->entries);
+    free(monitor);
+}
+
+int isotp_monitor_pair(isotp_monitor_t monitor,
+                       const uint32_t can_id,
+                       const uint32_t fc_can_id,
+                       const bool extended_id) {
+    if ((monitor == NULL) || (can_id == fc_can_id)) {
+        return -EINVAL;
+    }
+
+    // the first entry may move when the second is added
+    if (find_entry(monitor, fc_can_id, extended_id) == NULL) {
+        return -ENOMEM;
+    }
+    struct entry_s* e = find_entry(monitor, can_id, extended_id);
+    if (e == NULL) {
+        return -ENOMEM;
+    }
+    struct entry_s* peer = lookup_entry(monitor,
+                                        entry_key(fc_can_id, extended_id));
+
+    pair_entries(e, peer);
+
+    return EOK;
+}
+
+static void await_fc(struct entry_s* e, const uint64_t ts_us) {
+    e->awaiting_fc = true;
+    e->awaiting_since_us = ts_us;
+}
+
+// the only unpaired sender owed an FC, if there is exactly one; with
+// transfers interleaved, there is no telling whose an FC is
+static struct entry_s* sole_awaiting(struct isotp_monitor_s* m,
+                                     const struct entry_s* fc_sender,
+                                     const uint64_t ts_us) {
+    struct entry_s* found = NULL;
+    for (int i=0; i < m->capacity; i++) {
+        struct entry_s* e = &(m->entries[i]);
+        if (!e->used || !e->awaiting_fc || e->has_peer || (e == fc_sender)) {
+            continue;
+        }
+        if ((ts_us > e->awaiting_since_us) &&
+            ((ts_us - e->awaiting_since_us) > MONITOR_N_BS_USEC)) {
+            // long given up on
+            continue;
+        }
+        if (found != NULL) {
+            return NULL;
+        }
+        found = e;
+    }
+    return found;
+}
+
+static void cf_frame(struct entry_s* e, const uint64_t ts_us) {
+    // a CF means the sender had its FC, whether or not it was seen
+    e->awaiting_fc = false;
+
+    if (e->last_cf_us != 0) {
+        uint64_t gap = (ts_us > e->last_cf_us) ? (ts_us - e->last_cf_us) : 0;
+        if ((e->stats.cf_gaps == 0) || (gap < e->stats.cf_gap_min_usec)) {
+            e->stats.cf_gap_min_usec = gap;
+        }
+        if (gap > e->stats.cf_gap_max_usec) {
+            e->stats.cf_gap_max_usec = gap;
+        }
+        e->stats.cf_gaps++;
+        e->cf_gap_sum_usec += gap;
+        if ((e->stats.stmin_usec >= 0) &&
+            (gap < (uint64_t)e->stats.stmin_usec)) {
+            e->stats.stmin_violations++;
+        }
+    }
+    e->last_cf_us = ts_us;
+
+    // at the end of a block, the next CF waits for an FC
+    e->block_cfs++;
+    if ((e->stats.blocksize > 0) && (e->block_cfs == e->stats.blocksize)) {
+        e->last_cf_us = 0;
+        await_fc(e, ts_us);
+    }
+}
+
+static void fc_frame(struct isotp_monitor_s* m,
+                     struct entry_s* e,
+                     const uint64_t ts_us,
+                     const uint8_t* frame_p,
+                     const int frame_len) {
+    isotp_fc_flowstatus_t fs = ISOTP_FC_FLOWSTATUS_NULL;
+    uint8_t bs = 0;
+    int stmin_usec = 0;
+    int rc = parse_fc_frame(m->ctx, frame_p, frame_len, &fs, &bs, &stmin_usec);
+
+    // the sender this FC steers, learning the pair if need be
+    struct entry_s* target = NULL;
+    if (e->has_peer) {
+        target = lookup_entry(m, e->peer_key);
+    } else {
+        target = sole_awaiting(m, e, ts_us);
+        if (target != NULL) {
+            pair_entries(target, e);
+        }
+    }
+    if (target == NULL) {
+        target = e;
+        e->stats.frames++;
+    }
+
+    if (rc < 0) {
+        return;
+    }
+
+    switch (fs) {
+        case ISOTP_FC_FLOWSTATUS_CTS:
+            target->stats.fc_cts++;
+            target->stats.blocksize = bs;
+            target->stats.stmin_usec = stmin_usec;
+            target->block_cfs = 0;
+            target->last_cf_us = 0;
+            target->awaiting_fc = false;
+            break;
+
+        case ISOTP_FC_FLOWSTATUS_WAIT:
+            target->stats.fc_wait++;
+            break;
+
+        case ISOTP_FC_FLOWSTATUS_OVFLW:
+            target->stats.fc_overflow++;
+            target->awaiting_fc = false;
+            break;
+
+        default:
+            break;
+    }
+}
+
+int isotp_monitor_frame(isotp_monitor_t monitor,
+                        const uint64_t ts_us,
+                        const uint32_t can_id,
+                        const bool extended_id,
+                        const can_format_t can_format,
+                        const uint8_t* frame_p,
+                        const int frame_len) {
+    if ((monitor == NULL) || (frame_p == NULL)) {
+        return -EINVAL;
+    }
+
+    int max_len = can_max_datalen(can_format);
+    if (max_len < 0) {
+        return max_len;
+    }
+    if ((frame_len < 0) || (frame_len > max_len)) {
+        return -EMSGSIZE;
+    }
+
+    struct entry_s* e = find_entry(monitor, can_id, extended_id);
+    if (e == NULL) {
+        return -ENOMEM;
+    }
+
+    // the first interval starts with the first frame
+    if (!monitor->started) {
+        monitor->started = true;
+        monitor->interval_start_us = ts_us;
+    }
+
+    if (frame_len <= monitor->ae_l) {
+        // too short to hold a PCI; not ISOTP
+        return EOK;
+    }
+
+    monitor->frame_pci = frame_p[monitor->ae_l] & PCI_MASK;
+    switch (monitor->frame_pci) {
+        case SF_PCI:
+            e->stats.frames++;
+            e->awaiting_fc = false;
+            break;
+
+        case FF_PCI:
+            e->stats.frames++;
+            e->block_cfs = 0;
+            e->last_cf_us = 0;
+            await_fc(e, ts_us);
+            break;
+
+        case CF_PCI:
+            e->stats.frames++;
+            cf_frame(e, ts_us);
+            break;
+
+        case FC_PCI:
+            fc_frame(monitor, e, ts_us, frame_p, frame_len);
+            return EOK;
+            break;
+
+        default:
+            return EOK;
+            break;
+    }
+
+    return isotp_decoder_frame(monitor->decoder,
+                               ts_us,
+                               can_id,
+                               extended_id,
+                               can_format,
+                               frame_p,
+                               frame_len);
+}
+
+int isotp_monitor_report(isotp_monitor_t monitor,
+                         const uint64_t now_us,
+                         isotp_monitor_report_f report_f,
+                         void* cb_ctx) {
+    if ((monitor == NULL) || (report_f == NULL)) {
+        return -EINVAL;
+    }
+
+    uint64_t interval = (now_us > monitor->interval_start_us) ?
+                        (now_us - monitor->interval_start_us) : 0;
+    int reported = 0;
+
+    for (int i=0; i < monitor->capacity; i++) {
+        struct entry_s* e = &(monitor->entries[i]);
+        if (!e->used || (e->stats.frames == 0)) {
+            continue;
+        }
+
+        isotp_monitor_stats_t* s = &(e->stats);
+        s->cf_gap_avg_usec = (s->cf_gaps > 0) ?
+                             (e->cf_gap_sum_usec / s->cf_gaps) : 0;
+        s->transfer_bytes_per_sec = (e->transfer_usec > 0) ?
+            ((e->transfer_bytes * USEC_PER_SEC) / e->transfer_usec) : 0;
+        s->interval_usec = interval;
+        s->messages_per_sec = (interval > 0) ?
+            ((e->interval_messages * USEC_PER_SEC) / interval) : 0;
+        s->bytes_per_sec = (interval > 0) ?
+            ((e->interval_bytes * USEC_PER_SEC) / interval) : 0;
+
+        (*report_f)(cb_ctx, s);
+        reported++;
+
+        e->interval_messages = 0;
+        e->interval_bytes = 0;
+    }
+
+    monitor->interval_start_us = now_us;
+    return reported;
+}
@@ -0,0 +1,316 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <isotp.h>
+#include <isotp_private.h>
+
+/**
+ * @brief a pool's context, and its place in the free or active list
+ *
+ * Free slots form a stack; the active list runs from the session idle
+ * the longest to the one touched last, so eviction only looks at its head.
+ */
+struct isotp_pool_slot_s {
+    struct isotp_pool_s* pool;
+    isotp_ctx_t ctx;
+    uint64_t last_active_us;
+    bool in_use;
+    struct isotp_pool_slot_s* prev;
+    struct isotp_pool_slot_s* next;
+};
+
+struct isotp_pool_s {
+    can_format_t can_format;
+    isotp_addressing_mode_t addressing_mode;
+    uint8_t max_fc_wait_frames;
+    uint64_t idle_timeout_us;
+    isotp_pool_evict_f evict_f;
+    void* cb_ctx;
+
+    struct isotp_pool_slot_s* slots;
+    int capacity;
+    struct isotp_pool_slot_s* free_list;
+    struct isotp_pool_slot_s* active_head;  // idle the longest
+    struct isotp_pool_slot_s* active_tail;  // touched last
+
+    isotp_pool_stats_t stats;
+};
+
+// the transmit function of a context no session is using
+static int unbound_tx_f(void* txfn_ctx,
+                        const uint8_t* tx_buf_p,
+                        const int tx_len,
+                        const uint64_t timeout_usec) {
+    (void)txfn_ctx;
+    (void)tx_buf_p;
+    (void)tx_len;
+    (void)timeout_usec;
+    return -ENOTCONN;
+}
+
+static void active_unlink(struct isotp_pool_s* pool,
+                          struct isotp_pool_slot_s* slot) {
+    if (slot->prev != NULL) {
+        slot->prev->next = slot->next;
+    } else {
+        pool->active_head = slot->next;
+    }
+    if (slot->next != NULL) {
+        slot->next->prev = slot->prev;
+    } else {
+        pool->active_tail = slot->prev;
+    }
+    slot->prev = NULL;
+    slot->next = NULL;
+}
+
+static void active_append(struct isotp_pool_s* pool,
+                          struct isotp_pool_slot_s* slot) {
+    slot->prev = pool->active_tail;
+    slot->next = NULL;
+    if (pool->active_tail != NULL) {
+        pool->active_tail->next = slot;
+    } else {
+        pool->active_head = slot;
+    }
+    pool->active_tail = slot;
+}
+
+static bool slot_idle(const struct isotp_pool_s* pool,
+                      const struct isotp_pool_slot_s* slot,
+                      const uint64_t now_us) {
+    return (pool->idle_timeout_us > 0) &&
+           (now_us >= slot->last_active_us) &&
+           ((now_us - slot->last_active_us) >= pool->idle_timeout_us);
+}
+
+// the slot of a context in use from this pool, or NULL
+static struct isotp_pool_slot_s* slot_of(const struct isotp_pool_s* pool,
+                                         const isotp_ctx_t ctx) {
+    if ((pool == NULL) || (ctx == NULL) || (ctx->pool_slot == NULL)) {
+        return NULL;
+    }
+    struct isotp_pool_slot_s* slot = ctx->pool_slot;
+    if ((slot->pool != pool) || !slot->in_use) {
+        return NULL;
+    }
+    return slot;
+}
+
+// back to the state isotp_ctx_init() left it in, on the free list
+static int slot_recycle(struct isotp_pool_s* pool,
+                        struct isotp_pool_slot_s* slot) {
+    active_unlink(pool, slot);
+    slot->in_use = false;
+    pool->stats.in_use--;
+    pool->stats.released++;
+
+    // gives back a pooled receive buffer the session didn't take
+    (void)isotp_ctx_reset(slot->ctx);
+    memset(slot->ctx, 0, sizeof(*(slot->ctx)));
+    int rc = ctx_setup(slot->ctx,
+                       pool->can_format,
+                       pool->addressing_mode,
+                       pool->max_fc_wait_frames,
+                       NULL,
+                       NULL,
+                       unbound_tx_f);
+    slot->ctx->pool_slot = slot;
+
+    slot->next = pool->free_list;
+    pool->free_list = slot;
+    return rc;
+}
+
+static int slot_evict(struct isotp_pool_s* pool,
+                      struct isotp_pool_slot_s* slot) {
+    if (pool->evict_f != NULL) {
+        pool->evict_f(pool->cb_ctx, slot->ctx);
+    }
+    pool->stats.evicted++;
+    return slot_recycle(pool, slot);
+}
+
+int isotp_pool_init(isotp_pool_t* pool,
+                    const can_format_t can_format,
+                    const isotp_addressing_mode_t isotp_addressing_mode,
+                    const uint8_t max_fc_wait_frames,
+                    const int capacity,
+                    const uint64_t idle_timeout_us,
+                    isotp_pool_evict_f evict_f,
+                    void* cb_ctx) {
+    if ((pool == NULL) || (capacity <= 0)) {
+        return -EINVAL;
+    }
+
+    struct isotp_pool_s* p = calloc(1, sizeof(*p));
+    if (p == NULL) {
+        return -ENOMEM;
+    }
+    p->slots = calloc(capacity, sizeof(*(p->slots)));
+    if (p->slots == NULL) {
+        free(p);
+        return -ENOMEM;
+    }
+    p->can_format = can_format;
+    p->addressing_mode = isotp_addressing_mode;
+    p->max_fc_wait_frames = max_fc_wait_frames;
+    p->idle_timeout_us = idle_timeout_us;
+    p->evict_f = evict_f;
+    p->cb_ctx = cb_ctx;
+    p->capacity = capacity;
+    p->stats.capacity = capacity;
+
+    // pushed in reverse, so the first slot is handed out first
+    for (int i=capacity - 1; i >= 0; i--) {
+        struct isotp_pool_slot_s* slot = &(p->slots[i]);
+        int rc = isotp_ctx_init(&(slot->ctx),
+                                can_format,
+                                isotp_addressing_mode,
+                                max_fc_wait_frames,
+                                NULL,
+                                NULL,
+                                unbound_tx_f);
+        if (rc < 0) {
+            isotp_pool_free(p);
+            return rc;
+        }
+        slot->pool = p;
+        slot->ctx->pool_slot = slot;
+        slot->next = p->free_list;
+        p->free_list = slot;
+    }
+
+    *pool = p;
+    return EOK;
+}
+
+void isotp_pool_free(isotp_pool_t pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    for (int i=0; i < pool->capacity; i++) {
+        isotp_ctx_free(pool->slots[i].ctx);
+    }
+    free(pool->slots);
+    free(pool);
+}
+
+int isotp_pool_acquire(isotp_pool_t pool,
+                       void* can_ctx,
+                       isotp_rx_f can_rx_f,
+                       isotp_tx_f can_tx_f,
+                       const uint64_t now_us,
+                       isotp_ctx_t* ctx) {
+    if ((pool == NULL) || (can_tx_f == NULL) || (ctx == NULL)) {
+        return -EINVAL;
+    }
+
+    if ((pool->free_list == NULL) &&
+        (pool->active_head != NULL) &&
+        slot_idle(pool, pool->active_head, now_us)) {
+        int rc = slot_evict(pool, pool->active_head);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+
+    struct isotp_pool_slot_s* slot = pool->free_list;
+    if (slot == NULL) {
+        pool->stats.exhausted++;
+        return -ENOBUFS;
+    }
+    pool->free_list = slot->next;
+
+    slot->ctx->can_ctx = can_ctx;
+    slot->ctx->can_rx_f = can_rx_f;
+    slot->ctx->can_tx_f = can_tx_f;
+    slot->in_use = true;
+    slot->last_active_us = now_us;
+    active_append(pool, slot);
+    pool->stats.in_use++;
+    pool->stats.acquired++;
+
+    *ctx = slot->ctx;
+    return EOK;
+}
+
+int isotp_pool_release(isotp_pool_t pool, isotp_ctx_t ctx) {
+    struct isotp_pool_slot_s* slot = slot_of(pool, ctx);
+    if (slot == NULL) {
+        return -EINVAL;
+    }
+
+    return slot_recycle(pool, slot);
+}
+
+int isotp_pool_touch(isotp_pool_t pool,
+                     isotp_ctx_t ctx,
+                     const uint64_t now_us) {
+    struct isotp_pool_slot_s* slot = slot_of(pool, ctx);
+    if (slot == NULL) {
+        return -EINVAL;
+    }
+
+    slot->last_active_us = now_us;
+    if (slot != pool->active_tail) {
+        active_unlink(pool, slot);
+        active_append(pool, slot);
+    }
+    return EOK;
+}
+
+int isotp_pool_evict(isotp_pool_t pool, const uint64_t now_us) {
+    if (pool == NULL) {
+        return -EINVAL;
+    }
+
+    int evicted = 0;
+    while ((pool->active_head != NULL) &&
+           slot_idle(pool, pool->active_head, now_us)) {
+        int rc = slot_evict(pool, pool->active_head);
+        if (rc < 0) {
+            return rc;
+        }
+        evicted++;
+    }
+    return evicted;
+}
+
+int isotp_pool_stats(const isotp_pool_t pool, isotp_pool_stats_t* stats) {
+    if ((pool == NULL) || (stats == NULL)) {
+        return -EINVAL;
+    }
+
+    *stats = pool->stats;
+    return EOK;
+}
@@ -25,8 +25,11 @@
 
 #pragma once
 
+#include <errno.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <can/can.h>
 #include <isotp.h>
@@ -50,40 +53,132 @@
 /**
  * @ref ISO-15765-2:2016, section 9.1
  */
-#define MAX_TX_DATALEN (INT32_MAX - 1)
+#define MAX_TX_DATALEN (ISOTP_MAX_TX_DATALEN)
+_Static_assert((MAX_TX_DATALEN > 0) && (MAX_TX_DATALEN <= (INT32_MAX - 1)),
+               "ISOTP_MAX_TX_DATALEN out of range");
+#ifdef ISOTP_NO_FF_ESCAPE
+_Static_assert(MAX_TX_DATALEN <= 4095,
+               "ISOTP_NO_FF_ESCAPE needs ISOTP_MAX_TX_DATALEN <= 4095");
+#endif  // ISOTP_NO_FF_ESCAPE
+#ifdef ISOTP_STATIC_CONTEXTS
+_Static_assert(ISOTP_STATIC_CONTEXTS > 0, "ISOTP_STATIC_CONTEXTS too small");
+#endif  // ISOTP_STATIC_CONTEXTS
+
+/**
+ * @brief room for the longest CAN frame the build sends or receives
+ */
+#ifdef ISOTP_FIXED_CAN_FORMAT
+#define CTX_FRAME_SZ (((ISOTP_FIXED_CAN_FORMAT) == CAN_FORMAT) ? 8 : 64)
+#else
+#define CTX_FRAME_SZ (64)
+#endif  // ISOTP_FIXED_CAN_FORMAT
+
+/**
+ * @brief state of a non-blocking transfer
+ *
+ * @see isotp_send_start(), isotp_recv_start(), isotp_poll()
+ */
+enum isotp_nb_state_e {
+    ISOTP_NB_IDLE,         // no transfer
+    ISOTP_NB_TX_WAIT_FC,   // FF sent, waiting for an FC (N_Bs)
+    ISOTP_NB_TX_CF,        // sending CFs, paced by STmin
+    ISOTP_NB_RX_WAIT,      // waiting for an SF or FF
+    ISOTP_NB_RX_CF,        // FC sent, waiting for CFs (N_Cr)
+    ISOTP_NB_DONE          // transfer finished, result not yet returned
+};
+typedef enum isotp_nb_state_e isotp_nb_state_t;
+
+#define CACHE_LINE_SZ (64)
 
 /**
  * @brief ISOTP context type
  *
  * An ISOTP context must be pre-allocated and initialized before used
  * by any ISOTP functions.
+ *
+ * The fields are laid out by how often they are used.  The first cache
+ * line holds everything isotp_poll() reads while a transfer waits for
+ * frames, so that polling many sessions touches one line of each.  The
+ * frame and the transfer state follow, and the configuration and the
+ * statistics, which are read once per transfer or less, come last.
+ * isotp_ctx_init() allocates contexts aligned to a cache line.
  */
 struct isotp_ctx_s {
-    can_format_t can_format;  // set at initialization time only
-    uint8_t can_frame[64];
+    /**
+     * @brief read on every poll
+     */
+    isotp_nb_state_t nb_state;
+    bool nb_timer_armed;      // false until the first isotp_poll()
     uint8_t can_frame_len;
-    int can_max_datalen;
+    uint8_t can_max_datalen;
+    uint8_t address_extension_len;
+    void* can_ctx;
+    isotp_rx_f can_rx_f;
+    isotp_tx_f can_tx_f;
+    uint64_t nb_timeout_us;   // N_Bs/N_Cr timeout, 0 = none
+    uint64_t nb_deadline_us;  // when the current N_Bs/N_Cr timer expires
+    uint64_t nb_next_cf_us;   // earliest time the next CF can be sent
+    int nb_result;            // result returned once the transfer is done
+    int remaining_datalen;
+
+    /**
+     * @brief read on every frame
+     */
+    uint8_t can_frame[CTX_FRAME_SZ];
 
+    can_format_t can_format;  // set at initialization time only
     isotp_addressing_mode_t addressing_mode;  // ISOTP addressing mode
                                               // set at initialization time only
     uint8_t address_extension;  // address extension for extended
                                 // or mixed ISOTP addressing modes
-    int address_extension_len;
+    uint8_t fs_blocksize;       // blocksize from the last FC
 
-    uint64_t wait_interval_us;
+    /**
+     * @brief non-blocking transfer state
+     * @see isotp_async.c
+     */
+    uint8_t nb_blocksize;       // BS sent in our FCs (receive only)
+    uint8_t nb_bs_remaining;    // CFs left in the current block
 
     int total_datalen;
-    int remaining_datalen;
     int sequence_num;
+    uint32_t fs_stmin;          // CF gap, STmin in usec
 
-    uint8_t fs_blocksize;  // blocksize from the last FC
-    uint64_t fs_stmin;     // CF gap, STmin in usec
+    int nb_buf_len;             // send length, or receive buffer size
+    int nb_stmin_usec;          // STmin sent in our FCs (receive only)
+    const uint8_t* nb_send_buf_p;
+    uint8_t* nb_recv_buf_p;
 
     uint64_t timestamp_us;
 
-    void* can_ctx;
-    isotp_rx_f can_rx_f;
-    isotp_tx_f can_tx_f;
+    /**
+     * @brief scatter/gather receive segments, NULL for a flat buffer
+     * @see isotp_recv_iov(), rx_copy()
+     */
+    const isotp_iovec_t* rx_iov;
+    int rx_iovcnt;
+    int rx_iov_idx;           // segment holding payload offset rx_iov_off
+    int rx_iov_off;           // payload offset of the start of rx_iov_idx
+
+    /**
+     * @brief pooled receive: the buffer is taken when the message starts
+     * @see isotp_recv_start_pooled(), isotp_buf_pool.c
+     */
+    isotp_buf_pool_t rx_buf_pool;
+    uint8_t* rx_pool_buf;     // held until isotp_recv_take()
+
+    /**
+     * @brief receiver flow control policy and the CF timing it is fed
+     * @see isotp_set_fc_policy(), isotp_fc_policy.c
+     */
+    int fc_block_cfs;            // CFs received in the current block
+    isotp_fc_policy_f fc_policy;
+    void* fc_policy_ctx;
+    uint64_t fc_last_cf_us;      // arrival time of the previous CF
+    uint64_t fc_last_gap_us;     // previous gap, for the jitter
+    uint64_t fc_gap_sum_us;
+    uint64_t fc_gap_max_us;
+    uint64_t fc_jitter_sum_us;
 
     /**
      * @brief FC.WAIT frames
@@ -92,7 +187,28 @@ struct isotp_ctx_s {
     uint8_t fc_wait_max;    // max number of FC.WAIT frames that can be sent
                             // set at initialization time only
     uint8_t fc_wait_count;  // number of FC.WAIT frames received
+
+    /**
+     * @brief configuration
+     */
+    bool has_fixed_address;     // normal fixed addressing only
+    uint8_t fixed_ta;
+    uint8_t fixed_sa;
+    uint8_t fixed_priority;
+    isotp_ta_type_t fixed_ta_type;
+
+    /**
+     * @brief sender side adjustments of received FC values
+     * @see isotp_ctx_set_peer_profile(), isotp_profile.c
+     */
+    bool has_peer_profile;
+    isotp_peer_profile_t peer_profile;
+
+    struct isotp_pool_slot_s* pool_slot;  // set while owned by a session
+                                          // pool, see isotp_pool.c
 };
+_Static_assert(offsetof(struct isotp_ctx_s, can_frame) <= CACHE_LINE_SZ,
+               "isotp_poll() fields do not fit a cache line");
 
 // ref ISO-15765-2:2016, table 18
 enum isotp_fc_flowstatus_e {
@@ -113,6 +229,135 @@ typedef enum isotp_fc_flowstatus_e isotp_fc_flowstatus_t;
        __typeof__ (b) _b = (b); \
        _a < _b ? _a : _b; })
 
+/**
+ * @brief whether this build supports a CAN format or addressing mode
+ *
+ * Only the fixed one does when the build fixes it (isotp_config.h).
+ */
+static inline bool can_format_supported(const can_format_t can_format) {
+#ifdef ISOTP_FIXED_CAN_FORMAT
+    return (can_format == (ISOTP_FIXED_CAN_FORMAT));
+#else
+    return ((can_format == CAN_FORMAT) || (can_format == CANFD_FORMAT));
+#endif  // ISOTP_FIXED_CAN_FORMAT
+}
+
+static inline bool addressing_mode_supported(
+        const isotp_addressing_mode_t addr_mode) {
+#ifdef ISOTP_FIXED_ADDRESSING_MODE
+    return (addr_mode == (ISOTP_FIXED_ADDRESSING_MODE));
+#else
+    return ((addr_mode > NULL_ISOTP_ADDRESSING_MODE) &&
+            (addr_mode < LAST_ISOTP_ADDRESSING_MODE));
+#endif  // ISOTP_FIXED_ADDRESSING_MODE
+}
+
+/**
+ * @brief the CAN format of contexts the library creates for itself
+ */
+#ifdef ISOTP_FIXED_CAN_FORMAT
+#define DEFAULT_CAN_FORMAT (ISOTP_FIXED_CAN_FORMAT)
+#else
+#define DEFAULT_CAN_FORMAT (CAN_FORMAT)
+#endif  // ISOTP_FIXED_CAN_FORMAT
+
+/**
+ * @brief the frame layout of a context
+ *
+ * Per-frame code reads the CAN format, the addressing mode and the
+ * lengths they determine through these, which return constants when the
+ * build fixes them, so the compiler can fold the frame arithmetic.
+ *
+ * @param ctx - ISOTP context
+ */
+static inline can_format_t ctx_can_format(const isotp_ctx_t ctx) {
+#ifdef ISOTP_FIXED_CAN_FORMAT
+    (void)ctx;
+    return (ISOTP_FIXED_CAN_FORMAT);
+#else
+    return ctx->can_format;
+#endif  // ISOTP_FIXED_CAN_FORMAT
+}
+
+static inline int ctx_can_max_datalen(const isotp_ctx_t ctx) {
+#ifdef ISOTP_FIXED_CAN_FORMAT
+    (void)ctx;
+    return ((ISOTP_FIXED_CAN_FORMAT) == CANFD_FORMAT) ? 64 : 8;
+#else
+    return ctx->can_max_datalen;
+#endif  // ISOTP_FIXED_CAN_FORMAT
+}
+
+static inline isotp_addressing_mode_t ctx_addressing_mode(
+        const isotp_ctx_t ctx) {
+#ifdef ISOTP_FIXED_ADDRESSING_MODE
+    (void)ctx;
+    return (ISOTP_FIXED_ADDRESSING_MODE);
+#else
+    return ctx->addressing_mode;
+#endif  // ISOTP_FIXED_ADDRESSING_MODE
+}
+
+static inline int ctx_ae_len(const isotp_ctx_t ctx) {
+#ifdef ISOTP_FIXED_ADDRESSING_MODE
+    (void)ctx;
+    return (((ISOTP_FIXED_ADDRESSING_MODE) == ISOTP_EXTENDED_ADDRESSING_MODE) ||
+            ((ISOTP_FIXED_ADDRESSING_MODE) == ISOTP_MIXED_ADDRESSING_MODE))
+           ? 1 : 0;
+#else
+    return ctx->address_extension_len;
+#endif  // ISOTP_FIXED_ADDRESSING_MODE
+}
+
+/**
+ * @brief copy received payload to its place in the message
+ *
+ * Writes into the flat receive buffer, or into the registered segments
+ * when a scatter/gather receive is in progress.  Payload is written in
+ * increasing offsets, so the segment cursor only moves forward, except
+ * when a new message starts over at offset 0.
+ *
+ * @param ctx - ISOTP context
+ * @param recv_buf_p - flat receive buffer (unused with segments)
+ * @param offset - offset of the payload within the message
+ * @param sp - payload to copy
+ * @param len - length of the payload
+ */
+static inline void rx_copy(isotp_ctx_t ctx,
+                           uint8_t* recv_buf_p,
+                           const int offset,
+                           const uint8_t* sp,
+                           const int len) {
+    if (ctx->rx_iov == NULL) {
+        memcpy(&(recv_buf_p[offset]), sp, len);
+        return;
+    }
+
+    if (offset < ctx->rx_iov_off) {
+        ctx->rx_iov_idx = 0;
+        ctx->rx_iov_off = 0;
+    }
+
+    int pos = offset;
+    int copied = 0;
+    while ((copied < len) && (ctx->rx_iov_idx < ctx->rx_iovcnt)) {
+        const isotp_iovec_t* seg = &(ctx->rx_iov[ctx->rx_iov_idx]);
+        int seg_off = pos - ctx->rx_iov_off;
+
+        if (seg_off >= seg->len) {
+            // move on to the next segment
+            ctx->rx_iov_off += seg->len;
+            ctx->rx_iov_idx++;
+            continue;
+        }
+
+        int n = MIN(seg->len - seg_off, len - copied);
+        memcpy(&(seg->base[seg_off]), &(sp[copied]), n);
+        copied += n;
+        pos += n;
+    }
+}
+
 /**
  * @brief process an incoming CAN frame as an ISOTP SF
  *
@@ -236,6 +481,41 @@ int parse_fc(isotp_ctx_t ctx,
              uint8_t* blocksize,
              int* stmin_usec);
 
+/**
+ * @brief parse an ISOTP frame held outside the context
+ *
+ * Same as parse_sf(), parse_ff(), parse_cf() and parse_fc(), except that
+ * the frame is read from frame_p rather than from the context's can_frame.
+ * This lets a frame be parsed in place, wherever the transport holds it.
+ *
+ * @param frame_p - pointer to the CAN frame data
+ * @param frame_len - length of the CAN frame data
+ */
+int parse_sf_frame(isotp_ctx_t ctx,
+                   const uint8_t* frame_p,
+                   const int frame_len,
+                   uint8_t* recv_buf_p,
+                   const int recv_buf_sz);
+
+int parse_ff_frame(isotp_ctx_t ctx,
+                   const uint8_t* frame_p,
+                   const int frame_len,
+                   uint8_t* recv_buf_p,
+                   const int recv_buf_sz);
+
+int parse_cf_frame(isotp_ctx_t ctx,
+                   const uint8_t* frame_p,
+                   const int frame_len,
+                   uint8_t* recv_buf_p,
+                   const int recv_buf_sz);
+
+int parse_fc_frame(isotp_ctx_t ctx,
+                   const uint8_t* frame_p,
+                   const int frame_len,
+                   isotp_fc_flowstatus_t* flowstatus,
+                   uint8_t* blocksize,
+                   int* stmin_usec);
+
 /**
  * @brief create an ISOTP FC in a CAN frame
  *
@@ -287,8 +567,125 @@ uint8_t fc_stmin_usec_to_parameter(const int stmin_usec);
  */
 int fc_stmin_parameter_to_usec(const uint8_t stmin_param);
 
+/**
+ * @brief set up a zeroed context, as isotp_ctx_init() does after allocating
+ *
+ * @param ctx - ISOTP context, all zeroes
+ * @see isotp_ctx_init() for the other parameters
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ *     -EFAULT = the CAN format or ISOTP addressing mode is invalid
+ */
+int ctx_setup(isotp_ctx_t ctx,
+              const can_format_t can_format,
+              const isotp_addressing_mode_t isotp_addressing_mode,
+              const uint8_t max_fc_wait_frames,
+              void* can_ctx,
+              isotp_rx_f can_rx_f,
+              isotp_tx_f can_tx_f);
+
+/**
+ * @brief return the SF_DL of an SF, without parsing the rest of it
+ *
+ * @param ctx - ISOTP context
+ * @param frame_p - pointer to the CAN frame data
+ * @param frame_len - length of the CAN frame data
+ *
+ * @returns
+ * on success (>0), the SF_DL
+ * otherwise (<0) - error code
+ *     -EBADMSG = not a valid SF
+ */
+int sf_datalen(const isotp_ctx_t ctx,
+               const uint8_t* frame_p,
+               const int frame_len);
+
+/**
+ * @brief return the FF_DL of an FF, without parsing the rest of it
+ *
+ * @param ctx - ISOTP context
+ * @param frame_p - pointer to the CAN frame data
+ * @param frame_len - length of the CAN frame data
+ *
+ * @returns
+ * on success (>0), the FF_DL
+ * otherwise (<0) - error code
+ *     -EBADMSG = not an FF, or too short
+ *     -EOVERFLOW = the FF_DL is larger than this build receives
+ */
+int ff_datalen(const isotp_ctx_t ctx,
+               const uint8_t* frame_p,
+               const int frame_len);
+
+/**
+ * @brief give back the pooled receive buffer a context holds, if any
+ *
+ * @param ctx - ISOTP context
+ */
+void rx_pool_drop(isotp_ctx_t ctx);
+
+/**
+ * @brief return the current time from the monotonic clock
+ *
+ * @returns
+ *     time in microseconds
+ */
 uint64_t get_time(void);
 
+/**
+ * @brief check if a transmit was only refused because the transport is full
+ *
+ * The frame can be transmitted again later (backpressure), rather than
+ * failing the transfer.
+ *
+ * @param rc - return code of can_tx_f
+ * @returns
+ *     true if the frame should be retried
+ */
+static inline bool tx_backpressure(const int rc) {
+    return (rc == -EAGAIN) || (rc == -ENOBUFS);
+}
+
+/**
+ * @brief record the arrival of a CF for the flow control policy
+ *
+ * @param ctx - ISOTP context
+ * @param now_us - arrival time of the CF
+ */
+void fc_policy_cf_received(isotp_ctx_t ctx, const uint64_t now_us);
+
+/**
+ * @brief choose the BS and STmin for the next FC.CTS
+ *
+ * Runs the context's flow control policy, if any, over the CFs recorded
+ * since the previous FC, and starts a new block.
+ *
+ * @param ctx - ISOTP context
+ * @param blocksize - in: current BS, out: BS to send
+ * @param stmin_usec - in: current STmin, out: STmin to send
+ * @param now_us - time the FC is sent
+ */
+void fc_policy_next_block(isotp_ctx_t ctx,
+                          uint8_t* blocksize,
+                          int* stmin_usec,
+                          const uint64_t now_us);
+
+/**
+ * @brief validate a list of receive segments and return their total size
+ *
+ * @param iov - list of segments
+ * @param iovcnt - number of segments
+ *
+ * @returns
+ * on success (>=0), total length of all the segments
+ * otherwise (<0), error code
+ *     -EINVAL = a parameter or segment is invalid
+ *     -ERANGE = the segments are larger than MAX_TX_DATALEN in total
+ */
+int iov_total_len(const isotp_iovec_t* iov, const int iovcnt);
+
 /**
  * @brief return a pointer to the start of the ISOTP frame data, excluding the address extension
  *
@@ -0,0 +1,286 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <isotp.h>
+#include <isotp_private.h>
+
+#define PROFILE_LINE_MAX (256)
+
+void isotp_peer_profile_init(isotp_peer_profile_t* profile,
+                             const uint32_t can_id) {
+    if (profile == NULL) {
+        return;
+    }
+
+    profile->can_id = can_id;
+    profile->stmin_override_usec = -1;
+    profile->stmin_scale_pct = -1;
+    profile->stmin_min_usec = -1;
+    profile->stmin_max_usec = -1;
+    profile->bs_override = -1;
+    profile->bs_min = -1;
+    profile->bs_max = -1;
+}
+
+void isotp_peer_profile_apply(const isotp_peer_profile_t* profile,
+                              uint8_t* blocksize,
+                              int* stmin_usec) {
+    if ((profile == NULL) || (blocksize == NULL) || (stmin_usec == NULL)) {
+        return;
+    }
+
+    int64_t stmin = *stmin_usec;
+    if (profile->stmin_override_usec >= 0) {
+        stmin = profile->stmin_override_usec;
+    } else {
+        if (profile->stmin_scale_pct >= 0) {
+            stmin = (stmin * profile->stmin_scale_pct) / 100;
+        }
+        if (profile->stmin_min_usec >= 0) {
+            stmin = MAX(stmin, (int64_t)profile->stmin_min_usec);
+        }
+        if (profile->stmin_max_usec >= 0) {
+            stmin = MIN(stmin, (int64_t)profile->stmin_max_usec);
+        }
+    }
+    *stmin_usec = (int)MIN(stmin, (int64_t)INT_MAX);
+
+    int bs = *blocksize;
+    if (profile->bs_override >= 0) {
+        bs = profile->bs_override;
+    } else {
+        // @ref ISO-15765-2:2016, section 9.6.5.3, BS 0 is "no limit"
+        if ((profile->bs_max > 0) && ((bs == 0) || (bs > profile->bs_max))) {
+            bs = profile->bs_max;
+        }
+        if ((profile->bs_min >= 0) && (bs != 0) && (bs < profile->bs_min)) {
+            bs = profile->bs_min;
+        }
+    }
+    *blocksize = (uint8_t)MIN(bs, UINT8_MAX);
+}
+
+int isotp_ctx_set_peer_profile(isotp_ctx_t ctx,
+                               const isotp_peer_profile_t* profile) {
+    if (ctx == NULL) {
+        return -EINVAL;
+    }
+
+    if (profile == NULL) {
+        ctx->has_peer_profile = false;
+        return EOK;
+    }
+
+    ctx->peer_profile = *profile;
+    ctx->has_peer_profile = true;
+
+    return EOK;
+}
+
+// index of the first profile with a CAN ID >= can_id
+static int profile_lower_bound(const isotp_profile_table_t* table,
+                               const uint32_t can_id) {
+    int lo = 0;
+    int hi = table->count;
+    while (lo < hi) {
+        int mid = lo + ((hi - lo) / 2);
+        if (table->profiles[mid].can_id < can_id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int isotp_profile_table_add(isotp_profile_table_t* table,
+                            const isotp_peer_profile_t* profile) {
+    if ((table == NULL) || (profile == NULL)) {
+        return -EINVAL;
+    }
+
+    int i = profile_lower_bound(table, profile->can_id);
+    if ((i < table->count) && (table->profiles[i].can_id == profile->can_id)) {
+        table->profiles[i] = *profile;
+        return EOK;
+    }
+
+    if (table->count == table->capacity) {
+        int capacity = (table->capacity > 0) ? (table->capacity * 2) : 16;
+        isotp_peer_profile_t* profiles = realloc(table->profiles,
+                                                 capacity * sizeof(*profiles));
+        if (profiles == NULL) {
+            return -ENOMEM;
+        }
+        table->profiles = profiles;
+        table->capacity = capacity;
+    }
+
+    memmove(&(table->profiles[i + 1]),
+            &(table->profiles[i]),
+            (table->count - i) * sizeof(*(table->profiles)));
+    table->profiles[i] = *profile;
+    table->count++;
+
+    return EOK;
+}
+
+const isotp_peer_profile_t* isotp_profile_table_find(const isotp_profile_table_t* table,
+                                                     const uint32_t can_id) {
+    if ((table == NULL) || (table->count == 0)) {
+        return NULL;
+    }
+
+    int i = profile_lower_bound(table, can_id);
+    if ((i < table->count) && (table->profiles[i].can_id == can_id)) {
+        return &(table->profiles[i]);
+    }
+
+    return NULL;
+}
+
+static int parse_setting(isotp_peer_profile_t* profile, char* setting) {
+    char* eq = strchr(setting, '=');
+    if ((eq == NULL) || (eq == setting) || (eq[1] == '\0')) {
+        return -EBADMSG;
+    }
+    *eq = '\0';
+
+    char* end = NULL;
+    errno = 0;
+    long value = strtol(&(eq[1]), &end, 0);
+    if ((errno != 0) || (*end != '\0') || (value < 0) || (value > INT_MAX)) {
+        return -EBADMSG;
+    }
+
+    if (strcmp(setting, "stmin") == 0) {
+        profile->stmin_override_usec = (int)value;
+    } else if (strcmp(setting, "stmin_scale") == 0) {
+        profile->stmin_scale_pct = (int)value;
+    } else if (strcmp(setting, "stmin_min") == 0) {
+        profile->stmin_min_usec = (int)value;
+    } else if (strcmp(setting, "stmin_max") == 0) {
+        profile->stmin_max_usec = (int)value;
+    } else if ((strcmp(setting, "bs") == 0) && (value <= UINT8_MAX)) {
+        profile->bs_override = (int)value;
+    } else if ((strcmp(setting, "bs_min") == 0) && (value <= UINT8_MAX)) {
+        profile->bs_min = (int)value;
+    } else if ((strcmp(setting, "bs_max") == 0) && (value <= UINT8_MAX)) {
+        profile->bs_max = (int)value;
+    } else {
+        return -EBADMSG;
+    }
+
+    return EOK;
+}
+
+// parse one line; 1 if a profile was parsed, 0 for a blank line
+static int parse_profile_line(char* line, isotp_peer_profile_t* profile) {
+    char* comment = strchr(line, '#');
+    if (comment != NULL) {
+        *comment = '\0';
+    }
+
+    char* save = NULL;
+    char* token = strtok_r(line, " \t\r\n", &save);
+    if (token == NULL) {
+        return 0;
+    }
+
+    char* end = NULL;
+    errno = 0;
+    unsigned long can_id = strtoul(token, &end, 0);
+    if ((errno != 0) || (*end != '\0') || (can_id > UINT32_MAX)) {
+        return -EBADMSG;
+    }
+    isotp_peer_profile_init(profile, (uint32_t)can_id);
+
+    while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+        int rc = parse_setting(profile, token);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+
+    return 1;
+}
+
+int isotp_profile_table_load(isotp_profile_table_t* table, const char* path) {
+    if ((table == NULL) || (path == NULL)) {
+        return -EINVAL;
+    }
+
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        return -errno;
+    }
+
+    int rc = EOK;
+    int loaded = 0;
+    char line[PROFILE_LINE_MAX];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if ((strchr(line, '\n') == NULL) && !feof(fp)) {
+            // line too long
+            rc = -EBADMSG;
+            break;
+        }
+
+        isotp_peer_profile_t profile;
+        rc = parse_profile_line(line, &profile);
+        if (rc < 0) {
+            break;
+        } else if (rc == 0) {
+            continue;
+        }
+
+        rc = isotp_profile_table_add(table, &profile);
+        if (rc < 0) {
+            break;
+        }
+        loaded++;
+    }
+
+    fclose(fp);
+
+    return (rc < 0) ? rc : loaded;
+}
+
+void isotp_profile_table_free(isotp_profile_table_t* table) {
+    if (table == NULL) {
+        return;
+    }
+
+    free(table->profiles);
+    table->profiles = NULL;
+    table->count = 0;
+    table->capacity = 0;
+}
@@ -37,11 +37,19 @@ static int recv_cfs(isotp_ctx_t ctx,
                     const int stmin_usec,
                     const uint64_t timeout) {
     int rc = EOK;
+    uint8_t fc_bs = blocksize;
+    int fc_stmin_usec = stmin_usec;
+
+    // new message; nothing observed for the policy yet
+    ctx->fc_block_cfs = 0;
+
     while (ctx->remaining_datalen > 0) {
+        fc_policy_next_block(ctx, &fc_bs, &fc_stmin_usec, get_time());
+
         rc = prepare_fc(ctx,
                         ISOTP_FC_FLOWSTATUS_CTS,
-                        blocksize,
-                        stmin_usec);
+                        fc_bs,
+                        fc_stmin_usec);
         if (rc < 0) {
             return rc;
         }
@@ -54,10 +62,10 @@ static int recv_cfs(isotp_ctx_t ctx,
             return rc;
         }
 
-        uint8_t bs = blocksize;
+        uint8_t bs = fc_bs;
 
         while ((ctx->remaining_datalen > 0) &&
-               ((blocksize == 0) || (bs > 0))) {
+               ((fc_bs == 0) || (bs > 0))) {
             rc = (*(ctx->can_rx_f))(ctx->can_ctx,
                                     ctx->can_frame,
                                     sizeof(ctx->can_frame),
@@ -65,6 +73,7 @@ static int recv_cfs(isotp_ctx_t ctx,
             if (rc < 0) {
                 return rc;
             }
+            ctx->can_frame_len = rc;
 
             // make sure the CAN frame contains a CF
             // this will also validate the sequence number
@@ -74,6 +83,10 @@ static int recv_cfs(isotp_ctx_t ctx,
                 return rc;
             }
 
+            if (ctx->fc_policy != NULL) {
+                fc_policy_cf_received(ctx, get_time());
+            }
+
             if (bs > 0) {
                 bs--;
             }
@@ -83,20 +96,12 @@ static int recv_cfs(isotp_ctx_t ctx,
     return rc;
 }
 
-int isotp_recv(isotp_ctx_t ctx,
-               uint8_t* recv_buf_p,
-               const int recv_buf_sz,
-               const uint8_t blocksize,
-               const int stmin_usec,
-               const uint64_t timeout) {
-    if ((ctx == NULL) || (recv_buf_p == NULL)) {
-        return -EINVAL;
-    }
-
-    if ((recv_buf_sz < 0) || (recv_buf_sz > MAX_TX_DATALEN)) {
-        return -ERANGE;
-    }
-
+static int recv_message(isotp_ctx_t ctx,
+                        uint8_t* recv_buf_p,
+                        const int recv_buf_sz,
+                        const uint8_t blocksize,
+                        const int stmin_usec,
+                        const uint64_t timeout) {
     int rc = 0;
     ctx->total_datalen = 0;
     ctx->remaining_datalen = 0;
@@ -108,10 +113,12 @@ int isotp_recv(isotp_ctx_t ctx,
     if (rc < 0) {
         return rc;
     }
+    ctx->can_frame_len = rc;
 
-    switch ((ctx->can_frame[ctx->address_extension_len]) & PCI_MASK) {
+    switch ((ctx->can_frame[ctx_ae_len(ctx)]) & PCI_MASK) {
         case SF_PCI:
-            rc = parse_sf(ctx, recv_buf_p, recv_buf_sz);
+            // the whole message; parse_sf() returns its length
+            return parse_sf(ctx, recv_buf_p, recv_buf_sz);
             break;
 
         case FF_PCI:
@@ -144,3 +151,67 @@ int isotp_recv(isotp_ctx_t ctx,
         return rc;
     }
 }
+
+int isotp_recv(isotp_ctx_t ctx,
+               uint8_t* recv_buf_p,
+               const int recv_buf_sz,
+               const uint8_t blocksize,
+               const int stmin_usec,
+               const uint64_t timeout) {
+    if ((ctx == NULL) || (recv_buf_p == NULL)) {
+        return -EINVAL;
+    }
+
+    if ((recv_buf_sz < 0) || (recv_buf_sz > MAX_TX_DATALEN)) {
+        return -ERANGE;
+    }
+
+    if (ctx->can_rx_f == NULL) {
+        return -ENOTSUP;
+    }
+
+    ctx->rx_iov = NULL;
+    return recv_message(ctx,
+                        recv_buf_p,
+                        recv_buf_sz,
+                        blocksize,
+                        stmin_usec,
+                        timeout);
+}
+
+int isotp_recv_iov(isotp_ctx_t ctx,
+                   const isotp_iovec_t* iov,
+                   const int iovcnt,
+                   const uint8_t blocksize,
+                   const int stmin_usec,
+                   const uint64_t timeout) {
+    if (ctx == NULL) {
+        return -EINVAL;
+    }
+
+    int total = iov_total_len(iov, iovcnt);
+    if (total < 0) {
+        return total;
+    }
+
+    if (ctx->can_rx_f == NULL) {
+        return -ENOTSUP;
+    }
+
+    ctx->rx_iov = iov;
+    ctx->rx_iovcnt = iovcnt;
+    ctx->rx_iov_idx = 0;
+    ctx->rx_iov_off = 0;
+
+    // the payload goes to the segments; the first one stands in as the
+    // flat buffer the parse functions validate
+    int rc = recv_message(ctx,
+                          iov[0].base,
+                          total,
+                          blocksize,
+                          stmin_usec,
+                          timeout);
+
+    ctx->rx_iov = NULL;
+    return rc;
+}
@@ -0,0 +1,150 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <isotp.h>
+#include <isotp_private.h>
+
+#define FIXED_ADDRESSES (256)
+
+/**
+ * @brief two level SA/TA table, one per target address type
+ *
+ * rows[type][TA] is allocated on first use and holds a context per SA.
+ */
+struct isotp_fixed_router_s {
+    isotp_ctx_t* rows[2][FIXED_ADDRESSES];
+    int row_count[2][FIXED_ADDRESSES];  // routes in each row
+};
+
+static int ta_type_index(const isotp_ta_type_t ta_type) {
+    switch (ta_type) {
+    case ISOTP_PHYSICAL_TA_TYPE:
+        return 0;
+        break;
+
+    case ISOTP_FUNCTIONAL_TA_TYPE:
+        return 1;
+        break;
+
+    case NULL_ISOTP_TA_TYPE:
+    case LAST_ISOTP_TA_TYPE:
+    default:
+        return -EFAULT;
+    }
+}
+
+int isotp_fixed_router_init(isotp_fixed_router_t* router) {
+    if (router == NULL) {
+        return -EINVAL;
+    }
+
+    *router = calloc(1, sizeof(**router));
+    if (*router == NULL) {
+        return -ENOMEM;
+    }
+
+    return EOK;
+}
+
+void isotp_fixed_router_free(isotp_fixed_router_t router) {
+    if (router == NULL) {
+        return;
+    }
+
+    for (int t=0; t < 2; t++) {
+        for (int ta=0; ta < FIXED_ADDRESSES; ta++) {
+            free(router->rows[t][ta]);
+        }
+    }
+    free(router);
+}
+
+int isotp_fixed_router_set(isotp_fixed_router_t router,
+                           const isotp_ta_type_t ta_type,
+                           const uint8_t ta,
+                           const uint8_t sa,
+                           isotp_ctx_t ctx) {
+    if (router == NULL) {
+        return -EINVAL;
+    }
+
+    int t = ta_type_index(ta_type);
+    if (t < 0) {
+        return t;
+    }
+
+    isotp_ctx_t* row = router->rows[t][ta];
+    if (row == NULL) {
+        if (ctx == NULL) {
+            return EOK;
+        }
+
+        row = calloc(FIXED_ADDRESSES, sizeof(*row));
+        if (row == NULL) {
+            return -ENOMEM;
+        }
+        router->rows[t][ta] = row;
+    }
+
+    if ((row[sa] == NULL) && (ctx != NULL)) {
+        router->row_count[t][ta]++;
+    } else if ((row[sa] != NULL) && (ctx == NULL)) {
+        router->row_count[t][ta]--;
+    }
+    row[sa] = ctx;
+
+    // give back rows that are no longer used
+    if (router->row_count[t][ta] == 0) {
+        free(row);
+        router->rows[t][ta] = NULL;
+    }
+
+    return EOK;
+}
+
+isotp_ctx_t isotp_fixed_router_lookup(const isotp_fixed_router_t router,
+                                      const uint32_t can_id) {
+    if (router == NULL) {
+        return NULL;
+    }
+
+    isotp_ta_type_t ta_type = NULL_ISOTP_TA_TYPE;
+    uint8_t ta = 0;
+    uint8_t sa = 0;
+    if (isotp_fixed_id_parse(can_id, &ta_type, &ta, &sa) < 0) {
+        return NULL;
+    }
+
+    const isotp_ctx_t* row = router->rows[ta_type_index(ta_type)][ta];
+    if (row == NULL) {
+        return NULL;
+    }
+
+    return row[sa];
+}
@@ -0,0 +1,504 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <isotp.h>
+#include <isotp_private.h>
+
+#define SCHED_MAX_FRAME_LEN (64)
+
+// most bus time saved up while idle, as wall time at the load ceiling
+#define SCHED_BURST_USEC (1000)
+
+// how far (in weighted bus time) a port may run ahead of the one furthest
+// behind before CAN ID priority yields to fair share
+#define SCHED_FAIR_WINDOW_NS (1000000)
+
+// FCs waiting per port; a context has at most one FC outstanding
+#define SCHED_FC_DEPTH (4)
+
+// virtual time is advanced by frame time * SCHED_WEIGHT_SCALE / weight
+#define SCHED_WEIGHT_SCALE (1024)
+
+#define PCT (100)
+#define NSEC_PER_USEC (1000)
+
+// an 11 bit ID wins arbitration against a 29 bit ID with the same base ID
+#define ARB_BASE_SHIFT (19)
+#define ARB_EXT_BIT (1U << 18)
+#define EXT_ID_BASE_SHIFT (18)
+#define EXT_ID_LOW_MASK (0x3FFFFU)
+
+struct sched_frame_s {
+    uint8_t data[SCHED_MAX_FRAME_LEN];
+    int len;
+    int64_t time_ns;
+    bool is_cf;
+};
+
+struct isotp_sched_port_s {
+    struct isotp_sched_s* sched;
+    uint32_t can_id;
+    bool extended_id;
+    uint32_t arb_key;  // lower wins arbitration
+    int weight;
+    int pci_offset;    // past the address extension, if any
+
+    isotp_ctx_t sender;   // its STmin spaces the CFs, if set
+    uint64_t next_cf_us;  // earliest a queued CF may be released
+
+    struct sched_frame_s fcs[SCHED_FC_DEPTH];
+    int fc_head;
+    int fc_count;
+
+    struct sched_frame_s* frames;
+    int depth;
+    int head;
+    int count;
+
+    uint64_t vtime_ns;
+};
+
+struct isotp_sched_s {
+    can_format_t can_format;
+    uint32_t nominal_bps;
+    uint32_t data_bps;
+    int load_pct;
+
+    int64_t budget_ns;  // bus time that can be used right now
+    int64_t burst_ns;
+    uint64_t last_us;
+    bool started;
+
+    uint64_t vclock_ns;  // virtual time of the last dispatched frame
+
+    struct isotp_sched_port_s** ports;
+    int port_count;
+
+    void* chan_ctx;
+    isotp_id_tx_f chan_tx_f;
+
+    uint64_t frames;
+    uint64_t busy_ns;
+};
+
+static uint32_t arb_key(const uint32_t can_id, const bool extended_id) {
+    if (extended_id) {
+        return ((can_id >> EXT_ID_BASE_SHIFT) << ARB_BASE_SHIFT) |
+               ARB_EXT_BIT | (can_id & EXT_ID_LOW_MASK);
+    }
+    return can_id << ARB_BASE_SHIFT;
+}
+
+int isotp_sched_init(isotp_sched_t* sched,
+                     const can_format_t can_format,
+                     const uint32_t nominal_bps,
+                     const uint32_t data_bps,
+                     const int load_pct,
+                     void* chan_ctx,
+                     isotp_id_tx_f chan_tx_f) {
+    if ((sched == NULL) || (chan_tx_f == NULL)) {
+        return -EINVAL;
+    }
+
+    if ((load_pct <= 0) || (load_pct > PCT)) {
+        return -ERANGE;
+    }
+
+    // the longest frame on this bus; a burst must allow at least one
+    int max_len = can_max_datalen(can_format);
+    if (max_len < 0) {
+        return max_len;
+    }
+    int64_t max_frame_ns = can_frame_time_ns(max_len,
+                                             can_format,
+                                             true,
+                                             nominal_bps,
+                                             data_bps);
+    if (max_frame_ns < 0) {
+        return (int)max_frame_ns;
+    }
+
+    *sched = calloc(1, sizeof(**sched));
+    if (*sched == NULL) {
+        return -ENOMEM;
+    }
+
+    struct isotp_sched_s* s = *sched;
+    s->can_format = can_format;
+    s->nominal_bps = nominal_bps;
+    s->data_bps = data_bps;
+    s->load_pct = load_pct;
+    s->burst_ns = MAX(((int64_t)SCHED_BURST_USEC * NSEC_PER_USEC * load_pct) /
+                      PCT, max_frame_ns);
+    s->budget_ns = s->burst_ns;
+    s->chan_ctx = chan_ctx;
+    s->chan_tx_f = chan_tx_f;
+
+    return EOK;
+}
+
+void isotp_sched_free(isotp_sched_t sched) {
+    if (sched == NULL) {
+        return;
+    }
+
+    for (int i=0; i < sched->port_count; i++) {
+        free(sched->ports[i]->frames);
+        free(sched->ports[i]);
+    }
+    free(sched->ports);
+    free(sched);
+}
+
+int isotp_sched_port_add(isotp_sched_t sched,
+                         const uint32_t can_id,
+                         const bool extended_id,
+                         const int weight,
+                         const int queue_depth,
+                         isotp_sched_port_t* port) {
+    if ((sched == NULL) || (port == NULL)) {
+        return -EINVAL;
+    }
+
+    if ((weight <= 0) || (queue_depth <= 0)) {
+        return -ERANGE;
+    }
+
+    struct isotp_sched_port_s** ports =
+        realloc(sched->ports, (sched->port_count + 1) * sizeof(*ports));
+    if (ports == NULL) {
+        return -ENOMEM;
+    }
+    sched->ports = ports;
+
+    struct isotp_sched_port_s* p = calloc(1, sizeof(*p));
+    if (p == NULL) {
+        return -ENOMEM;
+    }
+
+    p->frames = calloc(queue_depth, sizeof(*(p->frames)));
+    if (p->frames == NULL) {
+        free(p);
+        return -ENOMEM;
+    }
+
+    p->sched = sched;
+    p->can_id = can_id;
+    p->extended_id = extended_id;
+    p->arb_key = arb_key(can_id, extended_id);
+    p->weight = weight;
+    p->depth = queue_depth;
+    p->vtime_ns = sched->vclock_ns;
+
+    sched->ports[sched->port_count++] = p;
+    *port = p;
+
+    return EOK;
+}
+
+int isotp_sched_port_set_addressing(isotp_sched_port_t port,
+                                    const isotp_addressing_mode_t
+                                        isotp_addressing_mode) {
+    if (port == NULL) {
+        return -EINVAL;
+    }
+
+    int ae_l = address_extension_len(isotp_addressing_mode);
+    if (ae_l < 0) {
+        return ae_l;
+    }
+    port->pci_offset = ae_l;
+
+    return EOK;
+}
+
+int isotp_sched_port_set_sender(isotp_sched_port_t port,
+                                const isotp_ctx_t ctx) {
+    if (port == NULL) {
+        return -EINVAL;
+    }
+
+    port->sender = ctx;
+    port->next_cf_us = 0;
+
+    return EOK;
+}
+
+int isotp_sched_tx_f(void* txfn_ctx,
+                     const uint8_t* tx_buf_p,
+                     const int tx_len,
+                     const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct isotp_sched_port_s* p = (struct isotp_sched_port_s*)txfn_ctx;
+
+    if ((p == NULL) || (tx_buf_p == NULL) || (tx_len < 0) ||
+        (tx_len > SCHED_MAX_FRAME_LEN)) {
+        return -EINVAL;
+    }
+
+    struct isotp_sched_s* s = p->sched;
+    int64_t time_ns = can_frame_time_ns(tx_len,
+                                        s->can_format,
+                                        p->extended_id,
+                                        s->nominal_bps,
+                                        s->data_bps);
+    if (time_ns < 0) {
+        return (int)time_ns;
+    }
+
+    // FCs skip the queue of the port's other frames
+    if ((tx_len > p->pci_offset) &&
+        ((tx_buf_p[p->pci_offset] & PCI_MASK) == FC_PCI)) {
+        if (p->fc_count == SCHED_FC_DEPTH) {
+            return -ENOBUFS;
+        }
+
+        struct sched_frame_s* f =
+            &(p->fcs[(p->fc_head + p->fc_count) % SCHED_FC_DEPTH]);
+        memcpy(f->data, tx_buf_p, tx_len);
+        f->len = tx_len;
+        f->time_ns = time_ns;
+        p->fc_count++;
+
+        return tx_len;
+    }
+
+    if (p->count == p->depth) {
+        return -ENOBUFS;
+    }
+
+    // a port that has been idle doesn't get credit for the time it wasn't
+    // using the bus
+    if (p->count == 0) {
+        p->vtime_ns = MAX(p->vtime_ns, s->vclock_ns);
+    }
+
+    struct sched_frame_s* f = &(p->frames[(p->head + p->count) % p->depth]);
+    memcpy(f->data, tx_buf_p, tx_len);
+    f->len = tx_len;
+    f->time_ns = time_ns;
+    f->is_cf = (tx_len > p->pci_offset) &&
+               ((tx_buf_p[p->pci_offset] & PCI_MASK) == CF_PCI);
+    p->count++;
+
+    return tx_len;
+}
+
+int isotp_sched_charge(isotp_sched_t sched,
+                       const int datalen,
+                       const bool extended_id) {
+    if (sched == NULL) {
+        return -EINVAL;
+    }
+
+    int64_t time_ns = can_frame_time_ns(datalen,
+                                        sched->can_format,
+                                        extended_id,
+                                        sched->nominal_bps,
+                                        sched->data_bps);
+    if (time_ns < 0) {
+        return (int)time_ns;
+    }
+
+    sched->budget_ns -= time_ns;
+    sched->busy_ns += time_ns;
+
+    return EOK;
+}
+
+// the port with the FC that would win arbitration, or NULL if there is none
+static struct isotp_sched_port_s* pick_fc_port(const struct isotp_sched_s* s) {
+    struct isotp_sched_port_s* best = NULL;
+    for (int i=0; i < s->port_count; i++) {
+        struct isotp_sched_port_s* p = s->ports[i];
+        if ((p->fc_count > 0) &&
+            ((best == NULL) || (p->arb_key < best->arb_key))) {
+            best = p;
+        }
+    }
+
+    return best;
+}
+
+// a port with a frame that may be transmitted now; a CF is held back until
+// STmin has passed since the port's last CF, however long it was queued
+// @ref ISO-15765-2:2016, section 9.6.5.4
+static bool port_ready(const struct isotp_sched_port_s* p,
+                       const uint64_t now_us) {
+    if (p->count == 0) {
+        return false;
+    }
+
+    return !p->frames[p->head].is_cf || (now_us >= p->next_cf_us);
+}
+
+// the backlogged port to transmit from next, or NULL if there is none
+static struct isotp_sched_port_s* pick_port(const struct isotp_sched_s* s,
+                                            const uint64_t now_us) {
+    uint64_t min_vtime = UINT64_MAX;
+    for (int i=0; i < s->port_count; i++) {
+        if (port_ready(s->ports[i], now_us)) {
+            min_vtime = MIN(min_vtime, s->ports[i]->vtime_ns);
+        }
+    }
+
+    // within the fair share window, the lowest CAN ID goes first, as it
+    // would on the bus
+    struct isotp_sched_port_s* best = NULL;
+    for (int i=0; i < s->port_count; i++) {
+        struct isotp_sched_port_s* p = s->ports[i];
+        if (!port_ready(p, now_us) ||
+            (p->vtime_ns > (min_vtime + SCHED_FAIR_WINDOW_NS))) {
+            continue;
+        }
+        if ((best == NULL) || (p->arb_key < best->arb_key)) {
+            best = p;
+        }
+    }
+
+    return best;
+}
+
+int isotp_sched_poll(isotp_sched_t sched, const uint64_t now_us) {
+    if (sched == NULL) {
+        return -EINVAL;
+    }
+
+    struct isotp_sched_s* s = sched;
+
+    // accrue bus time at the load ceiling since the last poll
+    if (s->started && (now_us > s->last_us)) {
+        uint64_t elapsed_us = MIN(now_us - s->last_us,
+                                  (uint64_t)SCHED_BURST_USEC * PCT);
+        s->budget_ns = MIN(s->budget_ns + (int64_t)((elapsed_us *
+                               NSEC_PER_USEC * s->load_pct) / PCT),
+                           s->burst_ns);
+    }
+    s->started = true;
+    s->last_us = now_us;
+
+    int rc = EOK;
+    bool blocked = false;
+
+    // FCs go first, whatever the load; a peer waiting on one is idle
+    while (!blocked) {
+        struct isotp_sched_port_s* p = pick_fc_port(s);
+        if (p == NULL) {
+            break;
+        }
+
+        struct sched_frame_s* f = &(p->fcs[p->fc_head]);
+        int tx_rc = (*(s->chan_tx_f))(s->chan_ctx,
+                                      p->can_id,
+                                      f->data,
+                                      f->len,
+                                      0);
+        if (tx_backpressure(tx_rc)) {
+            blocked = true;
+            break;
+        }
+
+        p->fc_head = (p->fc_head + 1) % SCHED_FC_DEPTH;
+        p->fc_count--;
+
+        if (tx_rc < 0) {
+            rc = tx_rc;
+            continue;
+        }
+
+        s->budget_ns -= f->time_ns;
+        s->busy_ns += f->time_ns;
+        s->frames++;
+    }
+
+    while (!blocked && (s->budget_ns > 0)) {
+        struct isotp_sched_port_s* p = pick_port(s, now_us);
+        if (p == NULL) {
+            break;
+        }
+
+        struct sched_frame_s* f = &(p->frames[p->head]);
+        int tx_rc = (*(s->chan_tx_f))(s->chan_ctx,
+                                      p->can_id,
+                                      f->data,
+                                      f->len,
+                                      0);
+        if (tx_backpressure(tx_rc)) {
+            // the channel is full; try again on the next poll
+            blocked = true;
+            break;
+        }
+
+        // a frame the channel failed on is dropped; the ISOTP transfer
+        // sees it as lost
+        p->head = (p->head + 1) % p->depth;
+        p->count--;
+
+        if (tx_rc < 0) {
+            rc = tx_rc;
+            continue;
+        }
+
+        if (f->is_cf && (p->sender != NULL)) {
+            p->next_cf_us = now_us + p->sender->fs_stmin;
+        }
+
+        s->vclock_ns = p->vtime_ns;
+        p->vtime_ns += ((uint64_t)f->time_ns * SCHED_WEIGHT_SCALE) / p->weight;
+        s->budget_ns -= f->time_ns;
+        s->busy_ns += f->time_ns;
+        s->frames++;
+    }
+
+    if (rc < 0) {
+        return rc;
+    }
+
+    int queued = 0;
+    for (int i=0; i < s->port_count; i++) {
+        queued += s->ports[i]->count + s->ports[i]->fc_count;
+    }
+
+    return queued;
+}
+
+int isotp_sched_stats(const isotp_sched_t sched,
+                      uint64_t* frames,
+                      uint64_t* busy_ns) {
+    if ((sched == NULL) || (frames == NULL) || (busy_ns == NULL)) {
+        return -EINVAL;
+    }
+
+    *frames = sched->frames;
+    *busy_ns = sched->busy_ns;
+
+    return EOK;
+}
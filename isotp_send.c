@@ -36,6 +36,9 @@
 #define USEC_PER_SEC  (1000000)
 #define NSEC_PER_USEC (1000)
 
+// how long to wait before retrying a CF the transport had no room for
+#define BACKPRESSURE_RETRY_USEC (100)
+
 static void usec_to_ts(struct timespec *ts, const uint64_t us) {
     ts->tv_sec = us / USEC_PER_SEC;
     ts->tv_nsec = (us % USEC_PER_SEC) * NSEC_PER_USEC;
@@ -74,7 +77,11 @@ static int send_cfs(isotp_ctx_t ctx,
     }
 
     uint8_t bs = blocksize;
+    uint64_t blocked_since = 0;
     while ((ctx->remaining_datalen > 0) && (continuous || (bs > 0))) {
+        int remaining_datalen = ctx->remaining_datalen;
+        int sequence_num = ctx->sequence_num;
+
         int rc = prepare_cf(ctx, send_buf_p, send_buf_len);
         if (rc < 0) {
             return rc;
@@ -83,9 +90,29 @@ static int send_cfs(isotp_ctx_t ctx,
                                 ctx->can_frame,
                                 ctx->can_frame_len,
                                 timeout);
-        if (rc < 0) {
+        if (tx_backpressure(rc)) {
+            // the transport is full; take the CF back and retry it,
+            // for up to the timeout
+            ctx->remaining_datalen = remaining_datalen;
+            ctx->sequence_num = sequence_num;
+
+            uint64_t now = get_time();
+            if (blocked_since == 0) {
+                blocked_since = now;
+            } else if ((timeout > 0) && ((now - blocked_since) >= timeout)) {
+                return -ETIMEDOUT;
+            }
+
+            struct timespec retry_ts = {0};
+            usec_to_ts(&retry_ts, BACKPRESSURE_RETRY_USEC);
+            if (nanosleep(&retry_ts, NULL) != 0) {
+                return -EFAULT;
+            }
+            continue;
+        } else if (rc < 0) {
             return rc;
         }
+        blocked_since = 0;
 
         // prevent under-rolling
         if (bs > 0) {
@@ -112,6 +139,11 @@ static int send_ff(isotp_ctx_t ctx,
     uint8_t bs = UINT8_MAX;
     int stmin_usec = INT_MAX;
 
+    if (ctx->can_rx_f == NULL) {
+        // can't wait for an FC
+        return -ENOTSUP;
+    }
+
     rc = prepare_ff(ctx, send_buf_p, send_buf_len);
     if (rc < 0) {
         return rc;
@@ -134,6 +166,7 @@ static int send_ff(isotp_ctx_t ctx,
         if (rc < 0) {
             return rc;
         }
+        ctx->can_frame_len = rc;
 
         rc = parse_fc(ctx, &fs, &bs, &stmin_usec);
         if (rc < 0) {
@@ -142,6 +175,12 @@ static int send_ff(isotp_ctx_t ctx,
 
         switch (fs) {
             case ISOTP_FC_FLOWSTATUS_CTS:
+                if (ctx->has_peer_profile) {
+                    isotp_peer_profile_apply(&(ctx->peer_profile),
+                                             &bs,
+                                             &stmin_usec);
+                }
+
                 // start sending CF's
                 rc = send_cfs(ctx,
                               send_buf_p,
@@ -190,7 +229,7 @@ int isotp_send(isotp_ctx_t ctx,
     int rc = 0;
 
     // see if the data will fit into a single SF
-    if (send_buf_len <= ctx->can_max_datalen) {
+    if (send_buf_len <= ctx_can_max_datalen(ctx)) {
         // send an SF
         rc = send_sf(ctx, send_buf_p, send_buf_len, timeout);
     } else {
@@ -38,7 +38,9 @@
 #define SF_PCI (0x00)
 
 static int parse_sf_with_esc(isotp_ctx_t ctx,
-                             uint8_t** dp) {
+                             const uint8_t* frame_p,
+                             const int frame_len,
+                             const uint8_t** dp) {
     if (dp == NULL) {
         return -EINVAL;
     }
@@ -46,27 +48,27 @@ static int parse_sf_with_esc(isotp_ctx_t ctx,
 
     uint8_t sf_dl = 0;
 
-    switch (ctx->addressing_mode) {
+    switch (ctx_addressing_mode(ctx)) {
     case ISOTP_NORMAL_ADDRESSING_MODE:
     case ISOTP_NORMAL_FIXED_ADDRESSING_MODE:
-        sf_dl = ctx->can_frame[1];
-        if (((sf_dl >= 0) && (sf_dl <= 7)) ||
-            (sf_dl > (ctx->can_frame_len - 2))) {
+        sf_dl = frame_p[1];
+        if ((sf_dl <= 7) ||
+            (sf_dl > (frame_len - 2))) {
             return -ENOTSUP;
         } else {
-            *dp = &(ctx->can_frame[2]);
+            *dp = &(frame_p[2]);
         }
         break;
 
     case ISOTP_EXTENDED_ADDRESSING_MODE:
     case ISOTP_MIXED_ADDRESSING_MODE:
-        sf_dl = ctx->can_frame[2];
-        if (((sf_dl >= 0) && (sf_dl <= 6)) ||
-            (sf_dl > (ctx->can_frame_len - 3))) {
+        sf_dl = frame_p[2];
+        if ((sf_dl <= 6) ||
+            (sf_dl > (frame_len - 3))) {
             return -ENOTSUP;
         } else {
-            *dp = &(ctx->can_frame[3]);
-            ctx->address_extension = ctx->can_frame[0];
+            *dp = &(frame_p[3]);
+            ctx->address_extension = frame_p[0];
         }
         break;
 
@@ -79,7 +81,9 @@ static int parse_sf_with_esc(isotp_ctx_t ctx,
 }
 
 static int parse_sf_no_esc(isotp_ctx_t ctx,
-                           uint8_t** dp) {
+                           const uint8_t* frame_p,
+                           const int frame_len,
+                           const uint8_t** dp) {
     if (dp == NULL) {
         return -EINVAL;
     }
@@ -87,25 +91,31 @@ static int parse_sf_no_esc(isotp_ctx_t ctx,
 
     uint8_t sf_dl = 0;
 
-    switch (ctx->addressing_mode) {
+    switch (ctx_addressing_mode(ctx)) {
     case ISOTP_NORMAL_ADDRESSING_MODE:
     case ISOTP_NORMAL_FIXED_ADDRESSING_MODE:
-        sf_dl = ctx->can_frame[0] & SF_DL_PCI_MASK;
+        sf_dl = frame_p[0] & SF_DL_PCI_MASK;
         if ((sf_dl == 0) || (sf_dl > 7)) {
             return -ENOTSUP;
+        } else if (sf_dl > (frame_len - 1)) {
+            // the frame is shorter than its SF_DL
+            // @ref ISO-15765-2:2016, section 9.6.2.2
+            return -EBADMSG;
         } else {
-            *dp = &(ctx->can_frame[1]);
+            *dp = &(frame_p[1]);
         }
         break;
 
     case ISOTP_EXTENDED_ADDRESSING_MODE:
     case ISOTP_MIXED_ADDRESSING_MODE:
-        sf_dl = ctx->can_frame[1] & SF_DL_PCI_MASK;
+        sf_dl = frame_p[1] & SF_DL_PCI_MASK;
         if ((sf_dl == 0) || (sf_dl > 6)) {
             return -ENOTSUP;
+        } else if (sf_dl > (frame_len - 2)) {
+            return -EBADMSG;
         } else {
-            *dp = &(ctx->can_frame[2]);
-            ctx->address_extension = ctx->can_frame[0];
+            *dp = &(frame_p[2]);
+            ctx->address_extension = frame_p[0];
         }
         break;
 
@@ -120,7 +130,23 @@ static int parse_sf_no_esc(isotp_ctx_t ctx,
 int parse_sf(isotp_ctx_t ctx,
              uint8_t* recv_buf_p,
              const int recv_buf_sz) {
-    if ((ctx == NULL) || (recv_buf_p == NULL)) {
+    if (ctx == NULL) {
+        return -EINVAL;
+    }
+
+    return parse_sf_frame(ctx,
+                          ctx->can_frame,
+                          ctx->can_frame_len,
+                          recv_buf_p,
+                          recv_buf_sz);
+}
+
+int parse_sf_frame(isotp_ctx_t ctx,
+                   const uint8_t* frame_p,
+                   const int frame_len,
+                   uint8_t* recv_buf_p,
+                   const int recv_buf_sz) {
+    if ((ctx == NULL) || (frame_p == NULL) || (recv_buf_p == NULL)) {
         return -EINVAL;
     }
 
@@ -129,23 +155,28 @@ int parse_sf(isotp_ctx_t ctx,
     }
 
     // verify the length of the CAN frame
-    if ((ctx->can_frame_len < 0) ||
-        (ctx->can_frame_len > can_max_datalen(CANFD_FORMAT))) {
+    if ((frame_len < 0) ||
+        (frame_len > can_max_datalen(CANFD_FORMAT))) {
+        return -EBADMSG;
+    }
+
+    // too short to hold a PCI
+    if (frame_len <= ctx_ae_len(ctx)) {
         return -EBADMSG;
     }
 
     // verify that the frame contains an ISOTP SF header
-    if ((ctx->can_frame[ctx->address_extension_len] & PCI_MASK) != SF_PCI) {
+    if ((frame_p[ctx_ae_len(ctx)] & PCI_MASK) != SF_PCI) {
         // not an SF
         return -EBADMSG;
     }
 
     int sf_dl = 0;
-    uint8_t* dp = NULL;
-    if (ctx->can_frame_len <= 8) {
-        sf_dl = parse_sf_no_esc(ctx, &dp);
+    const uint8_t* dp = NULL;
+    if (frame_len <= 8) {
+        sf_dl = parse_sf_no_esc(ctx, frame_p, frame_len, &dp);
     } else {
-        sf_dl = parse_sf_with_esc(ctx, &dp);
+        sf_dl = parse_sf_with_esc(ctx, frame_p, frame_len, &dp);
     }
 
     if (sf_dl < 0) {
@@ -160,13 +191,48 @@ int parse_sf(isotp_ctx_t ctx,
         return -ENOBUFS;
     }
 
-    memcpy(recv_buf_p, dp, sf_dl);
+    rx_copy(ctx, recv_buf_p, 0, dp, sf_dl);
     ctx->total_datalen = 0;
     ctx->remaining_datalen = 0;
 
     return sf_dl;
 }
 
+int sf_datalen(const isotp_ctx_t ctx,
+               const uint8_t* frame_p,
+               const int frame_len) {
+    if ((ctx == NULL) || (frame_p == NULL)) {
+        return -EINVAL;
+    }
+
+    int ae_len = ctx_ae_len(ctx);
+    if ((frame_len <= ae_len) ||
+        (frame_len > can_max_datalen(CANFD_FORMAT))) {
+        return -EBADMSG;
+    }
+
+    if ((frame_p[ae_len] & PCI_MASK) != SF_PCI) {
+        return -EBADMSG;
+    }
+
+    // same rules as parse_sf_no_esc() and parse_sf_with_esc()
+    int sf_dl = 0;
+    if (frame_len <= 8) {
+        sf_dl = frame_p[ae_len] & SF_DL_PCI_MASK;
+        if ((sf_dl == 0) || (sf_dl > (7 - ae_len)) ||
+            (sf_dl > (frame_len - (1 + ae_len)))) {
+            return -EBADMSG;
+        }
+    } else {
+        sf_dl = frame_p[ae_len + 1];
+        if ((sf_dl <= (7 - ae_len)) || (sf_dl > (frame_len - (2 + ae_len)))) {
+            return -EBADMSG;
+        }
+    }
+
+    return sf_dl;
+}
+
 int prepare_sf(isotp_ctx_t ctx,
                const uint8_t* send_buf_p,
                const int send_buf_len) {
@@ -186,19 +252,19 @@ int prepare_sf(isotp_ctx_t ctx,
     ctx->remaining_datalen = 0;
 
     // prepare the SF header in the CAN frame
-    switch (ctx->addressing_mode) {
+    switch (ctx_addressing_mode(ctx)) {
     case ISOTP_NORMAL_ADDRESSING_MODE:
     case ISOTP_NORMAL_FIXED_ADDRESSING_MODE:
-        if ((ctx->can_max_datalen <= 8) &&
+        if ((ctx_can_max_datalen(ctx) <= 8) &&
             (send_buf_len >= 0) &&
             (send_buf_len <= 7)) {
             // send as an SF with no escape sequence
             ctx->can_frame[0] = SF_PCI | (uint8_t)(send_buf_len & 0x00000007U);
             dp = &(ctx->can_frame[1]);
             ctx->can_frame_len += 1;
-        } else if ((ctx->can_max_datalen > 8) &&
+        } else if ((ctx_can_max_datalen(ctx) > 8) &&
                    (send_buf_len >= 8) &&
-                   (send_buf_len <= (ctx->can_max_datalen - 2))) {
+                   (send_buf_len <= (ctx_can_max_datalen(ctx) - 2))) {
             ctx->can_frame[0] = SF_PCI;
             ctx->can_frame[1] = (uint8_t)(send_buf_len & 0x000000ffU);
             dp = &(ctx->can_frame[2]);
@@ -213,16 +279,16 @@ int prepare_sf(isotp_ctx_t ctx,
         ctx->can_frame[0] = ctx->address_extension;
         ctx->can_frame_len += 1;
 
-        if ((ctx->can_max_datalen <= 8) &&
+        if ((ctx_can_max_datalen(ctx) <= 8) &&
             (send_buf_len >= 0) &&
             (send_buf_len <= 6)) {
             // send as an SF with no escape sequence
             ctx->can_frame[1] = SF_PCI | (uint8_t)(send_buf_len & 0x00000007U);
             dp = &(ctx->can_frame[2]);
             ctx->can_frame_len += 1;
-        } else if ((ctx->can_max_datalen > 8) &&
+        } else if ((ctx_can_max_datalen(ctx) > 8) &&
                    (send_buf_len >= 7) &&
-                   (send_buf_len <= (ctx->can_max_datalen - 3))) {
+                   (send_buf_len <= (ctx_can_max_datalen(ctx) - 3))) {
             // send as an SF with escape sequence
             ctx->can_frame[1] = SF_PCI;
             ctx->can_frame[2] = (uint8_t)(send_buf_len & 0x000000ffU);
@@ -246,7 +312,7 @@ int prepare_sf(isotp_ctx_t ctx,
 
     memcpy(dp, send_buf_p, send_buf_len);
     ctx->can_frame_len += send_buf_len;
-    pad_can_frame(ctx->can_frame, ctx->can_frame_len, ctx->can_format);
+    pad_can_frame(ctx->can_frame, ctx->can_frame_len, ctx_can_format(ctx));
 
     return send_buf_len;
 }
@@ -0,0 +1,1003 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <can/can.h>
+#include <isotp.h>
+#include "sim/isotp_sim.h"
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+#define DEFAULT_TX_QUEUE_DEPTH (8)
+#define DEFAULT_ECU_POLL_USEC (100)
+#define DEFAULT_MAX_MESSAGE_LEN (4095)
+#define RX_QUEUE_DEPTH (256)
+#define INITIAL_NODES (8)
+#define INITIAL_HEAP (16)
+#define INITIAL_RX_INDEX (16)
+
+#define MAX_FRAME_LEN (64)
+#define PPM (1000000)
+#define NSEC_PER_USEC (1000)
+
+// ISOTP timeouts of the ECUs (N_Bs, N_Cr), @ref ISO-15765-2:2016, table 16
+#define ECU_TIMEOUT_USEC (1000000)
+
+#define NEVER (UINT64_MAX)
+
+struct sim_frame_s {
+    uint64_t at_ns;   // ready for arbitration, or delivered
+    uint32_t can_id;
+    bool extended_id;
+    int len;
+    uint8_t data[MAX_FRAME_LEN];
+};
+
+// a ring of frames
+struct frame_queue_s {
+    struct sim_frame_s* f;
+    int capacity;
+    int head;
+    int count;
+};
+
+enum ecu_state_e {
+    ECU_RECEIVING,   // waiting for, or receiving, a request
+    ECU_RESPONDING,  // waiting out the response delay
+    ECU_SENDING,     // sending the response
+};
+
+struct isotp_sim_node_s {
+    isotp_sim_t sim;
+    uint32_t tx_id;
+    uint32_t rx_id;
+    bool extended_id;
+    bool blocking;
+
+    isotp_sim_node_t rx_next;   // another node receiving rx_id
+
+    struct frame_queue_s txq;
+    struct frame_queue_s rxq;
+    uint64_t last_ready_ns;     // frames of a node stay in order
+    uint64_t last_delivery_ns;
+
+    // a simulated ECU
+    bool is_ecu;
+    isotp_sim_ecu_t ecu;
+    isotp_ctx_t ctx;
+    enum ecu_state_e state;
+    uint64_t next_ns;           // response due, or next poll of a
+                                // transfer under way
+    uint8_t* request;
+    uint8_t* response;
+    int response_len;
+};
+
+// a binary min-heap of fixed size items
+struct heap_s {
+    uint8_t* items;
+    size_t item_sz;
+    int count;
+    int capacity;
+    bool (*before)(const void* a, const void* b);
+};
+
+// a node in a heap; seq keeps equal keys in FIFO order
+struct entry_s {
+    uint64_t key;
+    uint64_t seq;
+    isotp_sim_node_t node;
+};
+
+struct delivery_s {
+    uint64_t seq;
+    isotp_sim_node_t node;
+    struct sim_frame_s frame;
+};
+
+// the largest item of any heap
+#define MAX_HEAP_ITEM (sizeof(struct delivery_s))
+
+struct isotp_sim_s {
+    isotp_sim_opts_t opts;
+    uint64_t rng;
+    uint64_t now_ns;
+
+    isotp_sim_node_t* nodes;
+    int node_count;
+    int node_capacity;
+    isotp_sim_node_t* rx_index;     // by rx_id, open addressing
+    int rx_index_capacity;
+
+    bool transmitting;
+    isotp_sim_node_t sender;
+    struct sim_frame_s on_wire;
+    uint64_t bus_free_ns;
+
+    struct heap_s deliveries;   // in flight to the receivers, by time
+    struct heap_s waiting;      // nodes with a frame not yet ready, by time
+    struct heap_s ready;        // nodes with a frame ready, by priority
+    struct heap_s timers;       // ECU wake ups, by time; an entry no
+                                // longer matching next_ns is stale
+    uint64_t seq;
+
+    bool running;
+    int error;                  // an allocation failed within an event
+    isotp_sim_stats_t stats;
+};
+
+// xorshift64*; the only source of randomness, for repeatable runs
+static uint64_t sim_random(isotp_sim_t sim) {
+    sim->rng ^= sim->rng >> 12;
+    sim->rng ^= sim->rng << 25;
+    sim->rng ^= sim->rng >> 27;
+    return sim->rng * 2685821657736338717ULL;
+}
+
+// up to max_usec, in nanoseconds
+static uint64_t sim_jitter_ns(isotp_sim_t sim, const uint64_t max_usec) {
+    if (max_usec == 0) {
+        return 0;
+    }
+    return sim_random(sim) % ((max_usec * NSEC_PER_USEC) + 1);
+}
+
+static int queue_init(struct frame_queue_s* q, const int capacity) {
+    q->f = calloc(capacity, sizeof(*(q->f)));
+    if (q->f == NULL) {
+        return -ENOMEM;
+    }
+    q->capacity = capacity;
+    q->head = 0;
+    q->count = 0;
+    return EOK;
+}
+
+static inline struct sim_frame_s* queue_head(struct frame_queue_s* q) {
+    return (q->count > 0) ? &(q->f[q->head]) : NULL;
+}
+
+static inline struct sim_frame_s* queue_push(struct frame_queue_s* q) {
+    if (q->count == q->capacity) {
+        return NULL;
+    }
+    return &(q->f[(q->head + q->count++) % q->capacity]);
+}
+
+static inline void queue_pop(struct frame_queue_s* q) {
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+}
+
+// arbitration order: the base ID first, then an 11 bit ID ahead of a 29
+// bit ID with the same base ID (its SRR bit is recessive)
+static inline uint32_t priority(const struct sim_frame_s* f) {
+    return f->extended_id ? ((f->can_id << 1) | 1) : (f->can_id << 19);
+}
+
+static int heap_init(struct heap_s* h,
+                     const size_t item_sz,
+                     bool (*before)(const void* a, const void* b)) {
+    h->items = malloc(INITIAL_HEAP * item_sz);
+    if (h->items == NULL) {
+        return -ENOMEM;
+    }
+    h->item_sz = item_sz;
+    h->count = 0;
+    h->capacity = INITIAL_HEAP;
+    h->before = before;
+    return EOK;
+}
+
+static inline void* heap_item(struct heap_s* h, const int i) {
+    return h->items + (i * h->item_sz);
+}
+
+static inline void* heap_top(struct heap_s* h) {
+    return (h->count > 0) ? h->items : NULL;
+}
+
+static void heap_swap(struct heap_s* h, const int i, const int j) {
+    uint8_t tmp[MAX_HEAP_ITEM];
+    memcpy(tmp, heap_item(h, i), h->item_sz);
+    memcpy(heap_item(h, i), heap_item(h, j), h->item_sz);
+    memcpy(heap_item(h, j), tmp, h->item_sz);
+}
+
+static int heap_push(struct heap_s* h, const void* item) {
+    if (h->count == h->capacity) {
+        int capacity = h->capacity * 2;
+        uint8_t* items = realloc(h->items, capacity * h->item_sz);
+        if (items == NULL) {
+            return -ENOMEM;
+        }
+        h->items = items;
+        h->capacity = capacity;
+    }
+
+    int i = h->count++;
+    memcpy(heap_item(h, i), item, h->item_sz);
+    while ((i > 0) &&
+           (*(h->before))(heap_item(h, i), heap_item(h, (i - 1) / 2))) {
+        heap_swap(h, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    return EOK;
+}
+
+static void heap_pop(struct heap_s* h) {
+    if (--(h->count) == 0) {
+        return;
+    }
+
+    memcpy(heap_item(h, 0), heap_item(h, h->count), h->item_sz);
+    int i = 0;
+    while (true) {
+        int first = i;
+        int l = (2 * i) + 1;
+        int r = l + 1;
+        if ((l < h->count) &&
+            (*(h->before))(heap_item(h, l), heap_item(h, first))) {
+            first = l;
+        }
+        if ((r < h->count) &&
+            (*(h->before))(heap_item(h, r), heap_item(h, first))) {
+            first = r;
+        }
+        if (first == i) {
+            return;
+        }
+        heap_swap(h, i, first);
+        i = first;
+    }
+}
+
+static bool entry_before(const void* a, const void* b) {
+    const struct entry_s* x = (const struct entry_s*)a;
+    const struct entry_s* y = (const struct entry_s*)b;
+    return (x->key < y->key) || ((x->key == y->key) && (x->seq < y->seq));
+}
+
+static bool delivery_before(const void* a, const void* b) {
+    const struct delivery_s* x = (const struct delivery_s*)a;
+    const struct delivery_s* y = (const struct delivery_s*)b;
+    return (x->frame.at_ns < y->frame.at_ns) ||
+           ((x->frame.at_ns == y->frame.at_ns) && (x->seq < y->seq));
+}
+
+static int push_entry(isotp_sim_t sim,
+                      struct heap_s* h,
+                      const uint64_t key,
+                      isotp_sim_node_t node) {
+    struct entry_s e = {
+        .key = key,
+        .seq = sim->seq++,
+        .node = node,
+    };
+    return heap_push(h, &e);
+}
+
+static inline size_t rx_slot(isotp_sim_t sim,
+                             const uint32_t can_id,
+                             const bool extended_id) {
+    return ((can_id * 2654435761u) ^ (extended_id ? 1 : 0)) &
+           (sim->rx_index_capacity - 1);
+}
+
+// the first of the nodes receiving a CAN ID; the others follow rx_next
+static isotp_sim_node_t rx_lookup(isotp_sim_t sim,
+                                  const uint32_t can_id,
+                                  const bool extended_id) {
+    size_t i = rx_slot(sim, can_id, extended_id);
+    isotp_sim_node_t node;
+    while ((node = sim->rx_index[i]) != NULL) {
+        if ((node->rx_id == can_id) && (node->extended_id == extended_id)) {
+            return node;
+        }
+        i = (i + 1) & (sim->rx_index_capacity - 1);
+    }
+    return NULL;
+}
+
+static void rx_insert(isotp_sim_t sim, isotp_sim_node_t node) {
+    node->rx_next = NULL;
+    size_t i = rx_slot(sim, node->rx_id, node->extended_id);
+    isotp_sim_node_t n;
+    while ((n = sim->rx_index[i]) != NULL) {
+        if ((n->rx_id == node->rx_id) &&
+            (n->extended_id == node->extended_id)) {
+            // receivers stay in the order they were added
+            while (n->rx_next != NULL) {
+                n = n->rx_next;
+            }
+            n->rx_next = node;
+            return;
+        }
+        i = (i + 1) & (sim->rx_index_capacity - 1);
+    }
+    sim->rx_index[i] = node;
+}
+
+// index the last node added, keeping the index at most half full
+static int rx_index_add(isotp_sim_t sim) {
+    if ((2 * sim->node_count) <= sim->rx_index_capacity) {
+        rx_insert(sim, sim->nodes[sim->node_count - 1]);
+        return EOK;
+    }
+
+    int capacity = sim->rx_index_capacity * 2;
+    isotp_sim_node_t* index = calloc(capacity, sizeof(*index));
+    if (index == NULL) {
+        return -ENOMEM;
+    }
+    free(sim->rx_index);
+    sim->rx_index = index;
+    sim->rx_index_capacity = capacity;
+    for (int i=0; i < sim->node_count; i++) {
+        rx_insert(sim, sim->nodes[i]);
+    }
+    return EOK;
+}
+
+// the node's next frame joins arbitration when it is ready
+static int schedule_head(isotp_sim_node_t node) {
+    struct sim_frame_s* f = queue_head(&(node->txq));
+    if (f == NULL) {
+        return EOK;
+    }
+    return push_entry(node->sim, &(node->sim->waiting), f->at_ns, node);
+}
+
+static void ecu_wake_at(isotp_sim_node_t node, const uint64_t at_ns) {
+    isotp_sim_t sim = node->sim;
+    node->next_ns = at_ns;
+    int rc = push_entry(sim, &(sim->timers), at_ns, node);
+    if (rc < 0) {
+        sim->error = rc;
+    }
+}
+
+static int queue_frame(isotp_sim_node_t node,
+                       const uint8_t* frame_p,
+                       const int frame_len) {
+    isotp_sim_t sim = node->sim;
+    struct sim_frame_s* f = queue_push(&(node->txq));
+    if (f == NULL) {
+        return -ENOBUFS;
+    }
+
+    uint64_t ready = sim->now_ns + sim_jitter_ns(sim, sim->opts.tx_jitter_usec);
+    if (ready < node->last_ready_ns) {
+        ready = node->last_ready_ns;
+    }
+    node->last_ready_ns = ready;
+
+    f->at_ns = ready;
+    f->can_id = node->tx_id;
+    f->extended_id = node->extended_id;
+    f->len = frame_len;
+    memcpy(f->data, frame_p, frame_len);
+
+    if (node->txq.count == 1) {
+        int rc = schedule_head(node);
+        if (rc < 0) {
+            node->txq.count--;
+            return rc;
+        }
+    }
+
+    return frame_len;
+}
+
+static int ecu_tx_f(void* txfn_ctx,
+                    const uint8_t* tx_buf_p,
+                    const int tx_len,
+                    const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    isotp_sim_node_t node = (isotp_sim_node_t)txfn_ctx;
+
+    // runs within the simulation, so never waits; the ISOTP context
+    // retries on the next poll
+    return queue_frame(node, tx_buf_p, tx_len);
+}
+
+static int ecu_listen(isotp_sim_node_t node) {
+    node->state = ECU_RECEIVING;
+    node->next_ns = NEVER;
+    return isotp_recv_start(node->ctx,
+                           node->request,
+                           node->ecu.max_message_len,
+                           node->ecu.blocksize,
+                           node->ecu.stmin_usec,
+                           ECU_TIMEOUT_USEC);
+}
+
+static void ecu_request(isotp_sim_node_t node, const int len) {
+    isotp_sim_t sim = node->sim;
+    sim->stats.requests++;
+
+    uint64_t delay_usec = node->ecu.response_delay_usec;
+    if (node->ecu.respond_f != NULL) {
+        node->response_len = (*(node->ecu.respond_f))(node->ecu.respond_ctx,
+                                                      node->request,
+                                                      len,
+                                                      node->response,
+                                                      node->ecu.max_message_len,
+                                                      &delay_usec);
+    } else if (len > 0) {
+        // a positive response
+        node->response[0] = node->request[0] + 0x40;
+        node->response[1] = (len > 1) ? node->request[1] : 0;
+        node->response_len = (len > 1) ? 2 : 1;
+    } else {
+        node->response_len = 0;
+    }
+
+    if (node->response_len <= 0) {
+        (void)ecu_listen(node);
+        return;
+    }
+
+    node->state = ECU_RESPONDING;
+    ecu_wake_at(node,
+                sim->now_ns + (delay_usec * NSEC_PER_USEC) +
+                sim_jitter_ns(sim, node->ecu.response_jitter_usec));
+}
+
+// the outcome of a step of the ECU's transfer
+static void ecu_result(isotp_sim_node_t node, const int rc) {
+    if (rc == -EINPROGRESS) {
+        ecu_wake_at(node,
+                    node->sim->now_ns +
+                    (node->sim->opts.ecu_poll_usec * NSEC_PER_USEC));
+        return;
+    }
+
+    if (node->state == ECU_RECEIVING) {
+        if (rc >= 0) {
+            ecu_request(node, rc);
+        } else {
+            (void)ecu_listen(node);
+        }
+    } else if (node->state == ECU_SENDING) {
+        if (rc >= 0) {
+            node->sim->stats.responses++;
+        }
+        (void)ecu_listen(node);
+    }
+}
+
+static void ecu_frame(isotp_sim_node_t node, const struct sim_frame_s* f) {
+    if (node->state == ECU_RESPONDING) {
+        // busy; a real ECU might answer with NRC 0x21
+        return;
+    }
+    ecu_result(node,
+               isotp_rx_frame(node->ctx,
+                              f->data,
+                              f->len,
+                              node->sim->now_ns / NSEC_PER_USEC));
+}
+
+static void ecu_wake(isotp_sim_node_t node) {
+    isotp_sim_t sim = node->sim;
+    if (node->state == ECU_RESPONDING) {
+        int rc = isotp_send_start(node->ctx,
+                                  node->response,
+                                  node->response_len,
+                                  ECU_TIMEOUT_USEC);
+        if (rc == -ENOBUFS) {
+            // the transmit queue is full; try again shortly
+            ecu_wake_at(node,
+                        sim->now_ns +
+                        (sim->opts.ecu_poll_usec * NSEC_PER_USEC));
+            return;
+        } else if (rc < 0) {
+            (void)ecu_listen(node);
+            return;
+        }
+        node->state = ECU_SENDING;
+    }
+    ecu_result(node, isotp_poll(node->ctx, sim->now_ns / NSEC_PER_USEC));
+}
+
+static int add_delivery(isotp_sim_t sim,
+                        isotp_sim_node_t node,
+                        const uint64_t at_ns) {
+    struct delivery_s d = {
+        .seq = sim->seq++,
+        .node = node,
+        .frame = sim->on_wire,
+    };
+    d.frame.at_ns = at_ns;
+    return heap_push(&(sim->deliveries), &d);
+}
+
+// the frame on the wire has been sent; it reaches the nodes receiving its
+// CAN ID, unless it was lost
+static int end_of_frame(isotp_sim_t sim) {
+    sim->transmitting = false;
+    sim->stats.frames++;
+
+    if ((sim_random(sim) % PPM) < sim->opts.drop_ppm) {
+        sim->stats.dropped++;
+        return EOK;
+    }
+
+    for (isotp_sim_node_t node = rx_lookup(sim,
+                                           sim->on_wire.can_id,
+                                           sim->on_wire.extended_id);
+         node != NULL;
+         node = node->rx_next) {
+        if (node == sim->sender) {
+            continue;
+        }
+
+        uint64_t at = sim->now_ns +
+                      (sim->opts.latency_usec * NSEC_PER_USEC) +
+                      sim_jitter_ns(sim, sim->opts.rx_jitter_usec);
+        if (at < node->last_delivery_ns) {
+            at = node->last_delivery_ns;
+        }
+        node->last_delivery_ns = at;
+
+        int rc = add_delivery(sim, node, at);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+    return EOK;
+}
+
+// deliver the frames due, in the order they are due
+static void deliver(isotp_sim_t sim) {
+    struct delivery_s* top;
+    while (((top = heap_top(&(sim->deliveries))) != NULL) &&
+           (top->frame.at_ns <= sim->now_ns)) {
+        struct delivery_s d = *top;
+        heap_pop(&(sim->deliveries));
+
+        if (d.node->is_ecu) {
+            ecu_frame(d.node, &(d.frame));
+        } else {
+            struct sim_frame_s* f = queue_push(&(d.node->rxq));
+            if (f == NULL) {
+                sim->stats.overruns++;
+            } else {
+                *f = d.frame;
+            }
+        }
+    }
+}
+
+// wake the ECUs due
+static void wake(isotp_sim_t sim) {
+    struct entry_s* top;
+    while (((top = heap_top(&(sim->timers))) != NULL) &&
+           (top->key <= sim->now_ns)) {
+        struct entry_s t = *top;
+        heap_pop(&(sim->timers));
+        if (t.node->next_ns == t.key) {
+            t.node->next_ns = NEVER;
+            ecu_wake(t.node);
+        }
+    }
+}
+
+// put the winner of arbitration among the frames ready on the wire
+static int arbitrate(isotp_sim_t sim) {
+    struct entry_s* top;
+    while (((top = heap_top(&(sim->waiting))) != NULL) &&
+           (top->key <= sim->now_ns)) {
+        isotp_sim_node_t node = top->node;
+        heap_pop(&(sim->waiting));
+        int rc = push_entry(sim,
+                            &(sim->ready),
+                            priority(queue_head(&(node->txq))),
+                            node);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+
+    top = heap_top(&(sim->ready));
+    if (top == NULL) {
+        return EOK;
+    }
+    isotp_sim_node_t winner = top->node;
+
+    int64_t wire_ns = can_frame_time_ns(queue_head(&(winner->txq))->len,
+                                        sim->opts.can_format,
+                                        winner->extended_id,
+                                        sim->opts.nominal_bps,
+                                        sim->opts.data_bps);
+    if (wire_ns < 0) {
+        return (int)wire_ns;
+    }
+
+    heap_pop(&(sim->ready));
+    sim->on_wire = *queue_head(&(winner->txq));
+    queue_pop(&(winner->txq));
+    sim->sender = winner;
+    sim->transmitting = true;
+    sim->bus_free_ns = sim->now_ns + (uint64_t)wire_ns;
+    sim->stats.busy_ns += (uint64_t)wire_ns;
+
+    return schedule_head(winner);
+}
+
+static uint64_t next_event_ns(isotp_sim_t sim) {
+    uint64_t next = NEVER;
+
+    if (sim->transmitting) {
+        next = sim->bus_free_ns;
+    } else if (sim->ready.count > 0) {
+        next = sim->now_ns;
+    } else if (sim->waiting.count > 0) {
+        struct entry_s* w = heap_top(&(sim->waiting));
+        next = (w->key > sim->now_ns) ? w->key : sim->now_ns;
+    }
+
+    struct delivery_s* d = heap_top(&(sim->deliveries));
+    if ((d != NULL) && (d->frame.at_ns < next)) {
+        next = d->frame.at_ns;
+    }
+
+    struct entry_s* t;
+    while (((t = heap_top(&(sim->timers))) != NULL) &&
+           (t->node->next_ns != t->key)) {
+        heap_pop(&(sim->timers));
+    }
+    if ((t != NULL) && (t->key < next)) {
+        next = t->key;
+    }
+
+    return next;
+}
+
+typedef bool (*done_f)(isotp_sim_node_t node);
+
+/**
+ * @brief run the simulation until until_ns, or until done says so
+ *
+ * Everything due at one instant is handled before done is checked.
+ */
+static int run(isotp_sim_t sim,
+               const uint64_t until_ns,
+               done_f done,
+               isotp_sim_node_t node) {
+    if (sim->running) {
+        return -EBUSY;
+    }
+    sim->running = true;
+
+    int rc = EOK;
+    while ((rc == EOK) && !((done != NULL) && (*done)(node))) {
+        uint64_t next = next_event_ns(sim);
+        if (next > until_ns) {
+            sim->now_ns = until_ns;
+            break;
+        }
+        if (next > sim->now_ns) {
+            sim->now_ns = next;
+        }
+
+        if (sim->transmitting && (sim->bus_free_ns <= sim->now_ns)) {
+            rc = end_of_frame(sim);
+        }
+        deliver(sim);
+        wake(sim);
+        if ((rc == EOK) && !sim->transmitting) {
+            rc = arbitrate(sim);
+        }
+        if ((rc == EOK) && (sim->error < 0)) {
+            rc = sim->error;
+        }
+    }
+
+    sim->running = false;
+    return rc;
+}
+
+static bool has_frame(isotp_sim_node_t node) {
+    return (node->rxq.count > 0);
+}
+
+static bool has_room(isotp_sim_node_t node) {
+    return (node->txq.count < node->txq.capacity);
+}
+
+static isotp_sim_node_t add_node(isotp_sim_t sim,
+                                 const uint32_t tx_id,
+                                 const uint32_t rx_id,
+                                 const bool extended_id) {
+    if (sim->node_count == sim->node_capacity) {
+        int capacity = sim->node_capacity * 2;
+        isotp_sim_node_t* nodes = realloc(sim->nodes,
+                                          capacity * sizeof(*nodes));
+        if (nodes == NULL) {
+            return NULL;
+        }
+        sim->nodes = nodes;
+        sim->node_capacity = capacity;
+    }
+
+    isotp_sim_node_t node = calloc(1, sizeof(*node));
+    if (node == NULL) {
+        return NULL;
+    }
+    if ((queue_init(&(node->txq), sim->opts.tx_queue_depth) < 0) ||
+        (queue_init(&(node->rxq), RX_QUEUE_DEPTH) < 0)) {
+        free(node->txq.f);
+        free(node);
+        return NULL;
+    }
+
+    node->sim = sim;
+    node->tx_id = tx_id;
+    node->rx_id = rx_id;
+    node->extended_id = extended_id;
+    node->next_ns = NEVER;
+    sim->nodes[sim->node_count++] = node;
+
+    return node;
+}
+
+static void free_node(isotp_sim_node_t node) {
+    isotp_ctx_free(node->ctx);
+    free(node->request);
+    free(node->response);
+    free(node->txq.f);
+    free(node->rxq.f);
+    free(node);
+}
+
+int isotp_sim_init(isotp_sim_t* sim, const isotp_sim_opts_t* opts) {
+    if ((sim == NULL) || (opts == NULL) || (opts->tx_queue_depth < 0)) {
+        return -EINVAL;
+    }
+
+    // the bit rates are checked once, here
+    if (can_frame_time_ns(can_max_datalen(opts->can_format),
+                          opts->can_format,
+                          true,
+                          opts->nominal_bps,
+                          opts->data_bps) < 0) {
+        return -EINVAL;
+    }
+
+    isotp_sim_t s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        return -ENOMEM;
+    }
+
+    s->opts = *opts;
+    if (s->opts.tx_queue_depth == 0) {
+        s->opts.tx_queue_depth = DEFAULT_TX_QUEUE_DEPTH;
+    }
+    if (s->opts.ecu_poll_usec == 0) {
+        s->opts.ecu_poll_usec = DEFAULT_ECU_POLL_USEC;
+    }
+    // xorshift must not start from 0
+    s->rng = (opts->seed != 0) ? opts->seed : 0x9E3779B97F4A7C15ULL;
+
+    s->node_capacity = INITIAL_NODES;
+    s->nodes = calloc(s->node_capacity, sizeof(*(s->nodes)));
+    s->rx_index_capacity = INITIAL_RX_INDEX;
+    s->rx_index = calloc(s->rx_index_capacity, sizeof(*(s->rx_index)));
+    if ((s->nodes == NULL) || (s->rx_index == NULL) ||
+        (heap_init(&(s->deliveries),
+                   sizeof(struct delivery_s),
+                   delivery_before) < 0) ||
+        (heap_init(&(s->waiting), sizeof(struct entry_s), entry_before) < 0) ||
+        (heap_init(&(s->ready), sizeof(struct entry_s), entry_before) < 0) ||
+        (heap_init(&(s->timers), sizeof(struct entry_s), entry_before) < 0)) {
+        isotp_sim_free(s);
+        return -ENOMEM;
+    }
+
+    *sim = s;
+    return EOK;
+}
+
+void isotp_sim_free(isotp_sim_t sim) {
+    if (sim == NULL) {
+        return;
+    }
+
+    for (int i=0; i < sim->node_count; i++) {
+        free_node(sim->nodes[i]);
+    }
+    free(sim->nodes);
+    free(sim->rx_index);
+    free(sim->deliveries.items);
+    free(sim->waiting.items);
+    free(sim->ready.items);
+    free(sim->timers.items);
+    free(sim);
+}
+
+int isotp_sim_tester_add(isotp_sim_t sim,
+                         const uint32_t tx_id,
+                         const uint32_t rx_id,
+                         const bool extended_id,
+                         const bool blocking,
+                         isotp_sim_node_t* node) {
+    if ((sim == NULL) || (node == NULL)) {
+        return -EINVAL;
+    }
+
+    isotp_sim_node_t n = add_node(sim, tx_id, rx_id, extended_id);
+    if (n == NULL) {
+        return -ENOMEM;
+    }
+    if (rx_index_add(sim) < 0) {
+        sim->node_count--;
+        free_node(n);
+        return -ENOMEM;
+    }
+    n->blocking = blocking;
+
+    *node = n;
+    return EOK;
+}
+
+int isotp_sim_ecu_add(isotp_sim_t sim, const isotp_sim_ecu_t* ecu) {
+    if ((sim == NULL) || (ecu == NULL) || (ecu->max_message_len < 0)) {
+        return -EINVAL;
+    }
+
+    isotp_sim_node_t node = add_node(sim,
+                                     ecu->tx_id,
+                                     ecu->rx_id,
+                                     ecu->extended_id);
+    if (node == NULL) {
+        return -ENOMEM;
+    }
+
+    node->is_ecu = true;
+    node->ecu = *ecu;
+    if (node->ecu.max_message_len == 0) {
+        node->ecu.max_message_len = DEFAULT_MAX_MESSAGE_LEN;
+    }
+
+    // frames are delivered with isotp_rx_frame()
+    int rc = isotp_ctx_init(&(node->ctx),
+                            sim->opts.can_format,
+                            ecu->addressing_mode,
+                            0,
+                            node,
+                            NULL,
+                            ecu_tx_f);
+    node->request = malloc(node->ecu.max_message_len);
+    node->response = malloc(node->ecu.max_message_len);
+    if ((rc == EOK) && ((node->request == NULL) || (node->response == NULL))) {
+        rc = -ENOMEM;
+    }
+    if (rc == EOK) {
+        rc = ecu_listen(node);
+    }
+    if (rc == EOK) {
+        rc = rx_index_add(sim);
+    }
+    if (rc < 0) {
+        sim->node_count--;
+        free_node(node);
+        return rc;
+    }
+
+    return EOK;
+}
+
+uint64_t isotp_sim_now_us(isotp_sim_t sim) {
+    return (sim != NULL) ? (sim->now_ns / NSEC_PER_USEC) : 0;
+}
+
+int isotp_sim_run_for(isotp_sim_t sim, const uint64_t usec) {
+    if (sim == NULL) {
+        return -EINVAL;
+    }
+    return run(sim, sim->now_ns + (usec * NSEC_PER_USEC), NULL, NULL);
+}
+
+void isotp_sim_stats(isotp_sim_t sim, isotp_sim_stats_t* stats) {
+    if ((sim == NULL) || (stats == NULL)) {
+        return;
+    }
+    *stats = sim->stats;
+}
+
+int isotp_sim_rx_f(void* rxfn_ctx,
+                   uint8_t* rx_buf_p,
+                   const int rx_buf_sz,
+                   const uint64_t timeout_usec) {
+    isotp_sim_node_t node = (isotp_sim_node_t)rxfn_ctx;
+    if ((node == NULL) || (rx_buf_p == NULL)) {
+        return -EINVAL;
+    }
+
+    if (!has_frame(node)) {
+        if (!node->blocking || (timeout_usec == 0)) {
+            return -EAGAIN;
+        }
+        int rc = run(node->sim,
+                     node->sim->now_ns + (timeout_usec * NSEC_PER_USEC),
+                     has_frame,
+                     node);
+        if (rc < 0) {
+            return rc;
+        }
+        if (!has_frame(node)) {
+            return -ETIMEDOUT;
+        }
+    }
+
+    struct sim_frame_s* f = queue_head(&(node->rxq));
+    if (f->len > rx_buf_sz) {
+        return -ENOBUFS;
+    }
+    int len = f->len;
+    memcpy(rx_buf_p, f->data, len);
+    queue_pop(&(node->rxq));
+
+    return len;
+}
+
+int isotp_sim_tx_f(void* txfn_ctx,
+                   const uint8_t* tx_buf_p,
+                   const int tx_len,
+                   const uint64_t timeout_usec) {
+    isotp_sim_node_t node = (isotp_sim_node_t)txfn_ctx;
+    if ((node == NULL) || (tx_buf_p == NULL) || (tx_len < 0) ||
+        (tx_len > can_max_datalen(node->sim->opts.can_format))) {
+        return -EINVAL;
+    }
+
+    if (!has_room(node)) {
+        if (!node->blocking || (timeout_usec == 0)) {
+            return -ENOBUFS;
+        }
+        int rc = run(node->sim,
+                     node->sim->now_ns + (timeout_usec * NSEC_PER_USEC),
+                     has_room,
+                     node);
+        if (rc < 0) {
+            return rc;
+        }
+        if (!has_room(node)) {
+            return -ETIMEDOUT;
+        }
+    }
+
+    return queue_frame(node, tx_buf_p, tx_len);
+}
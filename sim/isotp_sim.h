@@ -0,0 +1,242 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <can/can.h>
+#include <isotp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Simulated CAN bus
+ *
+ * A discrete-event simulation of one CAN bus, on a virtual clock: frames
+ * take their on-wire time at the configured bit rates (can_frame_time_ns()),
+ * contend for the bus by arbitration (the lowest CAN ID goes first), and
+ * reach the other nodes after a latency.  Impairments are drawn from a
+ * seeded generator, so a run is repeated exactly with the same seed:
+ *   - jitter before a frame enters arbitration, which reorders the frames
+ *     of different nodes (never those of one node)
+ *   - jitter on the delivery of each frame
+ *   - frames lost on the bus
+ *
+ * Nodes are either testers, used as the can_ctx of an ISOTP context with
+ * isotp_sim_rx_f()/isotp_sim_tx_f(), or simulated ECUs, which receive
+ * requests and answer them as described by their personality.
+ *
+ * The virtual clock only advances within the simulator: while a blocking
+ * tester waits in isotp_sim_rx_f() (or in isotp_sim_tx_f(), for room in
+ * its transmit queue), and in isotp_sim_run_for().  Blocking transfers
+ * (isotp_send(), isotp_recv()) work as is, but their STmin waits are
+ * taken on the real clock, so the virtual clock sees the CFs back to back.
+ * Non-blocking transfers time everything on the virtual clock:
+ *
+ *     isotp_send_start(ctx, buf, len, timeout);
+ *     while ((rc = isotp_poll(ctx, isotp_sim_now_us(sim))) == -EINPROGRESS) {
+ *         isotp_sim_run_for(sim, 100);
+ *     }
+ */
+typedef struct isotp_sim_s* isotp_sim_t;
+typedef struct isotp_sim_node_s* isotp_sim_node_t;
+
+struct isotp_sim_opts_s {
+    can_format_t can_format;
+    uint32_t nominal_bps;
+    uint32_t data_bps;          // CAN-FD data phase; 0 for no BRS
+    uint64_t seed;
+    uint32_t drop_ppm;          // frames lost, per million
+    uint64_t tx_jitter_usec;    // up to this before arbitration
+    uint64_t latency_usec;      // from the end of a frame to its delivery
+    uint64_t rx_jitter_usec;    // up to this on top of the latency
+    int tx_queue_depth;         // frames a node can queue; 0 for 8
+    uint64_t ecu_poll_usec;     // how often busy ECUs are polled; 0 for 100
+};
+typedef struct isotp_sim_opts_s isotp_sim_opts_t;
+
+/**
+ * @brief produce the response of a simulated ECU
+ *
+ * @param respond_ctx - opaque context of the personality
+ * @param request_p - the request received
+ * @param request_len - length of the request
+ * @param response_p - buffer for the response
+ * @param response_sz - size of the response buffer
+ * @param delay_usec - the response delay of the personality; may be
+ *                     changed for this response
+ *
+ * @returns
+ * >0 - length of the response
+ * otherwise - no response is sent
+ */
+typedef int (*isotp_sim_respond_f)(void* respond_ctx,
+                                   const uint8_t* request_p,
+                                   const int request_len,
+                                   uint8_t* response_p,
+                                   const int response_sz,
+                                   uint64_t* delay_usec);
+
+/**
+ * @brief personality of a simulated ECU
+ *
+ * Without respond_f, the ECU answers each request with a positive
+ * response: the SID + 0x40, and the first parameter byte if any.
+ */
+struct isotp_sim_ecu_s {
+    uint32_t rx_id;                // CAN ID of the requests
+    uint32_t tx_id;                // CAN ID of the responses
+    bool extended_id;
+    isotp_addressing_mode_t addressing_mode;
+    uint8_t blocksize;             // BS of its FCs
+    int stmin_usec;                // STmin of its FCs
+    uint64_t response_delay_usec;  // from the request to the response
+    uint64_t response_jitter_usec; // up to this on top of the delay
+    int max_message_len;           // 0 for 4095
+    isotp_sim_respond_f respond_f;
+    void* respond_ctx;
+};
+typedef struct isotp_sim_ecu_s isotp_sim_ecu_t;
+
+struct isotp_sim_stats_s {
+    uint64_t frames;     // frames that went on the bus
+    uint64_t dropped;    // of which lost
+    uint64_t overruns;   // frames a tester had no room to receive
+    uint64_t busy_ns;    // time the bus was busy
+    uint64_t requests;   // requests the ECUs received
+    uint64_t responses;  // responses the ECUs sent in full
+};
+typedef struct isotp_sim_stats_s isotp_sim_stats_t;
+
+/**
+ * @brief create a simulated bus, with its clock at 0
+ *
+ * @param sim - updated with the allocated simulator
+ * @param opts - options
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_sim_init(isotp_sim_t* sim, const isotp_sim_opts_t* opts);
+
+/**
+ * @brief free a simulated bus and its nodes
+ *
+ * @param sim - simulator, may be NULL
+ */
+void isotp_sim_free(isotp_sim_t sim);
+
+/**
+ * @brief add a tester to the bus
+ *
+ * The node is the can_ctx to give isotp_sim_rx_f()/isotp_sim_tx_f().
+ *
+ * @param sim - simulator
+ * @param tx_id - CAN ID the tester transmits with
+ * @param rx_id - CAN ID the tester receives
+ * @param extended_id - true if the IDs are 29 bit IDs
+ * @param blocking - true to have isotp_sim_rx_f()/isotp_sim_tx_f() wait
+ *                   (on the virtual clock) for a frame or for room, as
+ *                   blocking transfers need; false for non-blocking ones
+ * @param node - updated with the node
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_sim_tester_add(isotp_sim_t sim,
+                         const uint32_t tx_id,
+                         const uint32_t rx_id,
+                         const bool extended_id,
+                         const bool blocking,
+                         isotp_sim_node_t* node);
+
+/**
+ * @brief add a simulated ECU to the bus
+ *
+ * @param sim - simulator
+ * @param ecu - personality; copied
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_sim_ecu_add(isotp_sim_t sim, const isotp_sim_ecu_t* ecu);
+
+/**
+ * @brief current time of the virtual clock, in microseconds
+ */
+uint64_t isotp_sim_now_us(isotp_sim_t sim);
+
+/**
+ * @brief advance the virtual clock, running everything that happens
+ *
+ * @param sim - simulator
+ * @param usec - how far to advance the clock
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int isotp_sim_run_for(isotp_sim_t sim, const uint64_t usec);
+
+/**
+ * @brief get the statistics of a simulated bus
+ */
+void isotp_sim_stats(isotp_sim_t sim, isotp_sim_stats_t* stats);
+
+/**
+ * @brief isotp_rx_f of a tester
+ *
+ * Returns the next frame delivered to the tester.  Without one, a
+ * blocking tester waits up to timeout_usec of virtual time, and returns
+ * -ETIMEDOUT if none arrives; a non-blocking one returns -EAGAIN.
+ */
+int isotp_sim_rx_f(void* rxfn_ctx,
+                   uint8_t* rx_buf_p,
+                   const int rx_buf_sz,
+                   const uint64_t timeout_usec);
+
+/**
+ * @brief isotp_tx_f of a tester
+ *
+ * Queues the frame for the bus.  With the queue full, a blocking tester
+ * waits up to timeout_usec of virtual time for room, and returns
+ * -ETIMEDOUT if there is none; a non-blocking one returns -ENOBUFS.
+ */
+int isotp_sim_tx_f(void* txfn_ctx,
+                   const uint8_t* tx_buf_p,
+                   const int tx_len,
+                   const uint64_t timeout_usec);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,444 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <isotp.h>
+#include "sim/isotp_sim.h"
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+// 8 data bytes, 11 bit ID: 135 bits at 2us
+#define FRAME_8_USEC (270)
+
+static isotp_sim_t new_sim(const uint64_t seed) {
+    isotp_sim_opts_t opts = {
+        .can_format = CAN_FORMAT,
+        .nominal_bps = 500000,
+        .seed = seed,
+    };
+    isotp_sim_t sim = NULL;
+    assert_true(isotp_sim_init(&sim, &opts) == EOK);
+    return sim;
+}
+
+static void fill_buf(uint8_t* buf, const int buf_sz, const uint8_t pattern) {
+    for (int i=0; i < buf_sz; i++) {
+        buf[i] = (uint8_t)(pattern + i);
+    }
+}
+
+static int respond_300_f(void* respond_ctx,
+                         const uint8_t* request_p,
+                         const int request_len,
+                         uint8_t* response_p,
+                         const int response_sz,
+                         uint64_t* delay_usec) {
+    (void)respond_ctx;
+    (void)request_len;
+    (void)delay_usec;
+    assert_true(response_sz >= 300);
+    fill_buf(response_p, 300, request_p[0]);
+    return 300;
+}
+
+static void sim_invalid_parameters(void** state) {
+    (void)state;
+    isotp_sim_opts_t opts = { .can_format = CAN_FORMAT };
+    isotp_sim_t sim = NULL;
+    isotp_sim_node_t node = NULL;
+    uint8_t frame[8] = {0};
+
+    assert_true(isotp_sim_init(NULL, &opts) == -EINVAL);
+    assert_true(isotp_sim_init(&sim, NULL) == -EINVAL);
+    // no bit rate
+    assert_true(isotp_sim_init(&sim, &opts) == -EINVAL);
+
+    sim = new_sim(1);
+    assert_true(isotp_sim_tester_add(sim, 0x7E0, 0x7E8, false, true,
+                                     NULL) == -EINVAL);
+    assert_true(isotp_sim_ecu_add(sim, NULL) == -EINVAL);
+    assert_true(isotp_sim_tester_add(sim, 0x7E0, 0x7E8, false, false,
+                                     &node) == EOK);
+    assert_true(isotp_sim_tx_f(node, frame, 9, 0) == -EINVAL);
+    assert_true(isotp_sim_rx_f(node, frame, 8, 0) == -EAGAIN);
+    assert_true(isotp_sim_run_for(NULL, 10) == -EINVAL);
+    isotp_sim_free(sim);
+    isotp_sim_free(NULL);
+}
+
+static void sim_wire_time_and_arbitration(void** state) {
+    (void)state;
+    isotp_sim_opts_t opts = {
+        .can_format = CAN_FORMAT,
+        .nominal_bps = 500000,
+        .latency_usec = 100,
+    };
+    isotp_sim_t sim = NULL;
+    assert_true(isotp_sim_init(&sim, &opts) == EOK);
+
+    isotp_sim_node_t a = NULL;
+    isotp_sim_node_t b = NULL;
+    isotp_sim_node_t c = NULL;
+    isotp_sim_node_t d = NULL;
+    assert_true(isotp_sim_tester_add(sim, 0x100, 0x7FF, false, true,
+                                     &a) == EOK);
+    assert_true(isotp_sim_tester_add(sim, 0x080, 0x7FF, false, true,
+                                     &b) == EOK);
+    assert_true(isotp_sim_tester_add(sim, 0x7FF, 0x100, false, true,
+                                     &c) == EOK);
+    assert_true(isotp_sim_tester_add(sim, 0x7FF, 0x080, false, false,
+                                     &d) == EOK);
+
+    // queued first, but 0x080 wins arbitration
+    uint8_t frame[8];
+    uint8_t rx[8];
+    fill_buf(frame, sizeof(frame), 0x10);
+    assert_true(isotp_sim_tx_f(a, frame, 8, 0) == 8);
+    assert_true(isotp_sim_tx_f(b, frame, 8, 0) == 8);
+    assert_true(isotp_sim_now_us(sim) == 0);
+
+    assert_true(isotp_sim_rx_f(c, rx, sizeof(rx), 10000) == 8);
+    assert_memory_equal(rx, frame, sizeof(frame));
+    assert_true(isotp_sim_now_us(sim) == ((2 * FRAME_8_USEC) + 100));
+    assert_true(isotp_sim_rx_f(d, rx, sizeof(rx), 0) == 8);
+
+    // nothing more
+    assert_true(isotp_sim_rx_f(c, rx, sizeof(rx), 1000) == -ETIMEDOUT);
+    assert_true(isotp_sim_now_us(sim) == ((2 * FRAME_8_USEC) + 1100));
+
+    isotp_sim_stats_t stats;
+    isotp_sim_stats(sim, &stats);
+    assert_true(stats.frames == 2);
+    assert_true(stats.dropped == 0);
+    assert_true(stats.busy_ns == (2 * FRAME_8_USEC * 1000));
+
+    isotp_sim_free(sim);
+}
+
+static void sim_receivers(void** state) {
+    (void)state;
+    isotp_sim_t sim = new_sim(1);
+
+    // two nodes listening to one CAN ID, then enough for the index to grow
+    isotp_sim_node_t tx = NULL;
+    isotp_sim_node_t listeners[2] = {NULL};
+    isotp_sim_node_t nodes[100] = {NULL};
+    assert_true(isotp_sim_tester_add(sim, 0x7DF, 0x7FF, false, false,
+                                     &tx) == EOK);
+    for (int i=0; i < 2; i++) {
+        assert_true(isotp_sim_tester_add(sim, 0x7FF, 0x7DF, false, false,
+                                         &(listeners[i])) == EOK);
+    }
+    for (int i=0; i < 100; i++) {
+        assert_true(isotp_sim_tester_add(sim, 0x7FF, 0x18DA0000 + i, true,
+                                         false, &(nodes[i])) == EOK);
+    }
+    isotp_sim_node_t ext_tx = NULL;
+    assert_true(isotp_sim_tester_add(sim, 0x18DA0000, 0x7FF, true, false,
+                                     &ext_tx) == EOK);
+
+    uint8_t frame[8];
+    uint8_t rx[8];
+    fill_buf(frame, sizeof(frame), 0x20);
+    assert_true(isotp_sim_tx_f(tx, frame, 8, 0) == 8);
+    assert_true(isotp_sim_run_for(sim, 1000) == EOK);
+    for (int i=0; i < 2; i++) {
+        assert_true(isotp_sim_rx_f(listeners[i], rx, sizeof(rx), 0) == 8);
+        assert_memory_equal(rx, frame, sizeof(frame));
+    }
+    // not the sender itself
+    assert_true(isotp_sim_rx_f(tx, rx, sizeof(rx), 0) == -EAGAIN);
+
+    // the 29 bit ID reaches only its receiver
+    assert_true(isotp_sim_tx_f(ext_tx, frame, 8, 0) == 8);
+    assert_true(isotp_sim_run_for(sim, 1000) == EOK);
+    assert_true(isotp_sim_rx_f(nodes[0], rx, sizeof(rx), 0) == 8);
+    for (int i=1; i < 100; i++) {
+        assert_true(isotp_sim_rx_f(nodes[i], rx, sizeof(rx), 0) == -EAGAIN);
+    }
+
+    isotp_sim_free(sim);
+}
+
+static void sim_canfd_blocking_sf(void** state) {
+    (void)state;
+    isotp_sim_opts_t opts = {
+        .can_format = CANFD_FORMAT,
+        .nominal_bps = 500000,
+        .data_bps = 2000000,
+    };
+    isotp_sim_t sim = NULL;
+    assert_true(isotp_sim_init(&sim, &opts) == EOK);
+    isotp_sim_node_t a = NULL;
+    isotp_sim_node_t b = NULL;
+    assert_true(isotp_sim_tester_add(sim, 0x7E0, 0x7E8, false, true,
+                                     &a) == EOK);
+    assert_true(isotp_sim_tester_add(sim, 0x7E8, 0x7E0, false, true,
+                                     &b) == EOK);
+    isotp_ctx_t ctx_a = NULL;
+    isotp_ctx_t ctx_b = NULL;
+    assert_true(isotp_ctx_init(&ctx_a, CANFD_FORMAT,
+                               ISOTP_NORMAL_ADDRESSING_MODE, 0, a,
+                               isotp_sim_rx_f, isotp_sim_tx_f) == EOK);
+    assert_true(isotp_ctx_init(&ctx_b, CANFD_FORMAT,
+                               ISOTP_NORMAL_ADDRESSING_MODE, 0, b,
+                               isotp_sim_rx_f, isotp_sim_tx_f) == EOK);
+
+    // an SF with an escape sequence, to a context that has sent nothing
+    uint8_t request[20];
+    uint8_t rx[64] = {0};
+    fill_buf(request, sizeof(request), 0x40);
+    assert_true(isotp_send(ctx_a, request, sizeof(request), 1000000) >= 0);
+    assert_true(isotp_recv(ctx_b, rx, sizeof(rx), 0, 0, 1000000) >= 0);
+    assert_memory_equal(rx, request, sizeof(request));
+
+    isotp_ctx_free(ctx_a);
+    isotp_ctx_free(ctx_b);
+    isotp_sim_free(sim);
+}
+
+static void sim_blocking_short_fc(void** state) {
+    (void)state;
+    isotp_sim_opts_t opts = {
+        .can_format = CAN_FORMAT,
+        .nominal_bps = 500000,
+    };
+    isotp_sim_t sim = NULL;
+    assert_true(isotp_sim_init(&sim, &opts) == EOK);
+    isotp_sim_node_t a = NULL;
+    isotp_sim_node_t b = NULL;
+    assert_true(isotp_sim_tester_add(sim, 0x7E0, 0x7E8, false, true,
+                                     &a) == EOK);
+    assert_true(isotp_sim_tester_add(sim, 0x7E8, 0x7E0, false, true,
+                                     &b) == EOK);
+    isotp_ctx_t ctx_a = NULL;
+    assert_true(isotp_ctx_init(&ctx_a, CAN_FORMAT,
+                               ISOTP_NORMAL_ADDRESSING_MODE, 0, a,
+                               isotp_sim_rx_f, isotp_sim_tx_f) == EOK);
+
+    // an FC without its STmin is judged by its own length, not by that of
+    // the FF sent before it
+    const uint8_t short_fc[] = { 0x30, 0x00 };
+    uint8_t request[20];
+    fill_buf(request, sizeof(request), 0x00);
+    assert_true(isotp_sim_tx_f(b, short_fc, sizeof(short_fc), 1000000) ==
+                sizeof(short_fc));
+    assert_true(isotp_send(ctx_a, request, sizeof(request), 1000000) ==
+                -EMSGSIZE);
+
+    isotp_ctx_free(ctx_a);
+    isotp_sim_free(sim);
+}
+
+static void sim_ecu_round_trip(void** state) {
+    (void)state;
+    isotp_sim_t sim = new_sim(1);
+    isotp_sim_ecu_t ecu = {
+        .rx_id = 0x7E0,
+        .tx_id = 0x7E8,
+        .addressing_mode = ISOTP_NORMAL_ADDRESSING_MODE,
+        .blocksize = 8,
+        .response_delay_usec = 50000,
+        .respond_f = respond_300_f,
+    };
+    assert_true(isotp_sim_ecu_add(sim, &ecu) == EOK);
+
+    isotp_sim_node_t tester = NULL;
+    assert_true(isotp_sim_tester_add(sim, 0x7E0, 0x7E8, false, true,
+                                     &tester) == EOK);
+    isotp_ctx_t ctx = NULL;
+    assert_true(isotp_ctx_init(&ctx, CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, tester, isotp_sim_rx_f,
+                               isotp_sim_tx_f) == EOK);
+
+    uint8_t request[100];
+    fill_buf(request, sizeof(request), 0x36);
+    assert_true(isotp_send(ctx, request, sizeof(request), 1000000) >= 0);
+
+    uint8_t response[4095];
+    uint8_t expected[300];
+    fill_buf(expected, sizeof(expected), 0x36);
+    assert_true(isotp_recv(ctx, response, sizeof(response), 0, 0, 1000000) ==
+                300);
+    assert_memory_equal(response, expected, sizeof(expected));
+
+    // the response delay, and at least the frames of both messages
+    assert_true(isotp_sim_now_us(sim) >= (50000 + ((15 + 43) * FRAME_8_USEC)));
+
+    isotp_sim_stats_t stats;
+    isotp_sim_stats(sim, &stats);
+    assert_true(stats.requests == 1);
+    assert_true(stats.responses == 1);
+
+    isotp_ctx_free(ctx);
+    isotp_sim_free(sim);
+}
+
+// a 4095 byte request to an ECU asking for 1ms between CFs, on a noisy
+// bus, run non-blocking on the virtual clock; returns how long it took
+static uint64_t transfer_usec(const uint64_t seed) {
+    isotp_sim_opts_t opts = {
+        .can_format = CAN_FORMAT,
+        .nominal_bps = 500000,
+        .seed = seed,
+        .tx_jitter_usec = 200,
+        .latency_usec = 50,
+        .rx_jitter_usec = 100,
+    };
+    isotp_sim_t sim = NULL;
+    assert_true(isotp_sim_init(&sim, &opts) == EOK);
+    isotp_sim_ecu_t ecu = {
+        .rx_id = 0x7E0,
+        .tx_id = 0x7E8,
+        .addressing_mode = ISOTP_NORMAL_ADDRESSING_MODE,
+        .stmin_usec = 1000,
+        .response_delay_usec = 1000,
+        .response_jitter_usec = 500,
+    };
+    assert_true(isotp_sim_ecu_add(sim, &ecu) == EOK);
+
+    // bus traffic at a higher priority
+    isotp_sim_node_t other = NULL;
+    assert_true(isotp_sim_tester_add(sim, 0x100, 0x7FF, false, false,
+                                     &other) == EOK);
+
+    isotp_sim_node_t tester = NULL;
+    assert_true(isotp_sim_tester_add(sim, 0x7E0, 0x7E8, false, false,
+                                     &tester) == EOK);
+    isotp_ctx_t ctx = NULL;
+    assert_true(isotp_ctx_init(&ctx, CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, tester, isotp_sim_rx_f,
+                               isotp_sim_tx_f) == EOK);
+
+    static uint8_t request[4095];
+    fill_buf(request, sizeof(request), 0x36);
+    uint8_t frame[8] = {0};
+    int polls = 0;
+    int rc = isotp_send_start(ctx, request, sizeof(request), 1000000);
+    assert_true(rc == EOK);
+    while ((rc = isotp_poll(ctx, isotp_sim_now_us(sim))) == -EINPROGRESS) {
+        if ((polls++ % 20) == 0) {
+            (void)isotp_sim_tx_f(other, frame, sizeof(frame), 0);
+        }
+        assert_true(isotp_sim_run_for(sim, 50) == EOK);
+    }
+    assert_true(rc == (int)sizeof(request));
+
+    uint8_t response[8];
+    assert_true(isotp_recv_start(ctx, response, sizeof(response), 0, 0,
+                                 1000000) == EOK);
+    while ((rc = isotp_poll(ctx, isotp_sim_now_us(sim))) == -EINPROGRESS) {
+        assert_true(isotp_sim_run_for(sim, 50) == EOK);
+    }
+    assert_true(rc == 2);
+    assert_true(response[0] == 0x76);
+    assert_true(response[1] == 0x37);
+
+    uint64_t elapsed = isotp_sim_now_us(sim);
+    isotp_ctx_free(ctx);
+    isotp_sim_free(sim);
+    return elapsed;
+}
+
+static void sim_repeatable(void** state) {
+    (void)state;
+    uint64_t t1 = transfer_usec(42);
+
+    // 584 CFs, at least STmin apart
+    assert_true(t1 >= (584 * 1000));
+    assert_true(t1 < (584 * 1500));
+
+    // the same run again, and a different one
+    assert_true(transfer_usec(42) == t1);
+    assert_true(transfer_usec(43) != t1);
+}
+
+static void sim_lossy_bus(void** state) {
+    (void)state;
+    isotp_sim_opts_t opts = {
+        .can_format = CAN_FORMAT,
+        .nominal_bps = 500000,
+        .drop_ppm = 1000000,
+    };
+    isotp_sim_t sim = NULL;
+    assert_true(isotp_sim_init(&sim, &opts) == EOK);
+    isotp_sim_ecu_t ecu = {
+        .rx_id = 0x7E0,
+        .tx_id = 0x7E8,
+        .addressing_mode = ISOTP_NORMAL_ADDRESSING_MODE,
+    };
+    assert_true(isotp_sim_ecu_add(sim, &ecu) == EOK);
+    isotp_sim_node_t tester = NULL;
+    assert_true(isotp_sim_tester_add(sim, 0x7E0, 0x7E8, false, true,
+                                     &tester) == EOK);
+    isotp_ctx_t ctx = NULL;
+    assert_true(isotp_ctx_init(&ctx, CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, tester, isotp_sim_rx_f,
+                               isotp_sim_tx_f) == EOK);
+
+    // the request never arrives, so neither does a response
+    const uint8_t request[] = { 0x3E, 0x00 };
+    assert_true(isotp_send(ctx, request, sizeof(request), 1000000) >= 0);
+    uint8_t response[8];
+    assert_true(isotp_recv(ctx, response, sizeof(response), 0, 0, 200000) ==
+                -ETIMEDOUT);
+    assert_true(isotp_sim_now_us(sim) == 200000);
+
+    isotp_sim_stats_t stats;
+    isotp_sim_stats(sim, &stats);
+    assert_true(stats.frames == 1);
+    assert_true(stats.dropped == 1);
+    assert_true(stats.requests == 0);
+
+    isotp_ctx_free(ctx);
+    isotp_sim_free(sim);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(sim_invalid_parameters),
+        cmocka_unit_test(sim_wire_time_and_arbitration),
+        cmocka_unit_test(sim_receivers),
+        cmocka_unit_test(sim_canfd_blocking_sf),
+        cmocka_unit_test(sim_blocking_short_fc),
+        cmocka_unit_test(sim_ecu_round_trip),
+        cmocka_unit_test(sim_repeatable),
+        cmocka_unit_test(sim_lossy_bus),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
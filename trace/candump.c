@@ -0,0 +1,275 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace/candump.h"
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+#define USEC_PER_SEC (1000000)
+#define USEC_DIGITS (6)
+
+#define STD_ID_DIGITS (3)
+#define EXT_ID_DIGITS (8)
+#define STD_ID_MASK (0x7FFU)
+#define EXT_ID_MASK (0x1FFFFFFFU)
+
+// @ref linux/can.h; set in the CAN ID of an error frame
+#define CAN_ERR_FLAG (0x20000000U)
+
+static inline int hex_value(const char c) {
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    } else if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    } else if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static inline bool is_space(const char c) {
+    return (c == ' ') || (c == '\t') || (c == '\r');
+}
+
+// "(seconds.fraction)"
+static int parse_timestamp(const char** pp, const char* end, uint64_t* ts_us) {
+    const char* p = *pp;
+
+    if ((p == end) || (*p != '(')) {
+        return -EBADMSG;
+    }
+    p++;
+
+    uint64_t sec = 0;
+    const char* digits = p;
+    while ((p < end) && (*p >= '0') && (*p <= '9')) {
+        sec = (sec * 10) + (*p - '0');
+        p++;
+    }
+    if ((p == digits) || (p == end) || (*p != '.')) {
+        return -EBADMSG;
+    }
+    p++;
+
+    // keep microseconds, whatever the number of digits
+    uint64_t usec = 0;
+    int n = 0;
+    while ((p < end) && (*p >= '0') && (*p <= '9')) {
+        if (n < USEC_DIGITS) {
+            usec = (usec * 10) + (*p - '0');
+        }
+        n++;
+        p++;
+    }
+    for (; n < USEC_DIGITS; n++) {
+        usec *= 10;
+    }
+    if ((p == end) || (*p != ')')) {
+        return -EBADMSG;
+    }
+    p++;
+
+    *ts_us = (sec * USEC_PER_SEC) + usec;
+    *pp = p;
+
+    return EOK;
+}
+
+int candump_parse_line(const char* line,
+                       const size_t len,
+                       candump_frame_t* frame) {
+    if ((line == NULL) || (frame == NULL)) {
+        return -EINVAL;
+    }
+
+    const char* p = line;
+    const char* end = line + len;
+
+    while ((p < end) && is_space(*p)) {
+        p++;
+    }
+    if (p == end) {
+        return -ENOMSG;
+    }
+
+    int rc = parse_timestamp(&p, end, &(frame->ts_us));
+    if (rc < 0) {
+        return rc;
+    }
+
+    // the interface
+    while ((p < end) && is_space(*p)) {
+        p++;
+    }
+    while ((p < end) && !is_space(*p)) {
+        p++;
+    }
+    while ((p < end) && is_space(*p)) {
+        p++;
+    }
+
+    // the CAN ID
+    uint32_t can_id = 0;
+    int id_digits = 0;
+    int v = 0;
+    while ((p < end) && ((v = hex_value(*p)) >= 0)) {
+        can_id = (can_id << 4) | (uint32_t)v;
+        id_digits++;
+        p++;
+    }
+    if ((id_digits == 0) ||
+        (id_digits > EXT_ID_DIGITS) ||
+        (p == end) ||
+        (*p != '#')) {
+        return -EBADMSG;
+    }
+    p++;
+
+    frame->extended_id = (id_digits > STD_ID_DIGITS);
+    if (frame->extended_id && ((can_id & CAN_ERR_FLAG) != 0)) {
+        return -ENOMSG;
+    }
+    frame->can_id = can_id & (frame->extended_id ? EXT_ID_MASK : STD_ID_MASK);
+
+    // CAN-FD frames have a second '#', and a flags digit
+    frame->format = CAN_FORMAT;
+    frame->flags = 0;
+    if ((p < end) && (*p == '#')) {
+        p++;
+        if ((p == end) || ((v = hex_value(*p)) < 0)) {
+            return -EBADMSG;
+        }
+        frame->format = CANFD_FORMAT;
+        frame->flags = (uint8_t)v;
+        p++;
+    } else if ((p < end) && ((*p == 'R') || (*p == 'r'))) {
+        // remote frame
+        return -ENOMSG;
+    }
+
+    int max_len = can_max_datalen(frame->format);
+    frame->len = 0;
+    while ((p < end) && !is_space(*p)) {
+        if (*p == '.') {
+            p++;
+            continue;
+        }
+
+        int hi = hex_value(*p);
+        int lo = ((p + 1) < end) ? hex_value(p[1]) : -1;
+        if ((hi < 0) || (lo < 0) || (frame->len == max_len)) {
+            return -EBADMSG;
+        }
+        frame->data[frame->len++] = (uint8_t)((hi << 4) | lo);
+        p += 2;
+    }
+
+    // anything after the data (e.g. a direction flag) is ignored
+    return EOK;
+}
+
+int candump_open(candump_log_t* log, const char* path) {
+    if ((log == NULL) || (path == NULL)) {
+        return -EINVAL;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int rc = -errno;
+        (void)close(fd);
+        return rc;
+    }
+
+    log->base = NULL;
+    log->size = (size_t)st.st_size;
+
+    if (log->size > 0) {
+        void* base = mmap(NULL, log->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            int rc = -errno;
+            (void)close(fd);
+            return rc;
+        }
+        // the log is read front to back
+        (void)madvise(base, log->size, MADV_SEQUENTIAL);
+        log->base = (const char*)base;
+    }
+
+    // the mapping stays valid without the descriptor
+    (void)close(fd);
+
+    return EOK;
+}
+
+void candump_close(candump_log_t* log) {
+    if ((log == NULL) || (log->base == NULL)) {
+        return;
+    }
+
+    (void)munmap((void*)log->base, log->size);
+    log->base = NULL;
+    log->size = 0;
+}
+
+int candump_next(const candump_log_t* log,
+                 size_t* offset,
+                 const size_t end,
+                 candump_frame_t* frame) {
+    if ((log == NULL) || (offset == NULL) || (frame == NULL)) {
+        return -EINVAL;
+    }
+
+    size_t stop = (end < log->size) ? end : log->size;
+    while (*offset < stop) {
+        const char* line = &(log->base[*offset]);
+        const char* nl = memchr(line, '\n', stop - *offset);
+        size_t len = (nl != NULL) ? (size_t)(nl - line) : (stop - *offset);
+        *offset = (nl != NULL) ? (*offset + len + 1) : stop;
+
+        int rc = candump_parse_line(line, len, frame);
+        if (rc != -ENOMSG) {
+            return rc;
+        }
+    }
+
+    return -ENODATA;
+}
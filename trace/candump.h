@@ -0,0 +1,140 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <can/can.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Reading candump logs
+ *
+ * Logs are the format written by `candump -l` (and read by canplayer):
+ *
+ *     (1436509052.249713) can0 7E0#0210030000000000
+ *     (1436509052.250101) can0 18DA10F1##1112233445566778899AABB
+ *
+ * one frame per line: the timestamp in seconds, the interface, and the
+ * CAN ID (3 hex digits for an 11 bit ID, 8 for a 29 bit ID) followed by
+ * '#' and the data of a CAN frame, or by "##", a flags digit and the data
+ * of a CAN-FD frame.
+ *
+ * The log is memory-mapped, and frames are parsed straight out of the
+ * mapping, so reading it costs no more than one pass over the file.
+ */
+
+#define CANDUMP_MAX_DATALEN (64)
+
+// CAN-FD flags, @ref linux/can.h
+#define CANDUMP_FD_BRS (0x01)
+#define CANDUMP_FD_ESI (0x02)
+
+struct candump_frame_s {
+    uint64_t ts_us;       // timestamp, in microseconds
+    uint32_t can_id;
+    bool extended_id;     // can_id is a 29 bit ID
+    can_format_t format;
+    uint8_t flags;        // CAN-FD flags
+    int len;
+    uint8_t data[CANDUMP_MAX_DATALEN];
+};
+typedef struct candump_frame_s candump_frame_t;
+
+struct candump_log_s {
+    const char* base;  // mapping of the whole file
+    size_t size;
+};
+typedef struct candump_log_s candump_log_t;
+
+/**
+ * @brief parse one line of a candump log
+ *
+ * @param line - start of the line
+ * @param len - length of the line, not including the newline
+ * @param frame - updated with the frame
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ *     -ENOMSG = the line holds no data frame (it is empty, or holds a
+ *               remote or error frame)
+ *     -EBADMSG = the line is malformed
+ */
+int candump_parse_line(const char* line,
+                       const size_t len,
+                       candump_frame_t* frame);
+
+/**
+ * @brief memory-map a candump log
+ *
+ * @param log - updated with the mapping
+ * @param path - path of the log
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int candump_open(candump_log_t* log, const char* path);
+
+/**
+ * @brief unmap a candump log
+ *
+ * @param log - log
+ */
+void candump_close(candump_log_t* log);
+
+/**
+ * @brief read the next data frame of a log
+ *
+ * Lines that hold no data frame are skipped.
+ *
+ * @param log - log
+ * @param offset - in: where to start reading, out: the start of the
+ *                 next line
+ * @param end - offset to stop reading at
+ * @param frame - updated with the frame
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ *     -ENODATA = there are no more frames before end
+ *     -EBADMSG = the line was malformed; offset is past it, so the
+ *                caller may carry on reading
+ */
+int candump_next(const candump_log_t* log,
+                 size_t* offset,
+                 const size_t end,
+                 candump_frame_t* frame);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,437 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <isotp.h>
+#include "trace/candump.h"
+#include "trace/candump_decode.h"
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+#define MIN_CHUNK_SIZE (1 << 20)
+#define MAX_CHUNK_SIZE (16 << 20)
+
+// chunks per thread decoded or waiting to be delivered at any time
+#define CHUNKS_PER_THREAD (4)
+
+#define INITIAL_MSGS (1024)
+#define INITIAL_DATA (64 * 1024)
+
+struct chunk_msg_s {
+    isotp_message_t msg;
+    size_t data_off;    // into the chunk's data, which may move as it grows
+    uint64_t order_us;  // time of the frame that ended it
+    int seq;            // order it was stored in
+};
+
+struct chunk_s {
+    size_t start;
+    size_t end;
+    isotp_decoder_t decoder;
+
+    // messages completed within the chunk, awaiting delivery
+    struct chunk_msg_s* msgs;
+    int msg_count;
+    int msg_cap;
+    uint8_t* data;
+    size_t data_len;
+    size_t data_cap;
+
+    uint64_t frame_us;  // of the frame being decoded
+    uint64_t frames;
+    uint64_t bad_lines;
+    int rc;
+    bool done;
+};
+
+struct pool_s {
+    const candump_log_t* log;
+    const candump_decode_opts_t* opts;
+    struct chunk_s* chunks;
+    int chunk_count;
+    int window;  // chunks claimed ahead of delivery
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int next;       // next chunk to decode
+    int delivered;  // chunks delivered
+    bool abort;
+};
+
+// counts what is delivered on its way to the caller
+struct deliver_s {
+    isotp_message_f message_f;
+    void* cb_ctx;
+    candump_decode_stats_t* stats;
+};
+
+static void deliver_f(void* cb_ctx, const isotp_message_t* msg) {
+    struct deliver_s* dl = (struct deliver_s*)cb_ctx;
+
+    dl->stats->messages++;
+    if (msg->len < 0) {
+        dl->stats->failed++;
+    }
+    (*(dl->message_f))(dl->cb_ctx, msg);
+}
+
+static void store_f(void* cb_ctx, const isotp_message_t* msg) {
+    struct chunk_s* c = (struct chunk_s*)cb_ctx;
+    if (c->rc < 0) {
+        return;
+    }
+
+    if (c->msg_count == c->msg_cap) {
+        int cap = (c->msg_cap > 0) ? (2 * c->msg_cap) : INITIAL_MSGS;
+        struct chunk_msg_s* msgs = realloc(c->msgs, cap * sizeof(*msgs));
+        if (msgs == NULL) {
+            c->rc = -ENOMEM;
+            return;
+        }
+        c->msgs = msgs;
+        c->msg_cap = cap;
+    }
+
+    size_t len = (msg->len > 0) ? (size_t)msg->len : 0;
+    if ((c->data_len + len) > c->data_cap) {
+        size_t cap = (c->data_cap > 0) ? c->data_cap : INITIAL_DATA;
+        while ((c->data_len + len) > cap) {
+            cap *= 2;
+        }
+        uint8_t* data = realloc(c->data, cap);
+        if (data == NULL) {
+            c->rc = -ENOMEM;
+            return;
+        }
+        c->data = data;
+        c->data_cap = cap;
+    }
+
+    struct chunk_msg_s* m = &(c->msgs[c->msg_count]);
+    m->msg = *msg;
+    m->data_off = c->data_len;
+    m->order_us = c->frame_us;
+    m->seq = c->msg_count++;
+    if (len > 0) {
+        memcpy(&(c->data[c->data_len]), msg->data, len);
+        c->data_len += len;
+    }
+}
+
+static void decode_chunk(const struct pool_s* pool, struct chunk_s* c) {
+    c->rc = isotp_decoder_init(&(c->decoder),
+                               pool->opts->addressing_mode,
+                               pool->opts->max_message_len,
+                               store_f,
+                               c);
+    if (c->rc < 0) {
+        return;
+    }
+
+    size_t offset = c->start;
+    candump_frame_t frame;
+    int rc = 0;
+    while ((rc = candump_next(pool->log, &offset, c->end, &frame)) !=
+           -ENODATA) {
+        if (rc < 0) {
+            c->bad_lines++;
+            continue;
+        }
+
+        c->frames++;
+        c->frame_us = frame.ts_us;
+        rc = isotp_decoder_frame(c->decoder,
+                                 frame.ts_us,
+                                 frame.can_id,
+                                 frame.extended_id,
+                                 frame.format,
+                                 frame.data,
+                                 frame.len);
+        if (rc == -ENOMEM) {
+            c->rc = rc;
+            return;
+        } else if (rc < 0) {
+            c->bad_lines++;
+        }
+    }
+}
+
+static void* worker(void* arg) {
+    struct pool_s* pool = (struct pool_s*)arg;
+
+    pthread_mutex_lock(&(pool->lock));
+    while (true) {
+        while (!pool->abort &&
+               (pool->next < pool->chunk_count) &&
+               (pool->next >= (pool->delivered + pool->window))) {
+            pthread_cond_wait(&(pool->cond), &(pool->lock));
+        }
+        if (pool->abort || (pool->next >= pool->chunk_count)) {
+            break;
+        }
+
+        struct chunk_s* c = &(pool->chunks[pool->next++]);
+        pthread_mutex_unlock(&(pool->lock));
+
+        decode_chunk(pool, c);
+
+        pthread_mutex_lock(&(pool->lock));
+        c->done = true;
+        pthread_cond_broadcast(&(pool->cond));
+    }
+    pthread_mutex_unlock(&(pool->lock));
+
+    return NULL;
+}
+
+static int compare_order(const void* a, const void* b) {
+    const struct chunk_msg_s* ma = (const struct chunk_msg_s*)a;
+    const struct chunk_msg_s* mb = (const struct chunk_msg_s*)b;
+    if (ma->order_us != mb->order_us) {
+        return (ma->order_us < mb->order_us) ? -1 : 1;
+    }
+    return ma->seq - mb->seq;
+}
+
+/**
+ * @brief deliver a chunk's messages with those the join completed
+ *
+ * The join completes the messages spanning into the chunk stream by
+ * stream; each ended with its last frame, so they are slotted in among
+ * the chunk's own by end_us, as one decoder would have delivered them.
+ */
+static void deliver_merged(struct deliver_s* dl,
+                           struct chunk_s* spanning,
+                           struct chunk_s* c) {
+    for (int i=0; i < spanning->msg_count; i++) {
+        spanning->msgs[i].order_us = spanning->msgs[i].msg.end_us;
+    }
+    if (spanning->msg_count > 1) {
+        qsort(spanning->msgs, spanning->msg_count, sizeof(*(spanning->msgs)),
+              compare_order);
+    }
+
+    int i = 0;
+    int j = 0;
+    while ((i < spanning->msg_count) || (j < c->msg_count)) {
+        struct chunk_s* from = c;
+        if ((j == c->msg_count) ||
+            ((i < spanning->msg_count) &&
+             (spanning->msgs[i].order_us <= c->msgs[j].order_us))) {
+            from = spanning;
+        }
+        struct chunk_msg_s* m = (from == spanning) ? &(spanning->msgs[i++]) :
+                                                     &(c->msgs[j++]);
+        m->msg.data = (m->msg.len > 0) ? &(from->data[m->data_off]) : NULL;
+        deliver_f(dl, &(m->msg));
+    }
+
+    spanning->msg_count = 0;
+    spanning->data_len = 0;
+}
+
+static void free_chunk(struct chunk_s* c) {
+    isotp_decoder_free(c->decoder);
+    c->decoder = NULL;
+    free(c->msgs);
+    c->msgs = NULL;
+    free(c->data);
+    c->data = NULL;
+}
+
+// split the log into chunks starting at line boundaries
+static int split_log(const candump_log_t* log,
+                     const size_t chunk_size,
+                     struct chunk_s** chunks) {
+    int count = (int)((log->size + chunk_size - 1) / chunk_size);
+    *chunks = calloc((count > 0) ? count : 1, sizeof(**chunks));
+    if (*chunks == NULL) {
+        return -ENOMEM;
+    }
+
+    int n = 0;
+    size_t start = 0;
+    while (start < log->size) {
+        size_t end = start + chunk_size;
+        if (end >= log->size) {
+            end = log->size;
+        } else {
+            const char* nl = memchr(&(log->base[end]), '\n', log->size - end);
+            end = (nl != NULL) ? (size_t)(nl - log->base) + 1 : log->size;
+        }
+
+        (*chunks)[n].start = start;
+        (*chunks)[n].end = end;
+        n++;
+        start = end;
+    }
+
+    return n;
+}
+
+int candump_decode(const candump_log_t* log,
+                   const candump_decode_opts_t* opts,
+                   isotp_message_f message_f,
+                   void* cb_ctx,
+                   candump_decode_stats_t* stats) {
+    if ((log == NULL) || (opts == NULL) || (message_f == NULL)) {
+        return -EINVAL;
+    }
+
+    candump_decode_stats_t local_stats;
+    if (stats == NULL) {
+        stats = &local_stats;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    int threads = opts->threads;
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? (int)cpus : 1;
+    }
+
+    size_t chunk_size = opts->chunk_size;
+    if (chunk_size == 0) {
+        chunk_size = log->size / ((size_t)threads * CHUNKS_PER_THREAD);
+        chunk_size = (chunk_size < MIN_CHUNK_SIZE) ? MIN_CHUNK_SIZE :
+                     (chunk_size > MAX_CHUNK_SIZE) ? MAX_CHUNK_SIZE :
+                     chunk_size;
+    }
+
+    // completes the messages spanning chunks, and whatever is left at the
+    // end; they are held in spanning until they can be delivered in order
+    struct deliver_s dl = { message_f, cb_ctx, stats };
+    struct chunk_s spanning = {0};
+    isotp_decoder_t joined = NULL;
+    int rc = isotp_decoder_init(&joined,
+                                opts->addressing_mode,
+                                opts->max_message_len,
+                                store_f,
+                                &spanning);
+    if (rc < 0) {
+        return rc;
+    }
+
+    struct pool_s pool = {0};
+    pool.log = log;
+    pool.opts = opts;
+    pool.chunk_count = split_log(log, chunk_size, &(pool.chunks));
+    if (pool.chunk_count < 0) {
+        isotp_decoder_free(joined);
+        return pool.chunk_count;
+    }
+    stats->chunks = pool.chunk_count;
+
+    threads = (threads < pool.chunk_count) ? threads : pool.chunk_count;
+    pool.window = threads * CHUNKS_PER_THREAD;
+    pthread_mutex_init(&(pool.lock), NULL);
+    pthread_cond_init(&(pool.cond), NULL);
+
+    pthread_t* tids = calloc((threads > 0) ? threads : 1, sizeof(*tids));
+    int started = 0;
+    if (tids == NULL) {
+        rc = -ENOMEM;
+    }
+    for (; (rc == EOK) && (started < threads); started++) {
+        if (pthread_create(&(tids[started]), NULL, worker, &pool) != 0) {
+            rc = -EAGAIN;
+            break;
+        }
+    }
+
+    // join and deliver the chunks in order, as they are decoded
+    for (int k=0; (rc == EOK) && (k < pool.chunk_count); k++) {
+        struct chunk_s* c = &(pool.chunks[k]);
+
+        pthread_mutex_lock(&(pool.lock));
+        while (!c->done) {
+            pthread_cond_wait(&(pool.cond), &(pool.lock));
+        }
+        pthread_mutex_unlock(&(pool.lock));
+
+        rc = c->rc;
+        if (rc == EOK) {
+            rc = isotp_decoder_join(joined, c->decoder);
+        }
+        if (rc == EOK) {
+            rc = spanning.rc;
+        }
+        if (rc == EOK) {
+            deliver_merged(&dl, &spanning, c);
+        }
+        stats->frames += c->frames;
+        stats->bad_lines += c->bad_lines;
+        free_chunk(c);
+
+        pthread_mutex_lock(&(pool.lock));
+        pool.delivered++;
+        pthread_cond_broadcast(&(pool.cond));
+        pthread_mutex_unlock(&(pool.lock));
+    }
+
+    pthread_mutex_lock(&(pool.lock));
+    pool.abort = (rc != EOK);
+    pthread_cond_broadcast(&(pool.cond));
+    pthread_mutex_unlock(&(pool.lock));
+    for (int i=0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    if (rc == EOK) {
+        (void)isotp_decoder_flush(joined);
+        rc = spanning.rc;
+    }
+    if (rc == EOK) {
+        // the messages still in progress, in the order they were flushed
+        for (int i=0; i < spanning.msg_count; i++) {
+            struct chunk_msg_s* m = &(spanning.msgs[i]);
+            m->msg.data = (m->msg.len > 0) ? &(spanning.data[m->data_off]) :
+                                             NULL;
+            deliver_f(&dl, &(m->msg));
+        }
+    }
+
+    for (int k=0; k < pool.chunk_count; k++) {
+        free_chunk(&(pool.chunks[k]));
+    }
+    free_chunk(&spanning);
+    free(pool.chunks);
+    free(tids);
+    pthread_cond_destroy(&(pool.cond));
+    pthread_mutex_destroy(&(pool.lock));
+    isotp_decoder_free(joined);
+
+    return rc;
+}
@@ -0,0 +1,94 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <isotp.h>
+#include "trace/candump.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Decoding candump logs on several threads
+ *
+ * The log is split into chunks at line boundaries, and each chunk is
+ * decoded by its own passive decoder on a pool of threads.  The chunks are
+ * then joined in log order (see isotp_decoder_join()), so messages cut by
+ * a chunk boundary are reassembled as if the log had been decoded in one
+ * piece.
+ *
+ * Messages are delivered on the calling thread, chunk by chunk in log
+ * order, in the order of the frames that ended them, as when the log is
+ * decoded in one piece; messages spanning into a chunk are slotted in by
+ * the time of their last frame.  The exception is a message cut short by
+ * the next one on its CAN ID across a chunk boundary, which is delivered
+ * ahead of the chunk's messages.  Only a few chunks per thread are held
+ * in memory at a time.
+ */
+
+struct candump_decode_opts_s {
+    isotp_addressing_mode_t addressing_mode;
+    int max_message_len;   // largest message reassembled, in bytes
+    int threads;           // 0 for one per online CPU
+    size_t chunk_size;     // bytes of log per chunk; 0 for a default
+};
+typedef struct candump_decode_opts_s candump_decode_opts_t;
+
+struct candump_decode_stats_s {
+    uint64_t frames;     // data frames read
+    uint64_t bad_lines;  // malformed lines, and frames that failed to decode
+    uint64_t messages;   // messages delivered, complete or not
+    uint64_t failed;     // messages delivered with len < 0
+    int chunks;
+};
+typedef struct candump_decode_stats_s candump_decode_stats_t;
+
+/**
+ * @brief reassemble every ISOTP message in a candump log
+ *
+ * @param log - log
+ * @param opts - decoding options
+ * @param message_f - function invoked with each message
+ * @param cb_ctx - opaque context passed to message_f
+ * @param stats - updated with what was decoded; may be NULL
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int candump_decode(const candump_log_t* log,
+                   const candump_decode_opts_t* opts,
+                   isotp_message_f message_f,
+                   void* cb_ctx,
+                   candump_decode_stats_t* stats);
+
+#ifdef __cplusplus
+}
+#endif
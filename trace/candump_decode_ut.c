@@ -0,0 +1,316 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <string.h>
+#include <unistd.h>
+#include <cmocka.h>
+
+#include "trace/candump.h"
+#include "trace/candump_decode.h"
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+#define IDS (16)
+#define MESSAGES (3000)
+#define MAX_LEN (2000)
+
+// what is compared of a message
+struct summary_s {
+    uint64_t start_us;
+    uint64_t end_us;
+    uint32_t can_id;
+    int len;
+    int frames;
+    uint32_t sum;
+};
+
+struct summaries_s {
+    struct summary_s* s;
+    int count;
+    int cap;
+};
+
+static void summarize_f(void* cb_ctx, const isotp_message_t* msg) {
+    struct summaries_s* all = (struct summaries_s*)cb_ctx;
+
+    if (all->count == all->cap) {
+        all->cap = (all->cap > 0) ? (2 * all->cap) : 1024;
+        all->s = realloc(all->s, all->cap * sizeof(*(all->s)));
+        assert_true(all->s != NULL);
+    }
+
+    struct summary_s* s = &(all->s[all->count++]);
+    s->start_us = msg->start_us;
+    s->end_us = msg->end_us;
+    s->can_id = msg->can_id;
+    s->len = msg->len;
+    s->frames = msg->frames;
+    s->sum = 0;
+    for (int i=0; i < msg->len; i++) {
+        s->sum = (s->sum * 31) + msg->data[i];
+    }
+}
+
+static int compare_summary(const void* a, const void* b) {
+    const struct summary_s* sa = (const struct summary_s*)a;
+    const struct summary_s* sb = (const struct summary_s*)b;
+    if (sa->start_us != sb->start_us) {
+        return (sa->start_us < sb->start_us) ? -1 : 1;
+    }
+    if (sa->can_id != sb->can_id) {
+        return (sa->can_id < sb->can_id) ? -1 : 1;
+    }
+    return sa->len - sb->len;
+}
+
+static uint32_t lcg(uint32_t* seed) {
+    *seed = (*seed * 1103515245U) + 12345U;
+    return *seed >> 8;
+}
+
+static void put_frame(FILE* f,
+                      const uint64_t ts,
+                      const uint32_t id,
+                      const uint8_t* data) {
+    fprintf(f, "(%llu.%06llu) can0 %03X#",
+            (unsigned long long)(ts / 1000000),
+            (unsigned long long)(ts % 1000000),
+            (unsigned int)id);
+    for (int i=0; i < 8; i++) {
+        fprintf(f, "%02X", data[i]);
+    }
+    fprintf(f, "\n");
+}
+
+/**
+ * Write a log with the frames of up to IDS messages interleaved: mostly
+ * multi-frame, some longer than a chunk, some SFs, and the odd message
+ * broken off by a dropped frame.  It starts in the middle of a message.
+ */
+static void write_log(const char* path) {
+    FILE* f = fopen(path, "w");
+    assert_true(f != NULL);
+
+    uint32_t seed = 1;
+    uint64_t ts = 1000000;
+    uint8_t frame[8];
+
+    // leftovers of a message started before the log
+    memset(frame, 0xCC, sizeof(frame));
+    frame[0] = 0x25;
+    put_frame(f, ts++, 0x700, frame);
+
+    struct {
+        int len;
+        int off;
+        int sn;
+    } tx[IDS] = {{0}};
+    int started = 0;
+    int active = 0;
+
+    while ((started < MESSAGES) || (active > 0)) {
+        int i = (int)(lcg(&seed) % IDS);
+        uint32_t id = 0x700 + i;
+        ts += 10 + (lcg(&seed) % 100);
+        memset(frame, 0xCC, sizeof(frame));
+
+        if (tx[i].len == 0) {
+            if (started == MESSAGES) {
+                continue;
+            }
+            started++;
+            uint32_t r = lcg(&seed) % 100;
+            int len = (r < 20) ? (int)(1 + (r % 7)) :
+                      (r < 25) ? (int)(1000 + (lcg(&seed) % (MAX_LEN - 1000))) :
+                      (int)(8 + (lcg(&seed) % 120));
+            if (len <= 7) {
+                frame[0] = (uint8_t)len;
+                for (int j=0; j < len; j++) {
+                    frame[1 + j] = (uint8_t)(ts + j);
+                }
+            } else {
+                frame[0] = 0x10 | (uint8_t)(len >> 8);
+                frame[1] = (uint8_t)len;
+                for (int j=0; j < 6; j++) {
+                    frame[2 + j] = (uint8_t)(id + j);
+                }
+                tx[i].len = len;
+                tx[i].off = 6;
+                tx[i].sn = 1;
+                active++;
+            }
+        } else {
+            frame[0] = 0x20 | (uint8_t)(tx[i].sn & 0x0F);
+            for (int j=0; (j < 7) && (tx[i].off < tx[i].len); j++) {
+                frame[1 + j] = (uint8_t)(id + tx[i].off++);
+            }
+            tx[i].sn++;
+            if (tx[i].off == tx[i].len) {
+                tx[i].len = 0;
+                active--;
+            }
+            // drop the odd CF
+            if ((lcg(&seed) % 500) == 0) {
+                continue;
+            }
+        }
+
+        put_frame(f, ts, id, frame);
+    }
+
+    fclose(f);
+}
+
+static void decode_sequentially(const candump_log_t* log,
+                                struct summaries_s* all) {
+    isotp_decoder_t d = NULL;
+    assert_true(isotp_decoder_init(&d, ISOTP_NORMAL_ADDRESSING_MODE, MAX_LEN,
+                                   summarize_f, all) == EOK);
+
+    size_t offset = 0;
+    candump_frame_t frame;
+    while (candump_next(log, &offset, log->size, &frame) == EOK) {
+        assert_true(isotp_decoder_frame(d, frame.ts_us, frame.can_id,
+                                        frame.extended_id, frame.format,
+                                        frame.data, frame.len) == EOK);
+    }
+    (void)isotp_decoder_flush(d);
+    isotp_decoder_free(d);
+}
+
+// the complete messages came in the same order; those not reassembled may
+// be reported at another point (see candump_decode.h)
+static void check_order(const struct summaries_s* got,
+                        const struct summaries_s* expected) {
+    int j = 0;
+    for (int i=0; i < got->count; i++) {
+        if (got->s[i].len < 0) {
+            continue;
+        }
+        while (expected->s[j].len < 0) {
+            j++;
+        }
+        assert_memory_equal(&(got->s[i]), &(expected->s[j]),
+                            sizeof(got->s[i]));
+        j++;
+    }
+}
+
+static void parallel_matches_sequential_test(void** state) {
+    (void)state;
+    char path[] = "/tmp/candump_decode_ut_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    (void)close(fd);
+    write_log(path);
+
+    candump_log_t log;
+    assert_true(candump_open(&log, path) == EOK);
+
+    struct summaries_s expected = {0};
+    decode_sequentially(&log, &expected);
+    assert_true(expected.count >= MESSAGES);
+    struct summaries_s in_order = expected;
+    in_order.s = malloc(expected.count * sizeof(*(expected.s)));
+    assert_true(in_order.s != NULL);
+    memcpy(in_order.s, expected.s, expected.count * sizeof(*(expected.s)));
+    qsort(expected.s, expected.count, sizeof(*(expected.s)), compare_summary);
+
+    // chunks of a few lines, to chunks bigger than the log
+    const size_t chunk_sizes[] = { 100, 997, 4096, 65536, 1 << 30 };
+    const int threads[] = { 1, 3, 8 };
+    for (size_t i=0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); i++) {
+        for (size_t t=0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+            candump_decode_opts_t opts = {
+                .addressing_mode = ISOTP_NORMAL_ADDRESSING_MODE,
+                .max_message_len = MAX_LEN,
+                .threads = threads[t],
+                .chunk_size = chunk_sizes[i],
+            };
+            candump_decode_stats_t stats;
+            struct summaries_s got = {0};
+
+            assert_true(candump_decode(&log, &opts, summarize_f, &got,
+                                       &stats) == EOK);
+            assert_true(stats.messages == (uint64_t)got.count);
+            assert_true(stats.bad_lines == 0);
+            assert_true(got.count == expected.count);
+            check_order(&got, &in_order);
+
+            qsort(got.s, got.count, sizeof(*(got.s)), compare_summary);
+            assert_memory_equal(got.s, expected.s,
+                                expected.count * sizeof(*(got.s)));
+            free(got.s);
+        }
+    }
+
+    free(expected.s);
+    free(in_order.s);
+    candump_close(&log);
+    (void)unlink(path);
+}
+
+static void decode_invalid_parameters_test(void** state) {
+    (void)state;
+    candump_log_t log = {0};
+    candump_decode_opts_t opts = {
+        .addressing_mode = ISOTP_NORMAL_ADDRESSING_MODE,
+        .max_message_len = MAX_LEN,
+    };
+    struct summaries_s got = {0};
+
+    assert_true(candump_decode(NULL, &opts, summarize_f, &got, NULL) ==
+                -EINVAL);
+    assert_true(candump_decode(&log, NULL, summarize_f, &got, NULL) ==
+                -EINVAL);
+    assert_true(candump_decode(&log, &opts, NULL, &got, NULL) == -EINVAL);
+
+    // an empty log
+    assert_true(candump_decode(&log, &opts, summarize_f, &got, NULL) == EOK);
+    assert_true(got.count == 0);
+
+    opts.max_message_len = 0;
+    assert_true(candump_decode(&log, &opts, summarize_f, &got, NULL) ==
+                -ERANGE);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(parallel_matches_sequential_test),
+        cmocka_unit_test(decode_invalid_parameters_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
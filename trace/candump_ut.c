@@ -0,0 +1,184 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <string.h>
+#include <unistd.h>
+#include <cmocka.h>
+
+#include "trace/candump.h"
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+static int parse(const char* line, candump_frame_t* frame) {
+    return candump_parse_line(line, strlen(line), frame);
+}
+
+static void parse_can_frames_test(void** state) {
+    (void)state;
+    candump_frame_t frame;
+
+    assert_true(parse("(1436509052.249713) can0 7E0#0210030000000000",
+                      &frame) == EOK);
+    assert_true(frame.ts_us == 1436509052249713ULL);
+    assert_true(frame.can_id == 0x7E0);
+    assert_true(!frame.extended_id);
+    assert_true(frame.format == CAN_FORMAT);
+    assert_true(frame.len == 8);
+    assert_true(frame.data[0] == 0x02);
+    assert_true(frame.data[1] == 0x10);
+    assert_true(frame.data[2] == 0x03);
+
+    // 29 bit ID, lower case, a short frame and a direction flag
+    assert_true(parse("(0.5) vcan1 18daf110#02500a R", &frame) == EOK);
+    assert_true(frame.ts_us == 500000);
+    assert_true(frame.can_id == 0x18DAF110);
+    assert_true(frame.extended_id);
+    assert_true(frame.len == 3);
+    assert_true(frame.data[2] == 0x0A);
+
+    // no data, and dotted data
+    assert_true(parse("(1.000001) can0 123#", &frame) == EOK);
+    assert_true(frame.ts_us == 1000001);
+    assert_true(frame.len == 0);
+    assert_true(parse("(1.000001) can0 123#11.22.33", &frame) == EOK);
+    assert_true(frame.len == 3);
+    assert_true(frame.data[2] == 0x33);
+
+    // more than 8 bytes in a CAN frame
+    assert_true(parse("(1.0) can0 123#001122334455667788", &frame) ==
+                -EBADMSG);
+}
+
+static void parse_canfd_frames_test(void** state) {
+    (void)state;
+    candump_frame_t frame;
+    char line[256];
+
+    int n = sprintf(line, "(2.000000) can0 7E8##1");
+    for (int i=0; i < 64; i++) {
+        n += sprintf(&(line[n]), "%02X", i);
+    }
+
+    assert_true(parse(line, &frame) == EOK);
+    assert_true(frame.format == CANFD_FORMAT);
+    assert_true(frame.flags == CANDUMP_FD_BRS);
+    assert_true(frame.len == 64);
+    assert_true(frame.data[63] == 63);
+
+    assert_true(parse("(2.0) can0 7E8##", &frame) == -EBADMSG);
+    assert_true(parse("(2.0) can0 7E8##3", &frame) == EOK);
+    assert_true(frame.flags == (CANDUMP_FD_BRS | CANDUMP_FD_ESI));
+    assert_true(frame.len == 0);
+}
+
+static void parse_other_lines_test(void** state) {
+    (void)state;
+    candump_frame_t frame;
+
+    // no data frame
+    assert_true(parse("", &frame) == -ENOMSG);
+    assert_true(parse("   ", &frame) == -ENOMSG);
+    assert_true(parse("(1.0) can0 123#R", &frame) == -ENOMSG);
+    assert_true(parse("(1.0) can0 20000080#0000000000000000", &frame) ==
+                -ENOMSG);
+
+    // malformed
+    assert_true(parse("1.0 can0 123#00", &frame) == -EBADMSG);
+    assert_true(parse("(1.0 can0 123#00", &frame) == -EBADMSG);
+    assert_true(parse("(1.0) can0 123", &frame) == -EBADMSG);
+    assert_true(parse("(1.0) can0 123456789#00", &frame) == -EBADMSG);
+    assert_true(parse("(1.0) can0 123#0", &frame) == -EBADMSG);
+    assert_true(parse("(1.0) can0 123#0G", &frame) == -EBADMSG);
+
+    assert_true(candump_parse_line(NULL, 0, &frame) == -EINVAL);
+    assert_true(candump_parse_line("", 0, NULL) == -EINVAL);
+}
+
+static void read_log_test(void** state) {
+    (void)state;
+    char path[] = "/tmp/candump_ut_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+
+    const char* text =
+        "(1.000000) can0 7E0#0322F190\n"
+        "\n"
+        "(1.000100) can0 7E8#R\n"
+        "garbage\n"
+        "(1.000200) can0 7E8#101462F190010203\n"
+        "(1.000300) can0 7E8#21040506070809";  // no final newline
+    assert_true(write(fd, text, strlen(text)) == (ssize_t)strlen(text));
+    (void)close(fd);
+
+    candump_log_t log;
+    candump_frame_t frame;
+    size_t offset = 0;
+
+    assert_true(candump_open(&log, "/nonexistent/candump.log") == -ENOENT);
+    assert_true(candump_open(&log, path) == EOK);
+    assert_true(log.size == strlen(text));
+
+    assert_true(candump_next(&log, &offset, log.size, &frame) == EOK);
+    assert_true(frame.can_id == 0x7E0);
+    assert_true(frame.len == 4);
+    assert_true(candump_next(&log, &offset, log.size, &frame) == -EBADMSG);
+    assert_true(candump_next(&log, &offset, log.size, &frame) == EOK);
+    assert_true(frame.ts_us == 1000200);
+    assert_true(candump_next(&log, &offset, log.size, &frame) == EOK);
+    assert_true(frame.ts_us == 1000300);
+    assert_true(frame.len == 7);
+    assert_true(offset == log.size);
+    assert_true(candump_next(&log, &offset, log.size, &frame) == -ENODATA);
+
+    // stopping short of the end
+    offset = 0;
+    assert_true(candump_next(&log, &offset, 10, &frame) == -EBADMSG);
+    assert_true(offset == 10);
+    assert_true(candump_next(&log, &offset, 10, &frame) == -ENODATA);
+
+    candump_close(&log);
+    (void)unlink(path);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(parse_can_frames_test),
+        cmocka_unit_test(parse_canfd_frames_test),
+        cmocka_unit_test(parse_other_lines_test),
+        cmocka_unit_test(read_log_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
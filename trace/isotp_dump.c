@@ -0,0 +1,208 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * isotp_dump - reassemble the ISOTP messages in a candump log
+ *
+ * usage: isotp_dump [-a normal|fixed|extended|mixed] [-m max_len] [-j threads]
+ *                   [-q] log
+ *
+ * Every message, in both directions, is printed on a line of its own as
+ *
+ *     (start) ID [len] data  ; frames, duration
+ *
+ * with the timestamp of its SF/FF.  Messages that could not be reassembled
+ * are printed with the reason instead of the data.  A summary is printed
+ * to stderr at the end.
+ *
+ * The log is decoded on one thread per CPU unless -j says otherwise;
+ * messages are printed chunk by chunk in log order (see candump_decode.h).
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <isotp.h>
+#include "trace/candump.h"
+#include "trace/candump_decode.h"
+
+#define DEFAULT_MAX_MESSAGE_LEN (4095)
+#define OUTPUT_BUF_SZ (1 << 20)
+#define USEC_PER_SEC (1000000)
+
+struct dump_s {
+    bool quiet;
+    bool has_ae;
+    char* line;  // room for the longest line
+};
+
+static const char HEX[] = "0123456789ABCDEF";
+
+static void print_message(void* cb_ctx, const isotp_message_t* msg) {
+    struct dump_s* dump = (struct dump_s*)cb_ctx;
+
+    if (dump->quiet) {
+        return;
+    }
+
+    char* p = dump->line;
+    p += sprintf(p, "(%llu.%06llu) ",
+                 (unsigned long long)(msg->start_us / USEC_PER_SEC),
+                 (unsigned long long)(msg->start_us % USEC_PER_SEC));
+    p += sprintf(p, msg->extended_id ? "%08X" : "%03X",
+                 (unsigned int)msg->can_id);
+    if (dump->has_ae) {
+        p += sprintf(p, "/%02X", msg->address_extension);
+    }
+
+    if (msg->len < 0) {
+        p += sprintf(p, " ! %s", strerror(-(msg->len)));
+    } else {
+        p += sprintf(p, " [%d] ", msg->len);
+        for (int i=0; i < msg->len; i++) {
+            *p++ = HEX[msg->data[i] >> 4];
+            *p++ = HEX[msg->data[i] & 0x0F];
+        }
+    }
+
+    p += sprintf(p, "  ; %d frame%s, %llu us\n",
+                 msg->frames,
+                 (msg->frames == 1) ? "" : "s",
+                 (unsigned long long)(msg->end_us - msg->start_us));
+
+    (void)fwrite(dump->line, 1, p - dump->line, stdout);
+}
+
+static int parse_addressing(const char* s, isotp_addressing_mode_t* mode) {
+    if (strcmp(s, "normal") == 0) {
+        *mode = ISOTP_NORMAL_ADDRESSING_MODE;
+    } else if (strcmp(s, "fixed") == 0) {
+        *mode = ISOTP_NORMAL_FIXED_ADDRESSING_MODE;
+    } else if (strcmp(s, "extended") == 0) {
+        *mode = ISOTP_EXTENDED_ADDRESSING_MODE;
+    } else if (strcmp(s, "mixed") == 0) {
+        *mode = ISOTP_MIXED_ADDRESSING_MODE;
+    } else {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-a normal|fixed|extended|mixed] [-m max_len] "
+            "[-j threads] [-q] log\n",
+            prog);
+}
+
+int main(int argc, char** argv) {
+    candump_decode_opts_t opts = {
+        .addressing_mode = ISOTP_NORMAL_ADDRESSING_MODE,
+        .max_message_len = DEFAULT_MAX_MESSAGE_LEN,
+    };
+    struct dump_s dump = {0};
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "a:m:j:q")) != -1) {
+        switch (opt) {
+        case 'a':
+            if (parse_addressing(optarg, &(opts.addressing_mode)) < 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'm':
+            opts.max_message_len = atoi(optarg);
+            break;
+
+        case 'j':
+            opts.threads = atoi(optarg);
+            break;
+
+        case 'q':
+            dump.quiet = true;
+            break;
+
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ((optind != (argc - 1)) || (opts.max_message_len <= 0)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    dump.has_ae = (opts.addressing_mode == ISOTP_EXTENDED_ADDRESSING_MODE) ||
+                  (opts.addressing_mode == ISOTP_MIXED_ADDRESSING_MODE);
+
+    // "(timestamp) ID/AE [len] " + hex + "  ; frames, duration"
+    dump.line = malloc(((size_t)opts.max_message_len * 2) + 128);
+    if (dump.line == NULL) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    candump_log_t log;
+    int rc = candump_open(&log, argv[optind]);
+    if (rc < 0) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[optind], strerror(-rc));
+        free(dump.line);
+        return EXIT_FAILURE;
+    }
+
+    (void)setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUF_SZ);
+
+    candump_decode_stats_t stats;
+    rc = candump_decode(&log, &opts, print_message, &dump, &stats);
+    (void)fflush(stdout);
+    if (rc < 0) {
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(-rc));
+        candump_close(&log);
+        free(dump.line);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stderr,
+            "%llu frames, %llu messages (%llu not reassembled), "
+            "%llu bad lines, %d chunks\n",
+            (unsigned long long)stats.frames,
+            (unsigned long long)stats.messages,
+            (unsigned long long)stats.failed,
+            (unsigned long long)stats.bad_lines,
+            stats.chunks);
+
+    candump_close(&log);
+    free(dump.line);
+
+    return EXIT_SUCCESS;
+}
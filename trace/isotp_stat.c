@@ -0,0 +1,325 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * isotp_stat - ISOTP statistics of a CAN bus, per CAN ID
+ *
+ * usage: isotp_stat [-a normal|fixed|extended|mixed] [-m max_len]
+ *                   [-i seconds] [-p id:fc_id]... [-c] [log]
+ *
+ * Reads candump log lines from the log, or from stdin without one, so a
+ * live bus is watched with
+ *
+ *     candump -L can0 | isotp_stat
+ *
+ * Every interval (1 second by default, on the clock of the frames) a
+ * table is printed with, for each CAN ID sending ISOTP data: the message
+ * and byte rates, the rate achieved by multi-frame transfers, failures
+ * and SN errors, the FCs it was sent (and FC.WAITs), the STmin in force
+ * and the gaps measured between its CFs.  With -c the table is printed
+ * as CSV instead, for a spreadsheet or a plot.
+ *
+ * The CAN IDs of the FCs are paired with those they answer as they are
+ * seen; -p gives a pair up front.  Nothing is ever transmitted.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <isotp.h>
+#include "trace/candump.h"
+
+#define DEFAULT_MAX_MESSAGE_LEN (4095)
+#define USEC_PER_SEC (1000000)
+#define MAX_ROWS (2048)
+
+struct stat_s {
+    bool csv;
+    uint64_t now_us;
+    int rows;
+    isotp_monitor_stats_t row[MAX_ROWS];
+};
+
+static void collect_f(void* cb_ctx, const isotp_monitor_stats_t* stats) {
+    struct stat_s* st = (struct stat_s*)cb_ctx;
+    if (st->rows < MAX_ROWS) {
+        st->row[st->rows++] = *stats;
+    }
+}
+
+static int compare_rows(const void* a, const void* b) {
+    const isotp_monitor_stats_t* ra = (const isotp_monitor_stats_t*)a;
+    const isotp_monitor_stats_t* rb = (const isotp_monitor_stats_t*)b;
+    if (ra->can_id != rb->can_id) {
+        return (ra->can_id < rb->can_id) ? -1 : 1;
+    }
+    return (int)ra->extended_id - (int)rb->extended_id;
+}
+
+static void format_id(char* s,
+                      const bool valid,
+                      const uint32_t can_id,
+                      const bool extended_id) {
+    if (!valid) {
+        strcpy(s, "-");
+    } else {
+        sprintf(s, extended_id ? "%08X" : "%03X", (unsigned int)can_id);
+    }
+}
+
+static void print_report(struct stat_s* st) {
+    qsort(st->row, st->rows, sizeof(st->row[0]), compare_rows);
+
+    if (!st->csv) {
+        printf("\n(%llu.%06llu)\n",
+               (unsigned long long)(st->now_us / USEC_PER_SEC),
+               (unsigned long long)(st->now_us % USEC_PER_SEC));
+        printf("%-8s %-8s %8s %10s %10s %8s %6s %6s %6s %6s %6s %7s "
+               "%7s %7s %7s\n",
+               "ID", "FC ID", "msg/s", "B/s", "xfer B/s", "msgs", "failed",
+               "SN err", "FC", "WAIT", "BS", "STmin", "gap avg", "gap min",
+               "<STmin");
+    }
+
+    for (int i=0; i < st->rows; i++) {
+        const isotp_monitor_stats_t* r = &(st->row[i]);
+        char id[16];
+        char fc_id[16];
+        format_id(id, true, r->can_id, r->extended_id);
+        format_id(fc_id, r->paired, r->fc_can_id, r->extended_id);
+
+        if (st->csv) {
+            printf("%llu.%06llu,%s,%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,"
+                   "%llu,%llu,%d,%d,%llu,%llu,%llu\n",
+                   (unsigned long long)(st->now_us / USEC_PER_SEC),
+                   (unsigned long long)(st->now_us % USEC_PER_SEC),
+                   id,
+                   fc_id,
+                   (unsigned long long)r->messages_per_sec,
+                   (unsigned long long)r->bytes_per_sec,
+                   (unsigned long long)r->transfer_bytes_per_sec,
+                   (unsigned long long)r->messages,
+                   (unsigned long long)r->failed,
+                   (unsigned long long)r->sn_errors,
+                   (unsigned long long)r->fc_cts,
+                   (unsigned long long)r->fc_wait,
+                   (unsigned long long)r->fc_overflow,
+                   r->blocksize,
+                   r->stmin_usec,
+                   (unsigned long long)r->cf_gap_avg_usec,
+                   (unsigned long long)r->cf_gap_min_usec,
+                   (unsigned long long)r->stmin_violations);
+        } else {
+            printf("%-8s %-8s %8llu %10llu %10llu %8llu %6llu %6llu %6llu "
+                   "%6llu %6d %7d %7llu %7llu %7llu\n",
+                   id,
+                   fc_id,
+                   (unsigned long long)r->messages_per_sec,
+                   (unsigned long long)r->bytes_per_sec,
+                   (unsigned long long)r->transfer_bytes_per_sec,
+                   (unsigned long long)r->messages,
+                   (unsigned long long)r->failed,
+                   (unsigned long long)r->sn_errors,
+                   (unsigned long long)r->fc_cts,
+                   (unsigned long long)r->fc_wait,
+                   r->blocksize,
+                   r->stmin_usec,
+                   (unsigned long long)r->cf_gap_avg_usec,
+                   (unsigned long long)r->cf_gap_min_usec,
+                   (unsigned long long)r->stmin_violations);
+        }
+    }
+    (void)fflush(stdout);
+    st->rows = 0;
+}
+
+static int parse_addressing(const char* s, isotp_addressing_mode_t* mode) {
+    if (strcmp(s, "normal") == 0) {
+        *mode = ISOTP_NORMAL_ADDRESSING_MODE;
+    } else if (strcmp(s, "fixed") == 0) {
+        *mode = ISOTP_NORMAL_FIXED_ADDRESSING_MODE;
+    } else if (strcmp(s, "extended") == 0) {
+        *mode = ISOTP_EXTENDED_ADDRESSING_MODE;
+    } else if (strcmp(s, "mixed") == 0) {
+        *mode = ISOTP_MIXED_ADDRESSING_MODE;
+    } else {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [-a normal|fixed|extended|mixed] [-m max_len] "
+            "[-i seconds] [-p id:fc_id]... [-c] [log]\n",
+            prog);
+}
+
+int main(int argc, char** argv) {
+    isotp_addressing_mode_t mode = ISOTP_NORMAL_ADDRESSING_MODE;
+    int max_len = DEFAULT_MAX_MESSAGE_LEN;
+    uint64_t interval_us = USEC_PER_SEC;
+    struct {
+        uint32_t id;
+        uint32_t fc_id;
+    } pairs[64];
+    int pair_count = 0;
+    static struct stat_s st;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "a:m:i:p:c")) != -1) {
+        char* end = NULL;
+        switch (opt) {
+        case 'a':
+            if (parse_addressing(optarg, &mode) < 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'm':
+            max_len = atoi(optarg);
+            break;
+
+        case 'i':
+            interval_us = (uint64_t)(atof(optarg) * USEC_PER_SEC);
+            break;
+
+        case 'p':
+            if (pair_count == (int)(sizeof(pairs) / sizeof(pairs[0]))) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            pairs[pair_count].id = strtoul(optarg, &end, 16);
+            if (*end != ':') {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            pairs[pair_count++].fc_id = strtoul(end + 1, NULL, 16);
+            break;
+
+        case 'c':
+            st.csv = true;
+            break;
+
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ((optind < (argc - 1)) || (interval_us == 0)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE* in = stdin;
+    if (optind == (argc - 1)) {
+        in = fopen(argv[optind], "r");
+        if (in == NULL) {
+            fprintf(stderr, "%s: %s: %s\n",
+                    argv[0], argv[optind], strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    isotp_monitor_t monitor = NULL;
+    int rc = isotp_monitor_init(&monitor, mode, max_len);
+    for (int i=0; (rc == 0) && (i < pair_count); i++) {
+        rc = isotp_monitor_pair(monitor,
+                                pairs[i].id,
+                                pairs[i].fc_id,
+                                (pairs[i].id > 0x7FF));
+    }
+    if (rc < 0) {
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(-rc));
+        isotp_monitor_free(monitor);
+        if (in != stdin) {
+            fclose(in);
+        }
+        return EXIT_FAILURE;
+    }
+
+    if (st.csv) {
+        printf("time,id,fc_id,msg_per_sec,bytes_per_sec,transfer_bytes_per_sec,"
+               "messages,failed,sn_errors,fc_cts,fc_wait,fc_overflow,bs,"
+               "stmin_usec,cf_gap_avg_usec,cf_gap_min_usec,"
+               "stmin_violations\n");
+    }
+
+    char* line = NULL;
+    size_t line_sz = 0;
+    ssize_t len = 0;
+    uint64_t next_report_us = 0;
+    candump_frame_t frame;
+    while ((len = getline(&line, &line_sz, in)) >= 0) {
+        while ((len > 0) && ((line[len - 1] == '\n') ||
+                             (line[len - 1] == '\r'))) {
+            len--;
+        }
+        if (candump_parse_line(line, (size_t)len, &frame) < 0) {
+            continue;
+        }
+
+        if (next_report_us == 0) {
+            next_report_us = frame.ts_us + interval_us;
+        }
+        while (frame.ts_us >= next_report_us) {
+            st.now_us = next_report_us;
+            (void)isotp_monitor_report(monitor, next_report_us, collect_f,
+                                       &st);
+            print_report(&st);
+            next_report_us += interval_us;
+        }
+
+        (void)isotp_monitor_frame(monitor,
+                                  frame.ts_us,
+                                  frame.can_id,
+                                  frame.extended_id,
+                                  frame.format,
+                                  frame.data,
+                                  frame.len);
+        st.now_us = frame.ts_us;
+    }
+
+    // the rest of the last interval
+    if (next_report_us != 0) {
+        (void)isotp_monitor_report(monitor, st.now_us, collect_f, &st);
+        print_report(&st);
+    }
+
+    free(line);
+    isotp_monitor_free(monitor);
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    return EXIT_SUCCESS;
+}
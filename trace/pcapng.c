@@ -0,0 +1,619 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <isotp.h>
+#include "trace/pcapng.h"
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+#define DEFAULT_RING_FRAMES (4096)
+#define DEFAULT_FLUSH_USEC (100000)
+#define DEFAULT_MAX_MESSAGE_LEN (4095)
+#define FILE_BUF_SZ (256 * 1024)
+#define BATCH_FRAMES (256)
+#define NSEC_PER_USEC (1000)
+#define NSEC_PER_SEC (1000000000)
+
+// @ref pcapng, draft-ietf-opsawg-pcapng
+#define SHB_TYPE (0x0A0D0D0AU)
+#define IDB_TYPE (0x00000001U)
+#define EPB_TYPE (0x00000006U)
+#define BYTE_ORDER_MAGIC (0x1A2B3C4DU)
+#define OPT_ENDOFOPT (0)
+#define OPT_COMMENT (1)
+#define OPT_SHB_USERAPPL (4)
+#define OPT_IF_NAME (2)
+#define OPT_IF_TSRESOL (9)
+#define OPT_EPB_FLAGS (2)
+#define EPB_FLAGS_INBOUND (0x1U)
+#define EPB_FLAGS_OUTBOUND (0x2U)
+#define TSRESOL_NSEC (9)
+
+// @ref tcpdump.org/linktypes.html
+#define LINKTYPE_CAN_SOCKETCAN (227)
+#define LINKTYPE_WIRESHARK_UPPER_PDU (252)
+
+// @ref linux/can.h; the SocketCAN header is 8 bytes, CAN ID big-endian
+#define SOCKETCAN_HDR_LEN (8)
+#define CAN_MAX_DLEN (8)
+#define CANFD_MAX_DLEN (64)
+#define CAN_EFF_FLAG (0x80000000U)
+#define CANFD_FDF (0x04)
+
+// @ref wireshark epan/exported_pdu.h; tag and length are big-endian
+#define EXP_PDU_TAG_END_OF_OPT (0)
+#define EXP_PDU_TAG_DISSECTOR_NAME (12)
+
+#define INTERFACE_CAN (0)
+#define INTERFACE_MESSAGES (1)
+
+#define RECORD_EXTENDED_ID (0x01)
+#define RECORD_FD (0x02)
+#define RECORD_TX (0x04)
+
+#define PAD4(x) (((x) + 3) & ~((size_t)3))
+
+struct record_s {
+    uint64_t ts_ns;
+    uint32_t can_id;
+    uint8_t flags;
+    uint8_t len;
+    uint8_t data[CANFD_MAX_DLEN];
+};
+
+struct pcapng_writer_s {
+    pcapng_opts_t opts;
+    char* name;       // room for the path of any file
+    FILE* f;
+    size_t file_size;
+    int file_index;
+
+    isotp_decoder_t decoder;
+
+    uint8_t* block;   // block being formatted
+    size_t block_sz;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct record_s* ring;
+    struct record_s* batch;  // records being written out
+    uint64_t head;    // next record written by pcapng_frame()
+    uint64_t tail;    // next record written out
+    bool closing;
+    pcapng_stats_t stats;
+    pcapng_stats_t written;  // the writer thread's own copy
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * NSEC_PER_SEC) + (uint64_t)ts.tv_nsec;
+}
+
+static inline void put16(uint8_t* p, const uint16_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void put32(uint8_t* p, const uint32_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void put16_be(uint8_t* p, const uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static inline void put32_be(uint8_t* p, const uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+// option header and value, padded; returns the bytes used
+static size_t put_option(uint8_t* p,
+                         const uint16_t code,
+                         const void* value,
+                         const size_t len) {
+    put16(p, code);
+    put16(p + 2, (uint16_t)len);
+    memcpy(p + 4, value, len);
+    memset(p + 4 + len, 0, PAD4(len) - len);
+    return 4 + PAD4(len);
+}
+
+// the end-of-options option and the trailing length of a block of the
+// block type at the start of w->block
+static size_t end_block(pcapng_writer_t w, size_t len) {
+    put32(w->block + len, OPT_ENDOFOPT);
+    len += 4;
+    len += 4;
+    put32(w->block + 4, (uint32_t)len);
+    put32(w->block + len - 4, (uint32_t)len);
+    return len;
+}
+
+static void write_block(pcapng_writer_t w, const size_t len) {
+    if (w->f == NULL) {
+        return;
+    }
+    if (fwrite(w->block, 1, len, w->f) != len) {
+        w->written.error = -EIO;
+        return;
+    }
+    w->file_size += len;
+    w->written.bytes += len;
+}
+
+static size_t interface_block(pcapng_writer_t w,
+                              const uint16_t linktype,
+                              const uint32_t snaplen,
+                              const char* name) {
+    const uint8_t tsresol = TSRESOL_NSEC;
+
+    put32(w->block, IDB_TYPE);
+    put16(w->block + 8, linktype);
+    put16(w->block + 10, 0);
+    put32(w->block + 12, snaplen);
+    size_t len = 16;
+    len += put_option(w->block + len, OPT_IF_NAME, name, strlen(name));
+    len += put_option(w->block + len, OPT_IF_TSRESOL, &tsresol, 1);
+    return end_block(w, len);
+}
+
+static int open_file(pcapng_writer_t w) {
+    if (w->file_index == 0) {
+        strcpy(w->name, w->opts.path);
+    } else {
+        sprintf(w->name, "%s.%d", w->opts.path, w->file_index);
+    }
+
+    w->f = fopen(w->name, "wb");
+    if (w->f == NULL) {
+        return -errno;
+    }
+    (void)setvbuf(w->f, NULL, _IOFBF, FILE_BUF_SZ);
+    w->file_size = 0;
+    w->written.files++;
+
+    // section header: byte order, version 1.0, section length unknown
+    static const char USERAPPL[] = "isotp";
+    put32(w->block, SHB_TYPE);
+    put32(w->block + 8, BYTE_ORDER_MAGIC);
+    put16(w->block + 12, 1);
+    put16(w->block + 14, 0);
+    put32(w->block + 16, 0xFFFFFFFFU);
+    put32(w->block + 20, 0xFFFFFFFFU);
+    size_t len = 24;
+    len += put_option(w->block + len,
+                      OPT_SHB_USERAPPL,
+                      USERAPPL,
+                      sizeof(USERAPPL) - 1);
+    write_block(w, end_block(w, len));
+
+    write_block(w, interface_block(w,
+                                   LINKTYPE_CAN_SOCKETCAN,
+                                   SOCKETCAN_HDR_LEN + CANFD_MAX_DLEN,
+                                   "can"));
+    if (w->decoder != NULL) {
+        write_block(w, interface_block(w,
+                                       LINKTYPE_WIRESHARK_UPPER_PDU,
+                                       0,
+                                       "isotp"));
+    }
+    return w->written.error;
+}
+
+static void close_file(pcapng_writer_t w) {
+    if (w->f != NULL) {
+        if (fclose(w->f) != 0) {
+            w->written.error = -EIO;
+        }
+        w->f = NULL;
+    }
+}
+
+// start the next file once this one is full; rotating lazily, just ahead
+// of a packet, never leaves a file with nothing but headers
+static void rotate(pcapng_writer_t w) {
+    if ((w->opts.rotate_size == 0) || (w->file_size < w->opts.rotate_size)) {
+        return;
+    }
+    close_file(w);
+    w->file_index++;
+    if ((w->opts.max_files > 0) && (w->file_index >= w->opts.max_files)) {
+        w->file_index = 0;
+    }
+    int rc = open_file(w);
+    if (rc < 0) {
+        w->written.error = rc;
+    }
+}
+
+// enhanced packet block header, for a packet of len bytes
+static void packet_header(pcapng_writer_t w,
+                          const uint32_t interface,
+                          const uint64_t ts_ns,
+                          const size_t len) {
+    put32(w->block, EPB_TYPE);
+    put32(w->block + 8, interface);
+    put32(w->block + 12, (uint32_t)(ts_ns >> 32));
+    put32(w->block + 16, (uint32_t)ts_ns);
+    put32(w->block + 20, (uint32_t)len);
+    put32(w->block + 24, (uint32_t)len);
+}
+
+static void write_frame(pcapng_writer_t w, const struct record_s* r) {
+    const bool fd = ((r->flags & RECORD_FD) != 0);
+    const size_t len = SOCKETCAN_HDR_LEN + (fd ? CANFD_MAX_DLEN : CAN_MAX_DLEN);
+
+    rotate(w);
+    packet_header(w, INTERFACE_CAN, r->ts_ns, len);
+
+    uint8_t* p = w->block + 28;
+    memset(p, 0, len);
+    put32_be(p, r->can_id |
+                (((r->flags & RECORD_EXTENDED_ID) != 0) ? CAN_EFF_FLAG : 0));
+    p[4] = r->len;
+    p[5] = fd ? CANFD_FDF : 0;
+    memcpy(p + SOCKETCAN_HDR_LEN, r->data, r->len);
+
+    const uint32_t flags = ((r->flags & RECORD_TX) != 0) ?
+                           EPB_FLAGS_OUTBOUND : EPB_FLAGS_INBOUND;
+    size_t block_len = 28 + len;
+    block_len += put_option(w->block + block_len,
+                            OPT_EPB_FLAGS,
+                            &flags,
+                            sizeof(flags));
+    write_block(w, end_block(w, block_len));
+    w->written.frames++;
+
+    if (w->decoder != NULL) {
+        (void)isotp_decoder_frame(w->decoder,
+                                  r->ts_ns / NSEC_PER_USEC,
+                                  r->can_id,
+                                  ((r->flags & RECORD_EXTENDED_ID) != 0),
+                                  fd ? CANFD_FORMAT : CAN_FORMAT,
+                                  r->data,
+                                  r->len);
+    }
+}
+
+// a reassembled message, as an exported PDU for the configured dissector,
+// with the CAN ID and the number of frames in a comment
+static void write_message(void* cb_ctx, const isotp_message_t* msg) {
+    pcapng_writer_t w = (pcapng_writer_t)cb_ctx;
+    if (msg->len < 0) {
+        return;
+    }
+
+    const size_t name_len = strlen(w->opts.dissector);
+    const size_t tags_len = 4 + PAD4(name_len) + 4;
+    const size_t len = tags_len + (size_t)msg->len;
+
+    rotate(w);
+    packet_header(w, INTERFACE_MESSAGES, msg->end_us * NSEC_PER_USEC, len);
+
+    uint8_t* p = w->block + 28;
+    memset(p, 0, PAD4(len));
+    put16_be(p, EXP_PDU_TAG_DISSECTOR_NAME);
+    put16_be(p + 2, (uint16_t)PAD4(name_len));
+    memcpy(p + 4, w->opts.dissector, name_len);
+    put16_be(p + 4 + PAD4(name_len), EXP_PDU_TAG_END_OF_OPT);
+    put16_be(p + 6 + PAD4(name_len), 0);
+    if (msg->len > 0) {
+        memcpy(p + tags_len, msg->data, msg->len);
+    }
+
+    char comment[64];
+    int comment_len = snprintf(comment, sizeof(comment),
+                               msg->extended_id ? "%08X, %d frames" :
+                                                  "%03X, %d frames",
+                               (unsigned int)msg->can_id,
+                               msg->frames);
+    size_t block_len = 28 + PAD4(len);
+    block_len += put_option(w->block + block_len,
+                            OPT_COMMENT,
+                            comment,
+                            (size_t)comment_len);
+    write_block(w, end_block(w, block_len));
+    w->written.messages++;
+}
+
+static void* writer_thread(void* arg) {
+    pcapng_writer_t w = (pcapng_writer_t)arg;
+    struct record_s* batch = w->batch;
+    const uint64_t ring_frames = (uint64_t)w->opts.ring_frames;
+    bool dirty = false;
+
+    pthread_mutex_lock(&(w->lock));
+    while (true) {
+        // woken up with the ring half full, or at the latest after
+        // flush_usec, so that pcapng_frame() rarely has to signal
+        if ((((w->head - w->tail) * 2) < ring_frames) && !w->closing) {
+            uint64_t deadline = now_ns() +
+                                (w->opts.flush_usec * NSEC_PER_USEC);
+            struct timespec ts = {
+                .tv_sec = (time_t)(deadline / NSEC_PER_SEC),
+                .tv_nsec = (long)(deadline % NSEC_PER_SEC),
+            };
+            (void)pthread_cond_timedwait(&(w->cond), &(w->lock), &ts);
+        }
+        if (w->head == w->tail) {
+            if (w->closing) {
+                break;
+            }
+            if (dirty) {
+                pthread_mutex_unlock(&(w->lock));
+                if ((w->f != NULL) && (fflush(w->f) != 0)) {
+                    w->written.error = -EIO;
+                }
+                dirty = false;
+                pthread_mutex_lock(&(w->lock));
+            }
+            continue;
+        }
+
+        while (w->head != w->tail) {
+            int n = 0;
+            for (; (n < BATCH_FRAMES) && (w->tail != w->head); n++) {
+                batch[n] = w->ring[w->tail % ring_frames];
+                w->tail++;
+            }
+            pthread_mutex_unlock(&(w->lock));
+
+            for (int i=0; i < n; i++) {
+                write_frame(w, &(batch[i]));
+            }
+            dirty = true;
+
+            pthread_mutex_lock(&(w->lock));
+            uint64_t dropped = w->stats.dropped;
+            w->stats = w->written;
+            w->stats.dropped = dropped;
+        }
+    }
+    pthread_mutex_unlock(&(w->lock));
+
+    return NULL;
+}
+
+int pcapng_open(pcapng_writer_t* writer, const pcapng_opts_t* opts) {
+    if ((writer == NULL) || (opts == NULL) || (opts->path == NULL) ||
+        (opts->max_files < 0) || (opts->ring_frames < 0)) {
+        return -EINVAL;
+    }
+
+    pcapng_writer_t w = calloc(1, sizeof(*w));
+    if (w == NULL) {
+        return -ENOMEM;
+    }
+    w->opts = *opts;
+    if (w->opts.ring_frames == 0) {
+        w->opts.ring_frames = DEFAULT_RING_FRAMES;
+    }
+    if (w->opts.flush_usec == 0) {
+        w->opts.flush_usec = DEFAULT_FLUSH_USEC;
+    }
+    if (w->opts.max_message_len == 0) {
+        w->opts.max_message_len = DEFAULT_MAX_MESSAGE_LEN;
+    }
+
+    // the largest block is a message, with its tags and comment
+    w->block_sz = 28 + 4 + PAD4(w->opts.max_message_len) + 128;
+    if (w->opts.dissector != NULL) {
+        w->block_sz += PAD4(strlen(w->opts.dissector));
+    }
+    w->name = malloc(strlen(opts->path) + 16);
+    w->block = malloc(w->block_sz);
+    w->ring = malloc((size_t)w->opts.ring_frames * sizeof(*(w->ring)));
+    w->batch = malloc(BATCH_FRAMES * sizeof(*(w->batch)));
+    int rc = ((w->name == NULL) || (w->block == NULL) ||
+              (w->ring == NULL) || (w->batch == NULL)) ? -ENOMEM : EOK;
+
+    if ((rc == EOK) && (w->opts.dissector != NULL)) {
+        rc = isotp_decoder_init(&(w->decoder),
+                                w->opts.addressing_mode,
+                                w->opts.max_message_len,
+                                write_message,
+                                w);
+    }
+    if (rc == EOK) {
+        rc = open_file(w);
+    }
+
+    // timed waits are on the monotonic clock, like the timestamps
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&(w->cond), &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&(w->lock), NULL);
+    w->stats = w->written;
+
+    if ((rc == EOK) &&
+        (pthread_create(&(w->thread), NULL, writer_thread, w) != 0)) {
+        rc = -EAGAIN;
+    }
+    if (rc < 0) {
+        close_file(w);
+        pthread_cond_destroy(&(w->cond));
+        pthread_mutex_destroy(&(w->lock));
+        isotp_decoder_free(w->decoder);
+        free(w->batch);
+        free(w->ring);
+        free(w->block);
+        free(w->name);
+        free(w);
+        return rc;
+    }
+
+    *writer = w;
+    return EOK;
+}
+
+void pcapng_close(pcapng_writer_t writer) {
+    if (writer == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(writer->lock));
+    writer->closing = true;
+    pthread_cond_signal(&(writer->cond));
+    pthread_mutex_unlock(&(writer->lock));
+    pthread_join(writer->thread, NULL);
+
+    close_file(writer);
+    pthread_cond_destroy(&(writer->cond));
+    pthread_mutex_destroy(&(writer->lock));
+    isotp_decoder_free(writer->decoder);
+    free(writer->batch);
+    free(writer->ring);
+    free(writer->block);
+    free(writer->name);
+    free(writer);
+}
+
+int pcapng_frame(pcapng_writer_t writer,
+                 const uint64_t ts_ns,
+                 const uint32_t can_id,
+                 const bool extended_id,
+                 const can_format_t can_format,
+                 const bool tx,
+                 const uint8_t* frame_p,
+                 const int frame_len) {
+    if ((writer == NULL) || (frame_p == NULL) || (frame_len < 0) ||
+        (frame_len > ((can_format == CANFD_FORMAT) ? CANFD_MAX_DLEN :
+                                                     CAN_MAX_DLEN))) {
+        return -EINVAL;
+    }
+
+    const uint64_t ts = (ts_ns != 0) ? ts_ns : now_ns();
+    const uint64_t ring_frames = (uint64_t)writer->opts.ring_frames;
+
+    pthread_mutex_lock(&(writer->lock));
+    const uint64_t queued = writer->head - writer->tail;
+    if (queued == ring_frames) {
+        writer->stats.dropped++;
+        pthread_mutex_unlock(&(writer->lock));
+        return -ENOBUFS;
+    }
+
+    struct record_s* r = &(writer->ring[writer->head % ring_frames]);
+    r->ts_ns = ts;
+    r->can_id = can_id;
+    r->flags = (extended_id ? RECORD_EXTENDED_ID : 0) |
+               ((can_format == CANFD_FORMAT) ? RECORD_FD : 0) |
+               (tx ? RECORD_TX : 0);
+    r->len = (uint8_t)frame_len;
+    memcpy(r->data, frame_p, frame_len);
+    writer->head++;
+
+    if (((queued * 2) < ring_frames) && (((queued + 1) * 2) >= ring_frames)) {
+        pthread_cond_signal(&(writer->cond));
+    }
+    pthread_mutex_unlock(&(writer->lock));
+
+    return EOK;
+}
+
+void pcapng_stats(pcapng_writer_t writer, pcapng_stats_t* stats) {
+    if ((writer == NULL) || (stats == NULL)) {
+        return;
+    }
+    pthread_mutex_lock(&(writer->lock));
+    *stats = writer->stats;
+    pthread_mutex_unlock(&(writer->lock));
+}
+
+int pcapng_tap_init(pcapng_tap_t* tap,
+                    pcapng_writer_t writer,
+                    const can_format_t can_format,
+                    const uint32_t tx_id,
+                    const uint32_t rx_id,
+                    const bool extended_id,
+                    void* can_ctx,
+                    isotp_rx_f can_rx_f,
+                    isotp_tx_f can_tx_f) {
+    if ((tap == NULL) || (writer == NULL) || (can_tx_f == NULL)) {
+        return -EINVAL;
+    }
+
+    tap->writer = writer;
+    tap->can_format = can_format;
+    tap->tx_id = tx_id;
+    tap->rx_id = rx_id;
+    tap->extended_id = extended_id;
+    tap->can_ctx = can_ctx;
+    tap->can_rx_f = can_rx_f;
+    tap->can_tx_f = can_tx_f;
+
+    return EOK;
+}
+
+int pcapng_tap_rx_f(void* rxfn_ctx,
+                    uint8_t* rx_buf_p,
+                    const int rx_buf_sz,
+                    const uint64_t timeout_usec) {
+    pcapng_tap_t* tap = (pcapng_tap_t*)rxfn_ctx;
+    if (tap->can_rx_f == NULL) {
+        return -ENOTSUP;
+    }
+
+    int rc = tap->can_rx_f(tap->can_ctx, rx_buf_p, rx_buf_sz, timeout_usec);
+    if (rc > 0) {
+        // a frame the capture can't keep up with is not the caller's problem
+        (void)pcapng_frame(tap->writer, 0, tap->rx_id, tap->extended_id,
+                           tap->can_format, false, rx_buf_p, rc);
+    }
+    return rc;
+}
+
+int pcapng_tap_tx_f(void* txfn_ctx,
+                    const uint8_t* tx_buf_p,
+                    const int tx_len,
+                    const uint64_t timeout_usec) {
+    pcapng_tap_t* tap = (pcapng_tap_t*)txfn_ctx;
+
+    int rc = tap->can_tx_f(tap->can_ctx, tx_buf_p, tx_len, timeout_usec);
+    if (rc >= 0) {
+        (void)pcapng_frame(tap->writer, 0, tap->tx_id, tap->extended_id,
+                           tap->can_format, true, tx_buf_p, tx_len);
+    }
+    return rc;
+}
@@ -0,0 +1,208 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <isotp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Capturing ISOTP traffic to pcapng files
+ *
+ * A writer records CAN frames as SocketCAN packets (LINKTYPE_CAN_SOCKETCAN)
+ * in pcapng files that Wireshark reads, with CLOCK_MONOTONIC timestamps in
+ * nanoseconds and the direction of each frame.  Optionally, the messages
+ * reassembled from the frames (see isotp_decoder_init()) are added as
+ * packets on a second interface, for Wireshark to dissect with the
+ * dissector named in the options (e.g. "uds").
+ *
+ * Recording a frame only copies it into a ring buffer; a background
+ * thread formats and writes the files.  When the ring is full, frames are
+ * dropped (and counted) rather than holding up the caller.
+ *
+ * Frames transmitted and received by an ISOTP context are recorded by
+ * giving it a tap, which wraps the context's can_rx_f/can_tx_f:
+ *
+ *     pcapng_tap_init(&tap, writer, CAN_FORMAT, 0x7E0, 0x7E8, false,
+ *                     can_ctx, can_rx_f, can_tx_f);
+ *     isotp_ctx_init(&ctx, CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE, 0,
+ *                    &tap, pcapng_tap_rx_f, pcapng_tap_tx_f);
+ *
+ * Frames delivered with isotp_rx_frame() are recorded with pcapng_frame().
+ */
+typedef struct pcapng_writer_s* pcapng_writer_t;
+
+struct pcapng_opts_s {
+    const char* path;       // first file; later ones are path.1, path.2...
+    size_t rotate_size;     // start a new file past this size; 0 for never
+    int max_files;          // files kept when rotating, the oldest being
+                            // overwritten; 0 for no limit
+    int ring_frames;        // frames buffered; 0 for a default
+    uint64_t flush_usec;    // write buffered frames out at least this
+                            // often; 0 for a default
+    const char* dissector;  // dissector of reassembled messages, or NULL
+                            // not to record messages
+    isotp_addressing_mode_t addressing_mode;  // used to reassemble messages
+    int max_message_len;                      // ditto
+};
+typedef struct pcapng_opts_s pcapng_opts_t;
+
+struct pcapng_stats_s {
+    uint64_t frames;    // frames written
+    uint64_t dropped;   // frames dropped with the ring full
+    uint64_t messages;  // messages written
+    uint64_t bytes;     // bytes written, over all files
+    int files;          // files started
+    int error;          // last error writing, or 0
+};
+typedef struct pcapng_stats_s pcapng_stats_t;
+
+/**
+ * @brief create the first capture file and start the writer thread
+ *
+ * @param writer - updated with the allocated writer
+ * @param opts - options
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int pcapng_open(pcapng_writer_t* writer, const pcapng_opts_t* opts);
+
+/**
+ * @brief write out every frame recorded, stop the writer thread and free
+ *        the writer
+ *
+ * Messages still in progress are not recorded.
+ *
+ * @param writer - writer, may be NULL
+ */
+void pcapng_close(pcapng_writer_t writer);
+
+/**
+ * @brief record a CAN frame; safe to call from any thread
+ *
+ * @param writer - writer
+ * @param ts_ns - CLOCK_MONOTONIC timestamp of the frame, in nanoseconds;
+ *                0 for now
+ * @param can_id - CAN ID of the frame
+ * @param extended_id - true if can_id is a 29 bit ID
+ * @param can_format - format of the frame
+ * @param tx - true for a frame transmitted, false for one received
+ * @param frame_p - pointer to the CAN frame data
+ * @param frame_len - length of the CAN frame data
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ *     -ENOBUFS - the ring is full, and the frame was dropped
+ */
+int pcapng_frame(pcapng_writer_t writer,
+                 const uint64_t ts_ns,
+                 const uint32_t can_id,
+                 const bool extended_id,
+                 const can_format_t can_format,
+                 const bool tx,
+                 const uint8_t* frame_p,
+                 const int frame_len);
+
+/**
+ * @brief get what was written so far
+ *
+ * @param writer - writer
+ * @param stats - updated with the statistics
+ */
+void pcapng_stats(pcapng_writer_t writer, pcapng_stats_t* stats);
+
+/**
+ * @brief capture tap of an ISOTP context; the can_ctx it is given
+ */
+struct pcapng_tap_s {
+    pcapng_writer_t writer;
+    can_format_t can_format;
+    uint32_t tx_id;  // CAN ID the context transmits with
+    uint32_t rx_id;  // CAN ID the context receives
+    bool extended_id;
+    void* can_ctx;
+    isotp_rx_f can_rx_f;
+    isotp_tx_f can_tx_f;
+};
+typedef struct pcapng_tap_s pcapng_tap_t;
+
+/**
+ * @brief initialize a capture tap
+ *
+ * @param tap - tap
+ * @param writer - writer the frames are recorded with
+ * @param can_format - format of the CAN frames
+ * @param tx_id - CAN ID of the frames transmitted
+ * @param rx_id - CAN ID of the frames received
+ * @param extended_id - true if the IDs are 29 bit IDs
+ * @param can_ctx - opaque context passed to can_rx_f/can_tx_f
+ * @param can_rx_f - function receiving a CAN frame, may be NULL
+ * @param can_tx_f - function transmitting a CAN frame
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int pcapng_tap_init(pcapng_tap_t* tap,
+                    pcapng_writer_t writer,
+                    const can_format_t can_format,
+                    const uint32_t tx_id,
+                    const uint32_t rx_id,
+                    const bool extended_id,
+                    void* can_ctx,
+                    isotp_rx_f can_rx_f,
+                    isotp_tx_f can_tx_f);
+
+/**
+ * @brief isotp_rx_f of a tap: receive with the wrapped can_rx_f, and
+ *        record what was received
+ */
+int pcapng_tap_rx_f(void* rxfn_ctx,
+                    uint8_t* rx_buf_p,
+                    const int rx_buf_sz,
+                    const uint64_t timeout_usec);
+
+/**
+ * @brief isotp_tx_f of a tap: transmit with the wrapped can_tx_f, and
+ *        record what was transmitted
+ */
+int pcapng_tap_tx_f(void* txfn_ctx,
+                    const uint8_t* tx_buf_p,
+                    const int tx_len,
+                    const uint64_t timeout_usec);
+
+#ifdef __cplusplus
+}
+#endif
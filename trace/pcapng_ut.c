@@ -0,0 +1,409 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <string.h>
+#include <unistd.h>
+#include <cmocka.h>
+
+#include <isotp.h>
+#include "trace/pcapng.h"
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+#define MAX_PACKETS (512)
+
+// what was read back from a capture file
+struct packet_s {
+    uint32_t interface;
+    uint64_t ts_ns;
+    uint32_t flags;
+    size_t len;
+    uint8_t data[4200];
+};
+
+struct capture_s {
+    uint16_t linktypes[2];
+    int interfaces;
+    int packets;
+    struct packet_s p[MAX_PACKETS];
+};
+
+static uint32_t get32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint16_t get16(const uint8_t* p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t get32_be(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+// parse a whole file, checking the structure of each block
+static void read_capture(const char* path, struct capture_s* cap) {
+    FILE* f = fopen(path, "rb");
+    assert_true(f != NULL);
+    static uint8_t buf[1 << 20];
+    size_t size = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+
+    memset(cap, 0, sizeof(*cap));
+    assert_true(size >= 28);
+    assert_true(get32(buf) == 0x0A0D0D0AU);
+    assert_true(get32(buf + 8) == 0x1A2B3C4DU);
+    assert_true(get16(buf + 12) == 1);
+
+    size_t off = 0;
+    while (off < size) {
+        assert_true((size - off) >= 12);
+        uint32_t type = get32(buf + off);
+        uint32_t len = get32(buf + off + 4);
+        assert_true((len % 4) == 0);
+        assert_true(len <= (size - off));
+        assert_true(get32(buf + off + len - 4) == len);
+
+        const uint8_t* b = buf + off;
+        if (type == 1) {
+            assert_true(cap->interfaces < 2);
+            cap->linktypes[cap->interfaces++] = get16(b + 8);
+        } else if (type == 6) {
+            assert_true(cap->packets < MAX_PACKETS);
+            struct packet_s* p = &(cap->p[cap->packets++]);
+            p->interface = get32(b + 8);
+            p->ts_ns = ((uint64_t)get32(b + 12) << 32) | get32(b + 16);
+            p->len = get32(b + 20);
+            assert_true(p->len <= sizeof(p->data));
+            memcpy(p->data, b + 28, p->len);
+
+            // options
+            size_t o = 28 + ((p->len + 3) & ~3U);
+            while (get16(b + o) != 0) {
+                if (get16(b + o) == 2) {
+                    p->flags = get32(b + o + 4);
+                }
+                o += 4 + ((get16(b + o + 2) + 3) & ~3U);
+            }
+        }
+        off += len;
+    }
+    assert_true(off == size);
+}
+
+// a CAN bus that loops back frames queued for reception
+struct bus_s {
+    uint8_t rx[8][8];
+    int rx_len[8];
+    int rx_count;
+    int tx_count;
+};
+
+static int bus_tx_f(void* ctx,
+                    const uint8_t* tx_buf_p,
+                    const int tx_len,
+                    const uint64_t timeout_usec) {
+    (void)tx_buf_p;
+    (void)timeout_usec;
+    struct bus_s* bus = (struct bus_s*)ctx;
+    bus->tx_count++;
+    return tx_len;
+}
+
+static int bus_rx_f(void* ctx,
+                    uint8_t* rx_buf_p,
+                    const int rx_buf_sz,
+                    const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct bus_s* bus = (struct bus_s*)ctx;
+    if (bus->rx_count == 0) {
+        return -ETIMEDOUT;
+    }
+    int i = --(bus->rx_count);
+    assert_true(bus->rx_len[i] <= rx_buf_sz);
+    memcpy(rx_buf_p, bus->rx[i], bus->rx_len[i]);
+    return bus->rx_len[i];
+}
+
+static char* temp_path(void) {
+    static char path[64];
+    strcpy(path, "/tmp/pcapng_ut_XXXXXX");
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    (void)close(fd);
+    return path;
+}
+
+static void tap_capture_test(void** state) {
+    (void)state;
+    const char* path = temp_path();
+    pcapng_opts_t opts = { .path = path };
+    pcapng_writer_t w = NULL;
+    assert_true(pcapng_open(&w, &opts) == EOK);
+
+    struct bus_s bus = {0};
+    pcapng_tap_t tap;
+    assert_true(pcapng_tap_init(&tap, w, CAN_FORMAT, 0x7E0, 0x7E8, false,
+                                &bus, bus_rx_f, bus_tx_f) == EOK);
+    isotp_ctx_t ctx = NULL;
+    assert_true(isotp_ctx_init(&ctx, CAN_FORMAT,
+                               ISOTP_NORMAL_ADDRESSING_MODE, 0,
+                               &tap, pcapng_tap_rx_f, pcapng_tap_tx_f) == EOK);
+
+    const uint8_t request[] = { 0x10, 0x03 };
+    assert_true(isotp_send(ctx, request, sizeof(request), 1000) >= 0);
+    const uint8_t response[] = { 0x06, 0x50, 0x03, 0x00, 0x32, 0x01, 0xF4,
+                                 0xAA };
+    memcpy(bus.rx[0], response, sizeof(response));
+    bus.rx_len[0] = sizeof(response);
+    bus.rx_count = 1;
+    uint8_t buf[64];
+    assert_true(isotp_recv(ctx, buf, sizeof(buf), 0, 0, 1000) >= 0);
+    assert_memory_equal(buf, &(response[1]), 6);
+    isotp_ctx_free(ctx);
+
+    // a 29 bit ID CAN-FD frame, recorded directly
+    uint8_t fd[64];
+    memset(fd, 0x5A, sizeof(fd));
+    assert_true(pcapng_frame(w, 12345, 0x18DAF110, true, CANFD_FORMAT, false,
+                             fd, sizeof(fd)) == EOK);
+
+    pcapng_close(w);
+
+    struct capture_s* cap = malloc(sizeof(*cap));
+    read_capture(path, cap);
+    assert_true(cap->interfaces == 1);
+    assert_true(cap->linktypes[0] == 227);
+    assert_true(cap->packets == 3);
+
+    // the SF sent: CAN ID big-endian, length, outbound
+    struct packet_s* p = &(cap->p[0]);
+    assert_true(p->len == 16);
+    assert_true(get32_be(p->data) == 0x7E0);
+    assert_true(p->data[4] == 3);
+    assert_true(p->data[5] == 0);
+    assert_true(p->data[8] == 0x02);
+    assert_true(p->data[9] == 0x10);
+    assert_true(p->flags == 2);
+
+    p = &(cap->p[1]);
+    assert_true(get32_be(p->data) == 0x7E8);
+    assert_true(p->data[4] == 8);
+    assert_memory_equal(&(p->data[8]), response, sizeof(response));
+    assert_true(p->flags == 1);
+    assert_true(p->ts_ns >= cap->p[0].ts_ns);
+
+    p = &(cap->p[2]);
+    assert_true(p->len == 72);
+    assert_true(p->ts_ns == 12345);
+    assert_true(get32_be(p->data) == (0x80000000U | 0x18DAF110));
+    assert_true(p->data[4] == 64);
+    assert_true(p->data[5] == 0x04);
+    assert_memory_equal(&(p->data[8]), fd, sizeof(fd));
+
+    free(cap);
+    (void)unlink(path);
+}
+
+static void messages_test(void** state) {
+    (void)state;
+    const char* path = temp_path();
+    pcapng_opts_t opts = {
+        .path = path,
+        .dissector = "uds",
+        .addressing_mode = ISOTP_NORMAL_ADDRESSING_MODE,
+    };
+    pcapng_writer_t w = NULL;
+    assert_true(pcapng_open(&w, &opts) == EOK);
+
+    // a 20 byte message: FF, FC and two CFs
+    uint8_t msg[20];
+    for (int i=0; i < 20; i++) {
+        msg[i] = (uint8_t)(0x40 + i);
+    }
+    uint8_t ff[8] = { 0x10, 20 };
+    memcpy(&(ff[2]), msg, 6);
+    uint8_t fc[3] = { 0x30, 0, 0 };
+    uint8_t cf1[8] = { 0x21 };
+    memcpy(&(cf1[1]), &(msg[6]), 7);
+    uint8_t cf2[8] = { 0x22 };
+    memcpy(&(cf2[1]), &(msg[13]), 7);
+
+    assert_true(pcapng_frame(w, 1000, 0x7E8, false, CAN_FORMAT, false,
+                             ff, 8) == EOK);
+    assert_true(pcapng_frame(w, 2000, 0x7E0, false, CAN_FORMAT, true,
+                             fc, 3) == EOK);
+    assert_true(pcapng_frame(w, 3000, 0x7E8, false, CAN_FORMAT, false,
+                             cf1, 8) == EOK);
+    assert_true(pcapng_frame(w, 4000, 0x7E8, false, CAN_FORMAT, false,
+                             cf2, 8) == EOK);
+    pcapng_close(w);
+
+    struct capture_s* cap = malloc(sizeof(*cap));
+    read_capture(path, cap);
+    assert_true(cap->interfaces == 2);
+    assert_true(cap->linktypes[1] == 252);
+    assert_true(cap->packets == 5);
+
+    // the message follows the frame completing it
+    struct packet_s* p = &(cap->p[4]);
+    assert_true(p->interface == 1);
+    assert_true(p->ts_ns == 4000);
+    // dissector name tag, end of tags, then the payload
+    assert_true(p->data[0] == 0);
+    assert_true(p->data[1] == 12);
+    assert_true(p->data[3] == 4);
+    assert_memory_equal(&(p->data[4]), "uds", 3);
+    assert_true(get32(&(p->data[8])) == 0);
+    assert_true(p->len == (12 + sizeof(msg)));
+    assert_memory_equal(&(p->data[12]), msg, sizeof(msg));
+
+    free(cap);
+    (void)unlink(path);
+}
+
+static void rotation_test(void** state) {
+    (void)state;
+    const char* path = temp_path();
+    pcapng_opts_t opts = {
+        .path = path,
+        .rotate_size = 1024,
+        .max_files = 3,
+        .ring_frames = 16,
+    };
+    pcapng_writer_t w = NULL;
+    assert_true(pcapng_open(&w, &opts) == EOK);
+
+    // with 84 bytes of headers and 60 per frame, a file is full after 16
+    // frames: 100 frames take 7 files, of which the last 3 are kept
+    uint8_t frame[8] = {0};
+    for (int i=0; i < 100; i++) {
+        frame[0] = (uint8_t)i;
+        while (pcapng_frame(w, 1 + i, 0x123, false, CAN_FORMAT, true,
+                            frame, sizeof(frame)) == -ENOBUFS) {
+            usleep(100);
+        }
+    }
+
+    pcapng_close(w);
+
+    char name[80];
+    int frames = 0;
+    for (int i=0; i < 3; i++) {
+        struct capture_s* cap = malloc(sizeof(*cap));
+        if (i == 0) {
+            strcpy(name, path);
+        } else {
+            sprintf(name, "%s.%d", path, i);
+        }
+        read_capture(name, cap);
+        frames += cap->packets;
+        // path itself was overwritten by the 7th file
+        if (i == 0) {
+            assert_true(cap->packets == 4);
+            assert_true(cap->p[3].data[8] == 99);
+        }
+        free(cap);
+        (void)unlink(name);
+    }
+    sprintf(name, "%s.3", path);
+    assert_true(access(name, F_OK) != 0);
+
+    assert_true(frames == 36);
+}
+
+static void stats_test(void** state) {
+    (void)state;
+    const char* path = temp_path();
+    pcapng_opts_t opts = { .path = path, .ring_frames = 4 };
+    pcapng_writer_t w = NULL;
+    pcapng_stats_t stats;
+
+    assert_true(pcapng_open(NULL, &opts) == -EINVAL);
+    assert_true(pcapng_open(&w, NULL) == -EINVAL);
+    opts.path = "/nonexistent/dir/capture.pcapng";
+    assert_true(pcapng_open(&w, &opts) == -ENOENT);
+    opts.path = path;
+    assert_true(pcapng_open(&w, &opts) == EOK);
+
+    uint8_t frame[9] = {0};
+    assert_true(pcapng_frame(w, 0, 0x123, false, CAN_FORMAT, true, frame,
+                             sizeof(frame)) == -EINVAL);
+
+    // fill the ring faster than it is written out
+    int dropped = 0;
+    for (int i=0; i < 1000; i++) {
+        if (pcapng_frame(w, 0, 0x123, false, CAN_FORMAT, true, frame, 8) ==
+            -ENOBUFS) {
+            dropped++;
+        }
+    }
+
+    pcapng_stats(w, &stats);
+    assert_true(stats.dropped == (uint64_t)dropped);
+    pcapng_close(w);
+
+    // the statistics of an idle writer
+    assert_true(pcapng_open(&w, &opts) == EOK);
+    assert_true(pcapng_frame(w, 0, 0x123, false, CAN_FORMAT, true, frame,
+                             8) == EOK);
+    do {
+        usleep(1000);
+        pcapng_stats(w, &stats);
+    } while (stats.frames == 0);
+    assert_true(stats.frames == 1);
+    assert_true(stats.dropped == 0);
+    assert_true(stats.files == 1);
+    assert_true(stats.error == 0);
+    assert_true(stats.bytes > 0);
+    pcapng_close(w);
+
+    (void)unlink(path);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(tap_capture_test),
+        cmocka_unit_test(messages_test),
+        cmocka_unit_test(rotation_test),
+        cmocka_unit_test(stats_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,406 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ * 
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <isotp.h>
+#include <uds/uds.h>
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+#define NSEC_PER_USEC (1000)
+#define USEC_PER_SEC  (1000000)
+
+// @ref ISO-15765-2:2016, table 16
+#define UDS_N_BS_USEC (1000000)
+#define UDS_N_CR_USEC (1000000)
+
+struct uds_req_s {
+    const uint8_t* req_p;
+    int req_len;
+    uint8_t* resp_p;
+    int resp_sz;
+    int flags;
+    uds_response_f cb;
+    void* cb_ctx;
+};
+
+enum uds_ecu_state_e {
+    UDS_ECU_IDLE,      // nothing in progress
+    UDS_ECU_SENDING,   // request being sent
+    UDS_ECU_WAITING    // waiting for the response, P2 or P2*, then N_Cr
+};
+typedef enum uds_ecu_state_e uds_ecu_state_t;
+
+struct uds_ecu_s {
+    isotp_ctx_t ctx;
+    uint64_t p2_usec;
+    uint64_t p2_star_usec;
+    uint8_t blocksize;
+    int stmin_usec;
+
+    uds_ecu_state_t state;
+    uint64_t deadline_us;  // end of P2/P2* for the first frame of the response
+    bool rx_started;       // the FF of the response is in; P2/P2* is met
+
+    struct uds_req_s* queue;  // ring, the head is in progress
+    int queue_depth;
+    int head;
+    int count;
+};
+
+struct uds_client_s {
+    struct uds_ecu_s** ecus;
+    int ecu_count;
+};
+
+static uint64_t uds_time(void) {
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * USEC_PER_SEC) + (ts.tv_nsec / NSEC_PER_USEC);
+}
+
+int uds_nrc(const uint8_t* resp_p, const int resp_len) {
+    if ((resp_p == NULL) ||
+        (resp_len < 3) ||
+        (resp_p[0] != UDS_NEGATIVE_RESPONSE_SID)) {
+        return 0;
+    }
+
+    return resp_p[2];
+}
+
+int uds_client_init(uds_client_t* client) {
+    if (client == NULL) {
+        return -EINVAL;
+    }
+
+    *client = calloc(1, sizeof(**client));
+    if (*client == NULL) {
+        return -ENOMEM;
+    }
+
+    return EOK;
+}
+
+void uds_client_free(uds_client_t client) {
+    if (client == NULL) {
+        return;
+    }
+
+    for (int i=0; i < client->ecu_count; i++) {
+        free(client->ecus[i]->queue);
+        free(client->ecus[i]);
+    }
+    free(client->ecus);
+    free(client);
+}
+
+int uds_client_add_ecu(uds_client_t client,
+                       isotp_ctx_t ctx,
+                       const uint64_t p2_usec,
+                       const uint64_t p2_star_usec,
+                       const int queue_depth) {
+    if ((client == NULL) || (ctx == NULL)) {
+        return -EINVAL;
+    }
+
+    if ((p2_usec == 0) || (p2_star_usec == 0) || (queue_depth <= 0)) {
+        return -ERANGE;
+    }
+
+    struct uds_ecu_s** ecus = realloc(client->ecus,
+                                      (client->ecu_count + 1) * sizeof(*ecus));
+    if (ecus == NULL) {
+        return -ENOMEM;
+    }
+    client->ecus = ecus;
+
+    struct uds_ecu_s* ecu = calloc(1, sizeof(*ecu));
+    if (ecu == NULL) {
+        return -ENOMEM;
+    }
+
+    ecu->queue = calloc(queue_depth, sizeof(*(ecu->queue)));
+    if (ecu->queue == NULL) {
+        free(ecu);
+        return -ENOMEM;
+    }
+
+    ecu->ctx = ctx;
+    ecu->p2_usec = p2_usec;
+    ecu->p2_star_usec = p2_star_usec;
+    ecu->queue_depth = queue_depth;
+    ecu->state = UDS_ECU_IDLE;
+
+    client->ecus[client->ecu_count] = ecu;
+    return client->ecu_count++;
+}
+
+static struct uds_ecu_s* get_ecu(uds_client_t client, const int ecu) {
+    if ((client == NULL) || (ecu < 0) || (ecu >= client->ecu_count)) {
+        return NULL;
+    }
+
+    return client->ecus[ecu];
+}
+
+int uds_client_set_fc(uds_client_t client,
+                      const int ecu,
+                      const uint8_t blocksize,
+                      const int stmin_usec) {
+    struct uds_ecu_s* e = get_ecu(client, ecu);
+    if (e == NULL) {
+        return -EINVAL;
+    }
+
+    if (stmin_usec < 0) {
+        return -ERANGE;
+    }
+
+    e->blocksize = blocksize;
+    e->stmin_usec = stmin_usec;
+
+    return EOK;
+}
+
+int uds_request(uds_client_t client,
+                const int ecu,
+                const uint8_t* req_p,
+                const int req_len,
+                uint8_t* resp_p,
+                const int resp_sz,
+                const int flags,
+                uds_response_f cb,
+                void* cb_ctx) {
+    struct uds_ecu_s* e = get_ecu(client, ecu);
+    if ((e == NULL) || (req_p == NULL)) {
+        return -EINVAL;
+    }
+
+    if (((flags & UDS_REQ_NO_RESPONSE) == 0) && (resp_p == NULL)) {
+        return -EINVAL;
+    }
+
+    if ((req_len <= 0) || (resp_sz < 0)) {
+        return -ERANGE;
+    }
+
+    if (e->count == e->queue_depth) {
+        return -ENOBUFS;
+    }
+
+    struct uds_req_s* r = &(e->queue[(e->head + e->count) % e->queue_depth]);
+    r->req_p = req_p;
+    r->req_len = req_len;
+    r->resp_p = resp_p;
+    r->resp_sz = resp_sz;
+    r->flags = flags;
+    r->cb = cb;
+    r->cb_ctx = cb_ctx;
+    e->count++;
+
+    return EOK;
+}
+
+static void ecu_complete(struct uds_ecu_s* e, const int rc) {
+    struct uds_req_s r = e->queue[e->head];
+    e->head = (e->head + 1) % e->queue_depth;
+    e->count--;
+    e->state = UDS_ECU_IDLE;
+
+    // last, as the callback may queue the next request
+    if (r.cb != NULL) {
+        (*(r.cb))(r.cb_ctx, rc, r.resp_p);
+    }
+}
+
+// the response is to this request, positive or negative; anything else
+// (e.g. a late response to a request that timed out) is not
+static bool is_response_to(const struct uds_req_s* r, const int resp_len) {
+    if (resp_len < 1) {
+        return false;
+    }
+
+    const uint8_t sid = r->req_p[0];
+    if (r->resp_p[0] == UDS_NEGATIVE_RESPONSE_SID) {
+        return (resp_len >= 2) && (r->resp_p[1] == sid);
+    }
+
+    return r->resp_p[0] == (uint8_t)(sid + UDS_POSITIVE_RESPONSE_SID);
+}
+
+// wait (until deadline_us) for the response to the request at the head
+//
+// P2/P2* only bounds the wait for the SF/FF; once the response has started
+// the CFs are timed by the ISOTP receive, with N_Cr
+static void ecu_recv_start(struct uds_ecu_s* e, const uint64_t deadline_us) {
+    struct uds_req_s* r = &(e->queue[e->head]);
+    int rc = isotp_recv_start(e->ctx,
+                              r->resp_p,
+                              r->resp_sz,
+                              e->blocksize,
+                              e->stmin_usec,
+                              UDS_N_CR_USEC);
+    if (rc < 0) {
+        ecu_complete(e, rc);
+        return;
+    }
+    e->deadline_us = deadline_us;
+    e->rx_started = false;
+    e->state = UDS_ECU_WAITING;
+}
+
+/**
+ * @brief advance the request at the head of an ECU's queue
+ *
+ * Moves on through as many states as it can without waiting.
+ */
+static void ecu_poll(struct uds_ecu_s* e, const uint64_t now_us) {
+    while (e->count > 0) {
+        struct uds_req_s* r = &(e->queue[e->head]);
+        int rc = 0;
+
+        switch (e->state) {
+            case UDS_ECU_IDLE:
+                rc = isotp_send_start(e->ctx, r->req_p, r->req_len, UDS_N_BS_USEC);
+                if (rc < 0) {
+                    ecu_complete(e, rc);
+                    break;
+                }
+                e->state = UDS_ECU_SENDING;
+                break;
+
+            case UDS_ECU_SENDING:
+                rc = isotp_poll(e->ctx, now_us);
+                if (rc == -EINPROGRESS) {
+                    return;
+                } else if (rc < 0) {
+                    ecu_complete(e, rc);
+                    break;
+                } else if ((r->flags & UDS_REQ_NO_RESPONSE) != 0) {
+                    ecu_complete(e, 0);
+                    break;
+                }
+
+                // P2 runs from the end of the request
+                // @ref ISO-14229-2:2013, section 7.2
+                ecu_recv_start(e, now_us + e->p2_usec);
+                break;
+
+            case UDS_ECU_WAITING:
+                rc = isotp_poll(e->ctx, now_us);
+                if (rc == -EINPROGRESS) {
+                    if (e->rx_started || (isotp_recv_started(e->ctx) > 0)) {
+                        e->rx_started = true;
+                        return;
+                    } else if (now_us < e->deadline_us) {
+                        return;
+                    }
+                    (void)isotp_ctx_reset(e->ctx);
+                    ecu_complete(e, -ETIMEDOUT);
+                    break;
+                } else if ((rc == -ETIMEDOUT) && !e->rx_started) {
+                    // N_Cr ran out before P2/P2* did, with nothing received
+                    // yet; keep waiting
+                    if (now_us >= e->deadline_us) {
+                        ecu_complete(e, -ETIMEDOUT);
+                        break;
+                    }
+                    ecu_recv_start(e, e->deadline_us);
+                    break;
+                } else if ((rc >= 0) && !is_response_to(r, rc)) {
+                    // not ours, not even a "response pending"; keep waiting
+                    // for what is left of P2/P2*
+                    if (now_us >= e->deadline_us) {
+                        ecu_complete(e, -ETIMEDOUT);
+                        break;
+                    }
+                    ecu_recv_start(e, e->deadline_us);
+                    break;
+                } else if (uds_nrc(r->resp_p, rc) == UDS_NRC_RESPONSE_PENDING) {
+                    // the final response follows within P2*
+                    ecu_recv_start(e, now_us + e->p2_star_usec);
+                    break;
+                }
+                ecu_complete(e, rc);
+                break;
+
+            default:
+                ecu_complete(e, -EFAULT);
+                break;
+        }
+    }
+}
+
+int uds_client_poll(uds_client_t client, const uint64_t now_us) {
+    if (client == NULL) {
+        return -EINVAL;
+    }
+
+    int pending = 0;
+    for (int i=0; i < client->ecu_count; i++) {
+        ecu_poll(client->ecus[i], now_us);
+        pending += client->ecus[i]->count;
+    }
+
+    return pending;
+}
+
+int uds_client_run(uds_client_t client,
+                   const uint64_t timeout_usec,
+                   const uint64_t idle_usec) {
+    if (client == NULL) {
+        return -EINVAL;
+    }
+
+    const uint64_t start = uds_time();
+    struct timespec idle_ts = {
+        .tv_sec = idle_usec / USEC_PER_SEC,
+        .tv_nsec = (idle_usec % USEC_PER_SEC) * NSEC_PER_USEC
+    };
+
+    while (true) {
+        uint64_t now = uds_time();
+        int rc = uds_client_poll(client, now);
+        if (rc <= 0) {
+            return rc;
+        }
+
+        if ((timeout_usec > 0) && ((now - start) >= timeout_usec)) {
+            return -ETIMEDOUT;
+        }
+
+        if (idle_usec > 0) {
+            (void)nanosleep(&idle_ts, NULL);
+        }
+    }
+}
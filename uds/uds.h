@@ -0,0 +1,214 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ * 
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <isotp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @ref ISO-14229-1:2020
+ *
+ * UDS client on top of non-blocking ISOTP transfers.
+ *
+ * Every ECU has its own ISOTP context, kept for the lifetime of the client,
+ * and its own queue of requests.  UDS only allows one outstanding request
+ * per ECU, so the requests to one ECU run in order, but the requests to
+ * different ECUs all run at the same time: uds_client_poll() advances
+ * every ECU's current request without blocking.
+ *
+ * A "response pending" negative response (NRC 0x78) extends the wait for
+ * the final response from P2 to P2*, for as many times as the ECU sends it.
+ */
+
+#define UDS_NEGATIVE_RESPONSE_SID   (0x7F)
+#define UDS_POSITIVE_RESPONSE_SID   (0x40)  // added to the request SID
+#define UDS_NRC_RESPONSE_PENDING    (0x78)
+
+// @ref ISO-14229-2:2013, table 4
+#define UDS_DEFAULT_P2_USEC         (50000)
+#define UDS_DEFAULT_P2_STAR_USEC    (5000000)
+
+/**
+ * @brief request flags
+ */
+#define UDS_REQ_NO_RESPONSE (0x01)  // suppressPosRspMsgIndicationBit is set;
+                                    // complete once the request is sent
+
+typedef struct uds_client_s* uds_client_t;
+
+/**
+ * @brief type definition of a function invoked when a request completes
+ *
+ * @param cb_ctx - opaque context given to uds_request()
+ * @param rc - on success (>=0), length of the response in the response
+ *             buffer (0 with UDS_REQ_NO_RESPONSE); a negative response
+ *             other than "response pending" is a success too, use
+ *             uds_nrc() to tell; responses whose SID doesn't match
+ *             the request are ignored
+ *             otherwise (<0) - error code; -ETIMEDOUT if P2/P2* expired
+ * @param resp_p - the response buffer given to uds_request()
+ */
+typedef void (*uds_response_f)(void* cb_ctx,
+                               const int rc,
+                               uint8_t* resp_p);
+
+/**
+ * @brief allocate a UDS client
+ *
+ * @param client - updated with pointer to the allocated client
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int uds_client_init(uds_client_t* client);
+
+/**
+ * @brief free a UDS client
+ *
+ * Requests still queued are dropped without their callbacks being invoked.
+ * The ISOTP contexts of the ECUs are not freed.
+ *
+ * @param client - UDS client
+ */
+void uds_client_free(uds_client_t client);
+
+/**
+ * @brief add an ECU to a client
+ *
+ * @param client - UDS client
+ * @param ctx - ISOTP context connected to the ECU; used only by the client
+ *              from now on, and not freed by it
+ * @param p2_usec - P2 (time to the start of a response), in microseconds
+ * @param p2_star_usec - P2* (time to the start of a response after a
+ *                       "response pending"), in microseconds
+ * @param queue_depth - most requests queued for the ECU at once
+ *
+ * @returns
+ * on success (>=0), the ECU number used with uds_request()
+ * otherwise (<0) - error code
+ */
+int uds_client_add_ecu(uds_client_t client,
+                       isotp_ctx_t ctx,
+                       const uint64_t p2_usec,
+                       const uint64_t p2_star_usec,
+                       const int queue_depth);
+
+/**
+ * @brief set the flow control used when receiving responses from an ECU
+ *
+ * Defaults to a BS of 0 and an STmin of 0.
+ *
+ * @param client - UDS client
+ * @param ecu - ECU number
+ * @param blocksize - BS sent in FCs
+ * @param stmin_usec - STmin sent in FCs
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int uds_client_set_fc(uds_client_t client,
+                      const int ecu,
+                      const uint8_t blocksize,
+                      const int stmin_usec);
+
+/**
+ * @brief queue a request to an ECU
+ *
+ * @param client - UDS client
+ * @param ecu - ECU number
+ * @param req_p - request; must remain valid until the callback is invoked
+ * @param req_len - length of the request
+ * @param resp_p - buffer for the response; must remain valid until the
+ *                 callback is invoked
+ * @param resp_sz - size of the response buffer
+ * @param flags - UDS_REQ_* flags
+ * @param cb - invoked when the request completes, may queue new requests
+ * @param cb_ctx - opaque context passed to the callback
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code; -ENOBUFS if the ECU's queue is full
+ */
+int uds_request(uds_client_t client,
+                const int ecu,
+                const uint8_t* req_p,
+                const int req_len,
+                uint8_t* resp_p,
+                const int resp_sz,
+                const int flags,
+                uds_response_f cb,
+                void* cb_ctx);
+
+/**
+ * @brief advance the requests of all ECUs
+ *
+ * Never sleeps; see isotp_poll().
+ *
+ * @param client - UDS client
+ * @param now_us - current time, in microseconds, from a monotonic clock
+ *
+ * @returns
+ * on success (>=0), the number of requests queued or in progress
+ * otherwise (<0) - error code
+ */
+int uds_client_poll(uds_client_t client, const uint64_t now_us);
+
+/**
+ * @brief poll a client until all its requests have completed
+ *
+ * @param client - UDS client
+ * @param timeout_usec - give up after this long, 0 to wait forever
+ * @param idle_usec - time to sleep between polls, 0 to never sleep
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code; -ETIMEDOUT if requests are still pending
+ */
+int uds_client_run(uds_client_t client,
+                   const uint64_t timeout_usec,
+                   const uint64_t idle_usec);
+
+/**
+ * @brief return the NRC of a negative response
+ *
+ * @param resp_p - response
+ * @param resp_len - length of the response
+ *
+ * @returns
+ * the NRC (>0) if the response is a negative response, otherwise 0
+ */
+int uds_nrc(const uint8_t* resp_p, const int resp_len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,395 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ * 
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <uds/uds.h>
+#include <uds/uds_flash.h>
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+#define FLASH_RESP_SZ (256)
+
+// addressAndLengthFormatIdentifier: 4 byte memorySize, 4 byte memoryAddress
+#define FLASH_ALFID (0x44)
+#define FLASH_REQUEST_DOWNLOAD_LEN (3 + 4 + 4)
+
+enum flash_state_e {
+    FLASH_QUEUED,     // waiting for its bus
+    FLASH_DOWNLOAD,   // RequestDownload sent
+    FLASH_TRANSFER,   // TransferData sent
+    FLASH_EXIT,       // RequestTransferExit sent
+    FLASH_DONE
+};
+typedef enum flash_state_e flash_state_t;
+
+struct flash_job_s {
+    struct uds_flash_s* flash;
+    uds_flash_job_t cfg;
+    flash_state_t state;
+    int rc;
+    int nrc;
+
+    uint8_t hdr[FLASH_REQUEST_DOWNLOAD_LEN];  // RequestDownload/Exit
+    uint8_t* block;                           // TransferData request
+    int block_len;                            // size of block
+    uint8_t resp[FLASH_RESP_SZ];
+
+    uint8_t seq;       // blockSequenceCounter of the block in flight
+    int chunk;         // data bytes in the block in flight
+    uint32_t acked;    // data bytes the ECU has accepted
+};
+
+struct uds_flash_s {
+    uds_client_t client;
+    int max_per_bus;
+    struct flash_job_s** jobs;
+    int job_count;
+    int* bus_active;   // active jobs per bus
+    int bus_count;
+};
+
+static void put_be32(uint8_t* p, const uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+int uds_flash_init(uds_flash_t* flash,
+                   uds_client_t client,
+                   const int max_per_bus) {
+    if ((flash == NULL) || (client == NULL)) {
+        return -EINVAL;
+    }
+
+    if (max_per_bus <= 0) {
+        return -ERANGE;
+    }
+
+    *flash = calloc(1, sizeof(**flash));
+    if (*flash == NULL) {
+        return -ENOMEM;
+    }
+
+    (*flash)->client = client;
+    (*flash)->max_per_bus = max_per_bus;
+
+    return EOK;
+}
+
+void uds_flash_free(uds_flash_t flash) {
+    if (flash == NULL) {
+        return;
+    }
+
+    for (int i=0; i < flash->job_count; i++) {
+        free(flash->jobs[i]->block);
+        free(flash->jobs[i]);
+    }
+    free(flash->jobs);
+    free(flash->bus_active);
+    free(flash);
+}
+
+int uds_flash_add(uds_flash_t flash, const uds_flash_job_t* job) {
+    if ((flash == NULL) || (job == NULL)) {
+        return -EINVAL;
+    }
+
+    if ((job->ecu < 0) ||
+        (job->bus < 0) ||
+        (job->fd < 0) ||
+        (job->offset < 0) ||
+        (job->max_block_len < 0) ||
+        ((job->max_block_len > 0) && (job->max_block_len < 3))) {
+        return -ERANGE;
+    }
+
+    if (job->bus >= flash->bus_count) {
+        int* bus_active = realloc(flash->bus_active,
+                                  (job->bus + 1) * sizeof(*bus_active));
+        if (bus_active == NULL) {
+            return -ENOMEM;
+        }
+        for (int b=flash->bus_count; b <= job->bus; b++) {
+            bus_active[b] = 0;
+        }
+        flash->bus_active = bus_active;
+        flash->bus_count = job->bus + 1;
+    }
+
+    struct flash_job_s** jobs = realloc(flash->jobs,
+                                        (flash->job_count + 1) * sizeof(*jobs));
+    if (jobs == NULL) {
+        return -ENOMEM;
+    }
+    flash->jobs = jobs;
+
+    struct flash_job_s* j = calloc(1, sizeof(*j));
+    if (j == NULL) {
+        return -ENOMEM;
+    }
+    j->flash = flash;
+    j->cfg = *job;
+    j->state = FLASH_QUEUED;
+    j->rc = -EINPROGRESS;
+
+    flash->jobs[flash->job_count] = j;
+    return flash->job_count++;
+}
+
+static void job_finish(struct flash_job_s* j, const int rc) {
+    j->state = FLASH_DONE;
+    j->rc = rc;
+    j->flash->bus_active[j->cfg.bus]--;
+
+    free(j->block);
+    j->block = NULL;
+}
+
+static void job_cb(void* cb_ctx, const int rc, uint8_t* resp_p);
+
+static void job_request(struct flash_job_s* j,
+                        const flash_state_t state,
+                        const uint8_t* req_p,
+                        const int req_len) {
+    j->state = state;
+    int rc = uds_request(j->flash->client,
+                         j->cfg.ecu,
+                         req_p,
+                         req_len,
+                         j->resp,
+                         sizeof(j->resp),
+                         0,
+                         job_cb,
+                         j);
+    if (rc < 0) {
+        job_finish(j, rc);
+    }
+}
+
+static void job_send_exit(struct flash_job_s* j) {
+    j->hdr[0] = UDS_SID_REQUEST_TRANSFER_EXIT;
+    job_request(j, FLASH_EXIT, j->hdr, 1);
+}
+
+static void job_send_block(struct flash_job_s* j) {
+    uint32_t left = j->cfg.length - j->acked;
+    if (left == 0) {
+        job_send_exit(j);
+        return;
+    }
+
+    j->chunk = (int)((left < (uint32_t)(j->block_len - 2)) ? left : (uint32_t)(j->block_len - 2));
+    j->block[0] = UDS_SID_TRANSFER_DATA;
+    j->block[1] = j->seq;
+
+    // stream the block straight from the file
+    int got = 0;
+    while (got < j->chunk) {
+        ssize_t n = pread(j->cfg.fd,
+                          &(j->block[2 + got]),
+                          j->chunk - got,
+                          j->cfg.offset + j->acked + got);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            job_finish(j, -errno);
+            return;
+        } else if (n == 0) {
+            // the file is shorter than the job says
+            job_finish(j, -EIO);
+            return;
+        }
+        got += (int)n;
+    }
+
+    job_request(j, FLASH_TRANSFER, j->block, j->chunk + 2);
+}
+
+/**
+ * @brief handle the positive response to RequestDownload
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+static int job_download_accepted(struct flash_job_s* j, const int resp_len) {
+    // @ref ISO-14229-1:2020, section 14.2.3.1, table 401
+    if ((resp_len < 2) ||
+        (j->resp[0] != (UDS_SID_REQUEST_DOWNLOAD + UDS_POSITIVE_RESPONSE_SID))) {
+        return -EBADMSG;
+    }
+
+    int n = j->resp[1] >> 4;
+    if ((n < 1) || (n > 4) || (resp_len < (2 + n))) {
+        return -EBADMSG;
+    }
+
+    uint32_t max_block_len = 0;
+    for (int i=0; i < n; i++) {
+        max_block_len = (max_block_len << 8) | j->resp[2 + i];
+    }
+    if ((j->cfg.max_block_len > 0) &&
+        ((uint32_t)j->cfg.max_block_len < max_block_len)) {
+        max_block_len = (uint32_t)j->cfg.max_block_len;
+    }
+    if ((max_block_len < 3) || (max_block_len > INT32_MAX)) {
+        return -EBADMSG;
+    }
+
+    j->block_len = (int)max_block_len;
+    j->block = malloc(j->block_len);
+    if (j->block == NULL) {
+        return -ENOMEM;
+    }
+    j->seq = 1;
+
+    return EOK;
+}
+
+static void job_cb(void* cb_ctx, const int rc, uint8_t* resp_p) {
+    (void)resp_p;
+    struct flash_job_s* j = (struct flash_job_s*)cb_ctx;
+
+    if (rc < 0) {
+        job_finish(j, rc);
+        return;
+    }
+
+    j->nrc = uds_nrc(j->resp, rc);
+    if (j->nrc > 0) {
+        job_finish(j, -EPROTO);
+        return;
+    }
+
+    int xrc = EOK;
+    switch (j->state) {
+        case FLASH_DOWNLOAD:
+            xrc = job_download_accepted(j, rc);
+            if (xrc < 0) {
+                job_finish(j, xrc);
+                return;
+            }
+            job_send_block(j);
+            break;
+
+        case FLASH_TRANSFER:
+            // @ref ISO-14229-1:2020, section 14.4.3.1, table 415
+            if ((rc < 2) ||
+                (j->resp[0] != (UDS_SID_TRANSFER_DATA + UDS_POSITIVE_RESPONSE_SID)) ||
+                (j->resp[1] != j->seq)) {
+                job_finish(j, -EBADMSG);
+                return;
+            }
+            j->acked += j->chunk;
+            j->seq++;  // wraps from 0xFF to 0x00
+            job_send_block(j);
+            break;
+
+        case FLASH_EXIT:
+            if (j->resp[0] != (UDS_SID_REQUEST_TRANSFER_EXIT + UDS_POSITIVE_RESPONSE_SID)) {
+                job_finish(j, -EBADMSG);
+                return;
+            }
+            job_finish(j, EOK);
+            break;
+
+        case FLASH_QUEUED:
+        case FLASH_DONE:
+        default:
+            job_finish(j, -EFAULT);
+            break;
+    }
+}
+
+static void job_start(struct flash_job_s* j) {
+    j->flash->bus_active[j->cfg.bus]++;
+
+    // @ref ISO-14229-1:2020, section 14.2.2.1, table 396
+    j->hdr[0] = UDS_SID_REQUEST_DOWNLOAD;
+    j->hdr[1] = j->cfg.data_format;
+    j->hdr[2] = FLASH_ALFID;
+    put_be32(&(j->hdr[3]), j->cfg.address);
+    put_be32(&(j->hdr[7]), j->cfg.length);
+
+    job_request(j, FLASH_DOWNLOAD, j->hdr, FLASH_REQUEST_DOWNLOAD_LEN);
+}
+
+int uds_flash_poll(uds_flash_t flash, const uint64_t now_us) {
+    if (flash == NULL) {
+        return -EINVAL;
+    }
+
+    for (int i=0; i < flash->job_count; i++) {
+        struct flash_job_s* j = flash->jobs[i];
+        if ((j->state == FLASH_QUEUED) &&
+            (flash->bus_active[j->cfg.bus] < flash->max_per_bus)) {
+            job_start(j);
+        }
+    }
+
+    int rc = uds_client_poll(flash->client, now_us);
+    if (rc < 0) {
+        return rc;
+    }
+
+    int unfinished = 0;
+    for (int i=0; i < flash->job_count; i++) {
+        if (flash->jobs[i]->state != FLASH_DONE) {
+            unfinished++;
+        }
+    }
+
+    return unfinished;
+}
+
+int uds_flash_result(const uds_flash_t flash, const int job, int* nrc) {
+    if ((flash == NULL) || (job < 0) || (job >= flash->job_count)) {
+        return -EINVAL;
+    }
+
+    if (nrc != NULL) {
+        *nrc = flash->jobs[job]->nrc;
+    }
+
+    return flash->jobs[job]->rc;
+}
+
+int64_t uds_flash_progress(const uds_flash_t flash, const int job) {
+    if ((flash == NULL) || (job < 0) || (job >= flash->job_count)) {
+        return -EINVAL;
+    }
+
+    return flash->jobs[job]->acked;
+}
@@ -0,0 +1,154 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ * 
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <uds/uds.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @ref ISO-14229-1:2020, sections 14.2-14.5
+ *
+ * Reflashing of many ECUs at once.
+ *
+ * Every job downloads one file region to one ECU with RequestDownload
+ * (0x34), TransferData (0x36) and RequestTransferExit (0x37).  The jobs
+ * run concurrently through a UDS client, each paced by its ECU's FCs,
+ * with at most max_per_bus jobs active on each bus so the transfers
+ * sharing a bus don't starve each other.  Data is read from the file
+ * with pread() one block at a time, so images need not fit into memory.
+ */
+
+#define UDS_SID_REQUEST_DOWNLOAD        (0x34)
+#define UDS_SID_TRANSFER_DATA           (0x36)
+#define UDS_SID_REQUEST_TRANSFER_EXIT   (0x37)
+
+/**
+ * @brief what to flash where
+ */
+struct uds_flash_job_s {
+    int ecu;                  // ECU number in the UDS client
+    int bus;                  // bus the ECU is on, >= 0
+    int fd;                   // file holding the image
+    off_t offset;             // start of the image in the file
+    uint32_t length;          // length of the image
+    uint32_t address;         // memory address to download to
+    uint8_t data_format;      // dataFormatIdentifier, 0 if not compressed
+                              // or encrypted
+    int max_block_len;        // largest TransferData request to send,
+                              // 0 to use what the ECU allows
+};
+typedef struct uds_flash_job_s uds_flash_job_t;
+
+typedef struct uds_flash_s* uds_flash_t;
+
+/**
+ * @brief allocate a flash orchestrator
+ *
+ * @param flash - updated with pointer to the allocated orchestrator
+ * @param client - UDS client the ECUs were added to
+ * @param max_per_bus - most jobs active on one bus at once, >0
+ *
+ * @returns
+ * on success, 0
+ * otherwise (<0) - error code
+ */
+int uds_flash_init(uds_flash_t* flash,
+                   uds_client_t client,
+                   const int max_per_bus);
+
+/**
+ * @brief free a flash orchestrator
+ *
+ * Must not be freed while jobs are running.
+ *
+ * @param flash - flash orchestrator
+ */
+void uds_flash_free(uds_flash_t flash);
+
+/**
+ * @brief add a job; jobs start in the order they were added
+ *
+ * @param flash - flash orchestrator
+ * @param job - what to flash (copied)
+ *
+ * @returns
+ * on success (>=0), the job number
+ * otherwise (<0) - error code
+ */
+int uds_flash_add(uds_flash_t flash, const uds_flash_job_t* job);
+
+/**
+ * @brief start jobs and advance the running ones
+ *
+ * Never sleeps; see uds_client_poll().
+ *
+ * @param flash - flash orchestrator
+ * @param now_us - current time, in microseconds, from a monotonic clock
+ *
+ * @returns
+ * on success (>=0), the number of jobs not yet finished
+ * otherwise (<0) - error code
+ */
+int uds_flash_poll(uds_flash_t flash, const uint64_t now_us);
+
+/**
+ * @brief return the result of a job
+ *
+ * @param flash - flash orchestrator
+ * @param job - job number
+ * @param nrc - updated with the NRC of a negative response, 0 if none
+ *              may be NULL
+ *
+ * @returns
+ *     0 - the job succeeded
+ *     -EINPROGRESS - the job hasn't finished
+ *     -EPROTO - the ECU sent a negative response, see nrc
+ *     -EBADMSG - the ECU sent an unexpected response
+ *     <0 - other error code (e.g. -ETIMEDOUT, or the pread() errno)
+ */
+int uds_flash_result(const uds_flash_t flash, const int job, int* nrc);
+
+/**
+ * @brief return how many bytes of a job have been transferred
+ *
+ * @param flash - flash orchestrator
+ * @param job - job number
+ *
+ * @returns
+ * on success (>=0), bytes acknowledged by the ECU
+ * otherwise (<0) - error code
+ */
+int64_t uds_flash_progress(const uds_flash_t flash, const int job);
+
+#ifdef __cplusplus
+}
+#endif
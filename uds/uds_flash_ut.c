@@ -0,0 +1,469 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ * 
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <isotp.h>
+#include <uds/uds.h>
+#include <uds/uds_flash.h>
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+// loopback transport, as in unit_tests/isotp_async_ut.c
+#define LINK_DEPTH (1024)
+
+struct link_s {
+    uint8_t frame[LINK_DEPTH][8];
+    int frame_len[LINK_DEPTH];
+    int head;
+    int tail;
+};
+
+struct port_s {
+    struct link_s* rx;
+    struct link_s* tx;
+};
+
+static int rx_f(void* rxfn_ctx,
+                uint8_t* rx_buf_p,
+                const int rx_buf_sz,
+                const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct port_s* port = (struct port_s*)rxfn_ctx;
+
+    if (port->rx->head == port->rx->tail) {
+        return -EAGAIN;
+    }
+
+    int i = port->rx->head % LINK_DEPTH;
+    int len = port->rx->frame_len[i];
+    assert_true(len <= rx_buf_sz);
+    memcpy(rx_buf_p, port->rx->frame[i], len);
+    port->rx->head++;
+
+    return len;
+}
+
+static int tx_f(void* txfn_ctx,
+                const uint8_t* tx_buf_p,
+                const int tx_len,
+                const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct port_s* port = (struct port_s*)txfn_ctx;
+
+    assert_true((port->tx->tail - port->tx->head) < LINK_DEPTH);
+    int i = port->tx->tail % LINK_DEPTH;
+    memcpy(port->tx->frame[i], tx_buf_p, tx_len);
+    port->tx->frame_len[i] = tx_len;
+    port->tx->tail++;
+
+    return tx_len;
+}
+
+// a simulated bootloader, writing downloads into its memory
+#define SIM_MEMORY (16384)
+
+struct sim_ecu_s {
+    struct link_s to_ecu;
+    struct link_s to_tester;
+    struct port_s tester_port;
+    struct port_s ecu_port;
+    isotp_ctx_t tester;
+    isotp_ctx_t ecu;
+
+    bool receiving;
+    bool sending;
+    uint8_t req[4096];
+    uint8_t resp[16];
+
+    uint8_t memory[SIM_MEMORY];
+    uint32_t address;
+    uint32_t remaining;
+    uint8_t seq;
+    bool downloading;
+    int blocks;
+
+    int max_block_len;        // advertised in the RequestDownload response
+    uint8_t reject_nrc;       // NRC to answer RequestDownload with
+    bool bad_seq;             // echo the wrong sequence counter
+
+    int *bus_active;          // downloads running on this ECU's bus
+    int *bus_active_max;
+};
+
+static void sim_init(struct sim_ecu_s* sim) {
+    memset(sim, 0, sizeof(*sim));
+    sim->tester_port.rx = &(sim->to_tester);
+    sim->tester_port.tx = &(sim->to_ecu);
+    sim->ecu_port.rx = &(sim->to_ecu);
+    sim->ecu_port.tx = &(sim->to_tester);
+    sim->max_block_len = 258;
+
+    assert_true(isotp_ctx_init(&(sim->tester), CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, &(sim->tester_port), rx_f, tx_f) == EOK);
+    assert_true(isotp_ctx_init(&(sim->ecu), CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, &(sim->ecu_port), rx_f, tx_f) == EOK);
+}
+
+static void sim_free(struct sim_ecu_s* sim) {
+    isotp_ctx_free(sim->tester);
+    isotp_ctx_free(sim->ecu);
+}
+
+static int sim_nrc(struct sim_ecu_s* sim, const uint8_t sid, const uint8_t nrc) {
+    sim->resp[0] = UDS_NEGATIVE_RESPONSE_SID;
+    sim->resp[1] = sid;
+    sim->resp[2] = nrc;
+    return 3;
+}
+
+static int sim_handle(struct sim_ecu_s* sim, const int req_len) {
+    uint8_t sid = sim->req[0];
+    sim->resp[0] = sid + UDS_POSITIVE_RESPONSE_SID;
+
+    switch (sid) {
+        case UDS_SID_REQUEST_DOWNLOAD:
+            assert_true(req_len == 11);
+            assert_true(sim->req[2] == 0x44);
+            if (sim->reject_nrc != 0) {
+                return sim_nrc(sim, sid, sim->reject_nrc);
+            }
+            sim->address = ((uint32_t)sim->req[3] << 24) | ((uint32_t)sim->req[4] << 16) |
+                           ((uint32_t)sim->req[5] << 8) | sim->req[6];
+            sim->remaining = ((uint32_t)sim->req[7] << 24) | ((uint32_t)sim->req[8] << 16) |
+                             ((uint32_t)sim->req[9] << 8) | sim->req[10];
+            assert_true(sim->address + sim->remaining <= SIM_MEMORY);
+            sim->seq = 1;
+            sim->downloading = true;
+            if (sim->bus_active != NULL) {
+                (*(sim->bus_active))++;
+                if (*(sim->bus_active) > *(sim->bus_active_max)) {
+                    *(sim->bus_active_max) = *(sim->bus_active);
+                }
+            }
+            sim->resp[1] = 0x20;
+            sim->resp[2] = (uint8_t)(sim->max_block_len >> 8);
+            sim->resp[3] = (uint8_t)sim->max_block_len;
+            return 4;
+
+        case UDS_SID_TRANSFER_DATA:
+            assert_true(sim->downloading);
+            assert_true(req_len <= sim->max_block_len);
+            if (sim->req[1] != sim->seq) {
+                return sim_nrc(sim, sid, 0x73);
+            }
+            assert_true((uint32_t)(req_len - 2) <= sim->remaining);
+            memcpy(&(sim->memory[sim->address]), &(sim->req[2]), req_len - 2);
+            sim->address += req_len - 2;
+            sim->remaining -= req_len - 2;
+            sim->resp[1] = sim->bad_seq ? (uint8_t)(sim->seq + 1) : sim->seq;
+            sim->seq++;
+            sim->blocks++;
+            return 2;
+
+        case UDS_SID_REQUEST_TRANSFER_EXIT:
+            if (!sim->downloading || (sim->remaining != 0)) {
+                return sim_nrc(sim, sid, 0x24);
+            }
+            sim->downloading = false;
+            if (sim->bus_active != NULL) {
+                (*(sim->bus_active))--;
+            }
+            return 1;
+
+        default:
+            return sim_nrc(sim, sid, 0x11);
+    }
+}
+
+static void sim_step(struct sim_ecu_s* sim, const uint64_t now) {
+    if (sim->sending) {
+        int rc = isotp_poll(sim->ecu, now);
+        if (rc == -EINPROGRESS) {
+            return;
+        }
+        assert_true(rc > 0);
+        sim->sending = false;
+    }
+
+    if (!sim->receiving) {
+        assert_true(isotp_recv_start(sim->ecu, sim->req, sizeof(sim->req),
+                                     0, 0, 0) == EOK);
+        sim->receiving = true;
+    }
+    int rc = isotp_poll(sim->ecu, now);
+    if (rc == -EINPROGRESS) {
+        return;
+    }
+    sim->receiving = false;
+    assert_true(rc > 0);
+
+    int resp_len = sim_handle(sim, rc);
+    assert_true(isotp_send_start(sim->ecu, sim->resp, resp_len, 0) == EOK);
+    sim->sending = true;
+}
+
+static uint64_t run(uds_flash_t flash,
+                    struct sim_ecu_s* sims,
+                    const int sim_count) {
+    uint64_t now = 1;
+    for (int i=0; i < 10000000; i++) {
+        int pending = uds_flash_poll(flash, now);
+        assert_true(pending >= 0);
+        for (int s=0; s < sim_count; s++) {
+            sim_step(&(sims[s]), now);
+        }
+        if (pending == 0) {
+            return now;
+        }
+        now += 100;
+    }
+    fail();
+    return now;
+}
+
+static int make_image(const int len) {
+    char path[] = "/tmp/uds_flash_ut.XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    unlink(path);
+
+    uint8_t buf[256];
+    for (int off=0; off < len; off += (int)sizeof(buf)) {
+        int n = ((len - off) < (int)sizeof(buf)) ? (len - off) : (int)sizeof(buf);
+        for (int i=0; i < n; i++) {
+            buf[i] = (uint8_t)(rand() & 0xff);
+        }
+        assert_true(write(fd, buf, n) == n);
+    }
+    return fd;
+}
+
+static void check_image(const int fd,
+                        const off_t offset,
+                        const struct sim_ecu_s* sim,
+                        const uint32_t address,
+                        const uint32_t len) {
+    uint8_t* expected = malloc(len);
+    assert_non_null(expected);
+    assert_true(pread(fd, expected, len, offset) == (ssize_t)len);
+    assert_memory_equal(&(sim->memory[address]), expected, len);
+    free(expected);
+}
+
+// tests
+static void flash_invalid_parameters(void** state) {
+    (void)state;
+
+    uds_client_t client = NULL;
+    uds_flash_t flash = NULL;
+    assert_true(uds_client_init(&client) == EOK);
+
+    assert_true(uds_flash_init(NULL, client, 1) == -EINVAL);
+    assert_true(uds_flash_init(&flash, NULL, 1) == -EINVAL);
+    assert_true(uds_flash_init(&flash, client, 0) == -ERANGE);
+    assert_true(uds_flash_init(&flash, client, 1) == EOK);
+
+    uds_flash_job_t job = { .ecu = 0, .bus = 0, .fd = 0, .length = 16 };
+    assert_true(uds_flash_add(NULL, &job) == -EINVAL);
+    assert_true(uds_flash_add(flash, NULL) == -EINVAL);
+    job.fd = -1;
+    assert_true(uds_flash_add(flash, &job) == -ERANGE);
+    job.fd = 0;
+    job.bus = -1;
+    assert_true(uds_flash_add(flash, &job) == -ERANGE);
+    job.bus = 0;
+    job.max_block_len = 2;
+    assert_true(uds_flash_add(flash, &job) == -ERANGE);
+    job.max_block_len = 0;
+    assert_true(uds_flash_add(flash, &job) == 0);
+
+    assert_true(uds_flash_result(flash, 0, NULL) == -EINPROGRESS);
+    assert_true(uds_flash_result(flash, 1, NULL) == -EINVAL);
+    assert_true(uds_flash_result(NULL, 0, NULL) == -EINVAL);
+    assert_true(uds_flash_progress(flash, 0) == 0);
+    assert_true(uds_flash_progress(flash, -1) == -EINVAL);
+    assert_true(uds_flash_poll(NULL, 0) == -EINVAL);
+
+    uds_flash_free(flash);
+    uds_flash_free(NULL);
+    uds_client_free(client);
+}
+
+static void flash_many_ecus(void** state) {
+    (void)state;
+
+    // six ECUs on two buses, at most two downloads per bus at a time
+    #define ECUS (6)
+    static struct sim_ecu_s sims[ECUS];
+    int bus_active[2] = { 0 };
+    int bus_active_max[2] = { 0 };
+    const uint32_t lens[ECUS] = { 0, 1, 254, 255, 4000, 9001 };
+
+    uds_client_t client = NULL;
+    uds_flash_t flash = NULL;
+    assert_true(uds_client_init(&client) == EOK);
+    assert_true(uds_flash_init(&flash, client, 2) == EOK);
+
+    int fd = make_image(16384);
+    for (int e=0; e < ECUS; e++) {
+        sim_init(&(sims[e]));
+        sims[e].bus_active = &(bus_active[e % 2]);
+        sims[e].bus_active_max = &(bus_active_max[e % 2]);
+        assert_true(uds_client_add_ecu(client, sims[e].tester, UDS_DEFAULT_P2_USEC,
+                                       UDS_DEFAULT_P2_STAR_USEC, 1) == e);
+
+        uds_flash_job_t job = {
+            .ecu = e,
+            .bus = e % 2,
+            .fd = fd,
+            .offset = 100 * e,
+            .length = lens[e],
+            .address = 0x100 + e,
+            .data_format = 0,
+            .max_block_len = 0
+        };
+        assert_true(uds_flash_add(flash, &job) == e);
+    }
+
+    run(flash, sims, ECUS);
+
+    for (int e=0; e < ECUS; e++) {
+        int nrc = -1;
+        assert_true(uds_flash_result(flash, e, &nrc) == EOK);
+        assert_true(nrc == 0);
+        assert_true(uds_flash_progress(flash, e) == lens[e]);
+        assert_true(sims[e].blocks == (int)((lens[e] + 255) / 256));
+        check_image(fd, 100 * e, &(sims[e]), 0x100 + e, lens[e]);
+    }
+    assert_true(bus_active_max[0] == 2);
+    assert_true(bus_active_max[1] == 2);
+
+    close(fd);
+    uds_flash_free(flash);
+    uds_client_free(client);
+    for (int e=0; e < ECUS; e++) {
+        sim_free(&(sims[e]));
+    }
+    #undef ECUS
+}
+
+static void flash_block_len_and_seq_wrap(void** state) {
+    (void)state;
+
+    static struct sim_ecu_s sim;
+    sim_init(&sim);
+    sim.max_block_len = 4000;
+
+    uds_client_t client = NULL;
+    uds_flash_t flash = NULL;
+    assert_true(uds_client_init(&client) == EOK);
+    assert_true(uds_flash_init(&flash, client, 1) == EOK);
+    assert_true(uds_client_add_ecu(client, sim.tester, UDS_DEFAULT_P2_USEC,
+                                   UDS_DEFAULT_P2_STAR_USEC, 1) == 0);
+
+    // our own limit is smaller than the ECU's; 300 blocks wraps the counter
+    int fd = make_image(12000);
+    uds_flash_job_t job = { .ecu = 0, .bus = 0, .fd = fd, .offset = 0,
+                            .length = 12000, .address = 0, .max_block_len = 42 };
+    assert_true(uds_flash_add(flash, &job) == 0);
+    run(flash, &sim, 1);
+
+    assert_true(uds_flash_result(flash, 0, NULL) == EOK);
+    assert_true(sim.blocks == 300);
+    check_image(fd, 0, &sim, 0, 12000);
+
+    close(fd);
+    uds_flash_free(flash);
+    uds_client_free(client);
+    sim_free(&sim);
+}
+
+static void flash_failures(void** state) {
+    (void)state;
+
+    static struct sim_ecu_s sims[3];
+    uds_client_t client = NULL;
+    uds_flash_t flash = NULL;
+    assert_true(uds_client_init(&client) == EOK);
+    assert_true(uds_flash_init(&flash, client, 4) == EOK);
+
+    int fd = make_image(1000);
+    for (int e=0; e < 3; e++) {
+        sim_init(&(sims[e]));
+        assert_true(uds_client_add_ecu(client, sims[e].tester, UDS_DEFAULT_P2_USEC,
+                                       UDS_DEFAULT_P2_STAR_USEC, 1) == e);
+    }
+    // rejects the download, echoes the wrong counter, file too short
+    sims[0].reject_nrc = 0x70;
+    sims[1].bad_seq = true;
+
+    uds_flash_job_t job = { .ecu = 0, .bus = 0, .fd = fd, .length = 500 };
+    assert_true(uds_flash_add(flash, &job) == 0);
+    job.ecu = 1;
+    assert_true(uds_flash_add(flash, &job) == 1);
+    job.ecu = 2;
+    job.offset = 800;
+    assert_true(uds_flash_add(flash, &job) == 2);
+    run(flash, sims, 3);
+
+    int nrc = 0;
+    assert_true(uds_flash_result(flash, 0, &nrc) == -EPROTO);
+    assert_true(nrc == 0x70);
+    assert_true(uds_flash_result(flash, 1, &nrc) == -EBADMSG);
+    assert_true(nrc == 0);
+    assert_true(uds_flash_progress(flash, 1) == 0);
+    assert_true(uds_flash_result(flash, 2, &nrc) == -EIO);
+
+    close(fd);
+    uds_flash_free(flash);
+    uds_client_free(client);
+    for (int e=0; e < 3; e++) {
+        sim_free(&(sims[e]));
+    }
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(flash_invalid_parameters),
+        cmocka_unit_test(flash_many_ecus),
+        cmocka_unit_test(flash_block_len_and_seq_wrap),
+        cmocka_unit_test(flash_failures),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,595 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ * 
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <isotp.h>
+#include <uds/uds.h>
+
+#ifndef EOK
+#define EOK (0)
+#endif  // EOK
+
+// loopback transport, as in unit_tests/isotp_async_ut.c
+#define LINK_DEPTH (256)
+
+struct link_s {
+    uint8_t frame[LINK_DEPTH][8];
+    int frame_len[LINK_DEPTH];
+    int head;
+    int tail;
+};
+
+struct port_s {
+    struct link_s* rx;
+    struct link_s* tx;
+};
+
+static int rx_f(void* rxfn_ctx,
+                uint8_t* rx_buf_p,
+                const int rx_buf_sz,
+                const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct port_s* port = (struct port_s*)rxfn_ctx;
+
+    if (port->rx->head == port->rx->tail) {
+        return -EAGAIN;
+    }
+
+    int i = port->rx->head % LINK_DEPTH;
+    int len = port->rx->frame_len[i];
+    assert_true(len <= rx_buf_sz);
+    memcpy(rx_buf_p, port->rx->frame[i], len);
+    port->rx->head++;
+
+    return len;
+}
+
+static int tx_f(void* txfn_ctx,
+                const uint8_t* tx_buf_p,
+                const int tx_len,
+                const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct port_s* port = (struct port_s*)txfn_ctx;
+
+    assert_true((port->tx->tail - port->tx->head) < LINK_DEPTH);
+    int i = port->tx->tail % LINK_DEPTH;
+    memcpy(port->tx->frame[i], tx_buf_p, tx_len);
+    port->tx->frame_len[i] = tx_len;
+    port->tx->tail++;
+
+    return tx_len;
+}
+
+// a simulated ECU, answering every request with a positive response
+enum sim_state_e {
+    SIM_RECV,
+    SIM_RESPOND,
+    SIM_SENDING_PENDING,
+    SIM_SENDING_FINAL
+};
+
+struct sim_ecu_s {
+    struct link_s to_ecu;
+    struct link_s to_tester;
+    struct port_s tester_port;
+    struct port_s ecu_port;
+    isotp_ctx_t tester;
+    isotp_ctx_t ecu;
+
+    enum sim_state_e state;
+    bool receiving;
+    uint8_t req[256];
+    int req_len;
+    uint8_t resp[512];
+    int resp_len;
+    uint8_t pending[3];
+
+    int pending_count;        // "response pending" before each response
+    uint64_t pending_gap_us;  // delay of each pending and of the response
+    int resp_extra;           // bytes added to each response
+    int stray_count;          // responses to another SID before the pendings
+    bool silent;              // never responds
+
+    int pendings_sent;
+    int strays_sent;
+    uint64_t next_us;
+    int requests;
+    uint64_t first_request_us;
+};
+
+static void sim_init(struct sim_ecu_s* sim) {
+    memset(sim, 0, sizeof(*sim));
+    sim->tester_port.rx = &(sim->to_tester);
+    sim->tester_port.tx = &(sim->to_ecu);
+    sim->ecu_port.rx = &(sim->to_ecu);
+    sim->ecu_port.tx = &(sim->to_tester);
+
+    assert_true(isotp_ctx_init(&(sim->tester), CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, &(sim->tester_port), rx_f, tx_f) == EOK);
+    assert_true(isotp_ctx_init(&(sim->ecu), CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, &(sim->ecu_port), rx_f, tx_f) == EOK);
+}
+
+static void sim_free(struct sim_ecu_s* sim) {
+    isotp_ctx_free(sim->tester);
+    isotp_ctx_free(sim->ecu);
+}
+
+static void sim_step(struct sim_ecu_s* sim, const uint64_t now) {
+    int rc = 0;
+
+    switch (sim->state) {
+        case SIM_RECV:
+            if (!sim->receiving) {
+                assert_true(isotp_recv_start(sim->ecu, sim->req, sizeof(sim->req),
+                                             0, 0, 0) == EOK);
+                sim->receiving = true;
+            }
+            rc = isotp_poll(sim->ecu, now);
+            if (rc == -EINPROGRESS) {
+                return;
+            }
+            sim->receiving = false;
+            assert_true(rc > 0);
+            sim->req_len = rc;
+            if (sim->requests++ == 0) {
+                sim->first_request_us = now;
+            }
+            if (!sim->silent) {
+                sim->pendings_sent = 0;
+                sim->strays_sent = 0;
+                sim->next_us = now + sim->pending_gap_us;
+                sim->state = SIM_RESPOND;
+            }
+            break;
+
+        case SIM_RESPOND:
+            if (now < sim->next_us) {
+                return;
+            }
+            if (sim->strays_sent < sim->stray_count) {
+                // alternately a "response pending" and a positive response,
+                // both to a RoutineControl the tester didn't send
+                if ((sim->strays_sent % 2) == 0) {
+                    sim->pending[0] = UDS_NEGATIVE_RESPONSE_SID;
+                    sim->pending[1] = 0x31;
+                    sim->pending[2] = UDS_NRC_RESPONSE_PENDING;
+                } else {
+                    sim->pending[0] = 0x31 + UDS_POSITIVE_RESPONSE_SID;
+                    sim->pending[1] = 0x01;
+                    sim->pending[2] = 0x02;
+                }
+                assert_true(isotp_send_start(sim->ecu, sim->pending, 3, 0) == EOK);
+                sim->strays_sent++;
+                sim->next_us = now + sim->pending_gap_us;
+                sim->state = SIM_SENDING_PENDING;
+                break;
+            }
+            if (sim->pendings_sent < sim->pending_count) {
+                sim->pending[0] = UDS_NEGATIVE_RESPONSE_SID;
+                sim->pending[1] = sim->req[0];
+                sim->pending[2] = UDS_NRC_RESPONSE_PENDING;
+                assert_true(isotp_send_start(sim->ecu, sim->pending, 3, 0) == EOK);
+                sim->pendings_sent++;
+                sim->next_us = now + sim->pending_gap_us;
+                sim->state = SIM_SENDING_PENDING;
+                break;
+            }
+            sim->resp[0] = sim->req[0] + UDS_POSITIVE_RESPONSE_SID;
+            memcpy(&(sim->resp[1]), &(sim->req[1]), sim->req_len - 1);
+            sim->resp_len = sim->req_len;
+            for (int i=0; i < sim->resp_extra; i++) {
+                sim->resp[sim->resp_len++] = (uint8_t)i;
+            }
+            assert_true(isotp_send_start(sim->ecu, sim->resp, sim->resp_len, 0) == EOK);
+            sim->state = SIM_SENDING_FINAL;
+            break;
+
+        case SIM_SENDING_PENDING:
+        case SIM_SENDING_FINAL:
+            rc = isotp_poll(sim->ecu, now);
+            if (rc == -EINPROGRESS) {
+                return;
+            }
+            assert_true(rc > 0);
+            sim->state = (sim->state == SIM_SENDING_PENDING) ? SIM_RESPOND : SIM_RECV;
+            break;
+    }
+}
+
+// run the client and the ECUs, 100us apart, until no requests are left
+static uint64_t run(uds_client_t client,
+                    struct sim_ecu_s* sims,
+                    const int sim_count,
+                    uint64_t now) {
+    for (int i=0; i < 1000000; i++) {
+        int pending = uds_client_poll(client, now);
+        assert_true(pending >= 0);
+        for (int s=0; s < sim_count; s++) {
+            sim_step(&(sims[s]), now);
+        }
+        if (pending == 0) {
+            return now;
+        }
+        now += 100;
+    }
+    fail();
+    return now;
+}
+
+struct result_s {
+    int rc;
+    int order;
+    uint8_t resp[512];
+};
+
+static int completions;
+
+static void record_cb(void* cb_ctx, const int rc, uint8_t* resp_p) {
+    struct result_s* result = (struct result_s*)cb_ctx;
+    assert_true((resp_p == NULL) || (resp_p == result->resp));
+    result->rc = rc;
+    result->order = completions++;
+}
+
+static const uint8_t read_vin[] = { 0x22, 0xF1, 0x90 };
+
+// tests
+static void uds_nrc_values(void** state) {
+    (void)state;
+
+    const uint8_t pending[] = { 0x7F, 0x22, 0x78 };
+    const uint8_t positive[] = { 0x62, 0xF1, 0x90 };
+    assert_true(uds_nrc(pending, sizeof(pending)) == UDS_NRC_RESPONSE_PENDING);
+    assert_true(uds_nrc(pending, 2) == 0);
+    assert_true(uds_nrc(positive, sizeof(positive)) == 0);
+    assert_true(uds_nrc(NULL, 3) == 0);
+}
+
+static void uds_invalid_parameters(void** state) {
+    (void)state;
+
+    struct sim_ecu_s sim;
+    sim_init(&sim);
+    uds_client_t client = NULL;
+    uint8_t resp[8];
+
+    assert_true(uds_client_init(NULL) == -EINVAL);
+    assert_true(uds_client_init(&client) == EOK);
+    assert_true(uds_client_add_ecu(NULL, sim.tester, 50000, 5000000, 4) == -EINVAL);
+    assert_true(uds_client_add_ecu(client, NULL, 50000, 5000000, 4) == -EINVAL);
+    assert_true(uds_client_add_ecu(client, sim.tester, 0, 5000000, 4) == -ERANGE);
+    assert_true(uds_client_add_ecu(client, sim.tester, 50000, 0, 4) == -ERANGE);
+    assert_true(uds_client_add_ecu(client, sim.tester, 50000, 5000000, 0) == -ERANGE);
+    assert_true(uds_client_add_ecu(client, sim.tester, 50000, 5000000, 1) == 0);
+
+    assert_true(uds_client_set_fc(client, 1, 0, 0) == -EINVAL);
+    assert_true(uds_client_set_fc(client, 0, 0, -1) == -ERANGE);
+    assert_true(uds_client_set_fc(client, 0, 8, 1000) == EOK);
+
+    assert_true(uds_request(NULL, 0, read_vin, 3, resp, 8, 0, NULL, NULL) == -EINVAL);
+    assert_true(uds_request(client, -1, read_vin, 3, resp, 8, 0, NULL, NULL) == -EINVAL);
+    assert_true(uds_request(client, 1, read_vin, 3, resp, 8, 0, NULL, NULL) == -EINVAL);
+    assert_true(uds_request(client, 0, NULL, 3, resp, 8, 0, NULL, NULL) == -EINVAL);
+    assert_true(uds_request(client, 0, read_vin, 3, NULL, 8, 0, NULL, NULL) == -EINVAL);
+    assert_true(uds_request(client, 0, read_vin, 0, resp, 8, 0, NULL, NULL) == -ERANGE);
+
+    // queue of one
+    assert_true(uds_request(client, 0, read_vin, 3, resp, 8, 0, NULL, NULL) == EOK);
+    assert_true(uds_request(client, 0, read_vin, 3, resp, 8, 0, NULL, NULL) == -ENOBUFS);
+
+    assert_true(uds_client_poll(NULL, 0) == -EINVAL);
+    assert_true(uds_client_run(NULL, 0, 0) == -EINVAL);
+
+    uds_client_free(client);
+    uds_client_free(NULL);
+    sim_free(&sim);
+}
+
+static void uds_pipelined_requests(void** state) {
+    (void)state;
+
+    #define ECUS (4)
+    #define REQS (5)
+    struct sim_ecu_s sims[ECUS];
+    static struct result_s results[ECUS][REQS];
+    uds_client_t client = NULL;
+    assert_true(uds_client_init(&client) == EOK);
+
+    for (int e=0; e < ECUS; e++) {
+        sim_init(&(sims[e]));
+        sims[e].pending_gap_us = 2000;  // 2ms to answer each request
+        sims[e].resp_extra = 20 * e;    // SFs and multi-frame responses
+        assert_true(uds_client_add_ecu(client, sims[e].tester,
+                                       UDS_DEFAULT_P2_USEC,
+                                       UDS_DEFAULT_P2_STAR_USEC, REQS) == e);
+    }
+
+    completions = 0;
+    for (int r=0; r < REQS; r++) {
+        for (int e=0; e < ECUS; e++) {
+            results[e][r].rc = -EINPROGRESS;
+            assert_true(uds_request(client, e, read_vin, sizeof(read_vin),
+                                    results[e][r].resp, sizeof(results[e][r].resp),
+                                    0, record_cb, &(results[e][r])) == EOK);
+        }
+    }
+
+    uint64_t end = run(client, sims, ECUS, 1);
+
+    for (int e=0; e < ECUS; e++) {
+        assert_true(sims[e].requests == REQS);
+        // every ECU got its first request straight away
+        assert_true(sims[e].first_request_us < 1000);
+        for (int r=0; r < REQS; r++) {
+            assert_true(results[e][r].rc == (int)sizeof(read_vin) + 20 * e);
+            assert_true(results[e][r].resp[0] == 0x62);
+            assert_memory_equal(&(results[e][r].resp[1]), &(read_vin[1]), 2);
+            // in order per ECU
+            if (r > 0) {
+                assert_true(results[e][r].order > results[e][r - 1].order);
+            }
+        }
+    }
+
+    // concurrently, not one ECU after the other
+    assert_true(end < (uint64_t)(REQS * 2 * 2000));
+
+    uds_client_free(client);
+    for (int e=0; e < ECUS; e++) {
+        sim_free(&(sims[e]));
+    }
+    #undef ECUS
+    #undef REQS
+}
+
+static void uds_response_pending(void** state) {
+    (void)state;
+
+    struct sim_ecu_s sim;
+    sim_init(&sim);
+    // three pendings, 40ms apart, so the response comes long after P2
+    sim.pending_count = 3;
+    sim.pending_gap_us = 40000;
+
+    uds_client_t client = NULL;
+    assert_true(uds_client_init(&client) == EOK);
+    assert_true(uds_client_add_ecu(client, sim.tester, 50000, 100000, 2) == 0);
+
+    static struct result_s result;
+    completions = 0;
+    assert_true(uds_request(client, 0, read_vin, sizeof(read_vin), result.resp,
+                            sizeof(result.resp), 0, record_cb, &result) == EOK);
+    uint64_t end = run(client, &sim, 1, 1);
+
+    assert_true(result.rc == sizeof(read_vin));
+    assert_true(result.resp[0] == 0x62);
+    assert_true(end >= 160000);
+
+    // P2* expires if the ECU keeps asking for longer than that
+    sim.pending_gap_us = 150000;
+    sim.pending_count = 1;
+    assert_true(uds_request(client, 0, read_vin, sizeof(read_vin), result.resp,
+                            sizeof(result.resp), 0, record_cb, &result) == EOK);
+    run(client, &sim, 1, end);
+    assert_true(result.rc == -ETIMEDOUT);
+
+    uds_client_free(client);
+    sim_free(&sim);
+}
+
+static void uds_stray_responses(void** state) {
+    (void)state;
+
+    struct sim_ecu_s sim;
+    sim_init(&sim);
+    sim.stray_count = 2;
+    sim.pending_gap_us = 10000;
+
+    uds_client_t client = NULL;
+    assert_true(uds_client_init(&client) == EOK);
+    assert_true(uds_client_add_ecu(client, sim.tester, 50000, 5000000, 2) == 0);
+
+    // responses to another SID are skipped over
+    static struct result_s result;
+    completions = 0;
+    assert_true(uds_request(client, 0, read_vin, sizeof(read_vin), result.resp,
+                            sizeof(result.resp), 0, record_cb, &result) == EOK);
+    uint64_t end = run(client, &sim, 1, 1);
+    assert_true(result.rc == sizeof(read_vin));
+    assert_true(result.resp[0] == 0x62);
+
+    // and don't extend P2, not even a "response pending"
+    sim.pending_gap_us = 30000;
+    uint64_t start = end;
+    assert_true(uds_request(client, 0, read_vin, sizeof(read_vin), result.resp,
+                            sizeof(result.resp), 0, record_cb, &result) == EOK);
+    end = run(client, &sim, 1, start);
+    assert_true(result.rc == -ETIMEDOUT);
+    assert_true(end - start < 60000);
+
+    uds_client_free(client);
+    sim_free(&sim);
+}
+
+static void uds_p2_timeout(void** state) {
+    (void)state;
+
+    struct sim_ecu_s sims[2];
+    sim_init(&(sims[0]));
+    sim_init(&(sims[1]));
+    sims[0].silent = true;
+
+    uds_client_t client = NULL;
+    assert_true(uds_client_init(&client) == EOK);
+    assert_true(uds_client_add_ecu(client, sims[0].tester, 50000, 5000000, 2) == 0);
+    assert_true(uds_client_add_ecu(client, sims[1].tester, 50000, 5000000, 2) == 1);
+
+    static struct result_s results[3];
+    completions = 0;
+    assert_true(uds_request(client, 0, read_vin, sizeof(read_vin), results[0].resp,
+                            sizeof(results[0].resp), 0, record_cb, &(results[0])) == EOK);
+    assert_true(uds_request(client, 0, read_vin, sizeof(read_vin), results[1].resp,
+                            sizeof(results[1].resp), 0, record_cb, &(results[1])) == EOK);
+    assert_true(uds_request(client, 1, read_vin, sizeof(read_vin), results[2].resp,
+                            sizeof(results[2].resp), 0, record_cb, &(results[2])) == EOK);
+    uint64_t end = run(client, sims, 2, 1);
+
+    // both requests to the silent ECU time out, one after the other,
+    // without holding up the other ECU
+    assert_true(results[0].rc == -ETIMEDOUT);
+    assert_true(results[1].rc == -ETIMEDOUT);
+    assert_true(results[2].rc == sizeof(read_vin));
+    assert_true(results[2].order == 0);
+    assert_true(sims[0].requests == 2);
+    assert_true(end >= 100000);
+    assert_true(end < 110000);
+
+    uds_client_free(client);
+    sim_free(&(sims[0]));
+    sim_free(&(sims[1]));
+}
+
+static void uds_slow_cfs(void** state) {
+    (void)state;
+
+    struct sim_ecu_s sim;
+    sim_init(&sim);
+    sim.resp_extra = 20;
+
+    uds_client_t client = NULL;
+    assert_true(uds_client_init(&client) == EOK);
+    assert_true(uds_client_add_ecu(client, sim.tester, 50000, 5000000, 2) == 0);
+    // the ECU paces its CFs further apart than P2; that's N_Cr's business
+    assert_true(uds_client_set_fc(client, 0, 0, 80000) == EOK);
+
+    static struct result_s result;
+    completions = 0;
+    assert_true(uds_request(client, 0, read_vin, sizeof(read_vin), result.resp,
+                            sizeof(result.resp), 0, record_cb, &result) == EOK);
+    uint64_t end = run(client, &sim, 1, 1);
+
+    assert_true(result.rc == (int)sizeof(read_vin) + 20);
+    assert_true(result.resp[0] == 0x62);
+    assert_true(result.resp[sizeof(read_vin) + 19] == 19);
+    assert_true(end >= 160000);
+
+    uds_client_free(client);
+    sim_free(&sim);
+}
+
+static int chained;
+
+static void chain_cb(void* cb_ctx, const int rc, uint8_t* resp_p) {
+    (void)resp_p;
+    assert_true(rc == 0);
+    uds_client_t client = (uds_client_t)cb_ctx;
+    static const uint8_t tester_present[] = { 0x3E, 0x80 };
+    if (++chained < 5) {
+        assert_true(uds_request(client, 0, tester_present, sizeof(tester_present),
+                                NULL, 0, UDS_REQ_NO_RESPONSE, chain_cb, client) == EOK);
+    }
+}
+
+static void uds_no_response(void** state) {
+    (void)state;
+
+    struct sim_ecu_s sim;
+    sim_init(&sim);
+    sim.silent = true;
+
+    uds_client_t client = NULL;
+    assert_true(uds_client_init(&client) == EOK);
+    assert_true(uds_client_add_ecu(client, sim.tester, 50000, 5000000, 1) == 0);
+
+    // each callback queues the next request
+    static const uint8_t tester_present[] = { 0x3E, 0x80 };
+    chained = 0;
+    assert_true(uds_request(client, 0, tester_present, sizeof(tester_present),
+                            NULL, 0, UDS_REQ_NO_RESPONSE, chain_cb, client) == EOK);
+    uint64_t end = run(client, &sim, 1, 1);
+    // let the ECU catch up with the requests still on the link
+    for (int i=0; i < 10; i++) {
+        sim_step(&sim, end);
+    }
+
+    assert_true(chained == 5);
+    assert_true(sim.requests == 5);
+    assert_true(end < 50000);
+
+    uds_client_free(client);
+    sim_free(&sim);
+}
+
+static void uds_run_real_time(void** state) {
+    (void)state;
+
+    // the simulated ECU answers from the transport of another client
+    struct sim_ecu_s sim;
+    sim_init(&sim);
+    uds_client_t client = NULL;
+    assert_true(uds_client_init(&client) == EOK);
+    assert_true(uds_client_add_ecu(client, sim.tester, 50000, 5000000, 1) == 0);
+
+    static struct result_s result;
+    assert_true(uds_request(client, 0, read_vin, sizeof(read_vin), result.resp,
+                            sizeof(result.resp), 0, record_cb, &result) == EOK);
+
+    // nothing answers; run gives up
+    assert_true(uds_client_run(client, 10000, 100) == -ETIMEDOUT);
+
+    // and completes with the P2 timeout
+    assert_true(uds_client_run(client, 0, 100) == EOK);
+    assert_true(result.rc == -ETIMEDOUT);
+
+    uds_client_free(client);
+    sim_free(&sim);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(uds_nrc_values),
+        cmocka_unit_test(uds_invalid_parameters),
+        cmocka_unit_test(uds_pipelined_requests),
+        cmocka_unit_test(uds_response_pending),
+        cmocka_unit_test(uds_stray_responses),
+        cmocka_unit_test(uds_p2_timeout),
+        cmocka_unit_test(uds_slow_cfs),
+        cmocka_unit_test(uds_no_response),
+        cmocka_unit_test(uds_run_real_time),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
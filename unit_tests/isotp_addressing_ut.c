@@ -0,0 +1,225 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "../isotp.h"
+#include "../isotp_private.h"
+
+static isotp_ctx_t fixed_ctx(void) {
+    isotp_ctx_t ctx = calloc(1, sizeof(struct isotp_ctx_s));
+    assert_non_null(ctx);
+    ctx->addressing_mode = ISOTP_NORMAL_FIXED_ADDRESSING_MODE;
+    return ctx;
+}
+
+// tests
+static void fixed_id_build_invalid_parameters(void** state) {
+    (void)state;
+
+    uint32_t id = 0;
+    assert_true(isotp_fixed_id_build(ISOTP_PHYSICAL_TA_TYPE, 0x10, 0xF1, 6, NULL) == -EINVAL);
+    assert_true(isotp_fixed_id_build(ISOTP_PHYSICAL_TA_TYPE, 0x10, 0xF1, 8, &id) == -ERANGE);
+    assert_true(isotp_fixed_id_build(NULL_ISOTP_TA_TYPE, 0x10, 0xF1, 6, &id) == -EFAULT);
+    assert_true(isotp_fixed_id_build(LAST_ISOTP_TA_TYPE, 0x10, 0xF1, 6, &id) == -EFAULT);
+}
+
+static void fixed_id_build_success(void** state) {
+    (void)state;
+
+    uint32_t id = 0;
+    assert_true(isotp_fixed_id_build(ISOTP_PHYSICAL_TA_TYPE, 0x10, 0xF1,
+                                     ISOTP_FIXED_DEFAULT_PRIORITY, &id) == EOK);
+    assert_true(id == 0x18DA10F1);
+    assert_true(isotp_fixed_id_build(ISOTP_FUNCTIONAL_TA_TYPE, 0x33, 0xF1,
+                                     ISOTP_FIXED_DEFAULT_PRIORITY, &id) == EOK);
+    assert_true(id == 0x18DB33F1);
+    assert_true(isotp_fixed_id_build(ISOTP_PHYSICAL_TA_TYPE, 0xFF, 0x00, 7, &id) == EOK);
+    assert_true(id == 0x1CDAFF00);
+    assert_true(isotp_fixed_id_build(ISOTP_PHYSICAL_TA_TYPE, 0x00, 0xFF, 0, &id) == EOK);
+    assert_true(id == 0x00DA00FF);
+}
+
+static void fixed_id_parse_invalid(void** state) {
+    (void)state;
+
+    isotp_ta_type_t type = NULL_ISOTP_TA_TYPE;
+    uint8_t ta = 0;
+    uint8_t sa = 0;
+    assert_true(isotp_fixed_id_parse(0x18DA10F1, NULL, &ta, &sa) == -EINVAL);
+    assert_true(isotp_fixed_id_parse(0x18DA10F1, &type, NULL, &sa) == -EINVAL);
+    assert_true(isotp_fixed_id_parse(0x18DA10F1, &type, &ta, NULL) == -EINVAL);
+
+    // wrong PF, R/DP set, more than 29 bits, 11 bit ID
+    assert_true(isotp_fixed_id_parse(0x18DC10F1, &type, &ta, &sa) == -ENOMSG);
+    assert_true(isotp_fixed_id_parse(0x19DA10F1, &type, &ta, &sa) == -ENOMSG);
+    assert_true(isotp_fixed_id_parse(0x1ADA10F1, &type, &ta, &sa) == -ENOMSG);
+    assert_true(isotp_fixed_id_parse(0x38DA10F1, &type, &ta, &sa) == -ENOMSG);
+    assert_true(isotp_fixed_id_parse(0x7E8, &type, &ta, &sa) == -ENOMSG);
+}
+
+static void fixed_id_parse_success(void** state) {
+    (void)state;
+
+    isotp_ta_type_t type = NULL_ISOTP_TA_TYPE;
+    uint8_t ta = 0;
+    uint8_t sa = 0;
+    assert_true(isotp_fixed_id_parse(0x18DAF110, &type, &ta, &sa) == EOK);
+    assert_true(type == ISOTP_PHYSICAL_TA_TYPE);
+    assert_true(ta == 0xF1);
+    assert_true(sa == 0x10);
+
+    assert_true(isotp_fixed_id_parse(0x04DB33F1, &type, &ta, &sa) == EOK);
+    assert_true(type == ISOTP_FUNCTIONAL_TA_TYPE);
+    assert_true(ta == 0x33);
+    assert_true(sa == 0xF1);
+
+    // round trip through every address pair
+    for (int t=0; t < 256; t++) {
+        for (int s=0; s < 256; s++) {
+            uint32_t id = 0;
+            assert_true(isotp_fixed_id_build(ISOTP_PHYSICAL_TA_TYPE, t, s, 6, &id) == EOK);
+            assert_true(isotp_fixed_id_parse(id, &type, &ta, &sa) == EOK);
+            assert_true((ta == t) && (sa == s));
+        }
+    }
+}
+
+static void fixed_ctx_address(void** state) {
+    (void)state;
+
+    isotp_ctx_t ctx = fixed_ctx();
+    uint32_t id = 0;
+
+    assert_true(isotp_ctx_set_fixed_address(NULL, ISOTP_PHYSICAL_TA_TYPE, 0x10, 0xF1, 6) == -EINVAL);
+    assert_true(isotp_ctx_fixed_tx_id(NULL, &id) == -EINVAL);
+    assert_true(isotp_ctx_fixed_tx_id(ctx, NULL) == -EINVAL);
+    assert_true(isotp_ctx_fixed_rx_id(NULL, &id) == -EINVAL);
+    assert_true(isotp_ctx_fixed_tx_id(ctx, &id) == -EDESTADDRREQ);
+    assert_true(isotp_ctx_fixed_rx_id(ctx, &id) == -EDESTADDRREQ);
+    assert_true(isotp_ctx_set_fixed_address(ctx, ISOTP_PHYSICAL_TA_TYPE, 0x10, 0xF1, 8) == -ERANGE);
+    assert_true(isotp_ctx_set_fixed_address(ctx, NULL_ISOTP_TA_TYPE, 0x10, 0xF1, 6) == -EFAULT);
+
+    assert_true(isotp_ctx_set_fixed_address(ctx, ISOTP_PHYSICAL_TA_TYPE, 0x10, 0xF1, 6) == EOK);
+    assert_true(isotp_ctx_fixed_tx_id(ctx, &id) == EOK);
+    assert_true(id == 0x18DA10F1);
+    assert_true(isotp_ctx_fixed_rx_id(ctx, &id) == EOK);
+    assert_true(id == 0x18DAF110);
+
+    assert_true(isotp_ctx_set_fixed_address(ctx, ISOTP_FUNCTIONAL_TA_TYPE, 0x33, 0xF1, 6) == EOK);
+    assert_true(isotp_ctx_fixed_tx_id(ctx, &id) == EOK);
+    assert_true(id == 0x18DB33F1);
+    assert_true(isotp_ctx_fixed_rx_id(ctx, &id) == -EOPNOTSUPP);
+
+    // only for normal fixed addressing
+    ctx->addressing_mode = ISOTP_NORMAL_ADDRESSING_MODE;
+    assert_true(isotp_ctx_set_fixed_address(ctx, ISOTP_PHYSICAL_TA_TYPE, 0x10, 0xF1, 6) == -EFAULT);
+
+    free(ctx);
+}
+
+static void fixed_router_invalid_parameters(void** state) {
+    (void)state;
+
+    isotp_fixed_router_t router = NULL;
+    assert_true(isotp_fixed_router_init(NULL) == -EINVAL);
+    assert_true(isotp_fixed_router_init(&router) == EOK);
+
+    isotp_ctx_t ctx = fixed_ctx();
+    assert_true(isotp_fixed_router_set(NULL, ISOTP_PHYSICAL_TA_TYPE, 0xF1, 0x10, ctx) == -EINVAL);
+    assert_true(isotp_fixed_router_set(router, NULL_ISOTP_TA_TYPE, 0xF1, 0x10, ctx) == -EFAULT);
+    assert_null(isotp_fixed_router_lookup(NULL, 0x18DAF110));
+    assert_null(isotp_fixed_router_lookup(router, 0x18DAF110));
+    assert_null(isotp_fixed_router_lookup(router, 0x7E8));
+
+    isotp_fixed_router_free(router);
+    isotp_fixed_router_free(NULL);
+    free(ctx);
+}
+
+static void fixed_router_dispatch(void** state) {
+    (void)state;
+
+    isotp_fixed_router_t router = NULL;
+    assert_true(isotp_fixed_router_init(&router) == EOK);
+
+    // a tester (0xF1) talking to every ECU address, and one functional route
+    static isotp_ctx_t ctxs[256];
+    for (int sa=0; sa < 256; sa++) {
+        ctxs[sa] = fixed_ctx();
+        assert_true(isotp_fixed_router_set(router, ISOTP_PHYSICAL_TA_TYPE,
+                                           0xF1, sa, ctxs[sa]) == EOK);
+    }
+    isotp_ctx_t func = fixed_ctx();
+    assert_true(isotp_fixed_router_set(router, ISOTP_FUNCTIONAL_TA_TYPE,
+                                       0x33, 0xF1, func) == EOK);
+
+    for (int sa=0; sa < 256; sa++) {
+        uint32_t id = 0;
+        assert_true(isotp_fixed_id_build(ISOTP_PHYSICAL_TA_TYPE, 0xF1, sa, 6, &id) == EOK);
+        assert_true(isotp_fixed_router_lookup(router, id) == ctxs[sa]);
+        // any priority
+        assert_true(isotp_fixed_router_lookup(router, id & 0x03FFFFFF) == ctxs[sa]);
+    }
+    assert_true(isotp_fixed_router_lookup(router, 0x18DB33F1) == func);
+    assert_null(isotp_fixed_router_lookup(router, 0x18DA33F1));
+    assert_null(isotp_fixed_router_lookup(router, 0x18DAF010));
+
+    // remove routes; the row goes away with the last one
+    for (int sa=0; sa < 256; sa++) {
+        assert_true(isotp_fixed_router_set(router, ISOTP_PHYSICAL_TA_TYPE,
+                                           0xF1, sa, NULL) == EOK);
+        assert_null(isotp_fixed_router_lookup(router, 0x18DAF100 | sa));
+        free(ctxs[sa]);
+    }
+    assert_true(isotp_fixed_router_set(router, ISOTP_PHYSICAL_TA_TYPE,
+                                       0xF1, 0x10, NULL) == EOK);
+    assert_true(isotp_fixed_router_lookup(router, 0x18DB33F1) == func);
+
+    isotp_fixed_router_free(router);
+    free(func);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(fixed_id_build_invalid_parameters),
+        cmocka_unit_test(fixed_id_build_success),
+        cmocka_unit_test(fixed_id_parse_invalid),
+        cmocka_unit_test(fixed_id_parse_success),
+        cmocka_unit_test(fixed_ctx_address),
+        cmocka_unit_test(fixed_router_invalid_parameters),
+        cmocka_unit_test(fixed_router_dispatch),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
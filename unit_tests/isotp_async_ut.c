@@ -0,0 +1,804 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "../isotp.h"
+#include "../isotp_private.h"
+
+// loopback transport; each context transmits into its peer's queue
+#define LINK_DEPTH (256)
+
+struct link_s {
+    uint8_t frame[LINK_DEPTH][64];
+    int frame_len[LINK_DEPTH];
+    int head;
+    int tail;
+};
+
+struct port_s {
+    struct link_s* rx;
+    struct link_s* tx;
+    int cf_busy_every;  // refuse every Nth CF with -EAGAIN, if >0
+    int cf_calls;
+};
+
+static int rx_f(void* rxfn_ctx,
+                uint8_t* rx_buf_p,
+                const int rx_buf_sz,
+                const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct port_s* port = (struct port_s*)rxfn_ctx;
+
+    if (port->rx->head == port->rx->tail) {
+        return 0;
+    }
+
+    int i = port->rx->head % LINK_DEPTH;
+    int len = port->rx->frame_len[i];
+    assert_true(len <= rx_buf_sz);
+    memcpy(rx_buf_p, port->rx->frame[i], len);
+    port->rx->head++;
+
+    return len;
+}
+
+static int tx_f(void* txfn_ctx,
+                const uint8_t* tx_buf_p,
+                const int tx_len,
+                const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct port_s* port = (struct port_s*)txfn_ctx;
+
+    if ((port->cf_busy_every > 0) && ((tx_buf_p[0] & PCI_MASK) == CF_PCI)) {
+        port->cf_calls++;
+        if ((port->cf_calls % port->cf_busy_every) == 0) {
+            return -EAGAIN;
+        }
+    }
+
+    assert_true((port->tx->tail - port->tx->head) < LINK_DEPTH);
+    int i = port->tx->tail % LINK_DEPTH;
+    memcpy(port->tx->frame[i], tx_buf_p, tx_len);
+    port->tx->frame_len[i] = tx_len;
+    port->tx->tail++;
+
+    return tx_len;
+}
+
+struct pair_s {
+    struct link_s a_to_b;
+    struct link_s b_to_a;
+    struct port_s a_port;
+    struct port_s b_port;
+    isotp_ctx_t a;
+    isotp_ctx_t b;
+};
+
+static void pair_init(struct pair_s* p, const can_format_t format) {
+    memset(p, 0, sizeof(*p));
+    p->a_port.rx = &(p->b_to_a);
+    p->a_port.tx = &(p->a_to_b);
+    p->b_port.rx = &(p->a_to_b);
+    p->b_port.tx = &(p->b_to_a);
+
+    assert_true(isotp_ctx_init(&(p->a), format, ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, &(p->a_port), rx_f, tx_f) == EOK);
+    assert_true(isotp_ctx_init(&(p->b), format, ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, &(p->b_port), rx_f, tx_f) == EOK);
+}
+
+static void pair_free(struct pair_s* p) {
+    isotp_ctx_free(p->a);
+    isotp_ctx_free(p->b);
+}
+
+// poll both sides, 100us apart, until neither is in progress
+static void pair_run(struct pair_s* p, int* a_rc, int* b_rc) {
+    uint64_t now = 1;
+    *a_rc = -EINPROGRESS;
+    *b_rc = -EINPROGRESS;
+
+    for (int i=0; i < 100000; i++) {
+        if (*a_rc == -EINPROGRESS) {
+            *a_rc = isotp_poll(p->a, now);
+        }
+        if (*b_rc == -EINPROGRESS) {
+            *b_rc = isotp_poll(p->b, now);
+        }
+        if ((*a_rc != -EINPROGRESS) && (*b_rc != -EINPROGRESS)) {
+            return;
+        }
+        now += 100;
+    }
+    fail();
+}
+
+static void fill_buf(uint8_t* buf, const int buf_sz, const uint8_t pattern) {
+    uint8_t p = pattern;
+    for (int i=0; i < buf_sz; i++) {
+        buf[i] = p++;
+    }
+}
+
+// tests
+static void async_invalid_parameters(void** state) {
+    (void)state;
+
+    struct pair_s p;
+    pair_init(&p, CAN_FORMAT);
+    uint8_t buf[64];
+
+    assert_true(isotp_send_start(NULL, buf, sizeof(buf), 0) == -EINVAL);
+    assert_true(isotp_send_start(p.a, NULL, sizeof(buf), 0) == -EINVAL);
+    assert_true(isotp_send_start(p.a, buf, -1, 0) == -ERANGE);
+    assert_true(isotp_recv_start(NULL, buf, sizeof(buf), 0, 0, 0) == -EINVAL);
+    assert_true(isotp_recv_start(p.a, NULL, sizeof(buf), 0, 0, 0) == -EINVAL);
+    assert_true(isotp_recv_start(p.a, buf, -1, 0, 0, 0) == -ERANGE);
+    assert_true(isotp_poll(NULL, 0) == -EINVAL);
+    assert_true(isotp_poll(p.a, 0) == -ENOTCONN);
+
+    assert_true(isotp_recv_start(p.a, buf, sizeof(buf), 0, 0, 0) == EOK);
+    assert_true(isotp_send_start(p.a, buf, sizeof(buf), 0) == -EBUSY);
+    assert_true(isotp_recv_start(p.a, buf, sizeof(buf), 0, 0, 0) == -EBUSY);
+
+    pair_free(&p);
+}
+
+static void async_sf_success(void** state) {
+    (void)state;
+
+    struct pair_s p;
+    pair_init(&p, CAN_FORMAT);
+    uint8_t tx_buf[7];
+    uint8_t rx_buf[64];
+    fill_buf(tx_buf, sizeof(tx_buf), 0x10);
+
+    int a_rc = 0;
+    int b_rc = 0;
+    assert_true(isotp_recv_start(p.b, rx_buf, sizeof(rx_buf), 0, 0, 0) == EOK);
+    assert_true(isotp_send_start(p.a, tx_buf, sizeof(tx_buf), 0) == EOK);
+    pair_run(&p, &a_rc, &b_rc);
+
+    assert_true(a_rc == sizeof(tx_buf));
+    assert_true(b_rc == sizeof(tx_buf));
+    assert_memory_equal(tx_buf, rx_buf, sizeof(tx_buf));
+
+    pair_free(&p);
+}
+
+static void async_multiframe_success(void** state) {
+    (void)state;
+
+    const can_format_t formats[] = { CAN_FORMAT, CANFD_FORMAT };
+    const uint8_t blocksizes[] = { 0, 1, 3 };
+
+    for (size_t f=0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        for (size_t b=0; b < sizeof(blocksizes); b++) {
+            struct pair_s p;
+            pair_init(&p, formats[f]);
+            uint8_t tx_buf[300];
+            uint8_t rx_buf[512];
+            fill_buf(tx_buf, sizeof(tx_buf), 0x40);
+            memset(rx_buf, 0, sizeof(rx_buf));
+
+            int a_rc = 0;
+            int b_rc = 0;
+            assert_true(isotp_recv_start(p.b, rx_buf, sizeof(rx_buf),
+                                         blocksizes[b], 0, 1000) == EOK);
+            assert_true(isotp_send_start(p.a, tx_buf, sizeof(tx_buf),
+                                         1000) == EOK);
+            pair_run(&p, &a_rc, &b_rc);
+
+            assert_true(a_rc == sizeof(tx_buf));
+            assert_true(b_rc == sizeof(tx_buf));
+            assert_memory_equal(tx_buf, rx_buf, sizeof(tx_buf));
+
+            pair_free(&p);
+        }
+    }
+}
+
+static void async_overflow(void** state) {
+    (void)state;
+
+    struct pair_s p;
+    pair_init(&p, CAN_FORMAT);
+    uint8_t tx_buf[100];
+    uint8_t rx_buf[50];
+    fill_buf(tx_buf, sizeof(tx_buf), 0x00);
+
+    int a_rc = 0;
+    int b_rc = 0;
+    assert_true(isotp_recv_start(p.b, rx_buf, sizeof(rx_buf), 0, 0, 0) == EOK);
+    assert_true(isotp_send_start(p.a, tx_buf, sizeof(tx_buf), 0) == EOK);
+    pair_run(&p, &a_rc, &b_rc);
+
+    assert_true(a_rc == -ECONNABORTED);
+    assert_true(b_rc == -EOVERFLOW);
+
+    pair_free(&p);
+}
+
+static void async_fc_timeout(void** state) {
+    (void)state;
+
+    struct pair_s p;
+    pair_init(&p, CAN_FORMAT);
+    uint8_t tx_buf[100];
+    fill_buf(tx_buf, sizeof(tx_buf), 0x00);
+
+    // nobody is receiving, so no FC ever comes back
+    assert_true(isotp_send_start(p.a, tx_buf, sizeof(tx_buf), 1000) == EOK);
+    assert_true(isotp_poll(p.a, 5000) == -EINPROGRESS);
+    assert_true(isotp_poll(p.a, 5999) == -EINPROGRESS);
+    assert_true(isotp_poll(p.a, 6000) == -ETIMEDOUT);
+    assert_true(isotp_poll(p.a, 6001) == -ENOTCONN);
+
+    pair_free(&p);
+}
+
+static void async_stmin_pacing(void** state) {
+    (void)state;
+
+    struct pair_s p;
+    pair_init(&p, CAN_FORMAT);
+    uint8_t tx_buf[100];
+    uint8_t rx_buf[100];
+    fill_buf(tx_buf, sizeof(tx_buf), 0x00);
+
+    assert_true(isotp_recv_start(p.b, rx_buf, sizeof(rx_buf), 0, 5000, 0) == EOK);
+    assert_true(isotp_send_start(p.a, tx_buf, sizeof(tx_buf), 0) == EOK);
+
+    // FF
+    assert_true(p.a_to_b.tail == 1);
+    assert_true(isotp_poll(p.b, 0) == -EINPROGRESS);
+
+    // FC received, first CF goes out immediately, then STmin applies
+    assert_true(isotp_poll(p.a, 0) == -EINPROGRESS);
+    assert_true(p.a_to_b.tail == 2);
+    assert_true(isotp_poll(p.a, 4999) == -EINPROGRESS);
+    assert_true(p.a_to_b.tail == 2);
+    assert_true(isotp_poll(p.a, 5000) == -EINPROGRESS);
+    assert_true(p.a_to_b.tail == 3);
+
+    pair_free(&p);
+}
+
+static void async_iov_invalid_parameters(void** state) {
+    (void)state;
+
+    struct pair_s p;
+    pair_init(&p, CAN_FORMAT);
+    uint8_t buf[16];
+    isotp_iovec_t iov[2] = { { buf, 8 }, { NULL, 8 } };
+
+    assert_true(isotp_recv_start_iov(NULL, iov, 1, 0, 0, 0) == -EINVAL);
+    assert_true(isotp_recv_start_iov(p.b, NULL, 1, 0, 0, 0) == -EINVAL);
+    assert_true(isotp_recv_start_iov(p.b, iov, 0, 0, 0, 0) == -EINVAL);
+    assert_true(isotp_recv_start_iov(p.b, iov, 2, 0, 0, 0) == -EINVAL);
+    iov[1].base = &(buf[8]);
+    iov[1].len = -1;
+    assert_true(isotp_recv_start_iov(p.b, iov, 2, 0, 0, 0) == -EINVAL);
+    iov[1].len = MAX_TX_DATALEN;
+    assert_true(isotp_recv_start_iov(p.b, iov, 2, 0, 0, 0) == -ERANGE);
+
+    pair_free(&p);
+}
+
+static void async_iov_success(void** state) {
+    (void)state;
+
+    // SF and multi-frame messages, for both frame formats
+    const struct {
+        can_format_t format;
+        int len;
+    } cases[] = {
+        { CAN_FORMAT, 3 },
+        { CAN_FORMAT, 350 },
+        { CANFD_FORMAT, 40 },
+        { CANFD_FORMAT, 350 },
+    };
+
+    // uneven segments, including an empty one, with gaps between them
+    const int seg_lens[] = { 1, 0, 6, 7, 13, 64, 309 };
+    const int num_segs = sizeof(seg_lens) / sizeof(seg_lens[0]);
+    const int gap = 10;
+
+    for (size_t c=0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        const int len = cases[c].len;
+        struct pair_s p;
+        pair_init(&p, cases[c].format);
+        uint8_t tx_buf[350];
+        uint8_t rx_buf[500];
+        uint8_t gathered[400];
+        fill_buf(tx_buf, sizeof(tx_buf), 0x80);
+        memset(rx_buf, 0, sizeof(rx_buf));
+
+        isotp_iovec_t iov[num_segs];
+        int off = 0;
+        for (int i=0; i < num_segs; i++) {
+            iov[i].base = &(rx_buf[off]);
+            iov[i].len = seg_lens[i];
+            off += seg_lens[i] + gap;
+        }
+
+        int a_rc = 0;
+        int b_rc = 0;
+        assert_true(isotp_recv_start_iov(p.b, iov, num_segs, 2, 0, 0) == EOK);
+        assert_true(isotp_send_start(p.a, tx_buf, len, 0) == EOK);
+        pair_run(&p, &a_rc, &b_rc);
+
+        assert_true(a_rc == len);
+        assert_true(b_rc == len);
+
+        // gather the segments back up; the gaps must be untouched
+        int n = 0;
+        for (int i=0; i < num_segs; i++) {
+            memcpy(&(gathered[n]), iov[i].base, iov[i].len);
+            n += iov[i].len;
+            for (int g=0; (i < (num_segs - 1)) && (g < gap); g++) {
+                assert_true(iov[i].base[iov[i].len + g] == 0);
+            }
+        }
+        assert_memory_equal(tx_buf, gathered, len);
+        assert_true(gathered[len] == 0);
+
+        pair_free(&p);
+    }
+}
+
+static void async_iov_overflow(void** state) {
+    (void)state;
+
+    struct pair_s p;
+    pair_init(&p, CAN_FORMAT);
+    uint8_t tx_buf[100];
+    uint8_t rx_buf[20];
+    fill_buf(tx_buf, sizeof(tx_buf), 0x00);
+    isotp_iovec_t iov[] = { { &(rx_buf[0]), 10 }, { &(rx_buf[10]), 10 } };
+
+    int a_rc = 0;
+    int b_rc = 0;
+    assert_true(isotp_recv_start_iov(p.b, iov, 2, 0, 0, 0) == EOK);
+    assert_true(isotp_send_start(p.a, tx_buf, sizeof(tx_buf), 0) == EOK);
+    pair_run(&p, &a_rc, &b_rc);
+
+    assert_true(a_rc == -ECONNABORTED);
+    assert_true(b_rc == -EOVERFLOW);
+
+    pair_free(&p);
+}
+
+static void async_rx_frame_in_place(void** state) {
+    (void)state;
+
+    struct pair_s p;
+    pair_init(&p, CAN_FORMAT);
+    uint8_t tx_buf[200];
+    uint8_t rx_buf[256];
+    fill_buf(tx_buf, sizeof(tx_buf), 0x33);
+
+    // B has no receive function; its frames are handed over in place
+    isotp_ctx_free(p.b);
+    assert_true(isotp_ctx_init(&(p.b), CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, &(p.b_port), NULL, tx_f) == EOK);
+    assert_true(isotp_recv(p.b, rx_buf, sizeof(rx_buf), 0, 0, 0) == -ENOTSUP);
+    assert_true(isotp_rx_frame(p.b, p.a_to_b.frame[0], 8, 0) == -ENOTCONN);
+
+    assert_true(isotp_recv_start(p.b, rx_buf, sizeof(rx_buf), 4, 0, 0) == EOK);
+    assert_true(isotp_send_start(p.a, tx_buf, sizeof(tx_buf), 0) == EOK);
+
+    uint64_t now = 0;
+    int a_rc = -EINPROGRESS;
+    int b_rc = -EINPROGRESS;
+    while ((a_rc == -EINPROGRESS) || (b_rc == -EINPROGRESS)) {
+        while ((b_rc == -EINPROGRESS) && (p.a_to_b.head != p.a_to_b.tail)) {
+            int i = p.a_to_b.head % LINK_DEPTH;
+            b_rc = isotp_rx_frame(p.b, p.a_to_b.frame[i],
+                                  p.a_to_b.frame_len[i], now);
+            p.a_to_b.head++;
+        }
+        if (a_rc == -EINPROGRESS) {
+            a_rc = isotp_poll(p.a, now);
+        }
+        now += 100;
+        assert_true(now < 1000000);
+    }
+
+    assert_true(a_rc == sizeof(tx_buf));
+    assert_true(b_rc == sizeof(tx_buf));
+    assert_memory_equal(tx_buf, rx_buf, sizeof(tx_buf));
+
+    pair_free(&p);
+}
+
+// doubles the blocksize after every block and records what it was shown
+struct doubling_policy_s {
+    int calls;
+    int block_cfs[16];
+};
+
+static int doubling_policy(void* policy_ctx,
+                           const isotp_fc_stats_t* stats,
+                           uint8_t* blocksize,
+                           int* stmin_usec) {
+    struct doubling_policy_s* d = (struct doubling_policy_s*)policy_ctx;
+    d->block_cfs[d->calls++] = stats->block_cfs;
+    *blocksize = (stats->block_cfs == 0) ? 1 : (uint8_t)(*blocksize * 2);
+    *stmin_usec = 0;
+    return 0;
+}
+
+static void async_fc_policy(void** state) {
+    (void)state;
+
+    struct pair_s p;
+    pair_init(&p, CAN_FORMAT);
+    uint8_t tx_buf[200];
+    uint8_t rx_buf[256];
+    fill_buf(tx_buf, sizeof(tx_buf), 0x42);
+
+    struct doubling_policy_s d = {0};
+    assert_true(isotp_set_fc_policy(NULL, doubling_policy, &d) == -EINVAL);
+    assert_true(isotp_set_fc_policy(p.b, doubling_policy, &d) == EOK);
+
+    int a_rc = 0;
+    int b_rc = 0;
+    assert_true(isotp_recv_start(p.b, rx_buf, sizeof(rx_buf), 8, 0, 0) == EOK);
+    assert_true(isotp_send_start(p.a, tx_buf, sizeof(tx_buf), 0) == EOK);
+    pair_run(&p, &a_rc, &b_rc);
+
+    assert_true(a_rc == sizeof(tx_buf));
+    assert_true(b_rc == sizeof(tx_buf));
+    assert_memory_equal(tx_buf, rx_buf, sizeof(tx_buf));
+
+    // 28 CFs in blocks of 1, 2, 4, 8 and the rest
+    assert_true(d.calls == 5);
+    const int expected_cfs[] = { 0, 1, 2, 4, 8 };
+    for (int i=0; i < d.calls; i++) {
+        assert_true(d.block_cfs[i] == expected_cfs[i]);
+    }
+
+    // and the FCs on the wire carried the policy's blocksizes
+    const uint8_t expected_bs[] = { 1, 2, 4, 8, 16 };
+    int fcs = 0;
+    for (int i=0; i < p.b_to_a.tail; i++) {
+        if ((p.b_to_a.frame[i][0] & 0xF0) == 0x30) {
+            assert_true(fcs < 5);
+            assert_true(p.b_to_a.frame[i][1] == expected_bs[fcs]);
+            fcs++;
+        }
+    }
+    assert_true(fcs == 5);
+
+    pair_free(&p);
+}
+
+static void async_peer_profile(void** state) {
+    (void)state;
+
+    struct pair_s p;
+    pair_init(&p, CAN_FORMAT);
+    uint8_t tx_buf[200];
+    uint8_t rx_buf[256];
+    fill_buf(tx_buf, sizeof(tx_buf), 0x24);
+
+    // the receiver asks for one CF per FC and a 2ms STmin, the
+    // profile tells the sender to ignore both
+    isotp_peer_profile_t profile;
+    isotp_peer_profile_init(&profile, 0x7E0);
+    profile.bs_override = 0;
+    profile.stmin_override_usec = 0;
+    assert_true(isotp_ctx_set_peer_profile(p.a, &profile) == EOK);
+
+    int a_rc = 0;
+    int b_rc = 0;
+    assert_true(isotp_recv_start(p.b, rx_buf, sizeof(rx_buf), 1, 2000, 0) == EOK);
+    assert_true(isotp_send_start(p.a, tx_buf, sizeof(tx_buf), 0) == EOK);
+    pair_run(&p, &a_rc, &b_rc);
+
+    assert_true(a_rc == sizeof(tx_buf));
+    assert_true(b_rc == sizeof(tx_buf));
+    assert_memory_equal(tx_buf, rx_buf, sizeof(tx_buf));
+    assert_true(p.a->fs_blocksize == 0);
+    assert_true(p.a->fs_stmin == 0);
+
+    pair_free(&p);
+}
+
+static void async_cf_backpressure(void** state) {
+    (void)state;
+
+    struct pair_s p;
+    pair_init(&p, CAN_FORMAT);
+    uint8_t tx_buf[300];
+    uint8_t rx_buf[512];
+    fill_buf(tx_buf, sizeof(tx_buf), 0x51);
+
+    // every other CF finds the transport full
+    p.a_port.cf_busy_every = 2;
+
+    int a_rc = 0;
+    int b_rc = 0;
+    assert_true(isotp_recv_start(p.b, rx_buf, sizeof(rx_buf), 4, 0, 1000) == EOK);
+    assert_true(isotp_send_start(p.a, tx_buf, sizeof(tx_buf), 1000) == EOK);
+    pair_run(&p, &a_rc, &b_rc);
+
+    assert_true(a_rc == sizeof(tx_buf));
+    assert_true(b_rc == sizeof(tx_buf));
+    assert_memory_equal(tx_buf, rx_buf, sizeof(tx_buf));
+    // 42 CFs, every other attempt refused
+    assert_true(p.a_port.cf_calls == 83);
+
+    pair_free(&p);
+}
+
+static void blocking_cf_backpressure(void** state) {
+    (void)state;
+
+    struct pair_s p;
+    pair_init(&p, CAN_FORMAT);
+    uint8_t tx_buf[200];
+    uint8_t rx_buf[256];
+    fill_buf(tx_buf, sizeof(tx_buf), 0x33);
+
+    p.a_port.cf_busy_every = 3;
+
+    // the FC.CTS the sender will wait for
+    uint8_t fc[8] = { FC_PCI, 0, 0, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC };
+    assert_true(tx_f(&(p.b_port), fc, sizeof(fc), 0) == sizeof(fc));
+
+    assert_true(isotp_send(p.a, tx_buf, sizeof(tx_buf), 100000) == EOK);
+    assert_true(p.a_port.cf_calls > 28);
+
+    int a_rc = -ENOTCONN;
+    int b_rc = 0;
+    assert_true(isotp_recv_start(p.b, rx_buf, sizeof(rx_buf), 0, 0, 0) == EOK);
+    pair_run(&p, &a_rc, &b_rc);
+
+    assert_true(b_rc == sizeof(tx_buf));
+    assert_memory_equal(tx_buf, rx_buf, sizeof(tx_buf));
+
+    pair_free(&p);
+}
+
+// the blocking receive into segments, with the sender's frames queued up
+static void blocking_iov_success(void** state) {
+    (void)state;
+
+    // an SF split over two segments; an FF/CF message with its FF and CFs
+    // split across segment boundaries
+    const int lens[] = { 5, 100 };
+    const int seg_lens[] = { 4, 0, 11, 30, 55 };
+    const int num_segs = sizeof(seg_lens) / sizeof(seg_lens[0]);
+
+    for (size_t c=0; c < sizeof(lens) / sizeof(lens[0]); c++) {
+        const int len = lens[c];
+        struct pair_s p;
+        pair_init(&p, CAN_FORMAT);
+        uint8_t tx_buf[100];
+        uint8_t rx_buf[100];
+        fill_buf(tx_buf, sizeof(tx_buf), 0x40);
+        memset(rx_buf, 0, sizeof(rx_buf));
+
+        isotp_iovec_t iov[num_segs];
+        int off = 0;
+        for (int i=0; i < num_segs; i++) {
+            iov[i].base = &(rx_buf[off]);
+            iov[i].len = seg_lens[i];
+            off += seg_lens[i];
+        }
+
+        // the FC.CTS the sender will wait for
+        uint8_t fc[8] = { FC_PCI, 0, 0, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC };
+        assert_true(tx_f(&(p.b_port), fc, sizeof(fc), 0) == sizeof(fc));
+        assert_true(isotp_send(p.a, tx_buf, len, 100000) >= 0);
+
+        assert_true(isotp_recv_iov(p.b, iov, num_segs, 0, 0, 100000) == len);
+        assert_memory_equal(tx_buf, rx_buf, len);
+        assert_true((len == (int)sizeof(rx_buf)) || (rx_buf[len] == 0));
+
+        pair_free(&p);
+    }
+}
+
+static void async_pooled_success(void** state) {
+    (void)state;
+
+    const can_format_t formats[] = { CAN_FORMAT, CANFD_FORMAT };
+    const int lens[][3] = {
+        { 5, 300, 1500 },   // an SF, then FFs and CFs
+        { 20, 300, 1500 },
+    };
+
+    isotp_buf_pool_t pool = NULL;
+    assert_true(isotp_buf_pool_init(&pool, 4095, 0) == EOK);
+    for (size_t f=0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        for (size_t l=0; l < sizeof(lens[0]) / sizeof(lens[0][0]); l++) {
+            struct pair_s p;
+            pair_init(&p, formats[f]);
+            uint8_t tx_buf[4095];
+            fill_buf(tx_buf, lens[f][l], 0x30);
+
+            int a_rc = 0;
+            int b_rc = 0;
+            uint8_t* rx_buf = NULL;
+            assert_true(isotp_recv_start_pooled(p.b, pool, 0, 0, 1000) == EOK);
+            assert_true(isotp_recv_take(p.b, &rx_buf) == -EBUSY);
+            assert_true(isotp_send_start(p.a, tx_buf, lens[f][l], 1000) == EOK);
+            pair_run(&p, &a_rc, &b_rc);
+
+            assert_true(a_rc == lens[f][l]);
+            assert_true(b_rc == lens[f][l]);
+            isotp_buf_pool_stats_t stats;
+            assert_true(isotp_buf_pool_stats(pool, &stats) == EOK);
+            assert_true(stats.bytes_requested == (size_t)lens[f][l]);
+
+            // the buffer is the application's from here
+            assert_true(isotp_recv_take(p.b, &rx_buf) == EOK);
+            assert_true(isotp_recv_take(p.b, &rx_buf) == -ENOMSG);
+            assert_memory_equal(tx_buf, rx_buf, lens[f][l]);
+            pair_free(&p);
+            assert_true(isotp_buf_pool_stats(pool, &stats) == EOK);
+            assert_true(stats.buffers_in_use == 1);
+            assert_true(isotp_buf_pool_put(pool, rx_buf) == EOK);
+        }
+    }
+    isotp_buf_pool_free(pool);
+}
+
+static void async_pooled_overflow(void** state) {
+    (void)state;
+
+    const struct {
+        int max_message_len;
+        size_t max_bytes;
+        int b_rc;
+    } cases[] = {
+        { 50, 0, -EMSGSIZE },    // larger than any buffer
+        { 4095, 64, -ENOBUFS },  // over the budget
+    };
+
+    for (size_t c=0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        isotp_buf_pool_t pool = NULL;
+        assert_true(isotp_buf_pool_init(&pool,
+                                        cases[c].max_message_len,
+                                        cases[c].max_bytes) == EOK);
+        struct pair_s p;
+        pair_init(&p, CAN_FORMAT);
+        uint8_t tx_buf[100];
+        fill_buf(tx_buf, sizeof(tx_buf), 0x00);
+
+        int a_rc = 0;
+        int b_rc = 0;
+        assert_true(isotp_recv_start_pooled(p.b, pool, 0, 0, 0) == EOK);
+        assert_true(isotp_send_start(p.a, tx_buf, sizeof(tx_buf), 0) == EOK);
+        pair_run(&p, &a_rc, &b_rc);
+
+        assert_true(a_rc == -ECONNABORTED);
+        assert_true(b_rc == cases[c].b_rc);
+        isotp_buf_pool_stats_t stats;
+        assert_true(isotp_buf_pool_stats(pool, &stats) == EOK);
+        assert_true(stats.buffers_in_use == 0);
+
+        pair_free(&p);
+        isotp_buf_pool_free(pool);
+    }
+}
+
+static void async_pooled_give_back(void** state) {
+    (void)state;
+
+    struct pair_s p;
+    pair_init(&p, CAN_FORMAT);
+    isotp_buf_pool_t pool = NULL;
+    assert_true(isotp_buf_pool_init(&pool, 4095, 0) == EOK);
+    const uint8_t ff[] = { 0x10, 0x64, 1, 2, 3, 4, 5, 6 };
+    const uint8_t sf[] = { 0x03, 7, 8, 9 };
+    isotp_buf_pool_stats_t stats;
+    uint8_t* rx_buf = NULL;
+
+    // a transfer that times out
+    assert_true(isotp_recv_start_pooled(NULL, pool, 0, 0, 0) == -EINVAL);
+    assert_true(isotp_recv_start_pooled(p.b, NULL, 0, 0, 0) == -EINVAL);
+    assert_true(isotp_recv_start_pooled(p.b, pool, 0, 0, 1000) == EOK);
+    assert_true(isotp_rx_frame(p.b, ff, sizeof(ff), 10) == -EINPROGRESS);
+    assert_true(isotp_buf_pool_stats(pool, &stats) == EOK);
+    assert_true(stats.bytes_requested == 100);
+    assert_true(isotp_poll(p.b, 2000) == -ETIMEDOUT);
+    assert_true(isotp_buf_pool_stats(pool, &stats) == EOK);
+    assert_true(stats.buffers_in_use == 0);
+    assert_true(isotp_recv_take(p.b, &rx_buf) == -ENOMSG);
+
+    // a new message replaces the one in progress
+    assert_true(isotp_recv_start_pooled(p.b, pool, 0, 0, 0) == EOK);
+    assert_true(isotp_rx_frame(p.b, ff, sizeof(ff), 10) == -EINPROGRESS);
+    assert_true(isotp_rx_frame(p.b, sf, sizeof(sf), 20) == 3);
+    assert_true(isotp_buf_pool_stats(pool, &stats) == EOK);
+    assert_true(stats.buffers_in_use == 1);
+    assert_true(stats.bytes_requested == 3);
+
+    // messages not taken are given back
+    assert_true(isotp_recv_start_pooled(p.b, pool, 0, 0, 0) == EOK);
+    assert_true(isotp_buf_pool_stats(pool, &stats) == EOK);
+    assert_true(stats.buffers_in_use == 0);
+    assert_true(isotp_rx_frame(p.b, sf, sizeof(sf), 30) == 3);
+    assert_true(isotp_ctx_reset(p.b) == EOK);
+    assert_true(isotp_buf_pool_stats(pool, &stats) == EOK);
+    assert_true(stats.buffers_in_use == 0);
+    assert_true(isotp_recv_start_pooled(p.b, pool, 0, 0, 0) == EOK);
+    assert_true(isotp_rx_frame(p.b, sf, sizeof(sf), 40) == 3);
+
+    // an SF shorter than its SF_DL is ignored without taking a buffer
+    const uint8_t short_sf[] = { 0x07, 0xAA };
+    assert_true(isotp_recv_start_pooled(p.b, pool, 0, 0, 0) == EOK);
+    assert_true(isotp_buf_pool_stats(pool, &stats) == EOK);
+    uint64_t acquired = stats.acquired;
+    assert_true(isotp_rx_frame(p.b, short_sf, sizeof(short_sf), 50) ==
+                -EINPROGRESS);
+    assert_true(isotp_buf_pool_stats(pool, &stats) == EOK);
+    assert_true(stats.acquired == acquired);
+    assert_true(stats.buffers_in_use == 0);
+    assert_true(isotp_rx_frame(p.b, sf, sizeof(sf), 60) == 3);
+
+    pair_free(&p);
+    assert_true(isotp_buf_pool_stats(pool, &stats) == EOK);
+    assert_true(stats.buffers_in_use == 0);
+    isotp_buf_pool_free(pool);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(async_invalid_parameters),
+        cmocka_unit_test(async_sf_success),
+        cmocka_unit_test(async_multiframe_success),
+        cmocka_unit_test(async_overflow),
+        cmocka_unit_test(async_fc_timeout),
+        cmocka_unit_test(async_stmin_pacing),
+        cmocka_unit_test(async_iov_invalid_parameters),
+        cmocka_unit_test(async_iov_success),
+        cmocka_unit_test(async_iov_overflow),
+        cmocka_unit_test(async_rx_frame_in_place),
+        cmocka_unit_test(async_fc_policy),
+        cmocka_unit_test(async_peer_profile),
+        cmocka_unit_test(async_cf_backpressure),
+        cmocka_unit_test(blocking_cf_backpressure),
+        cmocka_unit_test(blocking_iov_success),
+        cmocka_unit_test(async_pooled_success),
+        cmocka_unit_test(async_pooled_overflow),
+        cmocka_unit_test(async_pooled_give_back),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
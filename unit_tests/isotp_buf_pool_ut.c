@@ -0,0 +1,177 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "../isotp.h"
+#include "../isotp_private.h"
+
+static isotp_buf_pool_stats_t stats_of(const isotp_buf_pool_t pool) {
+    isotp_buf_pool_stats_t stats;
+    assert_int_equal(isotp_buf_pool_stats(pool, &stats), EOK);
+    return stats;
+}
+
+// the size class a length is rounded up to, as seen in the stats
+static int class_bytes(const isotp_buf_pool_t pool, const int len) {
+    uint8_t* buf = NULL;
+    assert_int_equal(isotp_buf_pool_get(pool, len, &buf), EOK);
+    memset(buf, 0xA5, len);
+    int bytes = (int)stats_of(pool).bytes_in_use;
+    assert_int_equal(isotp_buf_pool_put(pool, buf), EOK);
+    return bytes;
+}
+
+static void buf_pool_init_test(void** state) {
+    (void)state;
+
+    isotp_buf_pool_t pool = NULL;
+    uint8_t* buf = NULL;
+    assert_int_equal(isotp_buf_pool_init(NULL, 4095, 0), -EINVAL);
+    assert_int_equal(isotp_buf_pool_init(&pool, 0, 0), -EINVAL);
+    assert_int_equal(isotp_buf_pool_init(&pool, MAX_TX_DATALEN + 1, 0),
+                     -EINVAL);
+    assert_true(pool == NULL);
+
+    assert_int_equal(isotp_buf_pool_init(&pool, 4095, 0), EOK);
+    assert_int_equal(isotp_buf_pool_get(pool, 0, &buf), -EINVAL);
+    assert_int_equal(isotp_buf_pool_get(pool, 4096, &buf), -EMSGSIZE);
+    assert_int_equal(isotp_buf_pool_get(NULL, 1, &buf), -EINVAL);
+    assert_int_equal(isotp_buf_pool_get(pool, 1, NULL), -EINVAL);
+    assert_int_equal(isotp_buf_pool_stats(pool, NULL), -EINVAL);
+    assert_int_equal(stats_of(pool).bytes_allocated, 0);
+    isotp_buf_pool_free(pool);
+    isotp_buf_pool_free(NULL);
+
+    // the largest messages there are
+    assert_int_equal(isotp_buf_pool_init(&pool, MAX_TX_DATALEN, 0), EOK);
+    isotp_buf_pool_free(pool);
+}
+
+static void buf_pool_size_classes_test(void** state) {
+    (void)state;
+
+    isotp_buf_pool_t pool = NULL;
+    assert_int_equal(isotp_buf_pool_init(&pool, 70000, 0), EOK);
+
+    assert_int_equal(class_bytes(pool, 1), 64);
+    assert_int_equal(class_bytes(pool, 64), 64);
+    assert_int_equal(class_bytes(pool, 65), 80);
+    assert_int_equal(class_bytes(pool, 100), 112);
+    assert_int_equal(class_bytes(pool, 128), 128);
+    assert_int_equal(class_bytes(pool, 129), 160);
+    assert_int_equal(class_bytes(pool, 4095), 4096);
+    assert_int_equal(class_bytes(pool, 4097), 5120);
+    assert_int_equal(class_bytes(pool, 70000), 81920);
+
+    // never more than a quarter over
+    for (int len=65; len <= 70000; len += 7) {
+        int bytes = class_bytes(pool, len);
+        assert_true(bytes >= len);
+        assert_true((bytes - len) * 4 < len);
+    }
+
+    isotp_buf_pool_free(pool);
+}
+
+static void buf_pool_recycle_test(void** state) {
+    (void)state;
+
+    isotp_buf_pool_t pool = NULL;
+    uint8_t* a = NULL;
+    uint8_t* b = NULL;
+    assert_int_equal(isotp_buf_pool_init(&pool, 4095, 0), EOK);
+
+    assert_int_equal(isotp_buf_pool_get(pool, 100, &a), EOK);
+    isotp_buf_pool_stats_t stats = stats_of(pool);
+    assert_int_equal(stats.bytes_requested, 100);
+    assert_int_equal(stats.bytes_in_use, 112);
+    assert_int_equal(stats.buffers_in_use, 1);
+    assert_int_equal(isotp_buf_pool_put(pool, a), EOK);
+    assert_int_equal(isotp_buf_pool_put(pool, a), -EINVAL);
+    assert_int_equal(isotp_buf_pool_put(pool, NULL), -EINVAL);
+
+    // the same class gets the cached buffer back
+    assert_int_equal(isotp_buf_pool_get(pool, 110, &b), EOK);
+    assert_true(b == a);
+    stats = stats_of(pool);
+    assert_int_equal(stats.acquired, 2);
+    assert_int_equal(stats.allocated, 1);
+    assert_int_equal(stats.bytes_allocated, 112);
+
+    // only this pool's buffers are taken back
+    isotp_buf_pool_t other = NULL;
+    assert_int_equal(isotp_buf_pool_init(&other, 4095, 0), EOK);
+    assert_int_equal(isotp_buf_pool_put(other, b), -EINVAL);
+    isotp_buf_pool_free(other);
+
+    assert_int_equal(isotp_buf_pool_put(pool, b), EOK);
+    stats = stats_of(pool);
+    assert_int_equal(stats.bytes_in_use, 0);
+    assert_int_equal(stats.bytes_requested, 0);
+    assert_int_equal(stats.buffers_in_use, 0);
+    isotp_buf_pool_free(pool);
+}
+
+static void buf_pool_budget_test(void** state) {
+    (void)state;
+
+    isotp_buf_pool_t pool = NULL;
+    uint8_t* a = NULL;
+    uint8_t* b = NULL;
+    assert_int_equal(isotp_buf_pool_init(&pool, 4095, 256), EOK);
+
+    assert_int_equal(isotp_buf_pool_get(pool, 200, &a), EOK);  // 224
+    assert_int_equal(isotp_buf_pool_get(pool, 100, &b), -ENOBUFS);
+    assert_int_equal(stats_of(pool).exhausted, 1);
+
+    // a cached buffer of another class makes room
+    assert_int_equal(isotp_buf_pool_put(pool, a), EOK);
+    assert_int_equal(isotp_buf_pool_get(pool, 100, &b), EOK);
+    isotp_buf_pool_stats_t stats = stats_of(pool);
+    assert_int_equal(stats.bytes_allocated, 112);
+    assert_int_equal(stats.allocated, 2);
+    assert_int_equal(isotp_buf_pool_put(pool, b), EOK);
+    isotp_buf_pool_free(pool);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(buf_pool_init_test),
+        cmocka_unit_test(buf_pool_size_classes_test),
+        cmocka_unit_test(buf_pool_recycle_test),
+        cmocka_unit_test(buf_pool_budget_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -107,11 +107,18 @@ static void parse_cf_invalid_pci(void** state) {
     uint8_t buf[64];
 
     ctx->total_datalen = sizeof(buf);
+    ctx->can_frame_len = 8;
 
     will_return(address_extension_len, 0);
     ctx->can_frame[0] = ~CF_PCI;
     assert_true(parse_cf(ctx, buf, sizeof(buf)) == -EBADMSG);
 
+    // no room for the PCI
+    will_return(address_extension_len, 0);
+    ctx->can_frame[0] = CF_PCI;
+    ctx->can_frame_len = 0;
+    assert_true(parse_cf(ctx, buf, sizeof(buf)) == -EBADMSG);
+
     free(ctx);
 }
 
@@ -125,6 +132,7 @@ static void parse_cf_invalid_sn(void** state) {
     for (int i=0; i < 16; i++) {
         ctx->total_datalen = sizeof(buf);
         ctx->remaining_datalen = sizeof(buf);
+        ctx->can_frame_len = 8;
         ctx->can_frame[0] = CF_PCI | (uint8_t)(i & 0x0000000fU);
         ctx->sequence_num = (i + 1) & (0x0000000fU);
 
@@ -0,0 +1,201 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <isotp_coro.hpp>
+
+// in-memory loopback; each port transmits into its peer's queue
+struct frame_s {
+    uint8_t data[64];
+    int len;
+};
+
+struct port_s {
+    std::deque<frame_s>* rx;
+    std::deque<frame_s>* tx;
+};
+
+static int rx_f(void* rxfn_ctx,
+                uint8_t* rx_buf_p,
+                const int rx_buf_sz,
+                const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    port_s* port = static_cast<port_s*>(rxfn_ctx);
+
+    if (port->rx->empty()) {
+        return 0;
+    }
+
+    frame_s f = port->rx->front();
+    port->rx->pop_front();
+    int len = (f.len < rx_buf_sz) ? f.len : rx_buf_sz;
+    memcpy(rx_buf_p, f.data, len);
+
+    return len;
+}
+
+static int tx_f(void* txfn_ctx,
+                const uint8_t* tx_buf_p,
+                const int tx_len,
+                const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    port_s* port = static_cast<port_s*>(txfn_ctx);
+
+    frame_s f = {};
+    memcpy(f.data, tx_buf_p, tx_len);
+    f.len = tx_len;
+    port->tx->push_back(f);
+
+    return tx_len;
+}
+
+struct flow_s {
+    std::deque<frame_s> to_ecu;
+    std::deque<frame_s> to_tester;
+    port_s tester_port = {&to_tester, &to_ecu};
+    port_s ecu_port = {&to_ecu, &to_tester};
+    std::vector<uint8_t> request;
+    std::vector<uint8_t> response;
+    bool passed = false;
+};
+
+static isotp::task ecu(isotp::session& s) {
+    uint8_t buf[512];
+    int rc = co_await s.recv(buf, 4);
+    if (rc < 0) {
+        printf("ecu recv() failed: (%d)\n", rc);
+        co_return;
+    }
+
+    // respond with the request, repeated three times
+    std::vector<uint8_t> rsp;
+    for (int i = 0; i < 3; i++) {
+        rsp.insert(rsp.end(), buf, buf + rc);
+    }
+    rc = co_await s.send(rsp);
+    if (rc < 0) {
+        printf("ecu send() failed: (%d)\n", rc);
+    }
+}
+
+static isotp::task tester(isotp::session& s, flow_s& flow) {
+    int rc = co_await s.send(flow.request);
+    if (rc != static_cast<int>(flow.request.size())) {
+        printf("tester send() failed: (%d)\n", rc);
+        co_return;
+    }
+
+    flow.response.resize(1024);
+    rc = co_await s.recv(flow.response);
+    if (rc < 0) {
+        printf("tester recv() failed: (%d)\n", rc);
+        co_return;
+    }
+    flow.response.resize(rc);
+
+    flow.passed = (flow.response.size() == (3 * flow.request.size()));
+    for (size_t i = 0; flow.passed && (i < flow.response.size()); i++) {
+        flow.passed = (flow.response[i] == flow.request[i % flow.request.size()]);
+    }
+}
+
+// waits for a message that never comes, then tries again
+static isotp::task abandoned(isotp::session& s, int& first, int& second) {
+    uint8_t buf[8];
+    first = co_await s.recv(buf);
+    second = co_await s.recv(buf);
+}
+
+// a session destroyed under a waiting coroutine resumes it with -ECANCELED
+static bool cancel_on_destroy() {
+    isotp::loop l;
+    flow_s f;
+    int first = 0;
+    int second = 0;
+
+    auto s = std::make_unique<isotp::session>(
+        l, isotp::context(CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE, 0,
+                          &f.tester_port, rx_f, tx_f));
+    abandoned(*s, first, second);
+    l.poll_once();
+    if ((l.pending() != 1) || (first != 0)) {
+        return false;
+    }
+
+    s.reset();
+    return (l.pending() == 0) && (first == -ECANCELED) && (second == -ECANCELED);
+}
+
+int main(void) {
+    const int num_flows = 500;
+
+    isotp::loop l;
+    std::vector<std::unique_ptr<flow_s>> flows;
+    std::vector<std::unique_ptr<isotp::session>> sessions;
+
+    for (int i = 0; i < num_flows; i++) {
+        flows.push_back(std::make_unique<flow_s>());
+        flow_s& f = *flows.back();
+        f.request.resize(1 + (i % 150));
+        for (size_t j = 0; j < f.request.size(); j++) {
+            f.request[j] = static_cast<uint8_t>(i + j);
+        }
+
+        sessions.push_back(std::make_unique<isotp::session>(
+            l, isotp::context(CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE, 0,
+                              &f.ecu_port, rx_f, tx_f)));
+        ecu(*sessions.back());
+
+        sessions.push_back(std::make_unique<isotp::session>(
+            l, isotp::context(CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE, 0,
+                              &f.tester_port, rx_f, tx_f)));
+        tester(*sessions.back(), f);
+    }
+
+    printf("running %d concurrent flows\n", num_flows);
+    l.run();
+
+    int failed = 0;
+    for (const auto& f : flows) {
+        if (!f->passed) {
+            failed++;
+        }
+    }
+
+    printf("%d of %d flows passed\n", num_flows - failed, num_flows);
+
+    if (!cancel_on_destroy()) {
+        printf("destroying a session didn't cancel its waiter\n");
+        failed++;
+    }
+
+    return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,472 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "../isotp.h"
+#include "../isotp_private.h"
+
+#define MAX_MESSAGES (2048)
+
+struct collected_s {
+    isotp_message_t msgs[MAX_MESSAGES];
+    uint8_t data[MAX_MESSAGES][256];
+    int count;
+};
+
+static void collect_f(void* cb_ctx, const isotp_message_t* msg) {
+    struct collected_s* c = (struct collected_s*)cb_ctx;
+
+    assert_true(c->count < MAX_MESSAGES);
+    c->msgs[c->count] = *msg;
+    if (msg->len > 0) {
+        assert_true(msg->len <= 256);
+        memcpy(c->data[c->count], msg->data, msg->len);
+    }
+    c->count++;
+}
+
+static void fill_buf(uint8_t* buf, const int buf_sz, const uint8_t pattern) {
+    for (int i=0; i < buf_sz; i++) {
+        buf[i] = (uint8_t)(pattern + i);
+    }
+}
+
+// split a message into classic CAN frames (normal addressing), 1ms apart
+static int segment(const uint8_t* msg,
+                   const int len,
+                   uint8_t frames[][8]) {
+    if (len <= 7) {
+        memset(frames[0], 0xCC, 8);
+        frames[0][0] = (uint8_t)len;
+        memcpy(&(frames[0][1]), msg, len);
+        return 1;
+    }
+
+    memset(frames[0], 0xCC, 8);
+    frames[0][0] = FF_PCI | (uint8_t)(len >> 8);
+    frames[0][1] = (uint8_t)len;
+    memcpy(&(frames[0][2]), msg, 6);
+
+    int n = 1;
+    for (int off=6; off < len; off += 7) {
+        memset(frames[n], 0xCC, 8);
+        frames[n][0] = CF_PCI | (uint8_t)(n & 0x0F);
+        memcpy(&(frames[n][1]), &(msg[off]), MIN(7, len - off));
+        n++;
+    }
+
+    return n;
+}
+
+static void decoder_invalid_parameters(void** state) {
+    (void)state;
+    struct collected_s* c = calloc(1, sizeof(*c));
+    isotp_decoder_t d = NULL;
+    uint8_t frame[8] = {0};
+
+    assert_true(isotp_decoder_init(NULL, ISOTP_NORMAL_ADDRESSING_MODE, 256,
+                                   collect_f, c) == -EINVAL);
+    assert_true(isotp_decoder_init(&d, ISOTP_NORMAL_ADDRESSING_MODE, 256,
+                                   NULL, c) == -EINVAL);
+    assert_true(isotp_decoder_init(&d, ISOTP_NORMAL_ADDRESSING_MODE, 0,
+                                   collect_f, c) == -ERANGE);
+    assert_true(isotp_decoder_init(&d, NULL_ISOTP_ADDRESSING_MODE, 256,
+                                   collect_f, c) == -EFAULT);
+    assert_true(isotp_decoder_init(&d, ISOTP_NORMAL_ADDRESSING_MODE, 256,
+                                   collect_f, c) == EOK);
+
+    assert_true(isotp_decoder_frame(NULL, 0, 0x7E0, false, CAN_FORMAT,
+                                    frame, 8) == -EINVAL);
+    assert_true(isotp_decoder_frame(d, 0, 0x7E0, false, CAN_FORMAT,
+                                    NULL, 8) == -EINVAL);
+    assert_true(isotp_decoder_frame(d, 0, 0x7E0, false, CAN_FORMAT,
+                                    frame, 9) == -EMSGSIZE);
+    assert_true(isotp_decoder_frame(d, 0, 0x7E0, false, NULL_CAN_FORMAT,
+                                    frame, 8) < 0);
+    assert_true(isotp_decoder_flush(NULL) == -EINVAL);
+
+    isotp_decoder_free(d);
+    free(c);
+}
+
+static void decoder_both_directions(void** state) {
+    (void)state;
+    struct collected_s* c = calloc(1, sizeof(*c));
+    isotp_decoder_t d = NULL;
+    uint8_t req[3] = { 0x22, 0xF1, 0x90 };
+    uint8_t resp[20];
+    uint8_t req_frames[8][8];
+    uint8_t resp_frames[8][8];
+    uint8_t fc[8] = { FC_PCI, 0, 0, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC };
+    fill_buf(resp, sizeof(resp), 0x62);
+
+    assert_true(isotp_decoder_init(&d, ISOTP_NORMAL_ADDRESSING_MODE, 256,
+                                   collect_f, c) == EOK);
+
+    assert_true(segment(req, sizeof(req), req_frames) == 1);
+    assert_true(segment(resp, sizeof(resp), resp_frames) == 3);
+
+    // request, FF of the response, FC from the tester, then the CFs
+    assert_true(isotp_decoder_frame(d, 1000, 0x7E0, false, CAN_FORMAT,
+                                    req_frames[0], 8) == EOK);
+    assert_true(isotp_decoder_frame(d, 2000, 0x7E8, false, CAN_FORMAT,
+                                    resp_frames[0], 8) == EOK);
+    assert_true(isotp_decoder_frame(d, 2500, 0x7E0, false, CAN_FORMAT,
+                                    fc, 8) == EOK);
+    assert_true(isotp_decoder_frame(d, 3000, 0x7E8, false, CAN_FORMAT,
+                                    resp_frames[1], 8) == EOK);
+    assert_true(c->count == 1);
+    assert_true(isotp_decoder_frame(d, 4000, 0x7E8, false, CAN_FORMAT,
+                                    resp_frames[2], 8) == EOK);
+
+    assert_true(c->count == 2);
+    assert_true(c->msgs[0].can_id == 0x7E0);
+    assert_true(!c->msgs[0].extended_id);
+    assert_true(c->msgs[0].len == sizeof(req));
+    assert_true(c->msgs[0].frames == 1);
+    assert_true(c->msgs[0].start_us == 1000);
+    assert_true(c->msgs[0].end_us == 1000);
+    assert_memory_equal(c->data[0], req, sizeof(req));
+
+    assert_true(c->msgs[1].can_id == 0x7E8);
+    assert_true(c->msgs[1].len == sizeof(resp));
+    assert_true(c->msgs[1].frames == 3);
+    assert_true(c->msgs[1].start_us == 2000);
+    assert_true(c->msgs[1].end_us == 4000);
+    assert_memory_equal(c->data[1], resp, sizeof(resp));
+
+    // nothing is left in progress
+    assert_true(isotp_decoder_flush(d) == 0);
+
+    isotp_decoder_free(d);
+    free(c);
+}
+
+static void decoder_broken_messages(void** state) {
+    (void)state;
+    struct collected_s* c = calloc(1, sizeof(*c));
+    isotp_decoder_t d = NULL;
+    uint8_t msg[40];
+    uint8_t frames[8][8];
+    fill_buf(msg, sizeof(msg), 0x10);
+
+    assert_true(isotp_decoder_init(&d, ISOTP_NORMAL_ADDRESSING_MODE, 32,
+                                   collect_f, c) == EOK);
+    int n = segment(msg, 30, frames);
+    assert_true(n == 5);
+
+    // CFs without an FF (the log started mid-message) are ignored
+    assert_true(isotp_decoder_frame(d, 0, 0x7E8, false, CAN_FORMAT,
+                                    frames[1], 8) == EOK);
+    assert_true(c->count == 0);
+
+    // a missing CF
+    assert_true(isotp_decoder_frame(d, 1, 0x7E8, false, CAN_FORMAT,
+                                    frames[0], 8) == EOK);
+    assert_true(isotp_decoder_frame(d, 2, 0x7E8, false, CAN_FORMAT,
+                                    frames[2], 8) == EOK);
+    assert_true(c->count == 1);
+    assert_true(c->msgs[0].len == -ECONNABORTED);
+    assert_true(c->msgs[0].frames == 2);
+
+    // a message interrupted by the next one
+    assert_true(isotp_decoder_frame(d, 3, 0x7E8, false, CAN_FORMAT,
+                                    frames[0], 8) == EOK);
+    assert_true(isotp_decoder_frame(d, 4, 0x7E8, false, CAN_FORMAT,
+                                    frames[0], 8) == EOK);
+    assert_true(c->count == 2);
+    assert_true(c->msgs[1].len == -ECONNABORTED);
+
+    // and then completed
+    for (int i=1; i < n; i++) {
+        assert_true(isotp_decoder_frame(d, 5 + i, 0x7E8, false, CAN_FORMAT,
+                                        frames[i], 8) == EOK);
+    }
+    assert_true(c->count == 3);
+    assert_true(c->msgs[2].len == 30);
+    assert_memory_equal(c->data[2], msg, 30);
+
+    // too large
+    n = segment(msg, 40, frames);
+    assert_true(isotp_decoder_frame(d, 20, 0x7E8, false, CAN_FORMAT,
+                                    frames[0], 8) == EOK);
+    assert_true(c->count == 4);
+    assert_true(c->msgs[3].len == -EOVERFLOW);
+    for (int i=1; i < n; i++) {
+        assert_true(isotp_decoder_frame(d, 20 + i, 0x7E8, false, CAN_FORMAT,
+                                        frames[i], 8) == EOK);
+    }
+    assert_true(c->count == 4);
+
+    // still incomplete at the end of the log
+    n = segment(msg, 30, frames);
+    assert_true(isotp_decoder_frame(d, 30, 0x7E8, false, CAN_FORMAT,
+                                    frames[0], 8) == EOK);
+    assert_true(isotp_decoder_frame(d, 31, 0x7E8, false, CAN_FORMAT,
+                                    frames[1], 8) == EOK);
+    assert_true(isotp_decoder_flush(d) == 1);
+    assert_true(c->count == 5);
+    assert_true(c->msgs[4].len == -ENODATA);
+    assert_true(c->msgs[4].data == NULL);
+
+    // an SF shorter than its SF_DL is reported malformed, not as a message
+    uint8_t short_sf[2] = { 0x07, 0xAA };
+    assert_true(isotp_decoder_frame(d, 35, 0x7E8, false, CAN_FORMAT,
+                                    short_sf, sizeof(short_sf)) == EOK);
+    assert_true(c->count == 6);
+    assert_true(c->msgs[5].len == -EBADMSG);
+    assert_true(c->msgs[5].data == NULL);
+    assert_true(c->msgs[5].frames == 1);
+
+    // and so is an FF too short for its FF_DL
+    uint8_t short_ff[2] = { FF_PCI, 0x00 };
+    assert_true(isotp_decoder_frame(d, 36, 0x7E8, false, CAN_FORMAT,
+                                    short_ff, sizeof(short_ff)) == EOK);
+    assert_true(c->count == 7);
+    assert_true(c->msgs[6].len == -EBADMSG);
+
+    // not ISOTP at all
+    uint8_t junk[8] = { 0x0F, 1, 2, 3, 4, 5, 6, 7 };
+    assert_true(isotp_decoder_frame(d, 40, 0x123, false, CAN_FORMAT,
+                                    junk, 8) == EOK);
+    assert_true(isotp_decoder_frame(d, 41, 0x123, false, CAN_FORMAT,
+                                    junk, 0) == EOK);
+    assert_true(c->count == 7);
+
+    isotp_decoder_free(d);
+    free(c);
+}
+
+static void decoder_extended_addressing(void** state) {
+    (void)state;
+    struct collected_s* c = calloc(1, sizeof(*c));
+    isotp_decoder_t d = NULL;
+    uint8_t sf[8] = { 0x55, 0x02, 0x10, 0x03, 0xCC, 0xCC, 0xCC, 0xCC };
+
+    assert_true(isotp_decoder_init(&d, ISOTP_EXTENDED_ADDRESSING_MODE, 256,
+                                   collect_f, c) == EOK);
+    assert_true(isotp_decoder_frame(d, 7, 0x18DA10F1, true, CAN_FORMAT,
+                                    sf, 8) == EOK);
+
+    assert_true(c->count == 1);
+    assert_true(c->msgs[0].can_id == 0x18DA10F1);
+    assert_true(c->msgs[0].extended_id);
+    assert_true(c->msgs[0].address_extension == 0x55);
+    assert_true(c->msgs[0].len == 2);
+    assert_true(c->data[0][0] == 0x10);
+    assert_true(c->data[0][1] == 0x03);
+
+    isotp_decoder_free(d);
+    free(c);
+}
+
+static void decoder_canfd(void** state) {
+    (void)state;
+    struct collected_s* c = calloc(1, sizeof(*c));
+    isotp_decoder_t d = NULL;
+    uint8_t msg[100];
+    uint8_t frame[64];
+    fill_buf(msg, sizeof(msg), 0x80);
+
+    assert_true(isotp_decoder_init(&d, ISOTP_NORMAL_ADDRESSING_MODE, 256,
+                                   collect_f, c) == EOK);
+
+    // SF with escape: 20 bytes in a 24 byte frame
+    memset(frame, 0xCC, sizeof(frame));
+    frame[0] = 0x00;
+    frame[1] = 20;
+    memcpy(&(frame[2]), msg, 20);
+    assert_true(isotp_decoder_frame(d, 1, 0x7E8, false, CANFD_FORMAT,
+                                    frame, 24) == EOK);
+
+    // 100 bytes: a 64 byte FF and a 40 byte CF
+    frame[0] = FF_PCI;
+    frame[1] = 100;
+    memcpy(&(frame[2]), msg, 62);
+    assert_true(isotp_decoder_frame(d, 2, 0x7E8, false, CANFD_FORMAT,
+                                    frame, 64) == EOK);
+    memset(frame, 0xCC, sizeof(frame));
+    frame[0] = CF_PCI | 1;
+    memcpy(&(frame[1]), &(msg[62]), 38);
+    assert_true(isotp_decoder_frame(d, 3, 0x7E8, false, CANFD_FORMAT,
+                                    frame, 40) == EOK);
+
+    assert_true(c->count == 2);
+    assert_true(c->msgs[0].len == 20);
+    assert_memory_equal(c->data[0], msg, 20);
+    assert_true(c->msgs[1].len == 100);
+    assert_true(c->msgs[1].frames == 2);
+    assert_memory_equal(c->data[1], msg, 100);
+
+    isotp_decoder_free(d);
+    free(c);
+}
+
+static void decoder_many_streams(void** state) {
+    (void)state;
+    struct collected_s* c = calloc(1, sizeof(*c));
+    isotp_decoder_t d = NULL;
+    uint8_t msg[30];
+    uint8_t frames[8][8];
+    fill_buf(msg, sizeof(msg), 0x01);
+    int n = segment(msg, sizeof(msg), frames);
+
+    assert_true(isotp_decoder_init(&d, ISOTP_NORMAL_ADDRESSING_MODE, 64,
+                                   collect_f, c) == EOK);
+
+    // 500 streams, with their frames interleaved; 11 bit and 29 bit IDs
+    // with the same value are different streams
+    for (int i=0; i < n; i++) {
+        for (uint32_t id=0; id < 250; id++) {
+            assert_true(isotp_decoder_frame(d, i, id, false, CAN_FORMAT,
+                                            frames[i], 8) == EOK);
+            assert_true(isotp_decoder_frame(d, i, id, true, CAN_FORMAT,
+                                            frames[i], 8) == EOK);
+        }
+    }
+
+    assert_true(c->count == 500);
+    int extended = 0;
+    for (int i=0; i < c->count; i++) {
+        assert_true(c->msgs[i].len == sizeof(msg));
+        assert_memory_equal(c->data[i], msg, sizeof(msg));
+        extended += c->msgs[i].extended_id ? 1 : 0;
+    }
+    assert_true(extended == 250);
+
+    isotp_decoder_free(d);
+    free(c);
+}
+
+static void decoder_join(void** state) {
+    (void)state;
+    struct collected_s* c = calloc(1, sizeof(*c));
+    struct collected_s* c2 = calloc(1, sizeof(*c2));
+    isotp_decoder_t d = NULL;
+    isotp_decoder_t d2 = NULL;
+    isotp_decoder_t d3 = NULL;
+    uint8_t msg[60];
+    uint8_t frames[10][8];
+    fill_buf(msg, sizeof(msg), 0x30);
+    int n = segment(msg, sizeof(msg), frames);
+    assert_true(n == 9);
+
+    assert_true(isotp_decoder_init(&d, ISOTP_NORMAL_ADDRESSING_MODE, 64,
+                                   collect_f, c) == EOK);
+    assert_true(isotp_decoder_init(&d2, ISOTP_NORMAL_ADDRESSING_MODE, 64,
+                                   collect_f, c2) == EOK);
+    assert_true(isotp_decoder_init(&d3, ISOTP_NORMAL_ADDRESSING_MODE, 64,
+                                   collect_f, c2) == EOK);
+
+    // the log is cut after the third frame of 0x7E8 and inside a message
+    // on 0x7E9 that is then cut short by a new one
+    for (int i=0; i < 3; i++) {
+        assert_true(isotp_decoder_frame(d, 10 + i, 0x7E8, false, CAN_FORMAT,
+                                        frames[i], 8) == EOK);
+    }
+    assert_true(isotp_decoder_frame(d, 13, 0x7E9, false, CAN_FORMAT,
+                                    frames[0], 8) == EOK);
+    for (int i=3; i < n; i++) {
+        assert_true(isotp_decoder_frame(d2, 10 + i, 0x7E8, false, CAN_FORMAT,
+                                        frames[i], 8) == EOK);
+    }
+    assert_true(isotp_decoder_frame(d2, 30, 0x7E9, false, CAN_FORMAT,
+                                    frames[0], 8) == EOK);
+    // a message left in progress at the end of the second part
+    assert_true(isotp_decoder_frame(d2, 31, 0x7EA, false, CAN_FORMAT,
+                                    frames[0], 8) == EOK);
+    // and finished in a third
+    for (int i=1; i < n; i++) {
+        assert_true(isotp_decoder_frame(d3, 31 + i, 0x7EA, false, CAN_FORMAT,
+                                        frames[i], 8) == EOK);
+    }
+    assert_true(c->count == 0);
+    assert_true(c2->count == 0);
+
+    assert_true(isotp_decoder_join(d, d) == -EINVAL);
+    assert_true(isotp_decoder_join(d, NULL) == -EINVAL);
+    assert_true(isotp_decoder_join(d, d2) == EOK);
+    // one stream after the other, in no particular order
+    assert_true(c->count == 2);
+    int done = (c->msgs[0].can_id == 0x7E8) ? 0 : 1;
+    assert_true(c->msgs[done].can_id == 0x7E8);
+    assert_true(c->msgs[done].len == sizeof(msg));
+    assert_true(c->msgs[done].frames == n);
+    assert_true(c->msgs[done].start_us == 10);
+    assert_true(c->msgs[done].end_us == (uint64_t)(10 + n - 1));
+    assert_memory_equal(c->data[done], msg, sizeof(msg));
+    assert_true(c->msgs[1 - done].can_id == 0x7E9);
+    assert_true(c->msgs[1 - done].len == -ECONNABORTED);
+    isotp_decoder_free(d2);
+
+    assert_true(isotp_decoder_join(d, d3) == EOK);
+    isotp_decoder_free(d3);
+    assert_true(c->count == 3);
+    assert_true(c->msgs[2].can_id == 0x7EA);
+    assert_true(c->msgs[2].len == sizeof(msg));
+    assert_true(c->msgs[2].start_us == 31);
+    assert_memory_equal(c->data[2], msg, sizeof(msg));
+
+    // 0x7E9 is still in progress
+    assert_true(isotp_decoder_flush(d) == 1);
+    assert_true(c->msgs[3].can_id == 0x7E9);
+    assert_true(c->msgs[3].len == -ENODATA);
+    assert_true(c->msgs[3].start_us == 30);
+    assert_true(c2->count == 0);
+
+    // decoders that don't match
+    assert_true(isotp_decoder_init(&d2, ISOTP_EXTENDED_ADDRESSING_MODE, 64,
+                                   collect_f, c2) == EOK);
+    assert_true(isotp_decoder_join(d, d2) == -EINVAL);
+    isotp_decoder_free(d2);
+
+    isotp_decoder_free(d);
+    free(c);
+    free(c2);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(decoder_invalid_parameters),
+        cmocka_unit_test(decoder_both_directions),
+        cmocka_unit_test(decoder_broken_messages),
+        cmocka_unit_test(decoder_extended_addressing),
+        cmocka_unit_test(decoder_canfd),
+        cmocka_unit_test(decoder_many_streams),
+        cmocka_unit_test(decoder_join),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,196 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "../isotp.h"
+#include "../isotp_private.h"
+
+static void init_adaptive(isotp_fc_adaptive_t* a) {
+    assert_true(isotp_fc_adaptive_init(a, 2, 32, 0, 1600, 500) == EOK);
+}
+
+// tests
+static void fc_adaptive_init_invalid_parameters(void** state) {
+    (void)state;
+
+    isotp_fc_adaptive_t a;
+    assert_true(isotp_fc_adaptive_init(NULL, 1, 8, 0, 1000, 0) == -EINVAL);
+    assert_true(isotp_fc_adaptive_init(&a, 0, 8, 0, 1000, 0) == -ERANGE);
+    assert_true(isotp_fc_adaptive_init(&a, 9, 8, 0, 1000, 0) == -ERANGE);
+    assert_true(isotp_fc_adaptive_init(&a, 1, 8, -1, 1000, 0) == -ERANGE);
+    assert_true(isotp_fc_adaptive_init(&a, 1, 8, 2000, 1000, 0) == -ERANGE);
+    assert_true(isotp_fc_adaptive_init(&a, 1, 8, 0, 1000, 0) == EOK);
+    assert_true(a.load_limit_pct == 0);
+}
+
+static void fc_adaptive_invalid_parameters(void** state) {
+    (void)state;
+
+    isotp_fc_adaptive_t a;
+    init_adaptive(&a);
+    isotp_fc_stats_t stats = {0};
+    uint8_t bs = 0;
+    int stmin = 0;
+
+    assert_true(isotp_fc_policy_adaptive(NULL, &stats, &bs, &stmin) == -EINVAL);
+    assert_true(isotp_fc_policy_adaptive(&a, NULL, &bs, &stmin) == -EINVAL);
+    assert_true(isotp_fc_policy_adaptive(&a, &stats, NULL, &stmin) == -EINVAL);
+    assert_true(isotp_fc_policy_adaptive(&a, &stats, &bs, NULL) == -EINVAL);
+}
+
+static void fc_adaptive_first_block(void** state) {
+    (void)state;
+
+    isotp_fc_adaptive_t a;
+    init_adaptive(&a);
+    isotp_fc_stats_t stats = {0};
+    uint8_t bs = 0;
+    int stmin = 0;
+
+    assert_true(isotp_fc_policy_adaptive(&a, &stats, &bs, &stmin) == EOK);
+    assert_true(bs == 2);
+    assert_true(stmin == 1600);
+}
+
+static void fc_adaptive_clean_block_grows(void** state) {
+    (void)state;
+
+    isotp_fc_adaptive_t a;
+    init_adaptive(&a);
+    isotp_fc_stats_t stats = {0};
+    stats.block_cfs = 2;
+    stats.block_jitter_us = 100;
+    uint8_t bs = 2;
+    int stmin = 1600;
+
+    const uint8_t expected_bs[] = { 4, 8, 16, 32, 32 };
+    const int expected_stmin[] = { 800, 400, 200, 100, 0 };
+    for (size_t i=0; i < sizeof(expected_bs); i++) {
+        assert_true(isotp_fc_policy_adaptive(&a, &stats, &bs, &stmin) == EOK);
+        assert_true(bs == expected_bs[i]);
+        assert_true(stmin == expected_stmin[i]);
+        stats.block_cfs = bs;
+    }
+}
+
+static void fc_adaptive_jitter_backs_off(void** state) {
+    (void)state;
+
+    isotp_fc_adaptive_t a;
+    init_adaptive(&a);
+    isotp_fc_stats_t stats = {0};
+    stats.block_cfs = 32;
+    stats.block_jitter_us = 501;
+    uint8_t bs = 32;
+    int stmin = 0;
+
+    const uint8_t expected_bs[] = { 16, 8, 4, 2, 2 };
+    const int expected_stmin[] = { 100, 200, 400, 800, 1600 };
+    for (size_t i=0; i < sizeof(expected_bs); i++) {
+        assert_true(isotp_fc_policy_adaptive(&a, &stats, &bs, &stmin) == EOK);
+        assert_true(bs == expected_bs[i]);
+        assert_true(stmin == expected_stmin[i]);
+    }
+
+    // and stays at the limits
+    assert_true(isotp_fc_policy_adaptive(&a, &stats, &bs, &stmin) == EOK);
+    assert_true(bs == 2);
+    assert_true(stmin == 1600);
+}
+
+static void fc_adaptive_bus_load_backs_off(void** state) {
+    (void)state;
+
+    isotp_fc_adaptive_t a;
+    init_adaptive(&a);
+    a.load_limit_pct = 70;
+    isotp_fc_stats_t stats = {0};
+    stats.block_cfs = 8;
+    uint8_t bs = 8;
+    int stmin = 200;
+
+    a.load_pct = 70;
+    assert_true(isotp_fc_policy_adaptive(&a, &stats, &bs, &stmin) == EOK);
+    assert_true(bs == 16);
+    assert_true(stmin == 100);
+
+    a.load_pct = 85;
+    assert_true(isotp_fc_policy_adaptive(&a, &stats, &bs, &stmin) == EOK);
+    assert_true(bs == 8);
+    assert_true(stmin == 200);
+}
+
+static void fc_policy_block_stats(void** state) {
+    (void)state;
+
+    isotp_ctx_t ctx = calloc(1, sizeof(struct isotp_ctx_s));
+    assert_non_null(ctx);
+
+    // gaps of 1000, 1200, 900us
+    fc_policy_cf_received(ctx, 10000);
+    fc_policy_cf_received(ctx, 11000);
+    fc_policy_cf_received(ctx, 12200);
+    fc_policy_cf_received(ctx, 13100);
+
+    assert_true(ctx->fc_block_cfs == 4);
+    assert_true(ctx->fc_gap_sum_us == 3100);
+    assert_true(ctx->fc_gap_max_us == 1200);
+    assert_true(ctx->fc_jitter_sum_us == 500);
+
+    // no policy; values untouched, accumulators reset
+    uint8_t bs = 4;
+    int stmin = 300;
+    fc_policy_next_block(ctx, &bs, &stmin, 14000);
+    assert_true(bs == 4);
+    assert_true(stmin == 300);
+    assert_true(ctx->fc_block_cfs == 0);
+    assert_true(ctx->fc_gap_sum_us == 0);
+    assert_true(ctx->fc_jitter_sum_us == 0);
+
+    free(ctx);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(fc_adaptive_init_invalid_parameters),
+        cmocka_unit_test(fc_adaptive_invalid_parameters),
+        cmocka_unit_test(fc_adaptive_first_block),
+        cmocka_unit_test(fc_adaptive_clean_block_grows),
+        cmocka_unit_test(fc_adaptive_jitter_backs_off),
+        cmocka_unit_test(fc_adaptive_bus_load_backs_off),
+        cmocka_unit_test(fc_policy_block_stats),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -172,6 +172,58 @@ static void parse_ff_invalid_ffdl(void** state) {
     free(ctx);
 }
 
+static void parse_ff_short_frame(void** state) {
+    (void)state;
+
+    isotp_ctx_t ctx = calloc(1, sizeof(*ctx));
+    uint8_t buf[256];
+
+    // frames too short for their PCI and FF_DL
+    // @ref ISO-15765-2:2016, section 9.6.3.2
+    const uint8_t ff_pci[] = { FF_PCI | 0x01 };
+    const uint8_t ff_esc[] = { FF_PCI, 0x00, 0x00, 0x00, 0x10 };
+    const uint8_t ff_mixed[] = { 0xae, FF_PCI | 0x01 };
+
+    ctx->address_extension_len = 0;
+    ctx->can_format = CAN_FORMAT;
+    assert_true(parse_ff_frame(ctx, ff_pci, 0, buf, sizeof(buf)) == -EBADMSG);
+    assert_true(parse_ff_frame(ctx, ff_pci, sizeof(ff_pci), buf, sizeof(buf)) == -EBADMSG);
+    assert_true(parse_ff_frame(ctx, ff_esc, 2, buf, sizeof(buf)) == -EBADMSG);
+    assert_true(parse_ff_frame(ctx, ff_esc, sizeof(ff_esc), buf, sizeof(buf)) == -EBADMSG);
+
+    ctx->address_extension_len = 1;
+    assert_true(parse_ff_frame(ctx, ff_mixed, sizeof(ff_mixed), buf, sizeof(buf)) == -EBADMSG);
+
+    free(ctx);
+}
+
+static void parse_ff_frame_in_place(void** state) {
+    (void)state;
+
+    isotp_ctx_t ctx = calloc(1, sizeof(*ctx));
+    uint8_t buf[256];
+    uint8_t frame[64];
+
+    // the frame is read from outside the context; can_frame is left alone
+    memset(buf, 0, sizeof(buf));
+    memset(frame, 0x5a, sizeof(frame));
+    frame[0] = FF_PCI | 0x01;
+    frame[1] = 0x00;
+    ctx->address_extension_len = 0;
+    ctx->can_format = CANFD_FORMAT;
+    ctx->can_frame_len = 0;
+    will_return(can_max_datalen, 64);
+    assert_true(parse_ff_frame(ctx, frame, sizeof(frame), buf, sizeof(buf)) == 62);
+    assert_true(ctx->total_datalen == 256);
+    assert_true(ctx->remaining_datalen == 256 - 62);
+    assert_memory_equal(buf, &(frame[2]), 62);
+    assert_true(ctx->can_frame_len == 0);
+
+    assert_true(parse_ff_frame(ctx, NULL, sizeof(frame), buf, sizeof(buf)) == -EINVAL);
+
+    free(ctx);
+}
+
 static void parse_ff_no_esc_success(void** state) {
     (void)state;
 
@@ -567,6 +619,8 @@ int main(void) {
         cmocka_unit_test(parse_ff_invalid_params),
         cmocka_unit_test(parse_ff_invalid_pci),
         cmocka_unit_test(parse_ff_invalid_ffdl),
+        cmocka_unit_test(parse_ff_short_frame),
+        cmocka_unit_test(parse_ff_frame_in_place),
         cmocka_unit_test(parse_ff_no_esc_success),
         cmocka_unit_test(parse_ff_with_esc_success),
         cmocka_unit_test(prepare_ff_invalid_parameters),
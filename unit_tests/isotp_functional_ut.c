@@ -0,0 +1,391 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "../isotp.h"
+#include "../isotp_private.h"
+
+// a simulated bus: the tester's frames are delivered to the ECUs straight
+// away, the ECUs' frames are queued until the tester receives them
+#define BUS_DEPTH (512)
+#define MAX_ECUS  (8)
+
+struct bus_s;
+
+struct ecu_s {
+    struct bus_s* bus;
+    isotp_ctx_t ctx;
+    uint32_t req_id;     // physical ID the ECU receives on
+    uint32_t resp_id;    // physical ID the ECU responds on
+    uint8_t resp[512];
+    int resp_len;
+    bool deaf;           // ignores FCs
+};
+
+struct bus_s {
+    uint32_t func_id;
+    struct ecu_s ecus[MAX_ECUS];
+    int ecu_count;
+    uint32_t id[BUS_DEPTH];
+    uint8_t frame[BUS_DEPTH][64];
+    int frame_len[BUS_DEPTH];
+    int head;
+    int tail;
+    uint8_t request[64];
+    int request_len;
+};
+
+static void bus_push(struct bus_s* bus,
+                     const uint32_t id,
+                     const uint8_t* frame,
+                     const int len) {
+    assert_true((bus->tail - bus->head) < BUS_DEPTH);
+    int i = bus->tail % BUS_DEPTH;
+    bus->id[i] = id;
+    memcpy(bus->frame[i], frame, len);
+    bus->frame_len[i] = len;
+    bus->tail++;
+}
+
+static int ecu_tx_f(void* txfn_ctx,
+                    const uint8_t* tx_buf_p,
+                    const int tx_len,
+                    const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct ecu_s* ecu = (struct ecu_s*)txfn_ctx;
+    bus_push(ecu->bus, ecu->resp_id, tx_buf_p, tx_len);
+    return tx_len;
+}
+
+static int tester_tx_f(void* txfn_ctx,
+                       const uint32_t can_id,
+                       const uint8_t* tx_buf_p,
+                       const int tx_len,
+                       const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct bus_s* bus = (struct bus_s*)txfn_ctx;
+
+    if (can_id == bus->func_id) {
+        memcpy(bus->request, tx_buf_p, tx_len);
+        bus->request_len = tx_len;
+        for (int i=0; i < bus->ecu_count; i++) {
+            struct ecu_s* ecu = &(bus->ecus[i]);
+            assert_true(isotp_send_start(ecu->ctx, ecu->resp, ecu->resp_len, 0) == EOK);
+        }
+        return tx_len;
+    }
+
+    for (int i=0; i < bus->ecu_count; i++) {
+        struct ecu_s* ecu = &(bus->ecus[i]);
+        if ((ecu->req_id == can_id) && !ecu->deaf) {
+            (void)isotp_rx_frame(ecu->ctx, tx_buf_p, tx_len, get_time());
+        }
+    }
+    return tx_len;
+}
+
+static int tester_rx_f(void* rxfn_ctx,
+                       uint32_t* can_id,
+                       uint8_t* rx_buf_p,
+                       const int rx_buf_sz,
+                       const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct bus_s* bus = (struct bus_s*)rxfn_ctx;
+
+    for (int i=0; i < bus->ecu_count; i++) {
+        (void)isotp_poll(bus->ecus[i].ctx, get_time());
+    }
+
+    if (bus->head == bus->tail) {
+        return -EAGAIN;
+    }
+
+    int i = bus->head % BUS_DEPTH;
+    assert_true(bus->frame_len[i] <= rx_buf_sz);
+    *can_id = bus->id[i];
+    memcpy(rx_buf_p, bus->frame[i], bus->frame_len[i]);
+    bus->head++;
+
+    return bus->frame_len[i];
+}
+
+static struct ecu_s* bus_add_ecu(struct bus_s* bus,
+                                 const uint32_t req_id,
+                                 const uint32_t resp_id,
+                                 const int resp_len) {
+    assert_true(bus->ecu_count < MAX_ECUS);
+    struct ecu_s* ecu = &(bus->ecus[bus->ecu_count++]);
+    ecu->bus = bus;
+    ecu->req_id = req_id;
+    ecu->resp_id = resp_id;
+    ecu->resp_len = resp_len;
+    for (int i=0; i < resp_len; i++) {
+        ecu->resp[i] = (uint8_t)(resp_id + i);
+    }
+    assert_true(isotp_ctx_init(&(ecu->ctx), CAN_FORMAT,
+                               ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, ecu, NULL, ecu_tx_f) == EOK);
+    return ecu;
+}
+
+static void bus_free(struct bus_s* bus) {
+    for (int i=0; i < bus->ecu_count; i++) {
+        isotp_ctx_free(bus->ecus[i].ctx);
+    }
+}
+
+static void check_response(const struct bus_s* bus,
+                           const isotp_response_t* resp) {
+    for (int i=0; i < bus->ecu_count; i++) {
+        const struct ecu_s* ecu = &(bus->ecus[i]);
+        if (ecu->resp_id == resp->can_id) {
+            assert_true(resp->rc == ecu->resp_len);
+            assert_memory_equal(resp->data, ecu->resp, ecu->resp_len);
+            return;
+        }
+    }
+    fail();
+}
+
+static const uint8_t read_dtc[] = { 0x19, 0x02, 0xFF };
+
+// tests
+static void functional_fc_id(void** state) {
+    (void)state;
+
+    uint32_t fc_id = 0;
+    assert_true(isotp_functional_fc_id(NULL, 0x7E8, NULL) == -EINVAL);
+    assert_true(isotp_functional_fc_id(NULL, 0x7E8, &fc_id) == EOK);
+    assert_true(fc_id == 0x7E0);
+    assert_true(isotp_functional_fc_id(NULL, 0x7EF, &fc_id) == EOK);
+    assert_true(fc_id == 0x7E7);
+    assert_true(isotp_functional_fc_id(NULL, 0x18DAF110, &fc_id) == EOK);
+    assert_true(fc_id == 0x18DA10F1);
+    assert_true(isotp_functional_fc_id(NULL, 0x1CDAF110, &fc_id) == EOK);
+    assert_true(fc_id == 0x1CDA10F1);
+
+    assert_true(isotp_functional_fc_id(NULL, 0x7DF, &fc_id) == -ENOMSG);
+    assert_true(isotp_functional_fc_id(NULL, 0x7F0, &fc_id) == -ENOMSG);
+    assert_true(isotp_functional_fc_id(NULL, 0x18DB33F1, &fc_id) == -ENOMSG);
+}
+
+static void functional_invalid_parameters(void** state) {
+    (void)state;
+
+    struct bus_s bus = {0};
+    isotp_functional_t f = NULL;
+    isotp_response_t responses[4];
+
+    assert_true(isotp_functional_init(NULL, CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                                      4, 64, &bus, tester_rx_f, tester_tx_f) == -EINVAL);
+    assert_true(isotp_functional_init(&f, CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                                      4, 64, &bus, NULL, tester_tx_f) == -EINVAL);
+    assert_true(isotp_functional_init(&f, CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                                      4, 64, &bus, tester_rx_f, NULL) == -EINVAL);
+    assert_true(isotp_functional_init(&f, CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                                      0, 64, &bus, tester_rx_f, tester_tx_f) == -ERANGE);
+    assert_true(isotp_functional_init(&f, CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                                      4, 0, &bus, tester_rx_f, tester_tx_f) == -ERANGE);
+    assert_true(isotp_functional_init(&f, NULL_CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                                      4, 64, &bus, tester_rx_f, tester_tx_f) == -EFAULT);
+
+    assert_true(isotp_functional_init(&f, CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                                      4, 64, &bus, tester_rx_f, tester_tx_f) == EOK);
+    assert_true(isotp_functional_set_fc(NULL, 0, 0, 0) == -EINVAL);
+    assert_true(isotp_functional_set_fc(f, 0, -1, 0) == -ERANGE);
+    assert_true(isotp_functional_set_fc_id(NULL, NULL, NULL) == -EINVAL);
+    assert_true(isotp_functional_request(NULL, 0x7DF, read_dtc, 3, 0, responses) == -EINVAL);
+    assert_true(isotp_functional_request(f, 0x7DF, NULL, 3, 0, responses) == -EINVAL);
+    assert_true(isotp_functional_request(f, 0x7DF, read_dtc, 3, 0, NULL) == -EINVAL);
+
+    // must fit into an SF
+    uint8_t big[8] = {0};
+    assert_true(isotp_functional_request(f, 0x7DF, big, sizeof(big), 0, responses) == -EOVERFLOW);
+
+    isotp_functional_free(f);
+    isotp_functional_free(NULL);
+}
+
+static void functional_collects_responses(void** state) {
+    (void)state;
+
+    struct bus_s bus = {0};
+    bus.func_id = 0x7DF;
+    bus_add_ecu(&bus, 0x7E0, 0x7E8, 5);
+    bus_add_ecu(&bus, 0x7E1, 0x7E9, 100);
+    bus_add_ecu(&bus, 0x7E2, 0x7EA, 300);
+    bus_add_ecu(&bus, 0x7E3, 0x7EB, 7);
+
+    // a frame from something that isn't a responder
+    uint8_t noise[8] = { 0x02, 0x01, 0x02 };
+    bus_push(&bus, 0x123, noise, sizeof(noise));
+
+    isotp_functional_t f = NULL;
+    assert_true(isotp_functional_init(&f, CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                                      8, 512, &bus, tester_rx_f, tester_tx_f) == EOK);
+    // small blocks, so the multi-frame responses interleave
+    assert_true(isotp_functional_set_fc(f, 2, 0, 100000) == EOK);
+
+    isotp_response_t responses[8];
+    int rc = isotp_functional_request(f, 0x7DF, read_dtc, sizeof(read_dtc),
+                                      20000, responses);
+    assert_true(rc == 4);
+    assert_true(bus.request_len >= 1 + (int)sizeof(read_dtc));
+    assert_true(bus.request[0] == sizeof(read_dtc));
+    assert_memory_equal(&(bus.request[1]), read_dtc, sizeof(read_dtc));
+
+    bool seen[4] = { false };
+    for (int i=0; i < rc; i++) {
+        check_response(&bus, &(responses[i]));
+        seen[responses[i].can_id - 0x7E8] = true;
+    }
+    for (int i=0; i < 4; i++) {
+        assert_true(seen[i]);
+    }
+
+    // the SFs complete first
+    assert_true(responses[0].rc <= 7);
+    assert_true(responses[1].rc <= 7);
+
+    // and again, reusing the same requester
+    rc = isotp_functional_request(f, 0x7DF, read_dtc, sizeof(read_dtc),
+                                  20000, responses);
+    assert_true(rc == 4);
+    for (int i=0; i < rc; i++) {
+        check_response(&bus, &(responses[i]));
+    }
+
+    isotp_functional_free(f);
+    bus_free(&bus);
+}
+
+static void functional_fixed_addressing(void** state) {
+    (void)state;
+
+    struct bus_s bus = {0};
+    bus.func_id = 0x18DB33F1;
+    bus_add_ecu(&bus, 0x18DA10F1, 0x18DAF110, 40);
+    bus_add_ecu(&bus, 0x18DA17F1, 0x18DAF117, 3);
+    bus_add_ecu(&bus, 0x18DA28F1, 0x18DAF128, 200);
+
+    isotp_functional_t f = NULL;
+    assert_true(isotp_functional_init(&f, CAN_FORMAT, ISOTP_NORMAL_FIXED_ADDRESSING_MODE,
+                                      4, 256, &bus, tester_rx_f, tester_tx_f) == EOK);
+
+    isotp_response_t responses[4];
+    int rc = isotp_functional_request(f, 0x18DB33F1, read_dtc, sizeof(read_dtc),
+                                      20000, responses);
+    assert_true(rc == 3);
+    for (int i=0; i < rc; i++) {
+        check_response(&bus, &(responses[i]));
+    }
+
+    isotp_functional_free(f);
+    bus_free(&bus);
+}
+
+static void functional_stalled_response(void** state) {
+    (void)state;
+
+    struct bus_s bus = {0};
+    bus.func_id = 0x7DF;
+    bus_add_ecu(&bus, 0x7E0, 0x7E8, 5);
+    struct ecu_s* deaf = bus_add_ecu(&bus, 0x7E1, 0x7E9, 100);
+    deaf->deaf = true;
+
+    isotp_functional_t f = NULL;
+    assert_true(isotp_functional_init(&f, CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                                      4, 256, &bus, tester_rx_f, tester_tx_f) == EOK);
+    assert_true(isotp_functional_set_fc(f, 0, 0, 5000) == EOK);
+
+    isotp_response_t responses[4];
+    int rc = isotp_functional_request(f, 0x7DF, read_dtc, sizeof(read_dtc),
+                                      2000, responses);
+    assert_true(rc == 2);
+    check_response(&bus, &(responses[0]));
+    assert_true(responses[1].can_id == 0x7E9);
+    assert_true(responses[1].rc == -ETIMEDOUT);
+    assert_null(responses[1].data);
+
+    // without an N_Cr timeout, the stalled response is still given up on
+    assert_true(isotp_functional_set_fc(f, 0, 0, 0) == EOK);
+    assert_true(isotp_ctx_reset(deaf->ctx) == EOK);
+    bus.head = bus.tail;
+    rc = isotp_functional_request(f, 0x7DF, read_dtc, sizeof(read_dtc),
+                                  2000, responses);
+    assert_true(rc == 2);
+    check_response(&bus, &(responses[0]));
+    assert_true(responses[1].can_id == 0x7E9);
+    assert_true(responses[1].rc == -ETIMEDOUT);
+
+    isotp_functional_free(f);
+    bus_free(&bus);
+}
+
+static void functional_max_responses(void** state) {
+    (void)state;
+
+    struct bus_s bus = {0};
+    bus.func_id = 0x7DF;
+    bus_add_ecu(&bus, 0x7E0, 0x7E8, 5);
+    bus_add_ecu(&bus, 0x7E1, 0x7E9, 5);
+    bus_add_ecu(&bus, 0x7E2, 0x7EA, 5);
+
+    isotp_functional_t f = NULL;
+    assert_true(isotp_functional_init(&f, CAN_FORMAT, ISOTP_NORMAL_ADDRESSING_MODE,
+                                      2, 64, &bus, tester_rx_f, tester_tx_f) == EOK);
+
+    isotp_response_t responses[2];
+    int rc = isotp_functional_request(f, 0x7DF, read_dtc, sizeof(read_dtc),
+                                      5000, responses);
+    assert_true(rc == 2);
+    check_response(&bus, &(responses[0]));
+    check_response(&bus, &(responses[1]));
+
+    isotp_functional_free(f);
+    bus_free(&bus);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(functional_fc_id),
+        cmocka_unit_test(functional_invalid_parameters),
+        cmocka_unit_test(functional_collects_responses),
+        cmocka_unit_test(functional_fixed_addressing),
+        cmocka_unit_test(functional_stalled_response),
+        cmocka_unit_test(functional_max_responses),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
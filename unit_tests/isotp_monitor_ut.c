@@ -0,0 +1,297 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "../isotp.h"
+#include "../isotp_private.h"
+
+#define MAX_REPORTED (16)
+
+struct reported_s {
+    isotp_monitor_stats_t stats[MAX_REPORTED];
+    int count;
+};
+
+static void report_f(void* cb_ctx, const isotp_monitor_stats_t* stats) {
+    struct reported_s* r = (struct reported_s*)cb_ctx;
+    assert_true(r->count < MAX_REPORTED);
+    r->stats[r->count++] = *stats;
+}
+
+static const isotp_monitor_stats_t* find_id(const struct reported_s* r,
+                                            const uint32_t can_id) {
+    for (int i=0; i < r->count; i++) {
+        if (r->stats[i].can_id == can_id) {
+            return &(r->stats[i]);
+        }
+    }
+    fail();
+    return NULL;
+}
+
+static void feed(isotp_monitor_t m,
+                 const uint64_t ts_us,
+                 const uint32_t can_id,
+                 const uint8_t* frame) {
+    assert_true(isotp_monitor_frame(m, ts_us, can_id, false, CAN_FORMAT,
+                                    frame, 8) == EOK);
+}
+
+static void fc(isotp_monitor_t m,
+               const uint64_t ts_us,
+               const uint32_t can_id,
+               const uint8_t fs,
+               const uint8_t bs,
+               const uint8_t stmin) {
+    uint8_t frame[8] = { FC_PCI | fs, bs, stmin, 0xCC, 0xCC, 0xCC, 0xCC,
+                         0xCC };
+    feed(m, ts_us, can_id, frame);
+}
+
+static void monitor_invalid_parameters(void** state) {
+    (void)state;
+    isotp_monitor_t m = NULL;
+    uint8_t frame[8] = {0};
+    struct reported_s r = {0};
+
+    assert_true(isotp_monitor_init(NULL, ISOTP_NORMAL_ADDRESSING_MODE,
+                                   4095) == -EINVAL);
+    assert_true(isotp_monitor_init(&m, NULL_ISOTP_ADDRESSING_MODE,
+                                   4095) == -EFAULT);
+    assert_true(isotp_monitor_init(&m, ISOTP_NORMAL_ADDRESSING_MODE,
+                                   0) == -ERANGE);
+    assert_true(isotp_monitor_init(&m, ISOTP_NORMAL_ADDRESSING_MODE,
+                                   4095) == EOK);
+
+    assert_true(isotp_monitor_frame(NULL, 0, 0x7E0, false, CAN_FORMAT,
+                                    frame, 8) == -EINVAL);
+    assert_true(isotp_monitor_frame(m, 0, 0x7E0, false, CAN_FORMAT,
+                                    frame, 9) == -EMSGSIZE);
+    assert_true(isotp_monitor_pair(m, 0x7E0, 0x7E0, false) == -EINVAL);
+    assert_true(isotp_monitor_report(m, 0, NULL, &r) == -EINVAL);
+    assert_true(isotp_monitor_report(m, 0, report_f, &r) == 0);
+
+    isotp_monitor_free(m);
+    isotp_monitor_free(NULL);
+}
+
+// a 100 byte transfer in blocks of 4 CFs, with STmin 10ms and one FC.WAIT
+static void monitor_transfer(void** state) {
+    (void)state;
+    isotp_monitor_t m = NULL;
+    struct reported_s r = {0};
+    assert_true(isotp_monitor_init(&m, ISOTP_NORMAL_ADDRESSING_MODE,
+                                   4095) == EOK);
+
+    uint64_t t = 1000000;
+    uint8_t frame[8] = { FF_PCI, 100 };
+    feed(m, t, 0x7E0, frame);
+    const uint64_t start = t;
+
+    int sn = 1;
+    int sent = 6;
+    int block = 0;
+    while (sent < 100) {
+        if (block == 0) {
+            t += 1000;
+            if (sn == 5) {
+                fc(m, t, 0x7E8, 1, 0, 0);
+                t += 1000;
+            }
+            fc(m, t, 0x7E8, 0, 4, 0x0A);
+            // the first CF of a block is not held to STmin
+            t += 1000;
+        } else {
+            t += (sn == 7) ? 5000 : 12000;
+        }
+        memset(frame, 0, sizeof(frame));
+        frame[0] = CF_PCI | (uint8_t)(sn & 0x0F);
+        feed(m, t, 0x7E0, frame);
+        sent += 7;
+        sn++;
+        block = (block + 1) % 4;
+    }
+
+    // and a response
+    uint8_t sf[8] = { 0x02, 0x76, 0x01 };
+    feed(m, t + 2000, 0x7E8, sf);
+
+    assert_true(isotp_monitor_report(m, start + 1000000, report_f, &r) == 2);
+    const isotp_monitor_stats_t* s = find_id(&r, 0x7E0);
+    assert_true(s->paired);
+    assert_true(s->fc_can_id == 0x7E8);
+    assert_true(s->frames == 15);
+    assert_true(s->messages == 1);
+    assert_true(s->bytes == 100);
+    assert_true(s->failed == 0);
+    assert_true(s->sn_errors == 0);
+    assert_true(s->fc_cts == 4);
+    assert_true(s->fc_wait == 1);
+    assert_true(s->blocksize == 4);
+    assert_true(s->stmin_usec == 10000);
+    assert_true(s->cf_gaps == 10);
+    assert_true(s->cf_gap_min_usec == 5000);
+    assert_true(s->cf_gap_max_usec == 12000);
+    assert_true(s->cf_gap_avg_usec == ((9 * 12000) + 5000) / 10);
+    assert_true(s->stmin_violations == 1);
+    assert_true(s->transfer_bytes_per_sec ==
+                (100 * 1000000ULL) / (t - start));
+    assert_true(s->interval_usec == 1000000);
+    assert_true(s->messages_per_sec == 1);
+    assert_true(s->bytes_per_sec == 100);
+
+    // the FCs were counted with 0x7E0; 0x7E8 sent one message
+    s = find_id(&r, 0x7E8);
+    assert_true(s->paired);
+    assert_true(s->fc_can_id == 0x7E0);
+    assert_true(s->frames == 1);
+    assert_true(s->messages == 1);
+    assert_true(s->fc_cts == 0);
+
+    // nothing more in the next interval
+    r.count = 0;
+    assert_true(isotp_monitor_report(m, start + 3000000, report_f, &r) == 2);
+    s = find_id(&r, 0x7E0);
+    assert_true(s->interval_usec == 2000000);
+    assert_true(s->messages_per_sec == 0);
+    assert_true(s->messages == 1);
+
+    isotp_monitor_free(m);
+}
+
+static void monitor_errors(void** state) {
+    (void)state;
+    isotp_monitor_t m = NULL;
+    struct reported_s r = {0};
+    assert_true(isotp_monitor_init(&m, ISOTP_NORMAL_ADDRESSING_MODE,
+                                   4095) == EOK);
+    assert_true(isotp_monitor_pair(m, 0x7E1, 0x7E9, false) == EOK);
+
+    // a CF out of sequence
+    uint8_t ff[8] = { FF_PCI, 20 };
+    uint8_t cf1[8] = { CF_PCI | 1 };
+    uint8_t cf3[8] = { CF_PCI | 3 };
+    feed(m, 100, 0x7E1, ff);
+    fc(m, 200, 0x7E9, 0, 0, 0);
+    feed(m, 300, 0x7E1, cf1);
+    feed(m, 400, 0x7E1, cf3);
+
+    // a message cut short by the next one is no sequence error
+    feed(m, 500, 0x7E1, ff);
+    fc(m, 600, 0x7E9, 2, 0, 0);
+    feed(m, 700, 0x7E1, ff);
+
+    // an FC nobody is waiting for
+    fc(m, 800, 0x7EF, 0, 0, 0);
+
+    assert_true(isotp_monitor_report(m, 1000, report_f, &r) == 2);
+    const isotp_monitor_stats_t* s = find_id(&r, 0x7E1);
+    assert_true(s->fc_can_id == 0x7E9);
+    assert_true(s->messages == 0);
+    assert_true(s->failed == 2);
+    assert_true(s->sn_errors == 1);
+    assert_true(s->fc_cts == 1);
+    assert_true(s->fc_overflow == 1);
+
+    s = find_id(&r, 0x7EF);
+    assert_true(!s->paired);
+    assert_true(s->frames == 1);
+    assert_true(s->fc_cts == 1);
+
+    isotp_monitor_free(m);
+}
+
+// two transfers at once; the FCs can't be told apart until they aren't
+static void monitor_interleaved(void** state) {
+    (void)state;
+    isotp_monitor_t m = NULL;
+    struct reported_s r = {0};
+    assert_true(isotp_monitor_init(&m, ISOTP_NORMAL_ADDRESSING_MODE,
+                                   4095) == EOK);
+
+    uint8_t ff[8] = { FF_PCI, 20 };
+    uint8_t cf1[8] = { CF_PCI | 1 };
+    uint8_t cf2[8] = { CF_PCI | 2 };
+    feed(m, 1000, 0x7E0, ff);
+    feed(m, 1100, 0x7E1, ff);
+    fc(m, 1200, 0x7E8, 0, 0, 0);
+    fc(m, 1300, 0x7E9, 0, 0, 0);
+    feed(m, 1400, 0x7E0, cf1);
+    feed(m, 1500, 0x7E1, cf1);
+    feed(m, 1600, 0x7E0, cf2);
+    feed(m, 1700, 0x7E1, cf2);
+
+    // one at a time, the pairs are learnt
+    feed(m, 2000, 0x7E0, ff);
+    fc(m, 2100, 0x7E8, 0, 0, 0);
+    feed(m, 2200, 0x7E0, cf1);
+    feed(m, 2300, 0x7E0, cf2);
+    feed(m, 3000, 0x7E1, ff);
+    fc(m, 3100, 0x7E9, 0, 0, 0);
+    feed(m, 3200, 0x7E1, cf1);
+    feed(m, 3300, 0x7E1, cf2);
+
+    assert_true(isotp_monitor_report(m, 4000, report_f, &r) == 4);
+    const isotp_monitor_stats_t* s = find_id(&r, 0x7E0);
+    assert_true(s->paired);
+    assert_true(s->fc_can_id == 0x7E8);
+    assert_true(s->messages == 2);
+    assert_true(s->fc_cts == 1);
+
+    s = find_id(&r, 0x7E1);
+    assert_true(s->paired);
+    assert_true(s->fc_can_id == 0x7E9);
+    assert_true(s->messages == 2);
+    assert_true(s->fc_cts == 1);
+
+    // the FCs sent while both were waiting are counted with their senders
+    s = find_id(&r, 0x7E8);
+    assert_true(s->fc_can_id == 0x7E0);
+    assert_true(s->frames == 1);
+    assert_true(s->fc_cts == 1);
+
+    isotp_monitor_free(m);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(monitor_invalid_parameters),
+        cmocka_unit_test(monitor_transfer),
+        cmocka_unit_test(monitor_errors),
+        cmocka_unit_test(monitor_interleaved),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
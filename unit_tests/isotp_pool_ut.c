@@ -0,0 +1,306 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "../isotp.h"
+#include "../isotp_private.h"
+
+#define MAX_EVICTED (8)
+
+// last frame transmitted on a session
+struct link_s {
+    uint8_t frame[64];
+    int frame_len;
+};
+
+// sessions evicted, in order
+struct evicted_s {
+    isotp_ctx_t ctx[MAX_EVICTED];
+    int count;
+};
+
+static int link_tx_f(void* txfn_ctx,
+                     const uint8_t* tx_buf_p,
+                     const int tx_len,
+                     const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct link_s* link = (struct link_s*)txfn_ctx;
+
+    memcpy(link->frame, tx_buf_p, tx_len);
+    link->frame_len = tx_len;
+    return tx_len;
+}
+
+static void evict_f(void* cb_ctx, isotp_ctx_t ctx) {
+    struct evicted_s* evicted = (struct evicted_s*)cb_ctx;
+
+    assert_true(evicted->count < MAX_EVICTED);
+    evicted->ctx[evicted->count++] = ctx;
+}
+
+static isotp_pool_t pool_new(const int capacity,
+                             const uint64_t idle_timeout_us,
+                             struct evicted_s* evicted) {
+    isotp_pool_t pool = NULL;
+    assert_int_equal(isotp_pool_init(&pool,
+                                     CAN_FORMAT,
+                                     ISOTP_NORMAL_ADDRESSING_MODE,
+                                     0,
+                                     capacity,
+                                     idle_timeout_us,
+                                     evict_f,
+                                     evicted),
+                     EOK);
+    assert_true(pool != NULL);
+    return pool;
+}
+
+static void pool_init_test(void** state) {
+    (void)state;
+
+    isotp_pool_t pool = NULL;
+    assert_int_equal(isotp_pool_init(NULL, CAN_FORMAT,
+                                     ISOTP_NORMAL_ADDRESSING_MODE,
+                                     0, 4, 0, NULL, NULL),
+                     -EINVAL);
+    assert_int_equal(isotp_pool_init(&pool, CAN_FORMAT,
+                                     ISOTP_NORMAL_ADDRESSING_MODE,
+                                     0, 0, 0, NULL, NULL),
+                     -EINVAL);
+    assert_int_equal(isotp_pool_init(&pool, NULL_CAN_FORMAT,
+                                     ISOTP_NORMAL_ADDRESSING_MODE,
+                                     0, 4, 0, NULL, NULL),
+                     -EFAULT);
+    assert_true(pool == NULL);
+
+    pool = pool_new(4, 0, NULL);
+    isotp_pool_stats_t stats;
+    assert_int_equal(isotp_pool_stats(pool, &stats), EOK);
+    assert_int_equal(stats.capacity, 4);
+    assert_int_equal(stats.in_use, 0);
+    assert_int_equal(isotp_pool_stats(pool, NULL), -EINVAL);
+    assert_int_equal(isotp_pool_evict(NULL, 0), -EINVAL);
+    isotp_pool_free(pool);
+    isotp_pool_free(NULL);
+}
+
+static void pool_acquire_release_test(void** state) {
+    (void)state;
+
+    struct link_s link;
+    isotp_pool_t pool = pool_new(3, 0, NULL);
+    isotp_ctx_t ctx[3] = { NULL, NULL, NULL };
+    isotp_ctx_t extra = NULL;
+
+    assert_int_equal(isotp_pool_acquire(pool, &link, NULL, NULL, 0, &extra),
+                     -EINVAL);
+    for (int i=0; i < 3; i++) {
+        assert_int_equal(isotp_pool_acquire(pool, &link, NULL, link_tx_f,
+                                            0, &(ctx[i])),
+                         EOK);
+        for (int j=0; j < i; j++) {
+            assert_true(ctx[i] != ctx[j]);
+        }
+    }
+    assert_int_equal(isotp_pool_acquire(pool, &link, NULL, link_tx_f,
+                                        0, &extra),
+                     -ENOBUFS);
+
+    // the context given back is the next one handed out
+    assert_int_equal(isotp_pool_release(pool, ctx[1]), EOK);
+    assert_int_equal(isotp_pool_release(pool, ctx[1]), -EINVAL);
+    assert_int_equal(isotp_pool_acquire(pool, &link, NULL, link_tx_f,
+                                        0, &extra),
+                     EOK);
+    assert_true(extra == ctx[1]);
+
+    // only this pool's contexts in use are taken back
+    isotp_pool_t other = pool_new(1, 0, NULL);
+    assert_int_equal(isotp_pool_release(other, ctx[0]), -EINVAL);
+    isotp_ctx_t plain = NULL;
+    assert_int_equal(isotp_ctx_init(&plain, CAN_FORMAT,
+                                    ISOTP_NORMAL_ADDRESSING_MODE,
+                                    0, &link, NULL, link_tx_f),
+                     EOK);
+    assert_int_equal(isotp_pool_release(pool, plain), -EINVAL);
+    assert_int_equal(isotp_pool_touch(pool, plain, 0), -EINVAL);
+    assert_int_equal(isotp_pool_release(pool, NULL), -EINVAL);
+    isotp_ctx_free(plain);
+    isotp_pool_free(other);
+
+    isotp_pool_stats_t stats;
+    assert_int_equal(isotp_pool_stats(pool, &stats), EOK);
+    assert_int_equal(stats.in_use, 3);
+    assert_int_equal(stats.acquired, 4);
+    assert_int_equal(stats.released, 1);
+    assert_int_equal(stats.exhausted, 1);
+    assert_int_equal(stats.evicted, 0);
+    isotp_pool_free(pool);
+}
+
+static void pool_reset_test(void** state) {
+    (void)state;
+
+    struct link_s link_a;
+    struct link_s link_b;
+    isotp_pool_t pool = pool_new(1, 0, NULL);
+    isotp_ctx_t ctx = NULL;
+    const uint8_t request[] = { 0x22, 0xF1, 0x90 };
+
+    assert_int_equal(isotp_pool_acquire(pool, &link_a, NULL, link_tx_f,
+                                        0, &ctx),
+                     EOK);
+    assert_true(isotp_send(ctx, request, sizeof(request), 1000) > 0);
+    assert_int_equal(link_a.frame[0], 0x03);
+    assert_int_equal(set_isotp_address_extension(ctx, 0x55), EOK);
+    static uint8_t buf[64];
+    assert_int_equal(isotp_recv_start(ctx, buf, sizeof(buf), 0, 0, 0), EOK);
+    assert_true(ctx->nb_state != ISOTP_NB_IDLE);
+    assert_int_equal(isotp_pool_release(pool, ctx), EOK);
+
+    // as isotp_ctx_init() leaves it, with the new session's callbacks
+    memset(&link_b, 0, sizeof(link_b));
+    assert_int_equal(isotp_pool_acquire(pool, &link_b, NULL, link_tx_f,
+                                        0, &ctx),
+                     EOK);
+    assert_int_equal(get_isotp_address_extension(ctx), 0);
+    assert_int_equal(ctx->nb_state, ISOTP_NB_IDLE);
+    assert_int_equal(ctx->can_format, CAN_FORMAT);
+    assert_int_equal(ctx->addressing_mode, ISOTP_NORMAL_ADDRESSING_MODE);
+    assert_true(ctx->can_ctx == &link_b);
+    assert_true(isotp_send(ctx, request, sizeof(request), 1000) > 0);
+    assert_int_equal(link_b.frame_len, link_a.frame_len);
+    assert_int_equal(memcmp(link_b.frame, link_a.frame, link_a.frame_len),
+                     0);
+    isotp_pool_free(pool);
+}
+
+static void pool_evict_test(void** state) {
+    (void)state;
+
+    struct link_s link;
+    struct evicted_s evicted;
+    memset(&evicted, 0, sizeof(evicted));
+    isotp_pool_t pool = pool_new(4, 100, &evicted);
+    isotp_ctx_t a = NULL;
+    isotp_ctx_t b = NULL;
+    isotp_ctx_t c = NULL;
+
+    assert_int_equal(isotp_pool_acquire(pool, &link, NULL, link_tx_f,
+                                        0, &a),
+                     EOK);
+    assert_int_equal(isotp_pool_acquire(pool, &link, NULL, link_tx_f,
+                                        10, &b),
+                     EOK);
+    assert_int_equal(isotp_pool_acquire(pool, &link, NULL, link_tx_f,
+                                        20, &c),
+                     EOK);
+    assert_int_equal(isotp_pool_touch(pool, a, 50), EOK);
+
+    assert_int_equal(isotp_pool_evict(pool, 109), 0);
+    assert_int_equal(isotp_pool_evict(pool, 115), 1);
+    assert_int_equal(evicted.count, 1);
+    assert_true(evicted.ctx[0] == b);
+    assert_int_equal(isotp_pool_touch(pool, b, 115), -EINVAL);
+
+    // least recently active first
+    assert_int_equal(isotp_pool_evict(pool, 200), 2);
+    assert_int_equal(evicted.count, 3);
+    assert_true(evicted.ctx[1] == c);
+    assert_true(evicted.ctx[2] == a);
+
+    isotp_pool_stats_t stats;
+    assert_int_equal(isotp_pool_stats(pool, &stats), EOK);
+    assert_int_equal(stats.in_use, 0);
+    assert_int_equal(stats.evicted, 3);
+    assert_int_equal(stats.released, 3);
+    isotp_pool_free(pool);
+
+    // no timeout, no eviction
+    pool = pool_new(1, 0, &evicted);
+    assert_int_equal(isotp_pool_acquire(pool, &link, NULL, link_tx_f,
+                                        0, &a),
+                     EOK);
+    assert_int_equal(isotp_pool_evict(pool, UINT64_MAX), 0);
+    assert_int_equal(isotp_pool_acquire(pool, &link, NULL, link_tx_f,
+                                        UINT64_MAX, &b),
+                     -ENOBUFS);
+    isotp_pool_free(pool);
+}
+
+static void pool_acquire_evicts_test(void** state) {
+    (void)state;
+
+    struct link_s link;
+    struct evicted_s evicted;
+    memset(&evicted, 0, sizeof(evicted));
+    isotp_pool_t pool = pool_new(2, 100, &evicted);
+    isotp_ctx_t a = NULL;
+    isotp_ctx_t b = NULL;
+    isotp_ctx_t c = NULL;
+
+    assert_int_equal(isotp_pool_acquire(pool, &link, NULL, link_tx_f,
+                                        0, &a),
+                     EOK);
+    assert_int_equal(isotp_pool_acquire(pool, &link, NULL, link_tx_f,
+                                        50, &b),
+                     EOK);
+    assert_int_equal(isotp_pool_acquire(pool, &link, NULL, link_tx_f,
+                                        60, &c),
+                     -ENOBUFS);
+    assert_int_equal(evicted.count, 0);
+
+    // full, so the session idle for the timeout makes room
+    assert_int_equal(isotp_pool_acquire(pool, &link, NULL, link_tx_f,
+                                        100, &c),
+                     EOK);
+    assert_int_equal(evicted.count, 1);
+    assert_true(evicted.ctx[0] == a);
+    assert_true(c == a);
+    assert_int_equal(isotp_pool_release(pool, b), EOK);
+    assert_int_equal(isotp_pool_release(pool, c), EOK);
+    isotp_pool_free(pool);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(pool_init_test),
+        cmocka_unit_test(pool_acquire_release_test),
+        cmocka_unit_test(pool_reset_test),
+        cmocka_unit_test(pool_evict_test),
+        cmocka_unit_test(pool_acquire_evicts_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
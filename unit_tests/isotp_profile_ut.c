@@ -0,0 +1,277 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "../isotp.h"
+#include "../isotp_private.h"
+
+static void apply(const isotp_peer_profile_t* profile,
+                  const uint8_t bs_in,
+                  const int stmin_in,
+                  const uint8_t bs_out,
+                  const int stmin_out) {
+    uint8_t bs = bs_in;
+    int stmin = stmin_in;
+    isotp_peer_profile_apply(profile, &bs, &stmin);
+    assert_true(bs == bs_out);
+    assert_true(stmin == stmin_out);
+}
+
+// tests
+static void peer_profile_apply_none(void** state) {
+    (void)state;
+
+    isotp_peer_profile_t profile;
+    isotp_peer_profile_init(&profile, 0x7E0);
+    assert_true(profile.can_id == 0x7E0);
+
+    apply(&profile, 0, 0, 0, 0);
+    apply(&profile, 8, 10000, 8, 10000);
+    apply(NULL, 8, 10000, 8, 10000);
+}
+
+static void peer_profile_apply_override(void** state) {
+    (void)state;
+
+    isotp_peer_profile_t profile;
+    isotp_peer_profile_init(&profile, 0x7E0);
+    profile.stmin_override_usec = 0;
+    profile.bs_override = 0;
+    // overrides win over the clamps
+    profile.stmin_min_usec = 500;
+    profile.bs_max = 4;
+
+    apply(&profile, 8, 10000, 0, 0);
+    apply(&profile, 0, 127000, 0, 0);
+}
+
+static void peer_profile_apply_scale_and_clamp(void** state) {
+    (void)state;
+
+    isotp_peer_profile_t profile;
+    isotp_peer_profile_init(&profile, 0x7E0);
+    profile.stmin_scale_pct = 25;
+    profile.stmin_min_usec = 1000;
+    profile.stmin_max_usec = 5000;
+
+    apply(&profile, 8, 10000, 8, 2500);
+    apply(&profile, 8, 100, 8, 1000);
+    apply(&profile, 8, 127000, 8, 5000);
+
+    profile.stmin_scale_pct = 200;
+    profile.stmin_min_usec = -1;
+    profile.stmin_max_usec = -1;
+    apply(&profile, 8, 10000, 8, 20000);
+}
+
+static void peer_profile_apply_bs_clamp(void** state) {
+    (void)state;
+
+    isotp_peer_profile_t profile;
+    isotp_peer_profile_init(&profile, 0x7E0);
+    profile.bs_min = 4;
+    profile.bs_max = 16;
+
+    apply(&profile, 1, 0, 4, 0);
+    apply(&profile, 8, 0, 8, 0);
+    apply(&profile, 32, 0, 16, 0);
+    // no limit is larger than any max
+    apply(&profile, 0, 0, 16, 0);
+
+    // but stays unlimited without a max
+    profile.bs_max = -1;
+    apply(&profile, 0, 0, 0, 0);
+}
+
+static void peer_profile_set_ctx(void** state) {
+    (void)state;
+
+    isotp_ctx_t ctx = calloc(1, sizeof(struct isotp_ctx_s));
+    assert_non_null(ctx);
+
+    isotp_peer_profile_t profile;
+    isotp_peer_profile_init(&profile, 0x7E0);
+    profile.bs_override = 2;
+
+    assert_true(isotp_ctx_set_peer_profile(NULL, &profile) == -EINVAL);
+    assert_true(isotp_ctx_set_peer_profile(ctx, &profile) == EOK);
+    assert_true(ctx->has_peer_profile);
+    assert_true(ctx->peer_profile.bs_override == 2);
+
+    // copied, not referenced
+    profile.bs_override = 3;
+    assert_true(ctx->peer_profile.bs_override == 2);
+
+    assert_true(isotp_ctx_set_peer_profile(ctx, NULL) == EOK);
+    assert_false(ctx->has_peer_profile);
+
+    free(ctx);
+}
+
+static void profile_table_add_find(void** state) {
+    (void)state;
+
+    isotp_profile_table_t table = {0};
+    isotp_peer_profile_t profile;
+
+    assert_true(isotp_profile_table_add(NULL, &profile) == -EINVAL);
+    assert_true(isotp_profile_table_add(&table, NULL) == -EINVAL);
+    assert_null(isotp_profile_table_find(&table, 0x7E0));
+
+    // out of order, and enough to grow the table
+    for (int i=0; i < 100; i++) {
+        uint32_t id = (uint32_t)((i * 37) % 100) + 0x700;
+        isotp_peer_profile_init(&profile, id);
+        profile.bs_override = (int)(id & 0xff);
+        assert_true(isotp_profile_table_add(&table, &profile) == EOK);
+    }
+    assert_true(table.count == 100);
+
+    for (uint32_t id=0x700; id < 0x764; id++) {
+        const isotp_peer_profile_t* p = isotp_profile_table_find(&table, id);
+        assert_non_null(p);
+        assert_true(p->can_id == id);
+        assert_true(p->bs_override == (int)(id & 0xff));
+    }
+    assert_null(isotp_profile_table_find(&table, 0x6FF));
+    assert_null(isotp_profile_table_find(&table, 0x764));
+
+    // replaces
+    isotp_peer_profile_init(&profile, 0x710);
+    profile.bs_override = 1;
+    assert_true(isotp_profile_table_add(&table, &profile) == EOK);
+    assert_true(table.count == 100);
+    assert_true(isotp_profile_table_find(&table, 0x710)->bs_override == 1);
+
+    isotp_profile_table_free(&table);
+    assert_true(table.count == 0);
+    assert_null(isotp_profile_table_find(&table, 0x710));
+}
+
+static int write_profiles(char* path, const char* contents) {
+    strcpy(path, "/tmp/isotp_profile_ut.XXXXXX");
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    assert_true(write(fd, contents, strlen(contents)) == (ssize_t)strlen(contents));
+    close(fd);
+    return 0;
+}
+
+static void profile_table_load_success(void** state) {
+    (void)state;
+
+    char path[64];
+    write_profiles(path,
+                   "# fast ECU\n"
+                   "0x7E0 stmin=0 bs=0\n"
+                   "\n"
+                   "   # slow one\n"
+                   "0x18DA10F1\tstmin_scale=200 stmin_min=1000 bs_max=8  # trailing\n"
+                   "2017 bs_min=4 stmin_max=0x100");
+
+    isotp_profile_table_t table = {0};
+    assert_true(isotp_profile_table_load(&table, path) == 3);
+    unlink(path);
+
+    const isotp_peer_profile_t* p = isotp_profile_table_find(&table, 0x7E0);
+    assert_non_null(p);
+    assert_true(p->stmin_override_usec == 0);
+    assert_true(p->bs_override == 0);
+    assert_true(p->stmin_scale_pct == -1);
+
+    p = isotp_profile_table_find(&table, 0x18DA10F1);
+    assert_non_null(p);
+    assert_true(p->stmin_scale_pct == 200);
+    assert_true(p->stmin_min_usec == 1000);
+    assert_true(p->bs_max == 8);
+    assert_true(p->bs_override == -1);
+
+    p = isotp_profile_table_find(&table, 2017);
+    assert_non_null(p);
+    assert_true(p->bs_min == 4);
+    assert_true(p->stmin_max_usec == 0x100);
+
+    isotp_profile_table_free(&table);
+}
+
+static void profile_table_load_failure(void** state) {
+    (void)state;
+
+    isotp_profile_table_t table = {0};
+    assert_true(isotp_profile_table_load(NULL, "x") == -EINVAL);
+    assert_true(isotp_profile_table_load(&table, NULL) == -EINVAL);
+    assert_true(isotp_profile_table_load(&table, "/nonexistent/profiles") == -ENOENT);
+
+    const char* bad[] = {
+        "0x7E0 stmin\n",
+        "0x7E0 stmin=\n",
+        "0x7E0 stmin=-1\n",
+        "0x7E0 bs=256\n",
+        "0x7E0 speed=11\n",
+        "0x7EZ bs=1\n",
+        "0x7E0 bs=1x\n",
+    };
+    for (size_t i=0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        char path[64];
+        write_profiles(path, bad[i]);
+        assert_true(isotp_profile_table_load(&table, path) == -EBADMSG);
+        unlink(path);
+    }
+    assert_true(table.count == 0);
+
+    // lines before the bad one are kept
+    char path[64];
+    write_profiles(path, "0x7E0 bs=1\n0x7E1 bs=x\n");
+    assert_true(isotp_profile_table_load(&table, path) == -EBADMSG);
+    unlink(path);
+    assert_true(table.count == 1);
+
+    isotp_profile_table_free(&table);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(peer_profile_apply_none),
+        cmocka_unit_test(peer_profile_apply_override),
+        cmocka_unit_test(peer_profile_apply_scale_and_clamp),
+        cmocka_unit_test(peer_profile_apply_bs_clamp),
+        cmocka_unit_test(peer_profile_set_ctx),
+        cmocka_unit_test(profile_table_add_find),
+        cmocka_unit_test(profile_table_load_success),
+        cmocka_unit_test(profile_table_load_failure),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -367,6 +367,44 @@ static void parse_sf_with_esc(void** state) {
     free(ctx);
 }
 
+static void parse_sf_short_frame(void** state) {
+    (void)state;
+
+    isotp_ctx_t ctx = calloc(1, sizeof(*ctx));
+    uint8_t buf[64];
+
+    // frames shorter than their PCI and SF_DL
+    // @ref ISO-15765-2:2016, section 9.6.2.2
+    const uint8_t sf_7[] = { 0x07 };
+    const uint8_t sf_3[] = { 0x03, 0x11, 0x22 };
+    const uint8_t sf_ext_6[] = { 0xae, 0x06, 0x11 };
+    const uint8_t sf_2[] = { 0x02, 0x11, 0x22 };
+
+    ctx->addressing_mode = ISOTP_NORMAL_ADDRESSING_MODE;
+    ctx->address_extension_len = 0;
+    will_return(can_max_datalen, 64);
+    assert_true(parse_sf_frame(ctx, sf_7, 0, buf, sizeof(buf)) == -EBADMSG);
+    will_return(can_max_datalen, 64);
+    assert_true(parse_sf_frame(ctx, sf_7, sizeof(sf_7), buf, sizeof(buf)) == -EBADMSG);
+    will_return(can_max_datalen, 64);
+    assert_true(parse_sf_frame(ctx, sf_3, sizeof(sf_3), buf, sizeof(buf)) == -EBADMSG);
+
+    // exactly as long as the SF_DL says
+    memset(buf, 0, sizeof(buf));
+    will_return(can_max_datalen, 64);
+    assert_true(parse_sf_frame(ctx, sf_2, sizeof(sf_2), buf, sizeof(buf)) == 2);
+    assert_memory_equal(buf, &(sf_2[1]), 2);
+
+    ctx->addressing_mode = ISOTP_EXTENDED_ADDRESSING_MODE;
+    ctx->address_extension_len = 1;
+    will_return(can_max_datalen, 64);
+    assert_true(parse_sf_frame(ctx, sf_ext_6, 1, buf, sizeof(buf)) == -EBADMSG);
+    will_return(can_max_datalen, 64);
+    assert_true(parse_sf_frame(ctx, sf_ext_6, sizeof(sf_ext_6), buf, sizeof(buf)) == -EBADMSG);
+
+    free(ctx);
+}
+
 static void parse_sf_no_esc_success(void** state) {
     (void)state;
 
@@ -467,6 +505,7 @@ int main(void) {
         cmocka_unit_test(parse_sf_bad_msg),
         cmocka_unit_test(parse_sf_no_esc),
         cmocka_unit_test(parse_sf_with_esc),
+        cmocka_unit_test(parse_sf_short_frame),
         cmocka_unit_test(parse_sf_no_esc_success),
         cmocka_unit_test(parse_sf_with_esc_success),
     };
@@ -0,0 +1,285 @@
+/**
+ * Copyright 2024, Greg Moffatt (Greg.Moffatt@gmail.com)
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation and/or
+ * other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS” AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+// built twice, for the general library and with the build fixed in
+// isotp_config.h to a CAN FD, normal addressing, 4095 byte profile
+// without the FF escape and with static contexts
+#define ISOTP_IMPLEMENTATION
+#include "isotp_single.h"
+
+#ifdef ISOTP_FIXED_CAN_FORMAT
+#define TEST_FORMAT (ISOTP_FIXED_CAN_FORMAT)
+#define SF_LEN (20)   // CAN FD SFs carry at least 8 bytes
+#else
+#define TEST_FORMAT (CAN_FORMAT)
+#define SF_LEN (7)
+#endif  // ISOTP_FIXED_CAN_FORMAT
+
+// loopback transport; each context transmits into its peer's queue
+#define LINK_DEPTH (1024)
+
+struct link_s {
+    uint8_t frame[LINK_DEPTH][64];
+    int frame_len[LINK_DEPTH];
+    int head;
+    int tail;
+};
+
+struct port_s {
+    struct link_s* rx;
+    struct link_s* tx;
+};
+
+static int rx_f(void* rxfn_ctx,
+                uint8_t* rx_buf_p,
+                const int rx_buf_sz,
+                const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct port_s* port = (struct port_s*)rxfn_ctx;
+
+    if (port->rx->head == port->rx->tail) {
+        return 0;
+    }
+
+    int i = port->rx->head % LINK_DEPTH;
+    int len = port->rx->frame_len[i];
+    assert_true(len <= rx_buf_sz);
+    memcpy(rx_buf_p, port->rx->frame[i], len);
+    port->rx->head++;
+
+    return len;
+}
+
+static int tx_f(void* txfn_ctx,
+                const uint8_t* tx_buf_p,
+                const int tx_len,
+                const uint64_t timeout_usec) {
+    (void)timeout_usec;
+    struct port_s* port = (struct port_s*)txfn_ctx;
+
+    assert_true((port->tx->tail - port->tx->head) < LINK_DEPTH);
+    int i = port->tx->tail % LINK_DEPTH;
+    memcpy(port->tx->frame[i], tx_buf_p, tx_len);
+    port->tx->frame_len[i] = tx_len;
+    port->tx->tail++;
+
+    return tx_len;
+}
+
+struct pair_s {
+    struct link_s a_to_b;
+    struct link_s b_to_a;
+    struct port_s a_port;
+    struct port_s b_port;
+    isotp_ctx_t a;
+    isotp_ctx_t b;
+};
+
+static void pair_init(struct pair_s* p) {
+    memset(p, 0, sizeof(*p));
+    p->a_port.rx = &(p->b_to_a);
+    p->a_port.tx = &(p->a_to_b);
+    p->b_port.rx = &(p->a_to_b);
+    p->b_port.tx = &(p->b_to_a);
+
+    assert_true(isotp_ctx_init(&(p->a), TEST_FORMAT,
+                               ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, &(p->a_port), rx_f, tx_f) == EOK);
+    assert_true(isotp_ctx_init(&(p->b), TEST_FORMAT,
+                               ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, &(p->b_port), rx_f, tx_f) == EOK);
+}
+
+static void pair_free(struct pair_s* p) {
+    isotp_ctx_free(p->a);
+    isotp_ctx_free(p->b);
+}
+
+// send len bytes from a to b, polling both sides until both are done
+static void round_trip(const int len) {
+    struct pair_s p;
+    pair_init(&p);
+
+    uint8_t send_buf[4095];
+    uint8_t recv_buf[4095];
+    for (int i=0; i < len; i++) {
+        send_buf[i] = (uint8_t)(i * 7);
+    }
+    memset(recv_buf, 0, sizeof(recv_buf));
+
+    assert_true(isotp_recv_start(p.b, recv_buf, sizeof(recv_buf),
+                                 0, 0, 0) == EOK);
+    assert_true(isotp_send_start(p.a, send_buf, len, 0) == EOK);
+
+    int a_rc = -EINPROGRESS;
+    int b_rc = -EINPROGRESS;
+    uint64_t now = 1;
+    for (int i=0; (i < 100000) &&
+                  ((a_rc == -EINPROGRESS) || (b_rc == -EINPROGRESS)); i++) {
+        if (a_rc == -EINPROGRESS) {
+            a_rc = isotp_poll(p.a, now);
+        }
+        if (b_rc == -EINPROGRESS) {
+            b_rc = isotp_poll(p.b, now);
+        }
+        now += 100;
+    }
+
+    assert_true(a_rc == len);
+    assert_true(b_rc == len);
+    assert_memory_equal(send_buf, recv_buf, len);
+
+    pair_free(&p);
+}
+
+// tests
+static void single_sf_round_trip(void** state) {
+    (void)state;
+
+    round_trip(SF_LEN);
+}
+
+static void single_multiframe_round_trip(void** state) {
+    (void)state;
+
+    round_trip(300);
+    round_trip(4095);
+}
+
+static void single_build_profile(void** state) {
+    (void)state;
+
+    isotp_ctx_t ctx;
+    struct port_s port = { 0 };
+    uint8_t buf[16];
+
+#ifdef ISOTP_FIXED_CAN_FORMAT
+    // only the fixed format and mode
+    assert_true(isotp_ctx_init(&ctx, CAN_FORMAT,
+                               ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, &port, rx_f, tx_f) == -EFAULT);
+    assert_true(isotp_ctx_init(&ctx, TEST_FORMAT,
+                               ISOTP_EXTENDED_ADDRESSING_MODE,
+                               0, &port, rx_f, tx_f) == -EFAULT);
+#else
+    assert_true(isotp_ctx_init(&ctx, CANFD_FORMAT,
+                               ISOTP_EXTENDED_ADDRESSING_MODE,
+                               0, &port, rx_f, tx_f) == EOK);
+    isotp_ctx_free(ctx);
+#endif  // ISOTP_FIXED_CAN_FORMAT
+
+    // nothing above the maximum transfer size
+    assert_true(isotp_ctx_init(&ctx, TEST_FORMAT,
+                               ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, &port, rx_f, tx_f) == EOK);
+    assert_true(isotp_send_start(ctx, buf,
+                                 ISOTP_MAX_TX_DATALEN + 1, 0) == -ERANGE);
+    assert_true(isotp_recv_start(ctx, buf,
+                                 ISOTP_MAX_TX_DATALEN + 1, 0, 0, 0) == -ERANGE);
+    isotp_ctx_free(ctx);
+}
+
+static void single_ff_escape(void** state) {
+    (void)state;
+
+    isotp_ctx_t ctx;
+    struct port_s port = { 0 };
+    assert_true(isotp_ctx_init(&ctx, TEST_FORMAT,
+                               ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, &port, rx_f, tx_f) == EOK);
+
+    // an FF announcing 5000 bytes with the escape sequence
+    static uint8_t buf[5000];
+    uint8_t frame[64] = { FF_PCI, 0x00, 0x00, 0x00, 0x13, 0x88 };
+    int frame_len = can_max_datalen(TEST_FORMAT);
+
+#ifdef ISOTP_NO_FF_ESCAPE
+    assert_true(parse_ff_frame(ctx, frame, frame_len,
+                               buf, ISOTP_MAX_TX_DATALEN) == -EOVERFLOW);
+    assert_true(prepare_ff(ctx, buf, 4096) == -ERANGE);
+#else
+    assert_true(parse_ff_frame(ctx, frame, frame_len,
+                               buf, sizeof(buf)) == (frame_len - 6));
+    assert_true(prepare_ff(ctx, buf, 4096) == (frame_len - 6));
+#endif  // ISOTP_NO_FF_ESCAPE
+
+    isotp_ctx_free(ctx);
+}
+
+#ifdef ISOTP_STATIC_CONTEXTS
+static void single_static_contexts(void** state) {
+    (void)state;
+
+    isotp_ctx_t ctx[ISOTP_STATIC_CONTEXTS];
+    isotp_ctx_t extra;
+    struct port_s port = { 0 };
+
+    for (int i=0; i < ISOTP_STATIC_CONTEXTS; i++) {
+        assert_true(isotp_ctx_init(&(ctx[i]), TEST_FORMAT,
+                                   ISOTP_NORMAL_ADDRESSING_MODE,
+                                   0, &port, rx_f, tx_f) == EOK);
+    }
+    assert_true(isotp_ctx_init(&extra, TEST_FORMAT,
+                               ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, &port, rx_f, tx_f) == -ENOMEM);
+
+    // a freed context is handed out again, reset
+    ctx[1]->total_datalen = 100;
+    isotp_ctx_free(ctx[1]);
+    assert_true(isotp_ctx_init(&extra, TEST_FORMAT,
+                               ISOTP_NORMAL_ADDRESSING_MODE,
+                               0, &port, rx_f, tx_f) == EOK);
+    assert_true(extra == ctx[1]);
+    assert_int_equal(extra->total_datalen, 0);
+
+    for (int i=0; i < ISOTP_STATIC_CONTEXTS; i++) {
+        isotp_ctx_free(ctx[i]);
+    }
+}
+#endif  // ISOTP_STATIC_CONTEXTS
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(single_sf_round_trip),
+        cmocka_unit_test(single_multiframe_round_trip),
+        cmocka_unit_test(single_build_profile),
+        cmocka_unit_test(single_ff_escape),
+#ifdef ISOTP_STATIC_CONTEXTS
+        cmocka_unit_test(single_static_contexts),
+#endif  // ISOTP_STATIC_CONTEXTS
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -270,6 +270,6 @@ int main(void) {
     }
 
 out:
-    free(ctx);
+    isotp_ctx_free(ctx);
     return rc;
 }